@@ -87,6 +87,8 @@ static void bench_fastpath_simple(long iterations,
 
 extern "C" void tc_free_sized(void *ptr, size_t size) __attribute__((weak));
 extern "C" void *tc_memalign(size_t align, size_t size) __attribute__((weak));
+extern "C" size_t tc_malloc_batch(size_t size, void **ptrs, size_t count) __attribute__((weak));
+extern "C" void tc_free_batch(void **ptrs, size_t count, size_t size) __attribute__((weak));
 
 static bool is_sized_free_available(void)
 {
@@ -98,6 +100,11 @@ static bool is_memalign_available(void)
   return tc_memalign != NULL;
 }
 
+static bool is_batch_available(void)
+{
+  return tc_malloc_batch != NULL;
+}
+
 static void bench_fastpath_simple_sized(long iterations,
                                         uintptr_t param)
 {
@@ -132,6 +139,100 @@ static void bench_fastpath_memalign(long iterations,
   }
 }
 
+// Allocates "param" objects of mixed sizes and frees them in an order
+// the prefetchers cannot follow, either with free() or with
+// tc_free_sized().  param is large enough that the pages being freed
+// are not in the size class cache, so unsized frees have to read the
+// pagemap while sized ones can take the size class from the size.
+static void free_scattered(long iterations, uintptr_t _param, bool sized)
+{
+  static const uint32_t rnd_c = 1013904223;
+  static const uint32_t rnd_a = 1664525;
+  static void *ptrs[1 << 16];
+  static size_t sizes[1 << 16];
+
+  if ((_param & (_param - 1)) || _param > (1 << 16)) {
+    abort();
+  }
+  int param = static_cast<int>(_param);
+  size_t sz = 128;
+
+  for (; iterations>0; iterations -= param) {
+    for (int k = 0; k < param; k++) {
+      void *p = malloc(sz);
+      if (!p) {
+        abort();
+      }
+      ptrs[k] = p;
+      sizes[k] = sz;
+      sz = ((sz | reinterpret_cast<size_t>(p)) & 1023) + 16;
+    }
+
+    uint32_t rnd = 0;
+    uint32_t free_idx = 0;
+    do {
+      if (sized) {
+        tc_free_sized(ptrs[free_idx], sizes[free_idx]);
+      } else {
+        free(ptrs[free_idx]);
+      }
+      rnd = rnd * rnd_a + rnd_c;
+      free_idx = rnd & (param - 1);
+    } while (free_idx != 0);
+  }
+}
+
+static void bench_free_scattered(long iterations, uintptr_t param)
+{
+  free_scattered(iterations, param, false);
+}
+
+static void bench_free_scattered_sized(long iterations, uintptr_t param)
+{
+  free_scattered(iterations, param, true);
+}
+
+// Allocates and frees "param" objects of one size, either one call
+// per object or with one tc_malloc_batch()/tc_free_batch() pair.
+static void stack_batch(long iterations, uintptr_t _param, bool batch)
+{
+  static void *ptrs[1 << 12];
+  const size_t sz = 64;
+  long param = static_cast<long>(_param);
+  if (param <= 0 || param > (1 << 12)) {
+    abort();
+  }
+
+  for (; iterations > 0; iterations -= param) {
+    if (batch) {
+      if (tc_malloc_batch(sz, ptrs, param) != static_cast<size_t>(param)) {
+        abort();
+      }
+      tc_free_batch(ptrs, param, sz);
+    } else {
+      for (long k = 0; k < param; k++) {
+        ptrs[k] = malloc(sz);
+        if (!ptrs[k]) {
+          abort();
+        }
+      }
+      for (long k = 0; k < param; k++) {
+        free(ptrs[k]);
+      }
+    }
+  }
+}
+
+static void bench_fastpath_stack_unbatched(long iterations, uintptr_t param)
+{
+  stack_batch(iterations, param, false);
+}
+
+static void bench_fastpath_stack_batch(long iterations, uintptr_t param)
+{
+  stack_batch(iterations, param, true);
+}
+
 #endif // __GNUC__
 
 #define STACKSZ (1 << 16)
@@ -275,6 +376,20 @@ int main(void)
     report_benchmark("bench_fastpath_simple_sized", bench_fastpath_simple_sized, 2048);
   }
 
+  if (is_sized_free_available()) {
+    report_benchmark("bench_free_scattered", bench_free_scattered, 8192);
+    report_benchmark("bench_free_scattered_sized", bench_free_scattered_sized, 8192);
+    report_benchmark("bench_free_scattered", bench_free_scattered, 65536);
+    report_benchmark("bench_free_scattered_sized", bench_free_scattered_sized, 65536);
+  }
+
+  if (is_batch_available()) {
+    report_benchmark("bench_fastpath_stack_unbatched", bench_fastpath_stack_unbatched, 32);
+    report_benchmark("bench_fastpath_stack_batch", bench_fastpath_stack_batch, 32);
+    report_benchmark("bench_fastpath_stack_unbatched", bench_fastpath_stack_unbatched, 1024);
+    report_benchmark("bench_fastpath_stack_batch", bench_fastpath_stack_batch, 1024);
+  }
+
   if (is_memalign_available()) {
     report_benchmark("bench_fastpath_memalign", bench_fastpath_memalign, 64);
     report_benchmark("bench_fastpath_memalign", bench_fastpath_memalign, 2048);
@@ -0,0 +1,244 @@
+// -*- Mode: C++; c-basic-offset: 2; indent-tabs-mode: nil -*-
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Multi-threaded counterpart of malloc_bench.  Each scenario runs on
+// N threads (first argument, default 4) and stresses a different
+// shared part of the allocator: the central free lists, cross-thread
+// frees, the page heap shards and extended memory, and thread cache
+// creation and teardown.
+//
+// Latency of small operations is sampled once every kSampleEvery
+// operations, so that reading the clock does not dominate the
+// measured throughput.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+
+#include "run_benchmark.h"
+
+static const long kSampleEvery = 16;
+static const int kMaxThreads = 256;
+
+static void *checked_malloc(size_t sz)
+{
+  void *p = malloc(sz);
+  if (!p) {
+    abort();
+  }
+  return p;
+}
+
+// N threads each cycling through a set of sizes no other thread
+// uses, in batches deep enough to go past the thread cache into the
+// central free lists.
+static void bench_mt_private_sizes(long iterations, uintptr_t param,
+                                   int thread_index, int nthreads)
+{
+  static const int kDepth = 256;
+  void *ptrs[kDepth];
+  const size_t base = 16 + (thread_index % 32) * 16;
+  long depth = static_cast<long>(param);
+  depth = (depth > 0 && depth <= kDepth) ? depth : kDepth;
+
+  for (long i = 0; i < iterations; i += depth) {
+    for (long k = 0; k < depth; k++) {
+      size_t sz = base + (k & 3) * 512;
+      if (((i + k) % kSampleEvery) == 0) {
+        uint64_t t = bench_now_nsec();
+        ptrs[k] = checked_malloc(sz);
+        bench_record_latency(bench_now_nsec() - t);
+      } else {
+        ptrs[k] = checked_malloc(sz);
+      }
+    }
+    for (long k = 0; k < depth; k++) {
+      free(ptrs[k]);
+    }
+  }
+}
+
+// Threads are paired up: the even thread of each pair allocates and
+// hands the objects to the odd one, which frees them.  Every object
+// is therefore freed into a different thread's cache than the one it
+// came from.
+struct handoff_ring {
+  static const int kSize = 1024;
+  std::atomic<unsigned long> head;  // Next slot to fill (producer)
+  std::atomic<unsigned long> tail;  // Next slot to drain (consumer)
+  void *slots[kSize];
+  char pad[64];
+};
+
+static handoff_ring rings[kMaxThreads / 2];
+
+static void bench_mt_producer_consumer(long iterations, uintptr_t param,
+                                       int thread_index, int nthreads)
+{
+  handoff_ring *ring = &rings[thread_index / 2];
+  const size_t sz = static_cast<size_t>(param);
+
+  if (nthreads & 1 && thread_index == nthreads - 1) {
+    // Odd one out works alone so that every thread reports.
+    for (long i = 0; i < iterations; i++) {
+      uint64_t t = bench_now_nsec();
+      free(checked_malloc(sz));
+      bench_record_latency(bench_now_nsec() - t);
+    }
+    return;
+  }
+
+  if ((thread_index & 1) == 0) {
+    for (long i = 0; i < iterations; i++) {
+      while (i - ring->tail.load(std::memory_order_acquire) >=
+             static_cast<unsigned long>(handoff_ring::kSize)) {
+        sched_yield();
+      }
+      void *p;
+      if ((i % kSampleEvery) == 0) {
+        uint64_t t = bench_now_nsec();
+        p = checked_malloc(sz);
+        bench_record_latency(bench_now_nsec() - t);
+      } else {
+        p = checked_malloc(sz);
+      }
+      ring->slots[i % handoff_ring::kSize] = p;
+      ring->head.store(i + 1, std::memory_order_release);
+    }
+  } else {
+    for (long i = 0; i < iterations; i++) {
+      while (ring->head.load(std::memory_order_acquire) <=
+             static_cast<unsigned long>(i)) {
+        sched_yield();
+      }
+      void *p = ring->slots[i % handoff_ring::kSize];
+      if ((i % kSampleEvery) == 0) {
+        uint64_t t = bench_now_nsec();
+        free(p);
+        bench_record_latency(bench_now_nsec() - t);
+      } else {
+        free(p);
+      }
+      ring->tail.store(i + 1, std::memory_order_release);
+    }
+    // The producer is done with the ring once its last object has
+    // been consumed, so leave it empty for the next run.
+    ring->head.store(0, std::memory_order_relaxed);
+    ring->tail.store(0, std::memory_order_relaxed);
+  }
+}
+
+// Bursts of allocations above kMaxSize, which go straight to the page
+// heap and extended memory.  Each burst allocates "param" blocks of
+// varying size, touches them and frees them all.  Every operation is
+// timed.
+static void bench_mt_large_bursts(long iterations, uintptr_t param,
+                                  int thread_index, int nthreads)
+{
+  static const int kMaxBurst = 64;
+  void *ptrs[kMaxBurst];
+  long burst = static_cast<long>(param);
+  burst = (burst > 0 && burst <= kMaxBurst) ? burst : 8;
+  uint32_t rnd = thread_index * 2654435761u + 1;
+
+  for (long i = 0; i < iterations; i += burst) {
+    for (long k = 0; k < burst; k++) {
+      rnd = rnd * 1664525 + 1013904223;
+      // 256 KiB .. 4 MiB
+      size_t sz = (256 << 10) + (rnd >> 8) % (4 << 20);
+      uint64_t t = bench_now_nsec();
+      ptrs[k] = checked_malloc(sz);
+      bench_record_latency(bench_now_nsec() - t);
+      memset(ptrs[k], 0, 64);
+    }
+    for (long k = 0; k < burst; k++) {
+      uint64_t t = bench_now_nsec();
+      free(ptrs[k]);
+      bench_record_latency(bench_now_nsec() - t);
+    }
+  }
+}
+
+// Each operation starts a thread that makes "param" small allocations
+// and exits, so its thread cache is created and torn down.  The
+// latency is that of the whole create/run/join.
+static void *churn_thread(void *arg)
+{
+  long n = reinterpret_cast<long>(arg);
+  void *ptrs[64];
+  for (long i = 0; i < n; i += 64) {
+    long m = (n - i) < 64 ? (n - i) : 64;
+    for (long k = 0; k < m; k++) {
+      ptrs[k] = checked_malloc(16 + (k & 15) * 64);
+    }
+    for (long k = 0; k < m; k++) {
+      free(ptrs[k]);
+    }
+  }
+  return NULL;
+}
+
+static void bench_mt_thread_churn(long iterations, uintptr_t param,
+                                  int thread_index, int nthreads)
+{
+  for (long i = 0; i < iterations; i++) {
+    pthread_t tid;
+    uint64_t t = bench_now_nsec();
+    if (pthread_create(&tid, NULL, churn_thread,
+                       reinterpret_cast<void *>(param))) {
+      perror("pthread_create");
+      abort();
+    }
+    pthread_join(tid, NULL);
+    bench_record_latency(bench_now_nsec() - t);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int nthreads = 4;
+  if (argc > 1) {
+    nthreads = atoi(argv[1]);
+  }
+  if (nthreads < 1 || nthreads > kMaxThreads) {
+    fprintf(stderr, "usage: %s [threads (1..%d)]\n", argv[0], kMaxThreads);
+    return 1;
+  }
+
+  report_mt_benchmark("bench_mt_private_sizes", bench_mt_private_sizes, 32, nthreads);
+  report_mt_benchmark("bench_mt_private_sizes", bench_mt_private_sizes, 256, nthreads);
+  report_mt_benchmark("bench_mt_producer_consumer", bench_mt_producer_consumer, 64, nthreads);
+  report_mt_benchmark("bench_mt_producer_consumer", bench_mt_producer_consumer, 2048, nthreads);
+  report_mt_benchmark("bench_mt_large_bursts", bench_mt_large_bursts, 8, nthreads);
+  report_mt_benchmark("bench_mt_thread_churn", bench_mt_thread_churn, 128, nthreads);
+  return 0;
+}
@@ -31,6 +31,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <pthread.h>
+#include <time.h>
 
 struct internal_bench {
   bench_body body;
@@ -110,3 +112,237 @@ void report_benchmark(const char *name, bench_body body, uintptr_t param)
     fflush(stdout);
   }
 }
+
+// Latency histogram with four linear sub-buckets per power of two,
+// which keeps percentiles within 25% of the true value.
+#define LAT_SUB_BITS 2
+#define LAT_SUB (1 << LAT_SUB_BITS)
+#define LAT_LINEAR (2 * LAT_SUB)
+#define LAT_BUCKETS (LAT_LINEAR + (64 - LAT_SUB_BITS - 1) * LAT_SUB)
+
+struct mt_thread {
+  pthread_t tid;
+  struct mt_bench *bench;
+  int index;
+  double nsec;
+  uint64_t count;
+  uint64_t max;
+  uint64_t hist[LAT_BUCKETS];
+};
+
+struct mt_bench {
+  mt_bench_body body;
+  uintptr_t param;
+  int nthreads;
+  long iterations;
+  struct mt_thread *threads;
+  pthread_mutex_t mu;
+  pthread_cond_t cv;
+  int ready;
+  int go;
+};
+
+static __thread struct mt_thread *current_thread;
+
+uint64_t bench_now_nsec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int latency_bucket(uint64_t nsec)
+{
+  int e;
+  if (nsec < LAT_LINEAR) {
+    return (int)nsec;
+  }
+  e = 63 - __builtin_clzll(nsec);
+  return LAT_LINEAR + (e - LAT_SUB_BITS - 1) * LAT_SUB
+      + (int)((nsec >> (e - LAT_SUB_BITS)) & (LAT_SUB - 1));
+}
+
+// Largest latency that falls into the given bucket.
+static uint64_t latency_bucket_limit(int b)
+{
+  int e, sub;
+  if (b < LAT_LINEAR) {
+    return b;
+  }
+  e = (b - LAT_LINEAR) / LAT_SUB + LAT_SUB_BITS + 1;
+  sub = (b - LAT_LINEAR) % LAT_SUB;
+  return (((uint64_t)(LAT_SUB + sub + 1)) << (e - LAT_SUB_BITS)) - 1;
+}
+
+void bench_record_latency(uint64_t nsec)
+{
+  struct mt_thread *t = current_thread;
+  if (!t) {
+    return;
+  }
+  t->hist[latency_bucket(nsec)]++;
+  t->count++;
+  if (nsec > t->max) {
+    t->max = nsec;
+  }
+}
+
+static uint64_t latency_percentile(const uint64_t *hist, uint64_t count,
+                                   double pct)
+{
+  uint64_t want = (uint64_t)(count * pct / 100.0);
+  uint64_t seen = 0;
+  int b;
+  for (b = 0; b < LAT_BUCKETS; b++) {
+    seen += hist[b];
+    if (seen > want) {
+      return latency_bucket_limit(b);
+    }
+  }
+  return latency_bucket_limit(LAT_BUCKETS - 1);
+}
+
+static void *mt_thread_main(void *arg)
+{
+  struct mt_thread *t = arg;
+  struct mt_bench *b = t->bench;
+  uint64_t start;
+
+  current_thread = t;
+  pthread_mutex_lock(&b->mu);
+  b->ready++;
+  pthread_cond_broadcast(&b->cv);
+  while (!b->go) {
+    pthread_cond_wait(&b->cv, &b->mu);
+  }
+  pthread_mutex_unlock(&b->mu);
+
+  start = bench_now_nsec();
+  b->body(b->iterations, b->param, t->index, b->nthreads);
+  t->nsec = bench_now_nsec() - start;
+  current_thread = NULL;
+  return NULL;
+}
+
+static double mt_measure_once(struct mt_bench *b, long iterations)
+{
+  uint64_t start;
+  int i;
+
+  b->iterations = iterations;
+  b->ready = 0;
+  b->go = 0;
+  memset(b->threads, 0, sizeof(b->threads[0]) * b->nthreads);
+  for (i = 0; i < b->nthreads; i++) {
+    b->threads[i].bench = b;
+    b->threads[i].index = i;
+    if (pthread_create(&b->threads[i].tid, NULL, mt_thread_main,
+                       &b->threads[i])) {
+      perror("pthread_create");
+      abort();
+    }
+  }
+
+  pthread_mutex_lock(&b->mu);
+  while (b->ready < b->nthreads) {
+    pthread_cond_wait(&b->cv, &b->mu);
+  }
+  start = bench_now_nsec();
+  b->go = 1;
+  pthread_cond_broadcast(&b->cv);
+  pthread_mutex_unlock(&b->mu);
+
+  for (i = 0; i < b->nthreads; i++) {
+    pthread_join(b->threads[i].tid, NULL);
+  }
+  return bench_now_nsec() - start;
+}
+
+void report_mt_benchmark(const char *name, mt_bench_body body,
+                         uintptr_t param, int nthreads)
+{
+  struct mt_bench b;
+  static uint64_t total_hist[LAT_BUCKETS];
+  uint64_t total_count = 0, total_max = 0;
+  long iterations = 16;
+  double nsec;
+  int i, j, slen, padding_size;
+
+  if (nthreads < 1) {
+    nthreads = 1;
+  }
+  memset(&b, 0, sizeof(b));
+  b.body = body;
+  b.param = param;
+  b.nthreads = nthreads;
+  b.threads = calloc(nthreads, sizeof(b.threads[0]));
+  if (!b.threads) {
+    perror("calloc");
+    abort();
+  }
+  pthread_mutex_init(&b.mu, NULL);
+  pthread_cond_init(&b.cv, NULL);
+
+  // Same calibration as run_benchmark(), on the wall clock time of
+  // the whole group.  Only the last run is reported.
+  while (1) {
+    nsec = mt_measure_once(&b, iterations);
+    if (nsec > TRIAL_NSEC) {
+      break;
+    }
+    iterations <<= 1;
+  }
+  while (nsec < TARGET_NSEC) {
+    iterations = (long)(iterations * TARGET_NSEC * 1.1 / nsec);
+    nsec = mt_measure_once(&b, iterations);
+  }
+
+  memset(total_hist, 0, sizeof(total_hist));
+  for (i = 0; i < nthreads; i++) {
+    struct mt_thread *t = &b.threads[i];
+    for (j = 0; j < LAT_BUCKETS; j++) {
+      total_hist[j] += t->hist[j];
+    }
+    total_count += t->count;
+    if (t->max > total_max) {
+      total_max = t->max;
+    }
+  }
+
+  slen = printf("Benchmark: %s", name);
+  if (param && name[strlen(name)-1] != ')') {
+    slen += printf("(%lld)", (long long)param);
+  }
+  slen += printf(" x%d", nthreads);
+  padding_size = 60 - slen;
+  if (padding_size < 1) {
+    padding_size = 1;
+  }
+  printf("%*c%f nsec", padding_size, ' ', nsec / iterations);
+  if (total_count) {
+    printf("  p50 %llu p99 %llu p99.9 %llu max %llu",
+           (unsigned long long)latency_percentile(total_hist, total_count, 50),
+           (unsigned long long)latency_percentile(total_hist, total_count, 99),
+           (unsigned long long)latency_percentile(total_hist, total_count, 99.9),
+           (unsigned long long)total_max);
+  }
+  printf("\n");
+
+  for (i = 0; i < nthreads; i++) {
+    struct mt_thread *t = &b.threads[i];
+    printf("  thread %3d: %f nsec/op", i, t->nsec / iterations);
+    if (t->count) {
+      printf("  p50 %llu p99 %llu p99.9 %llu max %llu",
+             (unsigned long long)latency_percentile(t->hist, t->count, 50),
+             (unsigned long long)latency_percentile(t->hist, t->count, 99),
+             (unsigned long long)latency_percentile(t->hist, t->count, 99.9),
+             (unsigned long long)t->max);
+    }
+    printf("\n");
+  }
+  fflush(stdout);
+
+  pthread_cond_destroy(&b.cv);
+  pthread_mutex_destroy(&b.mu);
+  free(b.threads);
+}
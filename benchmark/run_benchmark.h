@@ -36,6 +36,25 @@ typedef void (*bench_body)(long iterations, uintptr_t param);
 
 void report_benchmark(const char *name, bench_body body, uintptr_t param);
 
+// Multi-threaded benchmarks.  The body is run concurrently by
+// nthreads threads, each with its own thread_index in [0, nthreads),
+// and each performing "iterations" operations.  Threads are released
+// together.  The report gives the group's wall clock time per
+// iteration, then each thread's own time per operation, along with
+// the latency percentiles recorded with bench_record_latency().
+typedef void (*mt_bench_body)(long iterations, uintptr_t param,
+                              int thread_index, int nthreads);
+
+void report_mt_benchmark(const char *name, mt_bench_body body,
+                         uintptr_t param, int nthreads);
+
+// Monotonic clock in nanoseconds, for timing single operations.
+uint64_t bench_now_nsec(void);
+
+// Adds one operation latency to the calling benchmark thread's
+// histogram.  A no-op outside report_mt_benchmark() threads.
+void bench_record_latency(uint64_t nsec);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -0,0 +1,85 @@
+// -*- Mode: C++; c-basic-offset: 2; indent-tabs-mode: nil -*-
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// One SpinLock shared by N threads (first argument, default 4), with
+// critical sections of "param" loop iterations of busy work and the
+// same amount of work done outside the lock between acquisitions.
+// Every acquisition is timed, so the reported percentiles are those
+// of lock wait time plus hold time.  Run it with more threads than
+// CPUs to see the cost of waiters that sleep and are woken.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "base/spinlock.h"
+#include "run_benchmark.h"
+
+static const int kMaxThreads = 1024;
+
+static SpinLock lock(base::LINKER_INITIALIZED);
+static volatile unsigned long shared_word;
+
+static void busy_work(long n)
+{
+  for (long i = 0; i < n; i++) {
+    __asm__ __volatile__("" : : : "memory");
+  }
+}
+
+static void bench_spinlock(long iterations, uintptr_t param,
+                           int thread_index, int nthreads)
+{
+  const long work = static_cast<long>(param);
+  for (long i = 0; i < iterations; i++) {
+    uint64_t t = bench_now_nsec();
+    {
+      SpinLockHolder h(&lock);
+      shared_word++;
+      busy_work(work);
+    }
+    bench_record_latency(bench_now_nsec() - t);
+    busy_work(work);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int nthreads = 4;
+  if (argc > 1) {
+    nthreads = atoi(argv[1]);
+  }
+  if (nthreads < 1 || nthreads > kMaxThreads) {
+    fprintf(stderr, "usage: %s [threads (1..%d)]\n", argv[0], kMaxThreads);
+    return 1;
+  }
+
+  report_mt_benchmark("bench_spinlock", bench_spinlock, 0, nthreads);
+  report_mt_benchmark("bench_spinlock", bench_spinlock, 100, nthreads);
+  report_mt_benchmark("bench_spinlock", bench_spinlock, 2000, nthreads);
+  return 0;
+}
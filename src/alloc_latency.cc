@@ -0,0 +1,193 @@
+// -*- Mode: C++; c-basic-offset: 2; indent-tabs-mode: nil -*-
+// Copyright (c) 2026, gperftools Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <config.h>
+#include "alloc_latency.h"
+#include <inttypes.h>                   // for PRIu64
+#include <stdlib.h>                     // for strtol
+#include <string.h>                     // for strcmp, strncmp, memset
+#include "base/atomicops.h"             // for Atomic64, AtomicIncrement
+#include "internal_logging.h"           // for TCMalloc_Printer
+
+namespace tcmalloc {
+
+static const char* const kTierNames[AllocLatency::kNumTiers] = {
+  "fast_path_miss",
+  "central_refill",
+  "shard_refill",
+  "extended_lock_wait",
+  "system_alloc",
+};
+
+const char* AllocLatency::TierName(int tier) {
+  ASSERT(tier >= 0 && tier < kNumTiers);
+  return kTierNames[tier];
+}
+
+#ifdef ENABLE_ALLOC_LATENCY_STATS
+
+using base::subtle::Atomic64;
+
+// Updated from many threads without a lock, so every field is only
+// ever changed with a compare-and-swap.  Readers may see a histogram
+// whose fields are a few events apart from each other.
+struct AtomicHistogram {
+  volatile Atomic64 count;
+  volatile Atomic64 total_ns;
+  volatile Atomic64 max_ns;
+  volatile Atomic64 buckets[AllocLatency::kNumBuckets];
+} CACHELINE_ALIGNED;
+
+static AtomicHistogram histograms[AllocLatency::kNumTiers];
+
+static void AtomicMax(volatile Atomic64* p, Atomic64 value) {
+  Atomic64 old = base::subtle::NoBarrier_Load(p);
+  while (old < value) {
+    const Atomic64 prev =
+        base::subtle::NoBarrier_CompareAndSwap(p, old, value);
+    if (prev == old) return;
+    old = prev;
+  }
+}
+
+static int BucketFor(uint64 ns) {
+  int b = 0;
+  while (ns > 1 && b < AllocLatency::kNumBuckets - 1) {
+    ns >>= 1;
+    b++;
+  }
+  return b;
+}
+
+void AllocLatency::Record(Tier tier, uint64 start) {
+  const uint64 now = Now();
+  const uint64 ns = now > start ? now - start : 0;
+  AtomicHistogram* h = &histograms[tier];
+  base::subtle::NoBarrier_AtomicIncrement(&h->count, 1);
+  base::subtle::NoBarrier_AtomicIncrement(&h->total_ns, ns);
+  AtomicMax(&h->max_ns, ns);
+  base::subtle::NoBarrier_AtomicIncrement(&h->buckets[BucketFor(ns)], 1);
+}
+
+void AllocLatency::Get(int tier, Histogram* out) {
+  ASSERT(tier >= 0 && tier < kNumTiers);
+  const AtomicHistogram* h = &histograms[tier];
+  out->count = base::subtle::NoBarrier_Load(&h->count);
+  out->total_ns = base::subtle::NoBarrier_Load(&h->total_ns);
+  out->max_ns = base::subtle::NoBarrier_Load(&h->max_ns);
+  for (int b = 0; b < kNumBuckets; b++) {
+    out->buckets[b] = base::subtle::NoBarrier_Load(&h->buckets[b]);
+  }
+}
+
+#else  // !ENABLE_ALLOC_LATENCY_STATS
+
+void AllocLatency::Get(int tier, Histogram* out) {
+  memset(out, 0, sizeof(*out));
+}
+
+#endif  // ENABLE_ALLOC_LATENCY_STATS
+
+bool AllocLatency::GetProperty(const char* name, size_t* value) {
+  static const char kPrefix[] = "tcmalloc.latency.";
+  if (!kEnabled || strncmp(name, kPrefix, sizeof(kPrefix) - 1) != 0) {
+    return false;
+  }
+  const char* rest = name + sizeof(kPrefix) - 1;
+  int tier = 0;
+  size_t len = 0;
+  for (; tier < kNumTiers; tier++) {
+    len = strlen(kTierNames[tier]);
+    if (strncmp(rest, kTierNames[tier], len) == 0 && rest[len] == '.') {
+      break;
+    }
+  }
+  if (tier == kNumTiers) {
+    return false;
+  }
+  const char* stat = rest + len + 1;
+
+  Histogram h;
+  Get(tier, &h);
+  static const char kBucket[] = "bucket.";
+  if (strcmp(stat, "count") == 0) {
+    *value = h.count;
+  } else if (strcmp(stat, "total_ns") == 0) {
+    *value = h.total_ns;
+  } else if (strcmp(stat, "max_ns") == 0) {
+    *value = h.max_ns;
+  } else if (strncmp(stat, kBucket, sizeof(kBucket) - 1) == 0) {
+    const char* number = stat + sizeof(kBucket) - 1;
+    char* end;
+    const long b = strtol(number, &end, 10);
+    if (end == number || *end != '\0' || b < 0 || b >= kNumBuckets) {
+      return false;
+    }
+    *value = h.buckets[b];
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void AllocLatency::Print(TCMalloc_Printer* out) {
+  if (!kEnabled) return;
+
+  out->printf("------------------------------------------------\n");
+  out->printf("Slow path latency (ns, log2 buckets):\n");
+  for (int tier = 0; tier < kNumTiers; tier++) {
+    Histogram h;
+    Get(tier, &h);
+    out->printf("latency %-18s count %10" PRIu64 " mean %8" PRIu64
+                " max %10" PRIu64 "\n",
+                kTierNames[tier], h.count,
+                h.count ? h.total_ns / h.count : 0, h.max_ns);
+    if (h.count == 0) continue;
+    // One line per non-empty bucket, "[lo, hi)" in ns, with the
+    // cumulative fraction so that percentiles can be read off.
+    uint64 total = 0;
+    for (int b = 0; b < kNumBuckets; b++) {
+      total += h.buckets[b];
+    }
+    uint64 cum = 0;
+    for (int b = 0; b < kNumBuckets; b++) {
+      if (h.buckets[b] == 0) continue;
+      cum += h.buckets[b];
+      const uint64 lo = b == 0 ? 0 : (static_cast<uint64>(1) << b);
+      const uint64 hi = static_cast<uint64>(1) << (b + 1);
+      out->printf("latency %-18s bucket %2d [%10" PRIu64 ", %10" PRIu64
+                  ") %10" PRIu64 " %6.2f%%\n",
+                  kTierNames[tier], b, lo, hi, h.buckets[b],
+                  100.0 * cum / total);
+    }
+  }
+}
+
+}  // namespace tcmalloc
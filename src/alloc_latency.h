@@ -0,0 +1,115 @@
+// -*- Mode: C++; c-basic-offset: 2; indent-tabs-mode: nil -*-
+// Copyright (c) 2026, gperftools Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// ---
+//
+// Latency histograms for the slow paths of the allocator, one per
+// tier a request can fall through to.  Built only with
+// --enable-alloc-latency-stats (ENABLE_ALLOC_LATENCY_STATS); otherwise
+// Now() and Record() compile to nothing and no properties or stats
+// are reported.
+//
+// Each histogram counts events in power-of-two nanosecond buckets:
+// bucket b holds latencies in [2^b, 2^(b+1)) ns, bucket 0 also holds
+// anything under 1 ns.  Only paths that already take a lock or leave
+// the thread cache are timed, so the cost of the two clock reads is
+// small next to the work being measured.
+
+#ifndef TCMALLOC_ALLOC_LATENCY_H_
+#define TCMALLOC_ALLOC_LATENCY_H_
+
+#include <config.h>
+#include <stddef.h>                     // for size_t
+#ifdef ENABLE_ALLOC_LATENCY_STATS
+#include <time.h>                       // for clock_gettime
+#endif
+#include "base/basictypes.h"
+
+class TCMalloc_Printer;
+
+namespace tcmalloc {
+
+class AllocLatency {
+ public:
+  enum Tier {
+    kFastPathMiss,       // Thread or per-cpu cache refilled from central cache
+    kCentralRefill,      // CentralFreeList::Populate() getting a span
+    kShardRefill,        // Page heap shard refilled from ExtendedMemory
+    kExtendedLockWait,   // Time spent acquiring extended_lock()
+    kSystemAlloc,        // GrowHeap() asking the system for memory
+    kNumTiers
+  };
+
+  static const int kNumBuckets = 32;
+
+  struct Histogram {
+    uint64 count;
+    uint64 total_ns;
+    uint64 max_ns;
+    uint64 buckets[kNumBuckets];
+  };
+
+#ifdef ENABLE_ALLOC_LATENCY_STATS
+  static const bool kEnabled = true;
+
+  // Start of an interval to pass to Record().
+  static uint64 Now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+  }
+
+  // Adds the time since "start" to the histogram of "tier".
+  static void Record(Tier tier, uint64 start);
+#else
+  static const bool kEnabled = false;
+  static uint64 Now() { return 0; }
+  static void Record(Tier tier, uint64 start) { }
+#endif
+
+  // Short name of a tier, as used in property names.
+  static const char* TierName(int tier);
+
+  // Copies out the current histogram of "tier".  All zero when the
+  // histograms are compiled out.
+  static void Get(int tier, Histogram* h);
+
+  // Handles the "tcmalloc.latency.<tier>.<stat>" properties, where
+  // <stat> is count, total_ns, max_ns or bucket.<b>.
+  static bool GetProperty(const char* name, size_t* value);
+
+  // Prints the histograms for MallocExtension::GetStats().  Prints
+  // nothing when they are compiled out.
+  static void Print(TCMalloc_Printer* out);
+};
+
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_ALLOC_LATENCY_H_
@@ -0,0 +1,399 @@
+// -*- Mode: C++; c-basic-offset: 2; indent-tabs-mode: nil -*-
+// Copyright (c) 2026, gperftools Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <config.h>
+#include "arena.h"
+#include <inttypes.h>                   // for PRIu64
+#include <string.h>                     // for strcmp, strncmp, strlen
+#include <new>                          // for placement new
+#include <algorithm>                    // for min
+#include "internal_logging.h"           // for TCMalloc_Printer, ASSERT
+#include "linked_list.h"                // for SLL_Next, SLL_SetNext
+#include "malloc_hook-inl.h"            // for MallocHook
+#include "static_vars.h"                // for Static
+
+namespace tcmalloc {
+
+// Guards the arena table.  Arenas are created and destroyed under it;
+// allocation and free only look their arena up, which is safe as long
+// as callers do not destroy an arena they are still using.
+static SpinLock arena_table_lock(SpinLock::LINKER_INITIALIZED);
+
+// Indexed by id.  An Arena object is allocated the first time its slot
+// is used and kept when the arena is destroyed; its id_ is 0 while the
+// slot is free.
+static Arena* arenas[Arena::kMaxArenas + 1];
+
+bool Arena::any_created_;
+
+void Arena::Init(int id, const char* name) {
+  id_ = id;
+  strncpy(name_, name, kMaxNameLength - 1);
+  name_[kMaxNameLength - 1] = '\0';
+  for (int cl = 0; cl < kClassSizesMax; cl++) {
+    DLL_Init(&partial_[cl]);
+  }
+  DLL_Init(&full_);
+  DLL_Init(&large_);
+  allocated_bytes_ = 0;
+  held_bytes_ = 0;
+}
+
+int Arena::Create(const char* name) {
+  if (name == NULL || name[0] == '\0') {
+    return 0;
+  }
+  SpinLockHolder h(&arena_table_lock);
+  int free_id = 0;
+  for (int id = 1; id <= kMaxArenas; id++) {
+    Arena* a = arenas[id];
+    if (a == NULL || a->id_ == 0) {
+      if (free_id == 0) free_id = id;
+    } else if (strncmp(a->name_, name, kMaxNameLength - 1) == 0) {
+      return 0;
+    }
+  }
+  if (free_id == 0) {
+    return 0;
+  }
+  if (arenas[free_id] == NULL) {
+    void* space = MetaDataAlloc(sizeof(Arena));
+    if (space == NULL) {
+      return 0;
+    }
+    arenas[free_id] = new (space) Arena;
+  }
+  arenas[free_id]->Init(free_id, name);
+  any_created_ = true;
+  return free_id;
+}
+
+void Arena::Destroy(int id) {
+  SpinLockHolder h(&arena_table_lock);
+  Arena* a = Get(id);
+  if (a == NULL) {
+    return;
+  }
+  a->Release();
+  a->id_ = 0;
+}
+
+Arena* Arena::Get(int id) {
+  if (id < 1 || id > kMaxArenas) {
+    return NULL;
+  }
+  Arena* a = arenas[id];
+  return (a != NULL && a->id_ == id) ? a : NULL;
+}
+
+Span* Arena::TakeSpan(Length n) {
+  SpinLockHolder h(Static::extended_lock());
+  Span* span = Static::extended_memory()->AllocLarge(n);
+  if (span != NULL) {
+    span->location = Span::IN_USE;
+    span->arena = id_;
+  }
+  return span;
+}
+
+void Arena::ReturnSpans(Span* list) {
+  if (DLL_IsEmpty(list)) {
+    return;
+  }
+  SpinLockHolder h(Static::extended_lock());
+  while (!DLL_IsEmpty(list)) {
+    Span* span = list->next;
+    DLL_Remove(span);
+    span->arena = 0;
+    span->refcount = 0;
+    span->objects = NULL;
+    Static::extended_memory()->Delete(span);
+  }
+}
+
+void Arena::Carve(Span* span) {
+  ASSERT(span->sizeclass != 0);
+  const size_t size = Static::sizemap()->ByteSizeForClass(span->sizeclass);
+  char* ptr = reinterpret_cast<char*>(span->start << kPageShift);
+  char* limit = ptr + (span->length << kPageShift);
+  void** tail = &span->objects;
+  while (ptr + size <= limit) {
+    *tail = ptr;
+    tail = reinterpret_cast<void**>(ptr);
+    ptr += size;
+  }
+  *tail = NULL;
+  span->refcount = 0;
+}
+
+bool Arena::Populate(uint32 cl) {
+  const Length npages = Static::sizemap()->class_to_pages(cl);
+  lock_.Unlock();
+  Span* span = TakeSpan(npages);
+  if (span != NULL) {
+    Static::pagemap()->RegisterSizeClass(span, cl);
+    // The pages may still be cached with the size class they had in
+    // the main heap.  Ours must never be cached, or free() would hand
+    // our objects to the thread cache.
+    for (Length i = 0; i < npages; i++) {
+      Static::pagemap()->InvalidateCachedSizeClass(span->start + i);
+    }
+    Carve(span);
+  }
+  lock_.Lock();
+  if (span == NULL) {
+    return false;
+  }
+  DLL_Prepend(&partial_[cl], span);
+  held_bytes_ += npages << kPageShift;
+  return true;
+}
+
+void* Arena::Allocate(size_t size) {
+  uint32 cl;
+  if (!Static::sizemap()->GetSizeClass(size, &cl)) {
+    Span* span = TakeSpan(pages(size));
+    if (span == NULL) {
+      return NULL;
+    }
+    Static::pagemap()->InvalidateCachedSizeClass(span->start);
+    SpinLockHolder h(&lock_);
+    DLL_Prepend(&large_, span);
+    held_bytes_ += span->length << kPageShift;
+    allocated_bytes_ += span->length << kPageShift;
+    return reinterpret_cast<void*>(span->start << kPageShift);
+  }
+
+  SpinLockHolder h(&lock_);
+  Span* list = &partial_[cl];
+  while (DLL_IsEmpty(list)) {
+    if (!Populate(cl)) {
+      return NULL;
+    }
+  }
+  Span* span = list->next;
+  void* result = span->objects;
+  span->objects = SLL_Next(result);
+  span->refcount++;
+  if (span->objects == NULL) {
+    DLL_Remove(span);
+    DLL_Prepend(&full_, span);
+  }
+  allocated_bytes_ += Static::sizemap()->ByteSizeForClass(cl);
+  return result;
+}
+
+void Arena::Free(Span* span, void* ptr) {
+  ASSERT(span->arena == id_);
+  const uint32 cl = span->sizeclass;
+  if (cl == 0) {
+    ASSERT(reinterpret_cast<uintptr_t>(ptr) == span->start << kPageShift);
+    Span returned;
+    DLL_Init(&returned);
+    {
+      SpinLockHolder h(&lock_);
+      DLL_Remove(span);
+      held_bytes_ -= span->length << kPageShift;
+      allocated_bytes_ -= span->length << kPageShift;
+    }
+    DLL_Prepend(&returned, span);
+    ReturnSpans(&returned);
+    return;
+  }
+
+  SpinLockHolder h(&lock_);
+  ASSERT(span->refcount > 0);
+  if (span->objects == NULL) {
+    DLL_Remove(span);
+    DLL_Prepend(&partial_[cl], span);
+  }
+  SLL_SetNext(ptr, span->objects);
+  span->objects = ptr;
+  span->refcount--;
+  allocated_bytes_ -= Static::sizemap()->ByteSizeForClass(cl);
+}
+
+void Arena::InvokeDeleteHooks(const Span* span) {
+  char* start = reinterpret_cast<char*>(span->start << kPageShift);
+  if (span->sizeclass == 0) {
+    MallocHook::InvokeDeleteHook(start);
+    return;
+  }
+  if (span->refcount == 0) {
+    return;
+  }
+  // Objects on the span's free list are dead.  Mark them in a bitmap
+  // kChunk objects at a time, so that it fits on the stack whatever
+  // the number of objects in the span.
+  static const size_t kChunk = 4096;
+  uint64 free_bits[kChunk / 64];
+  const size_t size = Static::sizemap()->ByteSizeForClass(span->sizeclass);
+  const size_t n = (span->length << kPageShift) / size;
+  for (size_t first = 0; first < n; first += kChunk) {
+    const size_t count = std::min(kChunk, n - first);
+    memset(free_bits, 0, sizeof(free_bits));
+    for (void* p = span->objects; p != NULL; p = SLL_Next(p)) {
+      const size_t i = (reinterpret_cast<char*>(p) - start) / size;
+      if (i >= first && i < first + count) {
+        const size_t bit = i - first;
+        free_bits[bit / 64] |= static_cast<uint64>(1) << (bit % 64);
+      }
+    }
+    for (size_t i = 0; i < count; i++) {
+      if ((free_bits[i / 64] & (static_cast<uint64>(1) << (i % 64))) == 0) {
+        MallocHook::InvokeDeleteHook(start + (first + i) * size);
+      }
+    }
+  }
+}
+
+void Arena::FreeAll(bool release, Span* returned) {
+  // tc_arena_malloc() told the new hooks about every object, so the
+  // delete hooks have to hear about the ones that die here.
+  if (PREDICT_FALSE(!base::internal::delete_hooks_.empty())) {
+    for (uint32 cl = 1; cl < Static::num_size_classes(); cl++) {
+      for (Span* span = partial_[cl].next; span != &partial_[cl];
+           span = span->next) {
+        InvokeDeleteHooks(span);
+      }
+    }
+    for (Span* span = full_.next; span != &full_; span = span->next) {
+      InvokeDeleteHooks(span);
+    }
+    for (Span* span = large_.next; span != &large_; span = span->next) {
+      InvokeDeleteHooks(span);
+    }
+  }
+  for (uint32 cl = 1; cl < Static::num_size_classes(); cl++) {
+    Span* list = &partial_[cl];
+    if (release) {
+      while (!DLL_IsEmpty(list)) {
+        Span* span = list->next;
+        DLL_Remove(span);
+        DLL_Prepend(returned, span);
+      }
+    } else {
+      for (Span* span = list->next; span != list; span = span->next) {
+        Carve(span);
+      }
+    }
+  }
+  while (!DLL_IsEmpty(&full_)) {
+    Span* span = full_.next;
+    DLL_Remove(span);
+    if (release) {
+      DLL_Prepend(returned, span);
+    } else {
+      Carve(span);
+      DLL_Prepend(&partial_[span->sizeclass], span);
+    }
+  }
+  while (!DLL_IsEmpty(&large_)) {
+    Span* span = large_.next;
+    DLL_Remove(span);
+    DLL_Prepend(returned, span);
+  }
+  for (Span* span = returned->next; span != returned; span = span->next) {
+    held_bytes_ -= span->length << kPageShift;
+  }
+  allocated_bytes_ = 0;
+}
+
+void Arena::Reset() {
+  Span returned;
+  DLL_Init(&returned);
+  {
+    SpinLockHolder h(&lock_);
+    FreeAll(false, &returned);
+  }
+  ReturnSpans(&returned);
+}
+
+void Arena::Release() {
+  Span returned;
+  DLL_Init(&returned);
+  {
+    SpinLockHolder h(&lock_);
+    FreeAll(true, &returned);
+  }
+  ReturnSpans(&returned);
+}
+
+void Arena::Print(TCMalloc_Printer* out) {
+  SpinLockHolder h(&arena_table_lock);
+  bool header = false;
+  for (int id = 1; id <= kMaxArenas; id++) {
+    Arena* a = Get(id);
+    if (a == NULL) continue;
+    if (!header) {
+      out->printf("------------------------------------------------\n");
+      out->printf("Arenas:\n");
+      header = true;
+    }
+    uint64_t allocated, held;
+    {
+      SpinLockHolder l(&a->lock_);
+      allocated = a->allocated_bytes_;
+      held = a->held_bytes_;
+    }
+    out->printf("arena %-2d %-31s %12" PRIu64 " bytes allocated"
+                " %12" PRIu64 " bytes held\n",
+                id, a->name_, allocated, held);
+  }
+}
+
+bool Arena::GetProperty(const char* name, size_t* value) {
+  static const char kPrefix[] = "tcmalloc.arena.";
+  if (strncmp(name, kPrefix, sizeof(kPrefix) - 1) != 0) {
+    return false;
+  }
+  const char* rest = name + sizeof(kPrefix) - 1;
+
+  SpinLockHolder h(&arena_table_lock);
+  for (int id = 1; id <= kMaxArenas; id++) {
+    Arena* a = Get(id);
+    if (a == NULL) continue;
+    const size_t len = strlen(a->name_);
+    if (strncmp(rest, a->name_, len) != 0 || rest[len] != '.') continue;
+    const char* stat = rest + len + 1;
+    SpinLockHolder l(&a->lock_);
+    if (strcmp(stat, "allocated_bytes") == 0) {
+      *value = a->allocated_bytes_;
+    } else if (strcmp(stat, "held_bytes") == 0) {
+      *value = a->held_bytes_;
+    } else {
+      return false;
+    }
+    return true;
+  }
+  return false;
+}
+
+}  // namespace tcmalloc
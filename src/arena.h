@@ -0,0 +1,160 @@
+// -*- Mode: C++; c-basic-offset: 2; indent-tabs-mode: nil -*-
+// Copyright (c) 2026, gperftools Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// ---
+//
+// Named arenas: heap partitions that keep one subsystem's memory apart
+// from everybody else's.  An arena takes whole spans from
+// ExtendedMemory and carves them itself, so its objects never share a
+// span, a central free list or a thread cache with the rest of the
+// heap.  Its spans stay with it until the arena is released, and
+// Reset() frees every object in it at once while keeping the spans for
+// the next round of allocations.
+//
+// Arena spans are ordinary spans in the global pagemap, marked with
+// the arena's id in Span::arena, so free() finds the owning arena from
+// the pointer alone.  Their pages are never put in the pagemap's size
+// class cache, which keeps free() off the thread cache fast path for
+// them.  Sized deallocation trusts the size instead of the pagemap, so
+// once any arena exists it falls back to the unsized path.
+
+#ifndef TCMALLOC_ARENA_H_
+#define TCMALLOC_ARENA_H_
+
+#include <config.h>
+#include <stddef.h>                     // for size_t
+#include "base/basictypes.h"
+#include "base/spinlock.h"
+#include "common.h"                     // for kClassSizesMax
+#include "span.h"
+
+class TCMalloc_Printer;
+
+namespace tcmalloc {
+
+class Arena {
+ public:
+  // Ids run from 1 to kMaxArenas; 0 is the main heap.  Bounded by the
+  // width of Span::arena.
+  static const int kMaxArenas = 15;
+  static const int kMaxNameLength = 32;
+
+  // Creates an arena and returns its id, or 0 if the name is empty or
+  // already taken, or all kMaxArenas are in use.
+  static int Create(const char* name);
+
+  // Releases all of the arena's memory and frees its id for reuse.
+  static void Destroy(int id);
+
+  // Returns the arena with the given id, or NULL if there is none.
+  static Arena* Get(int id);
+
+  // Whether an arena has ever been created.  Sized frees take the size
+  // class from the caller and never look at the span, so they check
+  // for arena objects only once this is true.  Never reset, so it can
+  // be read without a lock.
+  static bool AnyCreated() { return any_created_; }
+
+  // Returns the arena that owns span, which must be an arena span.
+  static Arena* ForSpan(const Span* span) {
+    ASSERT(span->arena != 0);
+    return Get(span->arena);
+  }
+
+  // Returns NULL when out of memory.
+  void* Allocate(size_t size);
+
+  // Frees ptr, which lies in span, one of this arena's spans.
+  void Free(Span* span, void* ptr);
+
+  // Frees every object in the arena.  Small object spans are kept for
+  // reuse, large ones go back to the page heap.
+  void Reset();
+
+  // Frees every object in the arena and returns all of its spans to
+  // the page heap.
+  void Release();
+
+  // Prints one line per arena for MallocExtension::GetStats().
+  static void Print(TCMalloc_Printer* out);
+
+  // Handles the "tcmalloc.arena.<name>.<stat>" properties, where <stat>
+  // is allocated_bytes or held_bytes.
+  static bool GetProperty(const char* name, size_t* value);
+
+ private:
+  void Init(int id, const char* name);
+
+  // Carves a new span into objects of size class cl and puts it on
+  // partial_[cl].  Called and returns with lock_ held, but drops it
+  // while the span is fetched.
+  bool Populate(uint32 cl);
+
+  // Links all of the objects of span, a small object span, into its
+  // free list.
+  static void Carve(Span* span);
+
+  // Takes an n page span from ExtendedMemory and marks it as ours.
+  Span* TakeSpan(Length n);
+
+  // Gives the spans on list back to ExtendedMemory.  lock_ must not be
+  // held.
+  static void ReturnSpans(Span* list);
+
+  // Calls the delete hooks for every live object in span.
+  static void InvokeDeleteHooks(const Span* span);
+
+  // Moves this arena's spans to *returned: all of them if release is
+  // true, otherwise only the large ones.  Calls the delete hooks for
+  // every live object first.  Called with lock_ held, so the hooks must
+  // not use this arena.
+  void FreeAll(bool release, Span* returned);
+
+  static bool any_created_;
+
+  SpinLock lock_;
+  int id_;
+  char name_[kMaxNameLength];
+
+  // Small object spans of each size class that have free objects, and
+  // those that are full.  Spans that become empty stay on partial_, so
+  // the arena keeps them until it is released.
+  Span partial_[kClassSizesMax];
+  Span full_;
+  // Spans of single large objects.
+  Span large_;
+
+  size_t allocated_bytes_;  // Bytes in live objects
+  size_t held_bytes_;       // Bytes in all of the arena's spans
+};
+
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_ARENA_H_
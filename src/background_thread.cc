@@ -0,0 +1,194 @@
+// -*- Mode: C++; c-basic-offset: 2; indent-tabs-mode: nil -*-
+// Copyright (c) 2026, gperftools Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <config.h>
+#include "background_thread.h"
+#include <errno.h>                      // for EINTR
+#include <inttypes.h>                   // for PRIu64
+#include <pthread.h>                    // for pthread_create, pthread_atfork
+#include <stdlib.h>                     // for strtol
+#include <string.h>                     // for strcmp, strncmp
+#include <time.h>                       // for nanosleep
+#include "base/commandlineflags.h"      // for DECLARE_int64
+#include "base/spinlock.h"              // for SpinLockHolder
+#include "cpu_cache.h"                  // for CpuCache
+#include "getenv_safe.h"                // for TCMallocGetenvSafe
+#include "heap_limit.h"                 // for HeapLimit
+#include "internal_logging.h"           // for Log, TCMalloc_Printer
+#include "page_heap.h"                  // for PageHeap
+#include "static_vars.h"                // for Static
+#include "thread_cache.h"               // for ThreadCache
+
+DECLARE_int64(tcmalloc_heap_limit_mb);
+
+namespace tcmalloc {
+
+// Bounds the scavenges done for one heap in one pass, and so how long
+// a burst of frees can keep the thread on a single lock.
+static const int kMaxScavengesPerPass = 64;
+
+// The thread keeps 1/kLimitHeadroom of the heap limit free.
+static const int kLimitHeadroom = 16;
+
+Atomic32 BackgroundThread::running_ = 0;
+
+// Written by the background thread only; readers may see them a pass
+// behind each other.
+static long interval_ms;
+static uint64_t passes;
+static uint64_t released_pages;
+static uint64_t limit_released_pages;
+static uint64_t shard_trimmed_pages;
+static uint64_t cpu_cache_trimmed_bytes;
+
+void BackgroundThread::Start() {
+  const char* flag = TCMallocGetenvSafe("TCMALLOC_BACKGROUND_INTERVAL_MS");
+  if (flag == NULL) return;
+  const long ms = strtol(flag, NULL, 10);
+  if (ms <= 0) return;
+
+  interval_ms = ms;
+  // Set first, so that no scavenge is missed between the thread's start
+  // and its first pass.
+  base::subtle::Release_Store(&running_, 1);
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, Main, NULL) != 0) {
+    base::subtle::Release_Store(&running_, 0);
+    Log(kLog, __FILE__, __LINE__,
+        "TCMALLOC_BACKGROUND_INTERVAL_MS ignored: cannot create thread");
+    return;
+  }
+  pthread_detach(thread);
+#ifdef HAVE_FORK
+  // The thread does not survive fork(), so the child goes back to
+  // scavenging inline.
+  pthread_atfork(NULL, NULL, ChildAfterFork);
+#endif
+}
+
+void BackgroundThread::ChildAfterFork() {
+  base::subtle::Release_Store(&running_, 0);
+}
+
+void* BackgroundThread::Main(void* arg) {
+  struct timespec interval;
+  interval.tv_sec = interval_ms / 1000;
+  interval.tv_nsec = (interval_ms % 1000) * 1000000;
+  while (IsRunning()) {
+    struct timespec left = interval;
+    while (nanosleep(&left, &left) != 0 && errno == EINTR) {
+    }
+    RunPass();
+  }
+  return NULL;
+}
+
+void BackgroundThread::RunPass() {
+  // Shards first: what an idle shard gives up goes to ExtendedMemory,
+  // which is scavenged next.
+  for (int i = 0; i < Static::get_pageheap_count(); i++) {
+    SpinLockHolder h(Static::pageheap_lock_by_number(i));
+    PageHeap* heap = Static::pageheap(i);
+    for (int n = 0; n < kMaxScavengesPerPass && heap->ScavengeDue(); n++) {
+      released_pages += heap->Scavenge();
+    }
+    shard_trimmed_pages += heap->TrimIfIdle();
+  }
+
+  PageHeap::ExtendedMemory* extended = Static::extended_memory();
+  for (int n = 0; n < kMaxScavengesPerPass; n++) {
+    // Let allocations in between scavenges.
+    SpinLockHolder h(Static::extended_lock());
+    if (!extended->ScavengeDue()) break;
+    released_pages += extended->Scavenge();
+  }
+
+  if (FLAGS_tcmalloc_heap_limit_mb > 0) {
+    const Length headroom =
+        ((FLAGS_tcmalloc_heap_limit_mb << 20) >> kPageShift) / kLimitHeadroom;
+    SpinLockHolder h(Static::extended_lock());
+    const uint64_t unmapped = Static::pagemap()->GetUnmappedBytes();
+    Static::pagemap()->EnsureLimit(headroom, true);
+    const uint64_t now_unmapped = Static::pagemap()->GetUnmappedBytes();
+    if (now_unmapped > unmapped) {
+      limit_released_pages += (now_unmapped - unmapped) >> kPageShift;
+    }
+  }
+
+  // Usually done already by the thread whose allocation crossed a limit.
+  HeapLimit::MaybeRelieve();
+
+  if (CpuCache::IsEnabled()) {
+    cpu_cache_trimmed_bytes += CpuCache::Scavenge();
+  }
+  ThreadCache::RequestScavenge();
+  passes++;
+}
+
+bool BackgroundThread::GetProperty(const char* name, size_t* value) {
+  static const char kPrefix[] = "tcmalloc.background.";
+  if (strncmp(name, kPrefix, sizeof(kPrefix) - 1) != 0) {
+    return false;
+  }
+  const char* stat = name + sizeof(kPrefix) - 1;
+  if (strcmp(stat, "interval_ms") == 0) {
+    *value = IsRunning() ? interval_ms : 0;
+  } else if (strcmp(stat, "passes") == 0) {
+    *value = passes;
+  } else if (strcmp(stat, "released_bytes") == 0) {
+    *value = released_pages << kPageShift;
+  } else if (strcmp(stat, "limit_released_bytes") == 0) {
+    *value = limit_released_pages << kPageShift;
+  } else if (strcmp(stat, "shard_trimmed_bytes") == 0) {
+    *value = shard_trimmed_pages << kPageShift;
+  } else if (strcmp(stat, "cpu_cache_trimmed_bytes") == 0) {
+    *value = cpu_cache_trimmed_bytes;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void BackgroundThread::Print(TCMalloc_Printer* out) {
+  if (!IsRunning()) return;
+  out->printf("------------------------------------------------\n");
+  out->printf("Background thread (every %ld ms): %" PRIu64 " passes\n",
+              interval_ms, passes);
+  out->printf("%12" PRIu64 " bytes released at the release rate\n",
+              released_pages << kPageShift);
+  out->printf("%12" PRIu64 " bytes released under the heap limit\n",
+              limit_released_pages << kPageShift);
+  out->printf("%12" PRIu64 " bytes moved from idle shards\n",
+              shard_trimmed_pages << kPageShift);
+  out->printf("%12" PRIu64 " bytes moved from per-cpu caches\n",
+              cpu_cache_trimmed_bytes);
+}
+
+}  // namespace tcmalloc
@@ -0,0 +1,93 @@
+// -*- Mode: C++; c-basic-offset: 2; indent-tabs-mode: nil -*-
+// Copyright (c) 2026, gperftools Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// ---
+//
+// Optional maintenance thread that takes the allocator's housekeeping
+// off the paths of malloc() and free().
+//
+// Enabled by TCMALLOC_BACKGROUND_INTERVAL_MS=<N>.  Every N milliseconds
+// the thread
+//  * does the scavenging that FLAGS_tcmalloc_release_rate calls for, in
+//    ExtendedMemory and in every page heap shard.  While it runs, a
+//    free() only counts the pages it frees instead of releasing them;
+//  * moves the free pages of shards that saw no traffic since its last
+//    pass back to ExtendedMemory, where busy shards can use them;
+//  * keeps a sixteenth of FLAGS_tcmalloc_heap_limit_mb free below the
+//    limit, so that allocations rarely have to release memory to stay
+//    under it;
+//  * gives objects left unused in the per-cpu caches back to the
+//    central cache, and asks the thread caches to do the same the next
+//    time they overflow or refill a freelist.
+
+#ifndef TCMALLOC_BACKGROUND_THREAD_H_
+#define TCMALLOC_BACKGROUND_THREAD_H_
+
+#include <config.h>
+#include <stddef.h>                     // for size_t
+#include "base/atomicops.h"             // for Atomic32
+#include "base/basictypes.h"
+
+class TCMalloc_Printer;
+
+namespace tcmalloc {
+
+class BackgroundThread {
+ public:
+  // Reads TCMALLOC_BACKGROUND_INTERVAL_MS and, if it is positive, starts
+  // the thread.  Called once from TCMallocGuard, when malloc() is fully
+  // set up and threads can be created.
+  static void Start();
+
+  static bool IsRunning() {
+    return base::subtle::Acquire_Load(&running_) != 0;
+  }
+
+  // Handles the "tcmalloc.background.<stat>" properties, where <stat>
+  // is interval_ms, passes, released_bytes, limit_released_bytes,
+  // shard_trimmed_bytes or cpu_cache_trimmed_bytes.
+  static bool GetProperty(const char* name, size_t* value);
+
+  // Prints the thread's counters for MallocExtension::GetStats().
+  static void Print(TCMalloc_Printer* out);
+
+ private:
+  static void* Main(void* arg);
+  static void RunPass();
+  static void ChildAfterFork();
+
+  // Set by Start() and cleared in a forked child, while other threads
+  // read it.
+  static Atomic32 running_;
+};
+
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_BACKGROUND_THREAD_H_
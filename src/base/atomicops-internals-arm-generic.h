@@ -90,6 +90,17 @@ inline Atomic32 NoBarrier_AtomicExchange(volatile Atomic32* ptr,
   return old_value;
 }
 
+inline Atomic32 NoBarrier_AtomicIncrement(volatile Atomic32* ptr,
+                                          Atomic32 increment) {
+  Atomic32 old_value = *ptr;
+  for (;;) {
+    const Atomic32 prev = NoBarrier_CompareAndSwap(ptr, old_value,
+                                                   old_value + increment);
+    if (prev == old_value) return old_value + increment;
+    old_value = prev;
+  }
+}
+
 inline Atomic32 Acquire_AtomicExchange(volatile Atomic32* ptr,
                                        Atomic32 new_value) {
   // pLinuxKernelCmpxchg already has acquire and release barrier semantics.
@@ -169,6 +180,12 @@ inline Atomic64 NoBarrier_AtomicExchange(volatile Atomic64* ptr,
   return 0;
 }
 
+inline Atomic64 NoBarrier_AtomicIncrement(volatile Atomic64* ptr,
+                                          Atomic64 increment) {
+  NotImplementedFatalError("NoBarrier_AtomicIncrement");
+  return 0;
+}
+
 inline Atomic64 Acquire_AtomicExchange(volatile Atomic64* ptr,
                                        Atomic64 new_value) {
   // pLinuxKernelCmpxchg already has acquire and release barrier semantics.
@@ -95,6 +95,17 @@ inline Atomic32 NoBarrier_AtomicExchange(volatile Atomic32* ptr,
   return old;
 }
 
+inline Atomic32 NoBarrier_AtomicIncrement(volatile Atomic32* ptr,
+                                          Atomic32 increment) {
+  Atomic32 old_value = *ptr;
+  for (;;) {
+    const Atomic32 prev = NoBarrier_CompareAndSwap(ptr, old_value,
+                                                   old_value + increment);
+    if (prev == old_value) return old_value + increment;
+    old_value = prev;
+  }
+}
+
 inline void MemoryBarrier() {
 #if !defined(ARMV7)
   uint32_t dest = 0;
@@ -206,6 +217,17 @@ inline Atomic64 NoBarrier_AtomicExchange(volatile Atomic64* ptr,
   return old;
 }
 
+inline Atomic64 NoBarrier_AtomicIncrement(volatile Atomic64* ptr,
+                                          Atomic64 increment) {
+  Atomic64 old_value = *ptr;
+  for (;;) {
+    const Atomic64 prev = NoBarrier_CompareAndSwap(ptr, old_value,
+                                                   old_value + increment);
+    if (prev == old_value) return old_value + increment;
+    old_value = prev;
+  }
+}
+
 inline Atomic64 Acquire_AtomicExchange(volatile Atomic64* ptr,
                                        Atomic64 new_value) {
   Atomic64 old_value = NoBarrier_AtomicExchange(ptr, new_value);
@@ -265,6 +287,12 @@ inline Atomic64 NoBarrier_AtomicExchange(volatile Atomic64* ptr,
   return 0;
 }
 
+inline Atomic64 NoBarrier_AtomicIncrement(volatile Atomic64* ptr,
+                                          Atomic64 increment) {
+  NotImplementedFatalError("NoBarrier_AtomicIncrement");
+  return 0;
+}
+
 inline Atomic64 Acquire_AtomicExchange(volatile Atomic64* ptr,
                                        Atomic64 new_value) {
   NotImplementedFatalError("Acquire_AtomicExchange");
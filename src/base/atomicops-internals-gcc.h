@@ -67,6 +67,11 @@ inline Atomic32 NoBarrier_AtomicExchange(volatile Atomic32* ptr,
   return __atomic_exchange_n(const_cast<Atomic32*>(ptr), new_value, __ATOMIC_RELAXED);
 }
 
+inline Atomic32 NoBarrier_AtomicIncrement(volatile Atomic32* ptr,
+                                          Atomic32 increment) {
+  return __atomic_add_fetch(const_cast<Atomic32*>(ptr), increment, __ATOMIC_RELAXED);
+}
+
 inline Atomic32 Acquire_AtomicExchange(volatile Atomic32* ptr,
                                        Atomic32 new_value) {
   return __atomic_exchange_n(const_cast<Atomic32*>(ptr), new_value,  __ATOMIC_ACQUIRE);
@@ -140,6 +145,11 @@ inline Atomic64 NoBarrier_AtomicExchange(volatile Atomic64* ptr,
   return __atomic_exchange_n(const_cast<Atomic64*>(ptr), new_value, __ATOMIC_RELAXED);
 }
 
+inline Atomic64 NoBarrier_AtomicIncrement(volatile Atomic64* ptr,
+                                          Atomic64 increment) {
+  return __atomic_add_fetch(const_cast<Atomic64*>(ptr), increment, __ATOMIC_RELAXED);
+}
+
 inline Atomic64 Acquire_AtomicExchange(volatile Atomic64* ptr,
                                        Atomic64 new_value) {
   return __atomic_exchange_n(const_cast<Atomic64*>(ptr), new_value,  __ATOMIC_ACQUIRE);
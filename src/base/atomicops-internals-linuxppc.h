@@ -164,6 +164,11 @@ inline Atomic32 NoBarrier_AtomicExchange(volatile Atomic32 *ptr,
   return old_value;
 }
 
+inline Atomic32 NoBarrier_AtomicIncrement(volatile Atomic32 *ptr,
+                                          Atomic32 increment) {
+  return OSAtomicAdd32(increment, const_cast<Atomic32*>(ptr));
+}
+
 inline Atomic32 Acquire_AtomicExchange(volatile Atomic32 *ptr,
                                        Atomic32 new_value) {
   Atomic32 old_value;
@@ -305,6 +310,11 @@ inline Atomic64 NoBarrier_AtomicExchange(volatile Atomic64 *ptr,
   return old_value;
 }
 
+inline Atomic64 NoBarrier_AtomicIncrement(volatile Atomic64 *ptr,
+                                          Atomic64 increment) {
+  return OSAtomicAdd64(increment, const_cast<Atomic64*>(ptr));
+}
+
 inline Atomic64 Acquire_AtomicExchange(volatile Atomic64 *ptr,
                                        Atomic64 new_value) {
   Atomic64 old_value;
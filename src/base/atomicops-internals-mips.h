@@ -112,6 +112,17 @@ inline Atomic32 NoBarrier_AtomicExchange(volatile Atomic32* ptr,
     return old;
 }
 
+inline Atomic32 NoBarrier_AtomicIncrement(volatile Atomic32* ptr,
+                                          Atomic32 increment) {
+  Atomic32 old_value = *ptr;
+  for (;;) {
+    const Atomic32 prev = NoBarrier_CompareAndSwap(ptr, old_value,
+                                                   old_value + increment);
+    if (prev == old_value) return old_value + increment;
+    old_value = prev;
+  }
+}
+
 inline void MemoryBarrier()
 {
     __asm__ volatile("sync" : : : "memory");
@@ -247,6 +258,17 @@ inline Atomic64 NoBarrier_AtomicExchange(volatile Atomic64* ptr,
     return old;
 }
 
+inline Atomic64 NoBarrier_AtomicIncrement(volatile Atomic64* ptr,
+                                          Atomic64 increment) {
+  Atomic64 old_value = *ptr;
+  for (;;) {
+    const Atomic64 prev = NoBarrier_CompareAndSwap(ptr, old_value,
+                                                   old_value + increment);
+    if (prev == old_value) return old_value + increment;
+    old_value = prev;
+  }
+}
+
 inline Atomic64 Acquire_AtomicExchange(volatile Atomic64* ptr,
                                        Atomic64 new_value)
 {
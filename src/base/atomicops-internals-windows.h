@@ -138,6 +138,17 @@ inline Atomic32 NoBarrier_AtomicExchange(volatile Atomic32* ptr,
   return static_cast<Atomic32>(result);
 }
 
+inline Atomic32 NoBarrier_AtomicIncrement(volatile Atomic32* ptr,
+                                          Atomic32 increment) {
+  Atomic32 old_value = *ptr;
+  for (;;) {
+    const Atomic32 prev = NoBarrier_CompareAndSwap(ptr, old_value,
+                                                   old_value + increment);
+    if (prev == old_value) return old_value + increment;
+    old_value = prev;
+  }
+}
+
 inline Atomic32 Acquire_AtomicExchange(volatile Atomic32* ptr,
                                        Atomic32 new_value) {
   // FastInterlockedExchange has both acquire and release memory barriers.
@@ -294,6 +305,17 @@ inline Atomic64 NoBarrier_AtomicExchange(volatile Atomic64* ptr,
   return reinterpret_cast<Atomic64>(result);
 }
 
+inline Atomic64 NoBarrier_AtomicIncrement(volatile Atomic64* ptr,
+                                          Atomic64 increment) {
+  Atomic64 old_value = *ptr;
+  for (;;) {
+    const Atomic64 prev = NoBarrier_CompareAndSwap(ptr, old_value,
+                                                   old_value + increment);
+    if (prev == old_value) return old_value + increment;
+    old_value = prev;
+  }
+}
+
 inline void NoBarrier_Store(volatile Atomic64* ptr, Atomic64 value) {
   *ptr = value;
 }
@@ -383,6 +405,12 @@ inline Atomic64 NoBarrier_AtomicExchange(volatile Atomic64* ptr,
 #endif
 }
 
+inline Atomic64 NoBarrier_AtomicIncrement(volatile Atomic64* ptr,
+                                          Atomic64 increment) {
+  NotImplementedFatalError("NoBarrier_AtomicIncrement");
+  return 0;
+}
+
 inline void NoBarrier_Store(volatile Atomic64* ptrValue, Atomic64 value)
 {
  	__asm {
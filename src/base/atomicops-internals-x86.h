@@ -91,6 +91,16 @@ inline Atomic32 NoBarrier_AtomicExchange(volatile Atomic32* ptr,
   return new_value;  // Now it's the previous value.
 }
 
+inline Atomic32 NoBarrier_AtomicIncrement(volatile Atomic32* ptr,
+                                          Atomic32 increment) {
+  Atomic32 temp = increment;
+  __asm__ __volatile__("lock; xaddl %0,%1"
+                       : "+r" (temp), "+m" (*ptr)
+                       : : "memory");
+  // temp now holds the old value of *ptr
+  return temp + increment;
+}
+
 inline Atomic32 Acquire_AtomicExchange(volatile Atomic32* ptr,
                                        Atomic32 new_value) {
   Atomic32 old_val = NoBarrier_AtomicExchange(ptr, new_value);
@@ -200,6 +210,16 @@ inline Atomic64 NoBarrier_AtomicExchange(volatile Atomic64* ptr,
   return new_value;  // Now it's the previous value.
 }
 
+inline Atomic64 NoBarrier_AtomicIncrement(volatile Atomic64* ptr,
+                                          Atomic64 increment) {
+  Atomic64 temp = increment;
+  __asm__ __volatile__("lock; xaddq %0,%1"
+                       : "+r" (temp), "+m" (*ptr)
+                       : : "memory");
+  // temp now holds the old value of *ptr
+  return temp + increment;
+}
+
 inline Atomic64 Acquire_AtomicExchange(volatile Atomic64* ptr,
                                        Atomic64 new_value) {
   Atomic64 old_val = NoBarrier_AtomicExchange(ptr, new_value);
@@ -310,6 +330,17 @@ inline Atomic64 NoBarrier_AtomicExchange(volatile Atomic64* ptr,
   return old_val;
 }
 
+inline Atomic64 NoBarrier_AtomicIncrement(volatile Atomic64* ptr,
+                                          Atomic64 increment) {
+  Atomic64 old_value = *ptr;
+  for (;;) {
+    const Atomic64 prev = NoBarrier_CompareAndSwap(ptr, old_value,
+                                                   old_value + increment);
+    if (prev == old_value) return old_value + increment;
+    old_value = prev;
+  }
+}
+
 inline Atomic64 Acquire_AtomicExchange(volatile Atomic64* ptr,
                                        Atomic64 new_val) {
   Atomic64 old_val = NoBarrier_AtomicExchange(ptr, new_val);
@@ -172,6 +172,14 @@ inline AtomicWord NoBarrier_AtomicExchange(volatile AtomicWord* ptr,
       reinterpret_cast<volatile AtomicWordCastType*>(ptr), new_value);
 }
 
+// Atomically add increment to *ptr, returning the new value.  This routine
+// implies no memory barriers.
+inline AtomicWord NoBarrier_AtomicIncrement(volatile AtomicWord* ptr,
+                                            AtomicWord increment) {
+  return NoBarrier_AtomicIncrement(
+      reinterpret_cast<volatile AtomicWordCastType*>(ptr), increment);
+}
+
 inline AtomicWord Acquire_AtomicExchange(volatile AtomicWord* ptr,
                                          AtomicWord new_value) {
   return Acquire_AtomicExchange(
@@ -259,6 +267,7 @@ Atomic32 NoBarrier_CompareAndSwap(volatile Atomic32* ptr,
                                   Atomic32 old_value,
                                   Atomic32 new_value);
 Atomic32 NoBarrier_AtomicExchange(volatile Atomic32* ptr, Atomic32 new_value);
+Atomic32 NoBarrier_AtomicIncrement(volatile Atomic32* ptr, Atomic32 increment);
 Atomic32 Acquire_AtomicExchange(volatile Atomic32* ptr, Atomic32 new_value);
 Atomic32 Release_AtomicExchange(volatile Atomic32* ptr, Atomic32 new_value);
 Atomic32 Acquire_CompareAndSwap(volatile Atomic32* ptr,
@@ -279,6 +288,7 @@ Atomic64 NoBarrier_CompareAndSwap(volatile Atomic64* ptr,
                                   Atomic64 old_value,
                                   Atomic64 new_value);
 Atomic64 NoBarrier_AtomicExchange(volatile Atomic64* ptr, Atomic64 new_value);
+Atomic64 NoBarrier_AtomicIncrement(volatile Atomic64* ptr, Atomic64 increment);
 Atomic64 Acquire_AtomicExchange(volatile Atomic64* ptr, Atomic64 new_value);
 Atomic64 Release_AtomicExchange(volatile Atomic64* ptr, Atomic64 new_value);
 
@@ -36,18 +36,36 @@
 #include "base/spinlock.h"
 #include "base/spinlock_internal.h"
 #include "base/sysinfo.h"   /* for GetSystemCPUsCount() */
+#ifndef _WIN32
+#include <time.h>           /* for clock_gettime() */
+#endif
 
 // NOTE on the Lock-state values:
 //
 // kSpinLockFree represents the unlocked state
 // kSpinLockHeld represents the locked state with no waiters
 // kSpinLockSleeper represents the locked state with waiters
+// kSpinLockStarving is kSpinLockSleeper, but one of the waiters has
+//   slept kStarvationLoops times without getting the lock
+// kSpinLockHandoff represents the lock being passed from an unlocking
+//   thread to the waiters.  Only a thread that has already slept
+//   waiting for the lock may take it; new arrivals wait their turn.
+//   This is not FIFO: the lock goes to whichever sleeper wakes first,
+//   since the futex word cannot tell which one has waited longest.
 
 static int adaptive_spin_count = 0;
 
+// A waiter that has slept this many times and still finds the lock
+// taken asks for the next unlock to hand the lock over to the sleepers
+// instead of letting spinning threads take it first.  This bounds how
+// long any one waiter can be overtaken.
+static const int kStarvationLoops = 4;
+
 const base::LinkerInitialized SpinLock::LINKER_INITIALIZED =
     base::LINKER_INITIALIZED;
 
+volatile AtomicWord SpinLock::profile_hook_ = 0;
+
 namespace {
 struct SpinLock_InitHelper {
   SpinLock_InitHelper() {
@@ -64,6 +82,17 @@ struct SpinLock_InitHelper {
 // but nothing lock-intensive should be going on at that time.
 static SpinLock_InitHelper init_helper;
 
+// Only read when a profile hook is set, to time contended waits.
+inline int64 MonotonicNanos() {
+#ifdef _WIN32
+  return 0;  // Waits are counted, but not timed.
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
 inline void SpinlockPause(void) {
 #if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
   __asm__ __volatile__("rep; nop" : : );
@@ -73,49 +102,97 @@ inline void SpinlockPause(void) {
 }  // unnamed namespace
 
 // Monitor the lock to see if its value changes within some time
-// period (adaptive_spin_count loop iterations). The last value read
-// from the lock is returned from the method.
+// period. The last value read from the lock is returned from the
+// method.
+//
+// The period adapts to how long the lock is usually held: it is twice
+// the number of iterations recent spins needed before the lock was
+// released, but at least adaptive_spin_count/8 so that shorter holds
+// are noticed again, and at most adaptive_spin_count.  A spin that
+// runs out without the lock being released shrinks the estimate, so
+// that a lock held for long stretches sends its waiters to sleep
+// sooner rather than burning CPU.  spin_estimate_ is a heuristic and
+// is updated without synchronization; a lost update is harmless.
 Atomic32 SpinLock::SpinLoop() {
-  int c = adaptive_spin_count;
-  while (base::subtle::NoBarrier_Load(&lockword_) != kSpinLockFree && --c > 0) {
+  int limit = adaptive_spin_count;
+  if (limit > 0) {
+    const int estimate = base::subtle::NoBarrier_Load(&spin_estimate_);
+    const int adaptive = 2 * estimate + limit / 8;
+    if (adaptive < limit) {
+      limit = adaptive;
+    }
+  }
+  int c = limit;
+  Atomic32 lock_value;
+  while ((lock_value = base::subtle::NoBarrier_Load(&lockword_)) !=
+             kSpinLockFree &&
+         lock_value != kSpinLockHandoff && --c > 0) {
     SpinlockPause();
   }
-  return base::subtle::Acquire_CompareAndSwap(&lockword_, kSpinLockFree,
-                                              kSpinLockSleeper);
+  lock_value = base::subtle::Acquire_CompareAndSwap(&lockword_, kSpinLockFree,
+                                                    kSpinLockSleeper);
+  if (limit > 0 && lock_value != kSpinLockHandoff) {
+    const int estimate = base::subtle::NoBarrier_Load(&spin_estimate_);
+    if (lock_value == kSpinLockFree) {
+      const int spins = limit - c;
+      base::subtle::NoBarrier_Store(&spin_estimate_,
+                                    estimate + (spins - estimate) / 8);
+    } else {
+      base::subtle::NoBarrier_Store(&spin_estimate_,
+                                    estimate - estimate / 8);
+    }
+  }
+  return lock_value;
 }
 
 void SpinLock::SlowLock() {
+  const ProfileHook hook = profile_hook();
+  const int64 wait_start = hook != NULL ? MonotonicNanos() : 0;
   Atomic32 lock_value = SpinLoop();
 
   int lock_wait_call_count = 0;
   while (lock_value != kSpinLockFree) {
-    // If the lock is currently held, but not marked as having a sleeper, mark
-    // it as having a sleeper.
-    if (lock_value == kSpinLockHeld) {
-      // Here, just "mark" that the thread is going to sleep.  Don't store the
-      // lock wait time in the lock as that will cause the current lock
-      // owner to think it experienced contention.
-      lock_value = base::subtle::Acquire_CompareAndSwap(&lockword_,
-                                                        kSpinLockHeld,
-                                                        kSpinLockSleeper);
-      if (lock_value == kSpinLockHeld) {
-        // Successfully transitioned to kSpinLockSleeper.  Pass
-        // kSpinLockSleeper to the SpinLockDelay routine to properly indicate
-        // the last lock_value observed.
-        lock_value = kSpinLockSleeper;
-      } else if (lock_value == kSpinLockFree) {
-        // Lock is free again, so try and acquire it before sleeping.  The
-        // new lock state will be the number of cycles this thread waited if
-        // this thread obtains the lock.
+    if (lock_value == kSpinLockHandoff) {
+      // The lock was handed to the threads that have been sleeping on
+      // it.  The first of them to get here takes it; a thread that has
+      // not slept yet goes to sleep and waits its turn.
+      if (lock_wait_call_count > 0) {
         lock_value = base::subtle::Acquire_CompareAndSwap(&lockword_,
-                                                          kSpinLockFree,
+                                                          kSpinLockHandoff,
                                                           kSpinLockSleeper);
-        continue;  // skip the delay at the end of the loop
+        if (lock_value == kSpinLockHandoff) {
+          break;
+        }
+        continue;
+      }
+    } else if (lock_value != kSpinLockStarving) {
+      // The lock is held.  Mark that a thread is going to sleep on it,
+      // or, if this thread has been overtaken too often, that the next
+      // unlock should hand the lock to the sleepers.  Don't store the
+      // lock wait time in the lock as that will cause the current lock
+      // owner to think it experienced contention.
+      const Atomic32 mark = lock_wait_call_count >= kStarvationLoops
+                                ? static_cast<Atomic32>(kSpinLockStarving)
+                                : static_cast<Atomic32>(kSpinLockSleeper);
+      if (lock_value != mark) {
+        const Atomic32 prev = base::subtle::Acquire_CompareAndSwap(
+            &lockword_, lock_value, mark);
+        if (prev == lock_value) {
+          // Pass the mark to the SpinLockDelay routine to properly
+          // indicate the last lock_value observed.
+          lock_value = mark;
+        } else {
+          lock_value = prev;
+          if (lock_value == kSpinLockFree) {
+            // Lock is free again, so try and acquire it before sleeping.
+            lock_value = base::subtle::Acquire_CompareAndSwap(
+                &lockword_, kSpinLockFree, kSpinLockSleeper);
+          }
+          continue;  // skip the delay at the end of the loop
+        }
       }
     }
 
-	//	pid_t thread_id = syscall(__NR_gettid); 
-	//	printf("lock_wait_count %d, thread id: %d\n", lock_wait_call_count, thread_id);
     // Wait for an OS specific delay.
     base::internal::SpinLockDelay(&lockword_, lock_value,
                                   ++lock_wait_call_count);
@@ -123,9 +200,21 @@ void SpinLock::SlowLock() {
     // some chance of obtaining the lock.
     lock_value = SpinLoop();
   }
+
+  if (hook != NULL) {
+    (*hook)(this, true, MonotonicNanos() - wait_start);
+  }
 }
 
-void SpinLock::SlowUnlock() {
-  // wake waiter if necessary
+void SpinLock::SlowUnlock(Atomic32 prev_value) {
+  if (prev_value == kSpinLockStarving) {
+    // Hand the lock to the sleepers rather than leaving it free for
+    // whoever is spinning.  If another thread has already taken it,
+    // the starving waiter will mark the lock again.
+    base::subtle::Release_CompareAndSwap(&lockword_, kSpinLockFree,
+                                         kSpinLockHandoff);
+  }
+  // Wake one waiter: waking all of them would only have the rest go
+  // back to sleep once one has the lock.
   base::internal::SpinLockWake(&lockword_, false);
 }
@@ -47,7 +47,7 @@
 
 class LOCKABLE SpinLock {
  public:
-  SpinLock() : lockword_(kSpinLockFree) { }
+  SpinLock() : lockword_(kSpinLockFree), spin_estimate_(0) { }
 
   // Special constructor for use with static SpinLock objects.  E.g.,
   //
@@ -59,7 +59,7 @@ class LOCKABLE SpinLock {
   // initializers without worrying about the order in which global
   // initializers run.
   explicit SpinLock(base::LinkerInitialized /*x*/) {
-    // Does nothing; lockword_ is already initialized
+    // Does nothing; lockword_ and spin_estimate_ are already initialized
   }
 
   // Acquire this SpinLock.
@@ -69,6 +69,8 @@ class LOCKABLE SpinLock {
     if (base::subtle::Acquire_CompareAndSwap(&lockword_, kSpinLockFree,
                                              kSpinLockHeld) != kSpinLockFree) {
       SlowLock();
+    } else if (PREDICT_FALSE(profile_hook() != NULL)) {
+      (*profile_hook())(this, false, 0);
     }
     ANNOTATE_RWLOCK_ACQUIRED(this, 1);
   }
@@ -82,6 +84,9 @@ class LOCKABLE SpinLock {
         (base::subtle::Acquire_CompareAndSwap(&lockword_, kSpinLockFree,
                                               kSpinLockHeld) == kSpinLockFree);
     if (res) {
+      if (PREDICT_FALSE(profile_hook() != NULL)) {
+        (*profile_hook())(this, false, 0);
+      }
       ANNOTATE_RWLOCK_ACQUIRED(this, 1);
     }
     return res;
@@ -92,11 +97,11 @@ class LOCKABLE SpinLock {
   //                 support this macro with 0 args (see thread_annotations.h)
   inline void Unlock() /*UNLOCK_FUNCTION()*/ {
     ANNOTATE_RWLOCK_RELEASED(this, 1);
-    uint64 prev_value = static_cast<uint64>(
-        base::subtle::Release_AtomicExchange(&lockword_, kSpinLockFree));
+    Atomic32 prev_value =
+        base::subtle::Release_AtomicExchange(&lockword_, kSpinLockFree);
     if (prev_value != kSpinLockHeld) {
       // Speed the wakeup of any waiter.
-      SlowUnlock();
+      SlowUnlock(prev_value);
     }
   }
 
@@ -107,16 +112,40 @@ class LOCKABLE SpinLock {
     return base::subtle::NoBarrier_Load(&lockword_) != kSpinLockFree;
   }
 
+  // Lock contention profiling.  If a hook is set, it is called right
+  // after every acquisition of any SpinLock by Lock() or a successful
+  // TryLock(), with the lock held.  "contended" says whether Lock()
+  // had to wait, and wait_ns for how long.  The hook may take other
+  // SpinLocks (it is called for those too), but must not allocate.
+  typedef void (*ProfileHook)(const SpinLock* lock, bool contended,
+                              int64 wait_ns);
+  static void SetProfileHook(ProfileHook hook) {
+    base::subtle::Release_Store(&profile_hook_,
+                                reinterpret_cast<AtomicWord>(hook));
+  }
+
   static const base::LinkerInitialized LINKER_INITIALIZED;  // backwards compat
  private:
   enum { kSpinLockFree = 0 };
   enum { kSpinLockHeld = 1 };
   enum { kSpinLockSleeper = 2 };
+  enum { kSpinLockStarving = 3 };
+  enum { kSpinLockHandoff = 4 };
 
   volatile Atomic32 lockword_;
+  // Running average of how many SpinLoop() iterations it took to see
+  // the lock released, for the waits that were won by spinning.
+  volatile Atomic32 spin_estimate_;
+
+  // The hook may be set while other threads are taking locks.
+  static volatile AtomicWord profile_hook_;
+  static ProfileHook profile_hook() {
+    return reinterpret_cast<ProfileHook>(
+        base::subtle::Acquire_Load(&profile_hook_));
+  }
 
   void SlowLock();
-  void SlowUnlock();
+  void SlowUnlock(Atomic32 prev_value);
   Atomic32 SpinLoop();
 
   DISALLOW_COPY_AND_ASSIGN(SpinLock);
@@ -271,6 +271,88 @@ int GetSystemCPUsCount()
 #endif
 }
 
+#if defined(__linux__)
+// Parses a sysfs cpu or node list such as "0-3,8-11\n" and stores
+// "value" into out[i] for every listed i below max.  Returns the
+// number of listed entries that were stored.
+static int ParseSysfsList(const char* p, int value, int* out, int max) {
+  int stored = 0;
+  while (*p != '\0' && *p != '\n') {
+    if (*p < '0' || *p > '9') return stored;
+    int first = 0;
+    while (*p >= '0' && *p <= '9') first = first * 10 + (*p++ - '0');
+    int last = first;
+    if (*p == '-') {
+      p++;
+      last = 0;
+      while (*p >= '0' && *p <= '9') last = last * 10 + (*p++ - '0');
+    }
+    for (int i = first; i <= last && i < max; i++) {
+      out[i] = value;
+      stored++;
+    }
+    if (*p == ',') p++;
+  }
+  return stored;
+}
+
+// Reads a small sysfs file into buf (NUL terminated).  Uses raw
+// syscalls so that it is safe to call while malloc is initializing.
+static bool ReadSysfsFile(const char* path, char* buf, int size) {
+  int fd = safeopen(path, O_RDONLY);
+  if (fd == -1) return false;
+  int len = saferead(fd, buf, size - 1);
+  safeclose(fd);
+  if (len <= 0) return false;
+  buf[len] = '\0';
+  return true;
+}
+#endif
+
+int GetSystemCPUNodes(int* cpu_to_node, int max_cpus) {
+  for (int i = 0; i < max_cpus; i++) {
+    cpu_to_node[i] = -1;
+  }
+#if defined(__linux__)
+  static const int kMaxNodes = 1024;
+  static const char kNodeDir[] = "/sys/devices/system/node/";
+  int online[kMaxNodes];
+  char buf[4096];
+  for (int i = 0; i < kMaxNodes; i++) {
+    online[i] = 0;
+  }
+  if (!ReadSysfsFile("/sys/devices/system/node/online", buf, sizeof(buf)) ||
+      ParseSysfsList(buf, 1, online, kMaxNodes) == 0) {
+    return 0;
+  }
+  int nodes = 0;
+  for (int node = 0; node < kMaxNodes; node++) {
+    if (!online[node]) continue;
+    // Build ".../node<N>/cpulist" by hand; we may run before libc
+    // is fully usable.
+    char path[sizeof(kNodeDir) + 32];
+    char digits[16];
+    int ndigits = 0;
+    for (int v = node; ndigits == 0 || v > 0; v /= 10) {
+      digits[ndigits++] = '0' + (v % 10);
+    }
+    char* q = path;
+    for (const char* s = kNodeDir; *s; s++) *q++ = *s;
+    for (const char* s = "node"; *s; s++) *q++ = *s;
+    while (ndigits > 0) *q++ = digits[--ndigits];
+    for (const char* s = "/cpulist"; *s; s++) *q++ = *s;
+    *q = '\0';
+    if (ReadSysfsFile(path, buf, sizeof(buf)) &&
+        ParseSysfsList(buf, node, cpu_to_node, max_cpus) > 0) {
+      nodes++;
+    }
+  }
+  return nodes;
+#else
+  return 0;
+#endif
+}
+
 // ----------------------------------------------------------------------
 
 #if defined __linux__ || defined __FreeBSD__ || defined __sun__ || defined __CYGWIN__ || defined __CYGWIN32__
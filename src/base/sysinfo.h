@@ -72,6 +72,13 @@ extern bool GetUniquePathFromEnv(const char* env_name, char* path);
 
 extern int GetSystemCPUsCount();
 
+// Fills cpu_to_node[0..max_cpus) with the NUMA node of each cpu, or
+// -1 for cpus that are offline or not described by the system.
+// Returns the number of NUMA nodes that own at least one cpu below
+// max_cpus, or 0 if the topology is unavailable.  Safe to call
+// before malloc is initialized.
+extern int GetSystemCPUNodes(int* cpu_to_node, int max_cpus);
+
 void SleepForMilliseconds(int milliseconds);
 
 //  Return true if we're running POSIX (e.g., NPTL on Linux) threads,
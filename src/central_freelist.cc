@@ -33,13 +33,12 @@
 
 #include "config.h"
 #include <algorithm>
+#include "alloc_latency.h"     // for AllocLatency
 #include "central_freelist.h"
 #include "internal_logging.h"  // for ASSERT, MESSAGE
 #include "linked_list.h"       // for SLL_Next, SLL_Push, etc
 #include "page_heap.h"         // for PageHeap
 #include "static_vars.h"       // for Static
-#include <sys/syscall.h>
-#include <chrono>
 
 using std::min;
 using std::max;
@@ -153,7 +152,7 @@ namespace tcmalloc {
 				}
 
 				bool CentralFreeList::EvictRandomSizeClass(
-												int locked_size_class, bool force) {
+												int self_size_class, bool force) {
 								static int race_counter = 0;
 								int t = race_counter++;  // Updated without a lock, but who cares.
 								if (t >= Static::num_size_classes()) {
@@ -164,8 +163,8 @@ namespace tcmalloc {
 								}
 								ASSERT(t >= 0);
 								ASSERT(t < Static::num_size_classes());
-								if (t == locked_size_class) return false;
-								return Static::central_cache()[t].ShrinkCache(locked_size_class, force);
+								if (t == self_size_class) return false;
+								return Static::central_cache()[t].ShrinkCache(force);
 				}
 
 				bool CentralFreeList::MakeCacheSpace() {
@@ -173,92 +172,99 @@ namespace tcmalloc {
 								if (used_slots_ < cache_size_) return true;
 								// Check if we can expand this cache?
 								if (cache_size_ == max_cache_size_) return false;
-								// Ok, we'll try to grab an entry from some other size class.
-								if (EvictRandomSizeClass(size_class_, false) ||
-																EvictRandomSizeClass(size_class_, true)) {
-												// Succeeded in evicting, we're going to make our cache larger.
-												// However, we may have dropped and re-acquired the lock in
-												// EvictRandomSizeClass (via ShrinkCache and the LockInverter), so the
-												// cache_size may have changed.  Therefore, check and verify that it is
-												// still OK to increase the cache_size.
-												if (cache_size_ < max_cache_size_) {
-																cache_size_++;
-																return true;
-												}
+								// Ok, we'll try to grab an entry from some other size class.  Our
+								// own tc_lock_ is dropped meanwhile so that we never hold two
+								// transfer cache locks, and the other class may need lock_ to
+								// release a batch to its spans.
+								tc_lock_.Unlock();
+								const bool evicted = EvictRandomSizeClass(size_class_, false) ||
+												EvictRandomSizeClass(size_class_, true);
+								tc_lock_.Lock();
+								// Other threads may have changed the cache while tc_lock_ was
+								// released, so check again before growing it.
+								if (evicted && cache_size_ < max_cache_size_) {
+												cache_size_++;
 								}
-								return false;
+								return used_slots_ < cache_size_;
 				}
 
+				bool CentralFreeList::ShrinkCache(bool force) {
+								// Start with a quick check without taking a lock.
+								if (cache_size_ == 0) return false;
+								// We don't evict from a full cache unless we are 'forcing'.
+								if (force == false && used_slots_ == cache_size_) return false;
 
-				namespace {
-								class LockInverter {
-												private:
-																SpinLock *held_, *temp_;
-												public:
-																inline explicit LockInverter(SpinLock* held, SpinLock *temp)
-																				: held_(held), temp_(temp) { held_->Unlock(); temp_->Lock(); }
-																inline ~LockInverter() { temp_->Unlock(); held_->Lock();  }
-								};
-				}
-
-				// This function is marked as NO_THREAD_SAFETY_ANALYSIS because it uses
-				// LockInverter to release one lock and acquire another in scoped-lock
-				// style, which our current annotation/analysis does not support.
-				bool CentralFreeList::ShrinkCache(int locked_size_class, bool force)
-								NO_THREAD_SAFETY_ANALYSIS {
-												// Start with a quick check without taking a lock.
-												if (cache_size_ == 0) return false;
-												// We don't evict from a full cache unless we are 'forcing'.
-												if (force == false && used_slots_ == cache_size_) return false;
-
-												// Grab lock, but first release the other lock held by this thread.  We use
-												// the lock inverter to ensure that we never hold two size class locks
-												// concurrently.  That can create a deadlock because there is no well
-												// defined nesting order.
-												LockInverter li(&Static::central_cache()[locked_size_class].lock_, &lock_);
+								void* release = NULL;
+								{
+												SpinLockHolder h(&tc_lock_);
 												ASSERT(used_slots_ <= cache_size_);
 												ASSERT(0 <= cache_size_);
 												if (cache_size_ == 0) return false;
 												if (used_slots_ == cache_size_) {
 																if (force == false) return false;
-																// ReleaseListToSpans releases the lock, so we have to make all the
-																// updates to the central list before calling it.
 																cache_size_--;
 																used_slots_--;
-																ReleaseListToSpans(tc_slots_[used_slots_].head);
-																return true;
+																release = tc_slots_[used_slots_].head;
+												} else {
+																cache_size_--;
 												}
-												cache_size_--;
-												return true;
 								}
+								if (release != NULL) {
+												SpinLockHolder h(&lock_);
+												ReleaseListToSpans(release);
+								}
+								return true;
+				}
+
+				int CentralFreeList::DrainTransferCache() {
+								// Bounded by what is there now, in case other threads keep
+								// filling the cache while we empty it.
+								int batches = used_slots_;
+								int released = 0;
+								for (; batches > 0; batches--) {
+												void* batch;
+												{
+																SpinLockHolder h(&tc_lock_);
+																if (used_slots_ == 0) break;
+																batch = tc_slots_[--used_slots_].head;
+												}
+												SpinLockHolder h(&lock_);
+												ReleaseListToSpans(batch);
+												released += Static::sizemap()->num_objects_to_move(size_class_);
+								}
+								return released;
+				}
 
 				void CentralFreeList::InsertRange(void *start, void *end, int N) {
-								SpinLockHolder h(&lock_);
-								if (N == Static::sizemap()->num_objects_to_move(size_class_) &&
-																MakeCacheSpace()) {
-												int slot = used_slots_++;
-												ASSERT(slot >=0);
-												ASSERT(slot < max_cache_size_);
-												TCEntry *entry = &tc_slots_[slot];
-												entry->head = start;
-												entry->tail = end;
-												return;
+								if (N == Static::sizemap()->num_objects_to_move(size_class_)) {
+												SpinLockHolder h(&tc_lock_);
+												if (MakeCacheSpace()) {
+																int slot = used_slots_++;
+																ASSERT(slot >=0);
+																ASSERT(slot < max_cache_size_);
+																TCEntry *entry = &tc_slots_[slot];
+																entry->head = start;
+																entry->tail = end;
+																return;
+												}
 								}
+								SpinLockHolder h(&lock_);
 								ReleaseListToSpans(start);
 				}
 
 				int CentralFreeList::RemoveRange(void **start, void **end, int N) {
 								ASSERT(N > 0);
-								lock_.Lock();
 								if (N == Static::sizemap()->num_objects_to_move(size_class_) &&
 																used_slots_ > 0) {
-												int slot = --used_slots_;
-												ASSERT(slot >= 0);
-												TCEntry *entry = &tc_slots_[slot];
-												*start = entry->head;
-												*end = entry->tail;
-												lock_.Unlock();
-												return N;
+												SpinLockHolder h(&tc_lock_);
+												if (used_slots_ > 0) {
+																int slot = --used_slots_;
+																ASSERT(slot >= 0);
+																TCEntry *entry = &tc_slots_[slot];
+																*start = entry->head;
+																*end = entry->tail;
+																return N;
+												}
 								}
 
 								int result = 0;
@@ -266,6 +272,7 @@ namespace tcmalloc {
 								*end = NULL;
 								// TODO: Prefetch multiple TCEntries?
 
+								lock_.Lock();
 								/*
 									 >>> for flowchart 7 goto implementation of FetchFromOneSpansSafe
 									 >>> in this file.
@@ -352,6 +359,7 @@ namespace tcmalloc {
 				void CentralFreeList::Populate() {
 								// Release central list lock while operating on pageheap
 								lock_.Unlock();
+								const uint64 populate_start = AllocLatency::Now();
 								const size_t npages = Static::sizemap()->class_to_pages(size_class_);
 
 								Span* span = NULL;
@@ -361,36 +369,16 @@ namespace tcmalloc {
 												/*
 													 >>> for flowchart 10 goto New method implementation in page_heap.cc file.
 												 */
-				//								pid_t thread_id = syscall(__NR_gettid); 
-				//								Log(kLog, __FILE__, __LINE__,
-				//																"begin --> thread ", thread_id, " requests memory from pageheap number ", pageheap_rank
-				//									 );
-				//								auto start = std::chrono::high_resolution_clock::now();
 												span = Static::pageheap(pageheap_rank)->New(npages);
-				//								auto stop = std::chrono::high_resolution_clock::now();
-				//								auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(stop-start);
 												if (span) Static::pagemap()->RegisterSizeClass(span, size_class_);
-				//								Log(kLog, __FILE__, __LINE__,
-				//																"end --> thread ", thread_id, " recieved memory duration: ", duration.count()
-				//									 );
 								}
 								if (span == NULL) {
 												Log(kLog, __FILE__, __LINE__,
 																				"tcmalloc: allocation failed", npages << kPageShift);
+												AllocLatency::Record(AllocLatency::kCentralRefill, populate_start);
 												lock_.Lock();
 												return;
 								}
-		//						auto start1 = std::chrono::high_resolution_clock::now();
-		//						int random[1000];
-		//						srand((unsigned)time(NULL));
-		//						for(int i=1; i<1000; i++){
-		//								random[i] = 1 + rand() % 10;
-		//						}
-		//						auto stop1 = std::chrono::high_resolution_clock::now();
-		//						auto duration1 = std::chrono::duration_cast<std::chrono::nanoseconds>(stop1-start1);
-		//						Log(kLog, __FILE__, __LINE__,
-		//														"new added duration: " ,duration1.count()
-		//							 );
 								ASSERT(span->length == npages);
 								// Cache sizeclass info eagerly.  Locking is not necessary.
 								// (Instead of being eager, we could just replace any stale info
@@ -419,6 +407,7 @@ namespace tcmalloc {
 								ASSERT(ptr <= limit);
 								*tail = NULL;
 								span->refcount = 0; // No sub-object in use yet
+								AllocLatency::Record(AllocLatency::kCentralRefill, populate_start);
 
 								// Add span to list of non-empty spans
 								lock_.Lock();
@@ -432,7 +421,7 @@ namespace tcmalloc {
 				}
 
 				int CentralFreeList::tc_length() {
-								SpinLockHolder h(&lock_);
+								SpinLockHolder h(&tc_lock_);
 								return used_slots_ * Static::sizemap()->num_objects_to_move(size_class_);
 				}
 
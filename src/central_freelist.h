@@ -52,7 +52,9 @@ class CentralFreeList {
   // A CentralFreeList may be used before its constructor runs.
   // So we prevent lock_'s constructor from doing anything to the
   // lock_ state.
-  CentralFreeList() : lock_(base::LINKER_INITIALIZED) { }
+  CentralFreeList()
+    : lock_(base::LINKER_INITIALIZED),
+      tc_lock_(base::LINKER_INITIALIZED) { }
 
   void Init(size_t cl);
 
@@ -74,22 +76,40 @@ class CentralFreeList {
   // Returns the number of free objects in the transfer cache.
   int tc_length();
 
+  // Gives every batch in the transfer cache back to the spans, so that
+  // spans left with no objects in use return to the page heap.  The
+  // cache keeps its size.  Returns the number of objects released.
+  int DrainTransferCache();
+
+  // Returns the number of spans carved into objects of this class.
+  size_t num_spans() {
+    SpinLockHolder h(&lock_);
+    return num_spans_;
+  }
+
   // Returns the memory overhead (internal fragmentation) attributable
   // to the freelist.  This is memory lost when the size of elements
   // in a freelist doesn't exactly divide the page-size (an 8192-byte
   // page full of 5-byte objects would have 2 bytes memory overhead).
   size_t OverheadBytes();
 
-  // Lock/Unlock the internal SpinLock. Used on the pthread_atfork call
-  // to set the lock in a consistent state before the fork.
+  // Lock/Unlock the internal SpinLocks. Used on the pthread_atfork call
+  // to set the locks in a consistent state before the fork.
   void Lock() {
     lock_.Lock();
+    tc_lock_.Lock();
   }
 
   void Unlock() {
+    tc_lock_.Unlock();
     lock_.Unlock();
   }
 
+  // The locks guarding the span lists and the transfer cache, so that
+  // LockProfile can tell them apart.
+  const SpinLock* span_lock() const { return &lock_; }
+  const SpinLock* transfer_cache_lock() const { return &tc_lock_; }
+
  private:
   // TransferCache is used to cache transfers of
   // sizemap.num_objects_to_move(size_class) back and forth between
@@ -137,30 +157,28 @@ class CentralFreeList {
   // May temporarily release lock_.
   void Populate() EXCLUSIVE_LOCKS_REQUIRED(lock_);
 
-  // REQUIRES: lock is held.
+  // REQUIRES: tc_lock_ is held.
   // Tries to make room for a TCEntry.  If the cache is full it will try to
   // expand it at the cost of some other cache size.  Return false if there is
   // no space.
-  bool MakeCacheSpace() EXCLUSIVE_LOCKS_REQUIRED(lock_);
+  // May temporarily release tc_lock_.
+  bool MakeCacheSpace() EXCLUSIVE_LOCKS_REQUIRED(tc_lock_);
 
-  // REQUIRES: lock_ for locked_size_class is held.
+  // REQUIRES: no size class locks are held.
   // Picks a "random" size class to steal TCEntry slot from.  In reality it
   // just iterates over the sizeclasses but does so without taking a lock.
   // Returns true on success.
   // May temporarily lock a "random" size class.
-  static bool EvictRandomSizeClass(int locked_size_class, bool force);
+  static bool EvictRandomSizeClass(int self_size_class, bool force);
 
-  // REQUIRES: lock_ is *not* held.
+  // REQUIRES: lock_ and tc_lock_ are *not* held.
   // Tries to shrink the Cache.  If force is true it will relase objects to
   // spans if it allows it to shrink the cache.  Return false if it failed to
   // shrink the cache.  Decrements cache_size_ on succeess.
-  // May temporarily take lock_.  If it takes lock_, the locked_size_class
-  // lock is released to keep the thread from holding two size class locks
-  // concurrently which could lead to a deadlock.
-  bool ShrinkCache(int locked_size_class, bool force) LOCKS_EXCLUDED(lock_);
+  // May temporarily take tc_lock_, and lock_ if objects are released.
+  bool ShrinkCache(bool force) LOCKS_EXCLUDED(lock_) LOCKS_EXCLUDED(tc_lock_);
 
-  // This lock protects all the data members.  cached_entries and cache_size_
-  // may be looked at without holding the lock.
+  // This lock protects the span lists and counter_.
   SpinLock lock_;
 
   // We keep linked lists of empty and non-empty spans.
@@ -170,6 +188,13 @@ class CentralFreeList {
   size_t   num_spans_;      // Number of spans in empty_ plus nonempty_
   size_t   counter_;        // Number of free objects in cache entry
 
+  // Protects the transfer cache: tc_slots_, used_slots_ and cache_size_.
+  // Full batches move in and out of the transfer cache under this lock
+  // alone, so they never wait behind the span walking done under lock_.
+  // Nothing else is ever locked while it is held.  used_slots_ and
+  // cache_size_ may be looked at without holding the lock.
+  SpinLock tc_lock_ CACHELINE_ALIGNED;
+
   // Here we reserve space for TCEntry cache slots.  Space is preallocated
   // for the largest possible number of entries than any one size class may
   // accumulate.  Not all size classes are allowed to accumulate
@@ -118,8 +118,119 @@ int SizeMap::NumMoveSize(size_t size) {
   return num;
 }
 
-// Initialize the mapping arrays
+// Number of pages to allocate at a time for objects of the given
+// size.
+static size_t ClassPages(size_t size, int blocks_to_move) {
+  size_t psize = 0;
+  do {
+    psize += kPageSize;
+    // Allocate enough pages so leftover is less than 1/8 of total.
+    // This bounds wasted space to at most 12.5%.
+    while ((psize % size) > (psize >> 3)) {
+      psize += kPageSize;
+    }
+    // Continue to add pages until there are at least as many objects in
+    // the span as are needed when moving objects from the central
+    // freelists and spans to the thread caches.
+  } while ((psize / size) < (blocks_to_move));
+  return psize >> kPageShift;
+}
+
+// One entry of TCMALLOC_SIZE_CLASSES.  A pages or batch of 0 means
+// the value is computed as for the default table.
+struct SizeClassSpec {
+  size_t size;
+  size_t pages;
+  size_t batch;
+};
+
+// Parses a TCMALLOC_SIZE_CLASSES list into specs[].  Entries are
+// separated by commas or spaces, and each is size[:pages[:batch]]:
+// the class size, the pages per span and the number of objects moved
+// to and from thread caches at a time.  Returns the number of entries
+// read, or 0 if the list is NULL, empty or has a bad entry or more
+// than max of them.  Runs before malloc is usable, so it must not
+// allocate.
+static int ParseSizeClassList(const char* p, SizeClassSpec* specs, int max) {
+  if (p == NULL) {
+    return 0;
+  }
+  int n = 0;
+  while (*p != '\0') {
+    if (*p == ',' || *p == ' ') {
+      p++;
+      continue;
+    }
+    unsigned long v[3] = { 0, 0, 0 };
+    int fields = 0;
+    char* end;
+    for (;;) {
+      v[fields++] = strtoul(p, &end, 10);
+      if (end == p || *end != ':' || fields == 3) break;
+      p = end + 1;
+    }
+    if (end == p || (*end != '\0' && *end != ',' && *end != ' ') ||
+        n == max) {
+      Log(kLog, __FILE__, __LINE__,
+          "TCMALLOC_SIZE_CLASSES ignored: bad entry or too many classes", n);
+      return 0;
+    }
+    specs[n].size = v[0];
+    specs[n].pages = v[1];
+    specs[n].batch = v[2];
+    n++;
+    p = end;
+  }
+  return n;
+}
+
+// Checks a size class list read by ParseSizeClassList().  Sizes must
+// increase, be representable in class_array_, and keep the natural
+// alignment the aligned allocation fast paths rely on: if a class
+// covers a multiple of some power of two, its size must be a multiple
+// of it too.  Spans given must fit in the page heap's exact-size lists
+// and hold at least one object, and batches must fit a thread cache's
+// free list.
+static bool ValidSizeClassList(const SizeClassSpec* specs, int n) {
+  size_t prev = 0;
+  for (int i = 0; i < n; i++) {
+    const size_t size = specs[i].size;
+    if (size <= prev || size > kMaxSize || size % kAlignment != 0 ||
+        (size > 1024 && size % 128 != 0)) {
+      Log(kLog, __FILE__, __LINE__,
+          "TCMALLOC_SIZE_CLASSES ignored: bad size", size);
+      return false;
+    }
+    for (size_t align = kMinAlign; align <= size; align <<= 1) {
+      if ((size / align) * align > prev && size % align != 0) {
+        Log(kLog, __FILE__, __LINE__,
+            "TCMALLOC_SIZE_CLASSES ignored: size not aligned to", size, align);
+        return false;
+      }
+    }
+    const size_t pages = specs[i].pages;
+    if (pages > kMaxPages || (pages > 0 && (pages << kPageShift) < size)) {
+      Log(kLog, __FILE__, __LINE__,
+          "TCMALLOC_SIZE_CLASSES ignored: bad pages for size", pages, size);
+      return false;
+    }
+    if (specs[i].batch > static_cast<size_t>(kMaxDynamicFreeListLength)) {
+      Log(kLog, __FILE__, __LINE__,
+          "TCMALLOC_SIZE_CLASSES ignored: bad batch for size",
+          specs[i].batch, size);
+      return false;
+    }
+    prev = size;
+  }
+  return true;
+}
+
 void SizeMap::Init() {
+  Init(TCMallocGetenvSafe("TCMALLOC_SIZE_CLASSES"));
+}
+
+// Initialize the mapping arrays
+void SizeMap::Init(const char* classes) {
   InitTCMallocTransferNumObjects();
 
   // Do some sanity checking on add_amount[]/shift_amount[]/class_array[]
@@ -132,46 +243,61 @@ void SizeMap::Init() {
         "Invalid class index for kMaxSize", ClassIndex(kMaxSize));
   }
 
-  // Compute the size classes we want to use
+  // A size class table tuned for a workload, e.g. by
+  // gen-size-classes from a heap profile, replaces the computed one.
+  // kMaxSize is always the last class.
+  SizeClassSpec custom[kClassSizesMax];
+  int ncustom = ParseSizeClassList(classes, custom, kClassSizesMax - 2);
+  if (ncustom > 0 && custom[ncustom - 1].size != kMaxSize) {
+    custom[ncustom].size = kMaxSize;
+    custom[ncustom].pages = 0;
+    custom[ncustom].batch = 0;
+    ncustom++;
+  }
+  if (ncustom > 0 && !ValidSizeClassList(custom, ncustom)) {
+    ncustom = 0;
+  }
+
   int sc = 1;   // Next size class to assign
-  int alignment = kAlignment;
-  CHECK_CONDITION(kAlignment <= kMinAlign);
-  for (size_t size = kAlignment; size <= kMaxSize; size += alignment) {
-    alignment = AlignmentForSize(size);
-    CHECK_CONDITION((size % alignment) == 0);
-
-    int blocks_to_move = NumMoveSize(size) / 4;
-    size_t psize = 0;
-    do {
-      psize += kPageSize;
-      // Allocate enough pages so leftover is less than 1/8 of total.
-      // This bounds wasted space to at most 12.5%.
-      while ((psize % size) > (psize >> 3)) {
-        psize += kPageSize;
-      }
-      // Continue to add pages until there are at least as many objects in
-      // the span as are needed when moving objects from the central
-      // freelists and spans to the thread caches.
-    } while ((psize / size) < (blocks_to_move));
-    const size_t my_pages = psize >> kPageShift;
-
-    if (sc > 1 && my_pages == class_to_pages_[sc-1]) {
-      // See if we can merge this into the previous class without
-      // increasing the fragmentation of the previous class.
-      const size_t my_objects = (my_pages << kPageShift) / size;
-      const size_t prev_objects = (class_to_pages_[sc-1] << kPageShift)
-                                  / class_to_size_[sc-1];
-      if (my_objects == prev_objects) {
-        // Adjust last class to include this size
-        class_to_size_[sc-1] = size;
-        continue;
-      }
+  if (ncustom > 0) {
+    for (int i = 0; i < ncustom; i++) {
+      const size_t size = custom[i].size;
+      const int batch = custom[i].batch > 0 ? custom[i].batch
+                                            : NumMoveSize(size);
+      class_to_pages_[sc] = custom[i].pages > 0 ? custom[i].pages
+                                                : ClassPages(size, batch / 4);
+      class_to_size_[sc] = size;
+      num_objects_to_move_[sc] = batch;
+      sc++;
     }
+  } else {
+    // Compute the size classes we want to use
+    int alignment = kAlignment;
+    CHECK_CONDITION(kAlignment <= kMinAlign);
+    for (size_t size = kAlignment; size <= kMaxSize; size += alignment) {
+      alignment = AlignmentForSize(size);
+      CHECK_CONDITION((size % alignment) == 0);
+
+      const size_t my_pages = ClassPages(size, NumMoveSize(size) / 4);
+
+      if (sc > 1 && my_pages == class_to_pages_[sc-1]) {
+        // See if we can merge this into the previous class without
+        // increasing the fragmentation of the previous class.
+        const size_t my_objects = (my_pages << kPageShift) / size;
+        const size_t prev_objects = (class_to_pages_[sc-1] << kPageShift)
+                                    / class_to_size_[sc-1];
+        if (my_objects == prev_objects) {
+          // Adjust last class to include this size
+          class_to_size_[sc-1] = size;
+          continue;
+        }
+      }
 
-    // Add new class
-    class_to_pages_[sc] = my_pages;
-    class_to_size_[sc] = size;
-    sc++;
+      // Add new class
+      class_to_pages_[sc] = my_pages;
+      class_to_size_[sc] = size;
+      sc++;
+    }
   }
   num_size_classes = sc;
   if (sc > kClassSizesMax) {
@@ -227,8 +353,9 @@ void SizeMap::Init() {
     }
   }
 
-  // Initialize the num_objects_to_move array.
-  for (size_t cl = 1; cl  < num_size_classes; ++cl) {
+  // Initialize the num_objects_to_move array, unless the custom table
+  // did.
+  for (size_t cl = 1; ncustom == 0 && cl < num_size_classes; ++cl) {
     num_objects_to_move_[cl] = NumMoveSize(ByteSizeForClass(cl));
   }
 }
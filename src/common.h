@@ -249,6 +249,10 @@ class SizeMap {
   // Initialize the mapping arrays
   void Init();
 
+  // As Init(), but with a table in the format of TCMALLOC_SIZE_CLASSES
+  // instead of the environment variable's; NULL means the computed one.
+  void Init(const char* classes);
+
   inline int SizeClass(size_t size) {
     return class_array_[ClassIndex(size)];
   }
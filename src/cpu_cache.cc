@@ -0,0 +1,366 @@
+// -*- Mode: C++; c-basic-offset: 2; indent-tabs-mode: nil -*-
+// Copyright (c) 2026, gperftools Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <config.h>
+#include "cpu_cache.h"
+#include <stdlib.h>                     // for strtol, strtoll
+#include <new>                          // for placement new
+#ifdef TCMALLOC_HAVE_PERCPU_RSEQ
+#include <linux/membarrier.h>           // for MEMBARRIER_CMD_*
+#include <sys/syscall.h>                // for __NR_membarrier
+#include <unistd.h>                     // for syscall
+#endif
+#include "alloc_latency.h"              // for AllocLatency
+#include "base/sysinfo.h"               // for GetSystemCPUsCount
+#include "central_freelist.h"           // for CentralFreeListPadded
+#include "getenv_safe.h"                // for TCMallocGetenvSafe
+#include "heap_limit.h"                 // for HeapLimit
+#include "internal_logging.h"           // for ASSERT, Log
+#include "linked_list.h"                // for SLL_Push, SLL_SetNext, etc
+#include "static_vars.h"                // for Static
+
+namespace tcmalloc {
+
+// Default bound on the bytes cached by a single cpu.  This plays the
+// role kMaxThreadCacheSize plays for thread caches.
+static const size_t kDefaultCpuCacheSize = 1 << 20;
+static const size_t kMinCpuCacheSize = kMaxSize * 2;
+
+// A class's list holds at most this many batches, and never more
+// slots than keep the whole slab addressable by 16-bit indices, even
+// with a large TCMALLOC_TRANSFER_NUM_OBJ.
+static const int kMaxBatchesPerList = 4;
+static const size_t kMaxListCapacity =
+    (0xfffe - kClassSizesMax) / kClassSizesMax;
+
+// Slabs and CpuStates are cache line aligned so cpus do not share lines.
+static const size_t kCacheLineSize = 64;
+
+static char* AlignToCacheLine(char* p) {
+  const uintptr_t mask = kCacheLineSize - 1;
+  return reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(p) + mask) & ~mask);
+}
+
+bool CpuCache::enabled_ = false;
+int CpuCache::num_cpus_ = 0;
+size_t CpuCache::max_cpu_cache_size_ = kDefaultCpuCacheSize;
+char* CpuCache::slabs_ = NULL;
+size_t CpuCache::slab_stride_ = 0;
+CpuCache::CpuState* CpuCache::states_ = NULL;
+uint16 CpuCache::begin_[kClassSizesMax];
+uint16 CpuCache::max_capacity_[kClassSizesMax];
+
+#ifdef TCMALLOC_HAVE_PERCPU_RSEQ
+
+static long Membarrier(int cmd, unsigned int flags, int cpu) {
+  return syscall(__NR_membarrier, cmd, flags, cpu);
+}
+
+int CpuCache::CurrentCpu() {
+  const struct rseq* r = reinterpret_cast<const struct rseq*>(
+      static_cast<char*>(__builtin_thread_pointer()) + __rseq_offset);
+  return static_cast<int>(
+      *reinterpret_cast<const volatile uint32*>(&r->cpu_id));
+}
+
+void CpuCache::Fence(int cpu) {
+  if (Membarrier(MEMBARRIER_CMD_PRIVATE_EXPEDITED_RSEQ,
+                 MEMBARRIER_CMD_FLAG_CPU, cpu) == 0) {
+    return;
+  }
+  // A forked child has to register again.
+  if (Membarrier(MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_RSEQ, 0, 0) != 0 ||
+      Membarrier(MEMBARRIER_CMD_PRIVATE_EXPEDITED_RSEQ,
+                 MEMBARRIER_CMD_FLAG_CPU, cpu) != 0) {
+    Log(kCrash, __FILE__, __LINE__,
+        "membarrier() failed after working at startup");
+  }
+}
+
+#else  // !TCMALLOC_HAVE_PERCPU_RSEQ
+
+int CpuCache::CurrentCpu() { return -1; }
+void CpuCache::Fence(int cpu) { }
+
+#endif  // TCMALLOC_HAVE_PERCPU_RSEQ
+
+void CpuCache::InitModule() {
+  const char* flag = TCMallocGetenvSafe("TCMALLOC_PERCPU_CACHE");
+  if (flag == NULL || strtol(flag, NULL, 10) == 0) {
+    return;
+  }
+#ifndef TCMALLOC_HAVE_PERCPU_RSEQ
+  Log(kLog, __FILE__, __LINE__,
+      "TCMALLOC_PERCPU_CACHE ignored: needs rseq on x86-64 Linux");
+  return;
+#else
+  if (__rseq_size == 0 ||
+      Membarrier(MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_RSEQ, 0, 0) != 0 ||
+      Membarrier(MEMBARRIER_CMD_PRIVATE_EXPEDITED_RSEQ,
+                 MEMBARRIER_CMD_FLAG_CPU, 0) != 0) {
+    Log(kLog, __FILE__, __LINE__,
+        "TCMALLOC_PERCPU_CACHE ignored: rseq or membarrier() unavailable");
+    return;
+  }
+  const char* bytes = TCMallocGetenvSafe("TCMALLOC_PERCPU_CACHE_BYTES");
+  if (bytes != NULL) {
+    size_t n = strtoll(bytes, NULL, 10);
+    max_cpu_cache_size_ = n < kMinCpuCacheSize ? kMinCpuCacheSize : n;
+  }
+
+  // Threads on cpus past the last slab go to the central cache.
+  int cpus = GetSystemCPUsCount();
+  if (cpus < 1) cpus = 1;
+  if (cpus > Static::kMaxShardedCPUs) cpus = Static::kMaxShardedCPUs;
+
+  // The headers take the first kClassSizesMax slots of each slab.
+  size_t slots = kClassSizesMax;
+  for (int cl = 0; cl < kClassSizesMax; cl++) {
+    begin_[cl] = 0;
+    max_capacity_[cl] = 0;
+    if (cl == 0 || cl >= Static::num_size_classes()) continue;
+    const size_t size = Static::sizemap()->ByteSizeForClass(cl);
+    size_t capacity =
+        kMaxBatchesPerList * Static::sizemap()->num_objects_to_move(cl);
+    if (capacity > max_cpu_cache_size_ / size) {
+      capacity = max_cpu_cache_size_ / size;
+    }
+    if (capacity > kMaxListCapacity) capacity = kMaxListCapacity;
+    begin_[cl] = slots;
+    max_capacity_[cl] = capacity;
+    slots += capacity;
+  }
+  CHECK_CONDITION(slots < 0xffff);
+  const size_t stride = (slots * sizeof(void*) + kCacheLineSize - 1) &
+      ~(kCacheLineSize - 1);
+
+  char* mem = reinterpret_cast<char*>(
+      MetaDataAlloc(stride * cpus + kCacheLineSize));
+  char* state_mem = reinterpret_cast<char*>(
+      MetaDataAlloc(sizeof(CpuState) * cpus + kCacheLineSize));
+  if (mem == NULL || state_mem == NULL) {
+    Log(kLog, __FILE__, __LINE__,
+        "TCMALLOC_PERCPU_CACHE ignored: out of memory for per-cpu caches");
+    return;
+  }
+  slabs_ = AlignToCacheLine(mem);
+  slab_stride_ = stride;
+  states_ = reinterpret_cast<CpuState*>(AlignToCacheLine(state_mem));
+  for (int i = 0; i < cpus; i++) {
+    // Lists start out with no capacity; Grow() hands it out as they
+    // run dry.
+    for (int cl = 0; cl < kClassSizesMax; cl++) {
+      base::subtle::NoBarrier_Store(
+          Header(i, cl), MakeHeader(begin_[cl], begin_[cl], begin_[cl]));
+    }
+    new (&states_[i].lock) SpinLock();
+    states_[i].budget = max_cpu_cache_size_;
+    for (int cl = 0; cl < kClassSizesMax; cl++) {
+      states_[i].underflow[cl] = false;
+    }
+  }
+  num_cpus_ = cpus;
+  enabled_ = true;
+#endif
+}
+
+bool CpuCache::Grow(uint32 cl, size_t size, int n) {
+  // The thread may move to another cpu at any point; that only makes
+  // the capacity land where it is less useful.
+  const int cpu = CurrentCpu();
+  if (cpu < 0 || cpu >= num_cpus_) return false;
+  CpuState* state = &states_[cpu];
+  SpinLockHolder h(&state->lock);
+  const uint64 header = base::subtle::NoBarrier_Load(Header(cpu, cl));
+  const uint16 end = Field(header, kEndShift);
+  const int room = max_capacity_[cl] - (end - begin_[cl]);
+  if (n > room) n = room;
+  const int affordable = state->budget / size;
+  if (n > affordable) n = affordable;
+  if (n <= 0) return false;
+  state->budget -= n * size;
+  StoreEnd(cpu, cl, end + n);
+  return true;
+}
+
+// Fetches one batch from the central cache, returns its first object
+// and pushes as much of the rest as fits onto the current cpu's slab.
+void* CpuCache::Refill(uint32 cl, size_t size,
+                       void *(*oom_handler)(size_t size)) {
+  ASSERT(size == Static::sizemap()->ByteSizeForClass(cl));
+  const int batch_size = Static::sizemap()->num_objects_to_move(cl);
+  void *start, *end;
+  const uint64 fetch_start = AllocLatency::Now();
+  int fetch_count = Static::central_cache()[cl].RemoveRange(
+      &start, &end, batch_size);
+  AllocLatency::Record(AllocLatency::kFastPathMiss, fetch_start);
+  if (fetch_count == 0) {
+    ASSERT(start == NULL);
+    return oom_handler(size);
+  }
+  void* result = SLL_Pop(&start);
+  --fetch_count;
+
+  // Same slow start as ThreadCache: a list that runs dry gets room for
+  // another batch, and Scavenge() leaves it alone this round.
+  const int cpu = CurrentCpu();
+  if (cpu >= 0 && cpu < num_cpus_) {
+    states_[cpu].underflow[cl] = true;
+  }
+  if (fetch_count > 0) {
+    Grow(cl, size, batch_size);
+  }
+  // Read the link first: once pushed, another thread may take the
+  // object and write over it.
+  while (fetch_count > 0) {
+    void* next = SLL_Next(start);
+    if (!Push(cl, start)) break;
+    start = next;
+    --fetch_count;
+  }
+  if (fetch_count > 0) {
+    Static::central_cache()[cl].InsertRange(start, end, fetch_count);
+  }
+  // The refill may have grown the heap past the soft limit.
+  HeapLimit::MaybeShrink();
+  return result;
+}
+
+// The current cpu's list for cl is full.  Give it more room if the
+// budget allows; otherwise send ptr and up to a batch from the top of
+// the list back to the central cache.
+void CpuCache::Overflow(void* ptr, uint32 cl) {
+  const size_t size = Static::sizemap()->ByteSizeForClass(cl);
+  const int batch_size = Static::sizemap()->num_objects_to_move(cl);
+  if (Grow(cl, size, batch_size) && Push(cl, ptr)) return;
+
+  void* head = ptr;
+  void* tail = ptr;
+  SLL_SetNext(ptr, NULL);
+  int n = 1;
+  while (n < batch_size) {
+    void* p = Pop(cl);
+    if (p == NULL) break;
+    SLL_Push(&head, p);
+    n++;
+  }
+  Static::central_cache()[cl].InsertRange(head, tail, n);
+}
+
+void CpuCache::GetStats(uint64_t* total_bytes, uint64_t* class_count) {
+  for (int i = 0; i < num_cpus_; i++) {
+    // The lock keeps Scavenge() from locking the headers under us.
+    SpinLockHolder h(&states_[i].lock);
+    for (uint32 cl = 1; cl < Static::num_size_classes(); cl++) {
+      const uint64 header = base::subtle::NoBarrier_Load(Header(i, cl));
+      const uint64 count = Field(header, kCurrentShift) - begin_[cl];
+      *total_bytes += count * Static::sizemap()->ByteSizeForClass(cl);
+      if (class_count) {
+        class_count[cl] += count;
+      }
+    }
+  }
+}
+
+size_t CpuCache::ScavengeCpu(int cpu) {
+  CpuState* state = &states_[cpu];
+  SpinLockHolder h(&state->lock);
+  const uint32 num_classes = Static::num_size_classes();
+
+  // Lock the headers, then wait out any sequence on the cpu that read
+  // one before it was locked.  Such a sequence may still commit its
+  // store to current, which is never 0 for a real list, so a nonzero
+  // current in a locked header is the one to use.  No one else stores
+  // end while we hold the lock.
+  uint16 current[kClassSizesMax];
+  uint16 end[kClassSizesMax];
+  for (uint32 cl = 1; cl < num_classes; cl++) {
+    const uint64 old = base::subtle::NoBarrier_AtomicExchange(
+        Header(cpu, cl), kLockedHeader);
+    current[cl] = Field(old, kCurrentShift);
+    end[cl] = Field(old, kEndShift);
+  }
+  Fence(cpu);
+  for (uint32 cl = 1; cl < num_classes; cl++) {
+    const uint16 late = Field(base::subtle::NoBarrier_Load(Header(cpu, cl)),
+                              kCurrentShift);
+    if (late != 0) current[cl] = late;
+  }
+
+  size_t moved = 0;
+  void** slots = Slots(cpu);
+  for (uint32 cl = 1; cl < num_classes; cl++) {
+    const size_t size = Static::sizemap()->ByteSizeForClass(cl);
+    const uint16 begin = begin_[cl];
+    if (!state->underflow[cl]) {
+      // An idle list: give back half its objects and all its unused
+      // capacity.
+      const int count = current[cl] - begin;
+      const int n = (count + 1) / 2;
+      if (n > 0) {
+        void* head = NULL;
+        void* tail = slots[current[cl] - 1];
+        for (int i = 0; i < n; i++) {
+          SLL_Push(&head, slots[--current[cl]]);
+        }
+        Static::central_cache()[cl].InsertRange(head, tail, n);
+        moved += n * size;
+      }
+      state->budget += (end[cl] - current[cl]) * size;
+      end[cl] = current[cl];
+    }
+    state->underflow[cl] = false;
+    base::subtle::NoBarrier_Store(
+        Header(cpu, cl), MakeHeader(begin, current[cl], end[cl]));
+  }
+  return moved;
+}
+
+size_t CpuCache::Scavenge() {
+  size_t moved = 0;
+  for (int i = 0; i < num_cpus_; i++) {
+    moved += ScavengeCpu(i);
+  }
+  return moved;
+}
+
+void CpuCache::LockAll() {
+  for (int i = 0; i < num_cpus_; i++) {
+    states_[i].lock.Lock();
+  }
+}
+
+void CpuCache::UnlockAll() {
+  for (int i = 0; i < num_cpus_; i++) {
+    states_[i].lock.Unlock();
+  }
+}
+
+}  // namespace tcmalloc
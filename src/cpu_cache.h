@@ -0,0 +1,294 @@
+// -*- Mode: C++; c-basic-offset: 2; indent-tabs-mode: nil -*-
+// Copyright (c) 2026, gperftools Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// ---
+//
+// Optional per-cpu front end for small object allocation.  When
+// enabled (TCMALLOC_PERCPU_CACHE=1) do_malloc() and
+// do_free_with_callback() use the freelists of the cpu the calling
+// thread runs on instead of the thread's own ThreadCache, so the
+// memory held in front end caches is bounded by the number of cpus
+// rather than by the number of threads.
+//
+// Each cpu has a slab: a header per size class followed by an array
+// of object pointers per class.  A header packs three 16-bit slab
+// indices, the class's begin (fixed), current (one past its top
+// object) and end (its capacity).  Allocate() and Deallocate() pop and
+// push with a restartable sequence (rseq): the kernel restarts the
+// sequence if the thread is preempted or migrated before its single
+// committing store to current, so the fast path takes no lock and no
+// atomic instruction.
+//
+// Capacity is handed out to classes from a per-cpu byte budget,
+// TCMALLOC_PERCPU_CACHE_BYTES, as lists run dry, so a cpu never holds
+// more than that.  Only pops and pushes store current, and only the
+// slow paths, under the cpu's lock, store end.  Scavenge() takes back
+// what idle classes hold.  It runs on another cpu, so it first locks
+// the headers it changes and then uses membarrier() to finish or
+// restart any sequence still using them.
+//
+// This needs x86-64 Linux with glibc 2.35 or later, which registers
+// rseq for every thread; elsewhere TCMALLOC_PERCPU_CACHE is ignored.
+
+#ifndef TCMALLOC_CPU_CACHE_H_
+#define TCMALLOC_CPU_CACHE_H_
+
+#include <config.h>
+#include <stddef.h>                     // for size_t, NULL
+#ifdef HAVE_STDINT_H
+#include <stdint.h>                     // for uint64_t
+#endif
+#include "base/atomicops.h"
+#include "base/basictypes.h"
+#include "base/spinlock.h"
+#include "common.h"                     // for kClassSizesMax
+
+#if defined(__x86_64__) && defined(__linux__) && \
+    defined(HAVE_SYS_RSEQ_H) && defined(HAVE_LINUX_MEMBARRIER_H)
+#define TCMALLOC_HAVE_PERCPU_RSEQ 1
+#include <sys/rseq.h>                   // for __rseq_offset, __rseq_size
+#endif
+
+namespace tcmalloc {
+
+class CpuCache {
+ public:
+  // Reads TCMALLOC_PERCPU_CACHE and TCMALLOC_PERCPU_CACHE_BYTES and
+  // sets up the per-cpu slabs.  Called once from
+  // ThreadCache::InitModule() after the static vars are initialized.
+  static void InitModule();
+
+  static bool IsEnabled() { return enabled_; }
+
+  // Allocate an object of the given size and class from the current
+  // cpu's slab, refilling it from the central cache if needed.
+  static void* Allocate(size_t size, uint32 cl,
+                        void *(*oom_handler)(size_t size)) {
+    void* result = Pop(cl);
+    if (PREDICT_TRUE(result != NULL)) return result;
+    return Refill(cl, size, oom_handler);
+  }
+
+  // Return an object of the given class to the current cpu's slab.
+  static void Deallocate(void* ptr, uint32 cl) {
+    if (PREDICT_TRUE(Push(cl, ptr))) return;
+    Overflow(ptr, cl);
+  }
+
+  // Adds to *total_bytes the number of bytes held in the per-cpu
+  // slabs.  If class_count is not NULL, it must be an array of size
+  // kNumClasses, and each element is incremented by the number of
+  // objects of that class held in the per-cpu slabs.  The counts are
+  // read while the slabs are in use, so they are only a snapshot.
+  static void GetStats(uint64_t* total_bytes, uint64_t* class_count);
+
+  // Returns half of the objects held by the classes whose lists did
+  // not run dry since the previous call to the central cache, along
+  // with their unused capacity, as ThreadCache::Scavenge() does with
+  // its lists' low-water marks.  Returns the number of bytes moved.
+  static size_t Scavenge();
+
+  // Used by the fork handlers to keep Scavenge() out of the slabs
+  // while the child is set up.
+  static void LockAll();
+  static void UnlockAll();
+
+ private:
+  // Slab headers: begin, current and end slab indices, 16 bits each.
+  static const int kCurrentShift = 0;
+  static const int kEndShift = 16;
+  static const int kBeginShift = 32;
+  // What Scavenge() stores in a header while it works on the class:
+  // pops find current <= begin and pushes find current >= end.
+  static const uint64 kLockedHeader = static_cast<uint64>(0xffff) << kBeginShift;
+
+  struct CpuState {
+    SpinLock lock;                // Protects end fields and budget
+    size_t budget;                // Bytes of capacity not handed out
+    // Set when a list runs dry; cleared by Scavenge().
+    volatile bool underflow[kClassSizesMax];
+  } CACHELINE_ALIGNED;
+
+  static uint16 Field(uint64 header, int shift) {
+    return static_cast<uint16>(header >> shift);
+  }
+  static uint64 MakeHeader(uint16 begin, uint16 current, uint16 end) {
+    return (static_cast<uint64>(begin) << kBeginShift) |
+        (static_cast<uint64>(end) << kEndShift) |
+        (static_cast<uint64>(current) << kCurrentShift);
+  }
+  static volatile base::subtle::Atomic64* Header(int cpu, uint32 cl) {
+    return reinterpret_cast<volatile base::subtle::Atomic64*>(
+        slabs_ + cpu * slab_stride_) + cl;
+  }
+  static void** Slots(int cpu) {
+    return reinterpret_cast<void**>(slabs_ + cpu * slab_stride_);
+  }
+  static void StoreEnd(int cpu, uint32 cl, uint16 end) {
+    reinterpret_cast<volatile uint16*>(Header(cpu, cl))[kEndShift / 16] = end;
+  }
+
+  static void* Pop(uint32 cl);
+  static bool Push(uint32 cl, void* ptr);
+  // Returns the cpu the thread was on a moment ago, or -1.
+  static int CurrentCpu();
+
+  static void* Refill(uint32 cl, size_t size,
+                      void *(*oom_handler)(size_t size));
+  static void Overflow(void* ptr, uint32 cl);
+  // Gives class cl on the current cpu room for up to n more objects,
+  // within the cpu's budget.  Returns false if it could not grow.
+  static bool Grow(uint32 cl, size_t size, int n);
+  // Waits until no restartable sequence that started before the call
+  // is still running on cpu.
+  static void Fence(int cpu);
+  static size_t ScavengeCpu(int cpu);
+
+  static bool    enabled_;
+  static int     num_cpus_;
+  static size_t  max_cpu_cache_size_;   // Per-cpu bound on cached bytes
+  static char*   slabs_;
+  static size_t  slab_stride_;
+  static CpuState* states_;
+  static uint16  begin_[kClassSizesMax];          // Same on every cpu
+  static uint16  max_capacity_[kClassSizesMax];
+};
+
+#ifdef TCMALLOC_HAVE_PERCPU_RSEQ
+
+// Offsets of cpu_id and rseq_cs in struct rseq.
+#define TCMALLOC_RSEQ_CPU_ID "4"
+#define TCMALLOC_RSEQ_CS "8"
+
+// The struct rseq_cs descriptor of a sequence that starts at label 1,
+// commits at the instruction before label 2 and aborts to label 4,
+// and the code that points the thread's struct rseq at it (label 0,
+// where an abort restarts).  The abort handler must follow the
+// signature glibc registered rseq with.
+#define TCMALLOC_RSEQ_PROLOGUE(scratch)                         \
+  ".pushsection __rseq_cs, \"aw\"\n"                            \
+  ".balign 32\n"                                                \
+  "3:\n"                                                        \
+  ".long 0x0, 0x0\n"                                            \
+  ".quad 1f, (2f - 1f), 4f\n"                                   \
+  ".popsection\n"                                               \
+  "0:\n"                                                        \
+  "leaq 3b(%%rip), " scratch "\n"                               \
+  "movq " scratch ", %%fs:" TCMALLOC_RSEQ_CS "(%[rseq])\n"      \
+  "1:\n"
+
+#define TCMALLOC_RSEQ_EPILOGUE                                  \
+  ".pushsection __rseq_failure, \"ax\"\n"                       \
+  ".byte 0x0f, 0xb9, 0x3d\n"                                    \
+  ".long 0x53053053\n"                                          \
+  "4:\n"                                                        \
+  "jmp 0b\n"                                                    \
+  ".popsection\n"
+
+inline void* CpuCache::Pop(uint32 cl) {
+  void* result;
+  uintptr_t slab, header, current;
+  asm volatile(
+      TCMALLOC_RSEQ_PROLOGUE("%[slab]")
+      "movl %%fs:" TCMALLOC_RSEQ_CPU_ID "(%[rseq]), %k[slab]\n"
+      "cmpl %[cpus], %k[slab]\n"
+      "jae 5f\n"
+      "imulq %[stride], %[slab]\n"
+      "addq %[slabs], %[slab]\n"
+      "movq (%[slab],%[cl],8), %[header]\n"
+      "movzwl %w[header], %k[current]\n"
+      "shrq $32, %[header]\n"
+      "movzwl %w[header], %k[header]\n"
+      "cmpq %[header], %[current]\n"
+      "jbe 5f\n"
+      "movq -8(%[slab],%[current],8), %[result]\n"
+      "decl %k[current]\n"
+      "movw %w[current], (%[slab],%[cl],8)\n"
+      "2:\n"
+      "jmp 6f\n"
+      "5:\n"
+      "xorl %k[result], %k[result]\n"
+      "6:\n"
+      TCMALLOC_RSEQ_EPILOGUE
+      : [result] "=&r"(result), [slab] "=&r"(slab),
+        [header] "=&r"(header), [current] "=&r"(current)
+      : [rseq] "r"(__rseq_offset), [cpus] "r"(num_cpus_),
+        [stride] "r"(slab_stride_), [slabs] "r"(slabs_),
+        [cl] "r"(static_cast<uintptr_t>(cl))
+      : "memory", "cc");
+  return result;
+}
+
+inline bool CpuCache::Push(uint32 cl, void* ptr) {
+  int pushed;
+  uintptr_t slab, header, current;
+  asm volatile(
+      TCMALLOC_RSEQ_PROLOGUE("%[slab]")
+      "movl %%fs:" TCMALLOC_RSEQ_CPU_ID "(%[rseq]), %k[slab]\n"
+      "cmpl %[cpus], %k[slab]\n"
+      "jae 5f\n"
+      "imulq %[stride], %[slab]\n"
+      "addq %[slabs], %[slab]\n"
+      "movq (%[slab],%[cl],8), %[header]\n"
+      "movzwl %w[header], %k[current]\n"
+      "shrq $16, %[header]\n"
+      "movzwl %w[header], %k[header]\n"
+      "cmpq %[header], %[current]\n"
+      "jae 5f\n"
+      "movq %[ptr], (%[slab],%[current],8)\n"
+      "incl %k[current]\n"
+      "movw %w[current], (%[slab],%[cl],8)\n"
+      "2:\n"
+      "movl $1, %[pushed]\n"
+      "jmp 6f\n"
+      "5:\n"
+      "xorl %[pushed], %[pushed]\n"
+      "6:\n"
+      TCMALLOC_RSEQ_EPILOGUE
+      : [pushed] "=&r"(pushed), [slab] "=&r"(slab),
+        [header] "=&r"(header), [current] "=&r"(current)
+      : [rseq] "r"(__rseq_offset), [cpus] "r"(num_cpus_),
+        [stride] "r"(slab_stride_), [slabs] "r"(slabs_),
+        [cl] "r"(static_cast<uintptr_t>(cl)), [ptr] "r"(ptr)
+      : "memory", "cc");
+  return pushed;
+}
+
+#else  // !TCMALLOC_HAVE_PERCPU_RSEQ
+
+// InitModule() never enables the cache, so these are never called.
+inline void* CpuCache::Pop(uint32 cl) { return NULL; }
+inline bool CpuCache::Push(uint32 cl, void* ptr) { return false; }
+
+#endif  // TCMALLOC_HAVE_PERCPU_RSEQ
+
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_CPU_CACHE_H_
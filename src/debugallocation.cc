@@ -545,6 +545,10 @@ class MallocBlock {
       b->magic1_ = use_malloc_page_fence ? kMagicMMap : kMagicMalloc;
       b->Initialize(size, type);
     }
+    // do_malloc() leaves heap limit work to its callers.  Do it here
+    // rather than in do_malloc(), which Initialize() calls with
+    // alloc_map_lock_ held.
+    HeapLimit::MaybeRelieve();
     return b;
   }
 
@@ -1252,6 +1256,43 @@ extern "C" PERFTOOLS_DLL_DECL void tc_free_sized(void *ptr, size_t size) PERFTOO
   force_frame();
 }
 
+// Batches go through the debug allocator one object at a time, so
+// every object gets its own header, fill and checks.
+extern "C" PERFTOOLS_DLL_DECL size_t tc_malloc_batch(size_t size, void** ptrs, size_t count) PERFTOOLS_NOTHROW {
+  size_t n = 0;
+  for (; n < count; n++) {
+    ptrs[n] = tc_malloc(size);
+    if (ptrs[n] == NULL) break;
+  }
+  return n;
+}
+
+extern "C" PERFTOOLS_DLL_DECL void tc_free_batch(void** ptrs, size_t count, size_t size) PERFTOOLS_NOTHROW {
+  for (size_t i = 0; i < count; i++) {
+    tc_free_sized(ptrs[i], size);
+  }
+}
+
+// There are no arenas under the debug allocator: tc_arena_create()
+// always fails, so arena objects come from the checked main heap and
+// have to be freed one by one.
+extern "C" PERFTOOLS_DLL_DECL int tc_arena_create(const char* name) PERFTOOLS_NOTHROW {
+  return 0;
+}
+
+extern "C" PERFTOOLS_DLL_DECL void tc_arena_destroy(int arena) PERFTOOLS_NOTHROW {
+}
+
+extern "C" PERFTOOLS_DLL_DECL void* tc_arena_malloc(int arena, size_t size) PERFTOOLS_NOTHROW {
+  return tc_malloc(size);
+}
+
+extern "C" PERFTOOLS_DLL_DECL void tc_arena_reset(int arena) PERFTOOLS_NOTHROW {
+}
+
+extern "C" PERFTOOLS_DLL_DECL void tc_arena_release(int arena) PERFTOOLS_NOTHROW {
+}
+
 extern "C" PERFTOOLS_DLL_DECL void* tc_calloc(size_t count, size_t size) PERFTOOLS_NOTHROW {
   if (ThreadCache::IsUseEmergencyMalloc()) {
     return tcmalloc::EmergencyCalloc(count, size);
@@ -209,6 +209,8 @@ class PERFTOOLS_DLL_DECL HeapLeakChecker {
 
   class Allocator;
   struct RangeValue;
+  class MarkWorkers;
+  struct MarkBuffer;
 
  private:
 
@@ -287,6 +289,16 @@ class PERFTOOLS_DLL_DECL HeapLeakChecker {
   // are being used.
   static void IgnoreLiveObjectsLocked(const char* name, const char* name2);
 
+  // Helper for IgnoreLiveObjectsLocked and MarkWorkers to look for heap
+  // pointers at [object, last] (positions at which a pointer may start)
+  // and mark the objects they point to as live, adding them to *found.
+  // Stops early when *found is full.  Returns the position to resume at,
+  // which is past last once the whole range is done.  Worker threads
+  // call this while the checking thread holds heap_checker_lock for them.
+  static const char* ScanForHeapPointersLocked(const char* object,
+                                               const char* last,
+                                               MarkBuffer* found);
+
   // Do the overall whole-program heap leak check if needed;
   // returns true when did the leak check.
   static bool DoMainHeapCheck();
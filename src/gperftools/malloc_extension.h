@@ -206,6 +206,11 @@ class PERFTOOLS_DLL_DECL MallocExtension {
   //      is swapped out by the OS, they also count towards physical
   //      memory usage. This property is not writable.
   //
+  // "tcmalloc.cpu_cache_free_bytes"
+  //      Number of free bytes in the per-cpu caches enabled by
+  //      TCMALLOC_PERCPU_CACHE; zero when they are disabled. This
+  //      property is not writable.
+  //
   // "tcmalloc.pageheap_free_bytes"
   //      Number of bytes in free, mapped pages in page heap.  These
   //      bytes can be used to fulfill allocation requests.  They
@@ -222,6 +227,100 @@ class PERFTOOLS_DLL_DECL MallocExtension {
   //        virtual memory usage, and depending on the OS, typically
   //        do not count towards physical memory usage.  This property
   //        is not writable.
+  //
+  // "tcmalloc.pageheap_shards"
+  //        Number of page heap shards small spans are allocated from.
+  //        Picked at startup from the online cpu count and NUMA
+  //        topology, or from TCMALLOC_PAGEHEAP_SHARDS.  This property
+  //        is not writable.
+  //
+  // "tcmalloc.pageheap_shard.<N>.free_bytes"
+  // "tcmalloc.pageheap_shard.<N>.unmapped_bytes"
+  // "tcmalloc.pageheap_shard.<N>.scavenge_count"
+  // "tcmalloc.pageheap_shard.<N>.total_decommit_bytes"
+  //        The same quantities as the tcmalloc.pageheap_* properties
+  //        above, restricted to the small spans held by page heap shard
+  //        N, for 0 <= N < tcmalloc.pageheap_shards.  These properties
+  //        are not writable.
+  //
+  // "tcmalloc.pageheap_shard.<N>.refill_count"
+  //        Number of times page heap shard N ran out of free spans and
+  //        refilled from the shared large-span heap.
+  //
+  // "tcmalloc.pageheap_shard.<N>.refill_bytes"
+  //        Size of shard N's next refill.  It grows while allocations
+  //        outrun frees and shrinks when free spans pile up.
+  //
+  // "tcmalloc.hugepages_full"
+  // "tcmalloc.hugepages_partial"
+  // "tcmalloc.hugepages_free"
+  //        Number of 2MiB huge pages spanned by the heap all of whose
+  //        pages, only some of whose pages, or none of whose pages are
+  //        in use.  Computed by walking the heap, so not cheap.  These
+  //        properties are not writable.
+  //
+  // "tcmalloc.lock.<lock>.acquisitions"
+  // "tcmalloc.lock.<lock>.contended"
+  // "tcmalloc.lock.<lock>.wait_ns"
+  //        Number of times one of the allocator's locks was acquired,
+  //        how many of those had to wait, and the total nanoseconds
+  //        waited.  <lock> is extended, span_allocator,
+  //        pageheap_shard.<N>, central.<C> or transfer.<C> (the span
+  //        and transfer cache locks of size class C).  Only known when
+  //        TCMALLOC_LOCK_PROFILE is set.  These properties are not
+  //        writable.
+  //
+  // "tcmalloc.latency.<tier>.count"
+  // "tcmalloc.latency.<tier>.total_ns"
+  // "tcmalloc.latency.<tier>.max_ns"
+  // "tcmalloc.latency.<tier>.bucket.<B>"
+  //        Latency histogram of one of the allocator's slow paths:
+  //        number of events, their total and largest duration in
+  //        nanoseconds, and the number that took [2^B, 2^(B+1)) ns,
+  //        for 0 <= B < 32.  <tier> is fast_path_miss (a thread or
+  //        per-cpu cache refilling from the central cache),
+  //        central_refill (a central free list getting a new span),
+  //        shard_refill (a page heap shard refilling from the shared
+  //        heap), extended_lock_wait (waiting for the shared heap's
+  //        lock) or system_alloc (growing the heap).  Only known when
+  //        tcmalloc is configured with --enable-alloc-latency-stats.
+  //        These properties are not writable.
+  //
+  // "tcmalloc.heap_limit_mb"
+  // "tcmalloc.soft_heap_limit_mb"
+  //        Hard and soft limits on the size of the heap in MiB, 0 if
+  //        none; TCMALLOC_HEAP_LIMIT_MB and TCMALLOC_SOFT_HEAP_LIMIT_MB
+  //        at startup.  Allocations that would take the heap past the
+  //        hard limit fail once free memory has been released.  Past
+  //        the soft limit, tcmalloc instead gives back the memory held
+  //        in its caches and free lists.  These properties are
+  //        writable; lowering a limit below the current heap size
+  //        releases memory right away.
+  //
+  // "tcmalloc.heap_limit_hits"
+  // "tcmalloc.soft_heap_limit_hits"
+  // "tcmalloc.soft_heap_limit_released_bytes"
+  //        Number of allocations turned down by the hard limit, number
+  //        of times growth past the soft limit made tcmalloc shrink its
+  //        caches, and bytes released to the system when it did.  These
+  //        properties are not writable.
+  //
+  // "tcmalloc.background.interval_ms"
+  // "tcmalloc.background.passes"
+  //        How often the background maintenance thread wakes up (0 if
+  //        it is not running; see TCMALLOC_BACKGROUND_INTERVAL_MS), and
+  //        how many times it has.
+  //
+  // "tcmalloc.background.released_bytes"
+  // "tcmalloc.background.limit_released_bytes"
+  // "tcmalloc.background.shard_trimmed_bytes"
+  // "tcmalloc.background.cpu_cache_trimmed_bytes"
+  //        Work done by the background thread: bytes released to the
+  //        system at the release rate, bytes released to stay below
+  //        the heap limit, bytes moved from idle page heap shards back
+  //        to the shared heap, and bytes moved from the per-cpu caches
+  //        back to the central cache.  These properties are not
+  //        writable.
   // -------------------------------------------------------------------
 
   // Get the named "property"'s value.  Returns true if the property
@@ -416,6 +515,62 @@ class PERFTOOLS_DLL_DECL MallocExtension {
   // have an empty cache but will not need to pay to reconstruct the
   // cache data structures.
   virtual void MarkThreadTemporarilyIdle();
+
+  // New virtual methods go below, at the end of the class, so that the
+  // vtable slots of the ones above keep their place and code built
+  // against an older version of this header keeps working.
+
+  // Outputs to "writer" a contention profile of the allocator's own
+  // locks: the stack traces that waited for them, with the number of
+  // waits and the total time waited.  The output can be passed to
+  // "pprof".  Only tcmalloc run with TCMALLOC_LOCK_PROFILE=<N> records
+  // this, sampling one in N waits; otherwise an explanation is
+  // written instead.  tcmalloc_minimal takes no stack traces, so its
+  // profile has no samples.
+  virtual void GetLockContentionProfile(MallocExtensionWriter* writer);
+
+  // Like ReadStackTraces(), but returns the stack traces of sampled
+  // lock waits, with the number of waits and the total nanoseconds
+  // waited in place of count and size.
+  virtual void** ReadLockContentionStackTraces(int* sample_period);
+
+  // Outputs to "writer" the numbers GetStats() describes as one JSON
+  // object, together with a breakdown of the free objects of each size
+  // class by cache, the size of each thread cache and the free spans
+  // of each page heap shard.  Fields may be added over time; "version"
+  // changes when one is removed or changes meaning.  The numbers are
+  // gathered one lock at a time, so they need not add up exactly.
+  // (Currently only implemented in tcmalloc; other implementations
+  // output "{}".)
+  virtual void GetStatsJSON(MallocExtensionWriter* writer);
+
+  // Called when the heap grows past its soft limit (hard is false), and
+  // again each time it grows another sixteenth of it, or when the hard
+  // limit makes an allocation fail (hard is true).  heap_bytes is the
+  // size the heap had, or would have had, and limit_bytes the limit it
+  // ran into.  See the "tcmalloc.heap_limit_mb" and
+  // "tcmalloc.soft_heap_limit_mb" properties.  Runs with no allocator
+  // lock held, after the allocator has given back what it can; it may
+  // allocate, but does not run again for allocations it makes itself.
+  typedef void (*HeapLimitCallback)(bool hard, size_t heap_bytes,
+                                    size_t limit_bytes);
+
+  // Installs callback, or removes it if NULL, and returns the previous
+  // one.  (Currently only implemented in tcmalloc; other
+  // implementations never call it and return NULL.)
+  virtual HeapLimitCallback SetHeapLimitCallback(HeapLimitCallback callback);
+
+  // Allocates "count" objects of "size" bytes each into ptrs[0..count)
+  // and returns how many were allocated, which is fewer than count
+  // only if memory ran out.  Equivalent to calling malloc(size) count
+  // times; tcmalloc hands small objects out a whole batch at a time.
+  // The objects may be freed one by one or with FreeBatch().
+  virtual size_t AllocateBatch(size_t size, void** ptrs, size_t count);
+
+  // Frees ptrs[0..count), which must all have been allocated with the
+  // given size.  NULL entries are ignored.  Equivalent to calling
+  // free() on each; tcmalloc returns them to its caches in one go.
+  virtual void FreeBatch(void** ptrs, size_t count, size_t size);
 };
 
 namespace base {
@@ -79,6 +79,8 @@ PERFTOOLS_DLL_DECL void MallocExtension_ReleaseToSystem(size_t num_bytes);
 PERFTOOLS_DLL_DECL void MallocExtension_ReleaseFreeMemory(void);
 PERFTOOLS_DLL_DECL size_t MallocExtension_GetEstimatedAllocatedSize(size_t size);
 PERFTOOLS_DLL_DECL size_t MallocExtension_GetAllocatedSize(const void* p);
+PERFTOOLS_DLL_DECL size_t MallocExtension_AllocateBatch(size_t size, void** ptrs, size_t count);
+PERFTOOLS_DLL_DECL void MallocExtension_FreeBatch(void** ptrs, size_t count, size_t size);
 PERFTOOLS_DLL_DECL size_t MallocExtension_GetThreadCacheSize(void);
 PERFTOOLS_DLL_DECL void MallocExtension_MarkThreadTemporarilyIdle(void);
 
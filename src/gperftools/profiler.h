@@ -139,6 +139,36 @@ PERFTOOLS_DLL_DECL void ProfilerStop(void);
  */
 PERFTOOLS_DLL_DECL void ProfilerFlush(void);
 
+/* If the profile is being written in chunks (CPUPROFILE_CHUNK_SECONDS
+ * is set), flush the buffered profiling state, finish the current
+ * chunk and start writing the next one.  Returns nonzero if the next
+ * chunk was started, or zero if the profiler is not running in that
+ * mode or the next chunk could not be created.
+ */
+PERFTOOLS_DLL_DECL int ProfilerRotate(void);
+
+/* Gives the calling thread a label (at most 31 characters are kept).
+ * Labels select threads for ProfilerIncludeThreads() and
+ * ProfilerExcludeThreads(), and name them in the thread tags written
+ * when CPUPROFILE_THREAD_TAGS is set.  Threads start with the empty
+ * label.  Async-signal-safe; may be called whether or not the
+ * profiler is running.
+ */
+PERFTOOLS_DLL_DECL void ProfilerSetThreadLabel(const char* label);
+
+/* Thread filters.  While any include filter is set, only threads
+ * whose label starts with one of the included prefixes are sampled;
+ * threads whose label starts with an excluded prefix never are.
+ * Samples from other threads are dropped before their stack is
+ * unwound, so profiling a few threads costs little more than not
+ * profiling at all.  Filters apply to all later samples, whether or
+ * not the profiler is running, and stay until cleared.  Returns
+ * nonzero on success, zero if too many filters are set (16).
+ */
+PERFTOOLS_DLL_DECL int ProfilerIncludeThreads(const char* label_prefix);
+PERFTOOLS_DLL_DECL int ProfilerExcludeThreads(const char* label_prefix);
+PERFTOOLS_DLL_DECL void ProfilerClearThreadFilters(void);
+
 
 /* DEPRECATED: these functions were used to enable/disable profiling
  * in the current thread, but no longer do anything.
@@ -91,6 +91,7 @@
 #include "maybe_threads.h"
 #include "memory_region_map.h"
 #include "base/spinlock.h"
+#include "base/spinlock_internal.h"
 #include "base/sysinfo.h"
 #include "base/stl_allocator.h"
 
@@ -208,6 +209,20 @@ DEFINE_int64(heap_check_max_pointer_offset,
              "pointers going inside of heap allocated objects. "
              "Set to -1 to use the actual largest heap object size.");
 
+DEFINE_int32(heap_check_mark_threads,
+             EnvToInt("HEAP_CHECK_MARK_THREADS", 0),
+             "Number of extra threads that look for live heap objects "
+             "during a leak check.  If positive, the other threads are "
+             "stopped only while their stacks and registers are copied, "
+             "and keep running while the check looks for live objects, "
+             "unless they allocate or free memory: the heap is scanned "
+             "in place, not from a snapshot, so a thread that allocates, "
+             "frees or maps memory waits until the whole scan is done.  "
+             "Only threads that leave the heap alone meanwhile gain.  "
+             "If the scan finds leaks, they are confirmed by a check with "
+             "all threads stopped before being reported.  If 0, all "
+             "threads are stopped for the whole check.");
+
 DEFINE_bool(heap_check_run_under_gdb,
             EnvToBool("HEAP_CHECK_RUN_UNDER_GDB", false),
             "If false, turns off heap-checking library when running under gdb "
@@ -989,6 +1004,20 @@ static enum {
   CALLBACK_COMPLETED,
 } thread_listing_status = CALLBACK_NOT_STARTED;
 
+// Threads helping to look for live objects, if --heap_check_mark_threads
+// is positive; else NULL.
+// (protected by our lock; set by MarkWorkers)
+static HeapLeakChecker::MarkWorkers* mark_workers = NULL;
+
+// Set when IgnoreLiveThreadsLocked left the thread stacks and registers
+// to be scanned after resuming the threads; live_objects then holds
+// copies of them in thread_data_copy.
+// (protected by our lock)
+static bool thread_data_copied = false;
+static char* thread_data_copy = NULL;
+
+static void CopyLiveObjectsLocked();
+
 // Ideally to avoid deadlocks this function should not result in any libc
 // or other function calls that might need to lock a mutex:
 // It is called when all threads of a process are stopped
@@ -1065,6 +1094,20 @@ static enum {
     failures += 1;
 #endif
   }
+  if (mark_workers != NULL) {
+    // Only copy the thread data while the threads are stopped:
+    // IgnoreAllLiveObjectsLocked does all of the liveness walking
+    // after they are resumed.
+    if (thread_registers.size()) {
+      live_objects->push_back(AllocObject(&thread_registers[0],
+                                          thread_registers.size() * sizeof(void*),
+                                          THREAD_REGISTERS));
+    }
+    CopyLiveObjectsLocked();
+    TCMalloc_ResumeAllProcessThreads(num_threads, thread_pids);
+    thread_listing_status = CALLBACK_COMPLETED;
+    return failures;
+  }
   // Use all the collected thread (stack) liveness sources:
   IgnoreLiveObjectsLocked("threads stack data", "");
   if (thread_registers.size()) {
@@ -1336,6 +1379,15 @@ void HeapLeakChecker::IgnoreAllLiveObjectsLocked(const void* self_stack_top) {
                      "objects reachable only from there "
                      "will be reported as leaks");
   }
+  if (thread_data_copied) {
+    // The threads were stopped only to copy their stacks and registers.
+    IgnoreLiveObjectsLocked("threads stack and register data", "");
+    Allocator::Free(thread_data_copy);
+    thread_data_copy = NULL;
+    thread_data_copied = false;
+    IgnoreNonThreadLiveObjectsLocked();
+    need_to_ignore_non_thread_objects = false;
+  }
   // Do all other live data ignoring here if we did not do it
   // within thread listing callback with all threads stopped.
   if (need_to_ignore_non_thread_objects) {
@@ -1362,6 +1414,333 @@ static size_t pointer_source_alignment = kPointerSourceAlignment;
 // to protect pointer_source_alignment.
 static SpinLock alignment_checker_lock(SpinLock::LINKER_INITIALIZED);
 
+// Copies the objects in live_objects into thread_data_copy and points
+// the entries at the copies, so that they can be scanned after their
+// threads are resumed.  The copies keep their offsets modulo
+// pointer_source_alignment.
+static void CopyLiveObjectsLocked() {
+  RAW_DCHECK(heap_checker_lock.IsHeld(), "");
+  const size_t alignment = pointer_source_alignment;
+  size_t total = alignment;
+  for (LiveObjectsStack::const_iterator i = live_objects->begin();
+       i != live_objects->end(); ++i) {
+    total += i->size + alignment;
+  }
+  thread_data_copy =
+    reinterpret_cast<char*>(HeapLeakChecker::Allocator::Allocate(total));
+  char* copy = thread_data_copy + alignment - AsInt(thread_data_copy) % alignment;
+  for (LiveObjectsStack::iterator i = live_objects->begin();
+       i != live_objects->end(); ++i) {
+    char* const to = copy + AsInt(i->ptr) % alignment;
+    memcpy(to, i->ptr, i->size);
+    i->ptr = to;
+    copy = to + i->size;
+    copy += alignment - AsInt(copy) % alignment;
+  }
+  thread_data_copied = true;
+}
+
+// Pops the next object off live_objects, marks it as live if it must be
+// on the heap, and sets *object and *size to the part of it that can
+// hold pointers.  Returns false if there is no such part.
+static bool PopLiveObjectLocked(const char* name2,
+                                const char** object, size_t* size,
+                                int64* live_object_count,
+                                int64* live_byte_count) {
+  *object = reinterpret_cast<const char*>(live_objects->back().ptr);
+  *size = live_objects->back().size;
+  const ObjectPlacement place = live_objects->back().place;
+  live_objects->pop_back();
+  if (place == MUST_BE_ON_HEAP  &&  heap_profile->MarkAsLive(*object)) {
+    *live_object_count += 1;
+    *live_byte_count += *size;
+  }
+  RAW_VLOG(13, "Looking for heap pointers in %p of %" PRIuS " bytes",
+              *object, *size);
+  // Try interpretting any byte sequence in object,size as a heap pointer:
+  const size_t remainder = AsInt(*object) % pointer_source_alignment;
+  if (remainder) {
+    *object += pointer_source_alignment - remainder;
+    if (*size >= pointer_source_alignment - remainder) {
+      *size -= pointer_source_alignment - remainder;
+    } else {
+      *size = 0;
+    }
+  }
+  if (*size < sizeof(void*)) return false;
+
+#ifdef NO_FRAME_POINTER
+  // Frame pointer omission requires us to use libunwind, which uses direct
+  // mmap and munmap system calls, and that needs special handling.
+  if (name2 == kUnnamedProcSelfMapEntry) {
+    static const uintptr_t page_mask = ~(getpagesize() - 1);
+    const uintptr_t addr = reinterpret_cast<uintptr_t>(*object);
+    if ((addr & page_mask) == 0 && (*size & page_mask) == 0) {
+      // This is an object we slurped from /proc/self/maps.
+      // It may or may not be readable at this point.
+      //
+      // In case all the above conditions made a mistake, and the object is
+      // not related to libunwind, we also verify that it's not readable
+      // before ignoring it.
+      if (msync(const_cast<char*>(*object), *size, MS_ASYNC) != 0) {
+        // Skip unreadable object, so we don't crash trying to sweep it.
+        RAW_VLOG(0, "Ignoring inaccessible object [%p, %p) "
+                 "(msync error %d (%s))",
+                 *object, *object + *size, errno, strerror(errno));
+        return false;
+      }
+    }
+  }
+#endif
+  return true;
+}
+
+// Number of newly found live objects a MarkBuffer can hold.
+static const int kMarkBufferSize = 4096;
+
+// Live heap objects found by one thread, to be added to live_objects
+// by the thread doing the leak check.
+struct HeapLeakChecker::MarkBuffer {
+  AllocObject* objects;  // kMarkBufferSize of them
+  int count;
+  int64 bytes;
+
+  void Init() {
+    objects = reinterpret_cast<AllocObject*>(
+        Allocator::Allocate(kMarkBufferSize * sizeof(*objects)));
+    count = 0;
+    bytes = 0;
+  }
+  void Free() {
+    Allocator::Free(objects);
+    objects = NULL;
+  }
+  bool full() const { return count == kMarkBufferSize; }
+  void Add(const void* ptr, size_t size) {
+    new(&objects[count++]) AllocObject(ptr, size, IGNORED_ON_HEAP);
+    bytes += size;
+  }
+  // Moves the objects to live_objects, so they are scanned in turn.
+  void FlushLocked(int64* live_object_count, int64* live_byte_count) {
+    for (int i = 0; i < count; ++i) {
+      live_objects->push_back(objects[i]);
+    }
+    *live_object_count += count;
+    *live_byte_count += bytes;
+    count = 0;
+    bytes = 0;
+  }
+};
+
+// Threads that help IgnoreLiveObjectsLocked look for heap pointers when
+// --heap_check_mark_threads is positive.  DoNoLeaks starts them before
+// taking heap_checker_lock, as starting a thread allocates, and stops
+// them when done.  They never allocate, and only work while the thread
+// doing the check waits for them in MarkLocked, holding heap_checker_lock
+// on their behalf.
+//
+// The heap is marked live, not from a snapshot: the objects are read in
+// place and looked up in the allocation table as they are found, so
+// neither may change under the scan.  The allocation hooks therefore
+// block on heap_checker_lock for as long as marking takes, and of the
+// threads resumed after their stacks were copied, only those that do
+// not allocate, free or mmap meanwhile keep running.  A snapshot would
+// let the others through too, but would need a copy of the heap.
+//
+// The work is handed out in rounds: MarkLocked splits what is in
+// live_objects into chunks of at most kChunkBytes, and all threads
+// (including the checking one) claim chunks until none is left or
+// their buffer of found objects is full.  The found objects are then
+// moved to live_objects, and the next round gets them along with the
+// unfinished chunks.
+class HeapLeakChecker::MarkWorkers {
+ public:
+  explicit MarkWorkers(int num_threads)
+    : num_threads_(0), active_(false), stop_(false), chunks_(NULL),
+      num_chunks_(0), next_chunk_(0), round_(0), done_(0) {
+    if (num_threads <= 0) return;
+#ifdef HAVE_PTHREAD
+    if (num_threads > kMaxThreads) num_threads = kMaxThreads;
+    for (int i = 0; i < num_threads; ++i) {
+      Thread* t = &threads_[num_threads_];
+      t->owner = this;
+      if (pthread_create(&t->id, NULL, Run, t) != 0) {
+        RAW_LOG(WARNING, "Could not start leak check marking thread: "
+                "errno=%d", errno);
+        break;
+      }
+      ++num_threads_;
+    }
+#endif
+    SpinLockHolder l(&heap_checker_lock);
+    mark_workers = this;
+    active_ = true;
+  }
+
+  ~MarkWorkers() {
+    if (!active_) return;
+    { SpinLockHolder l(&heap_checker_lock);
+      mark_workers = NULL;
+    }
+    stop_ = true;
+    StartRound();
+#ifdef HAVE_PTHREAD
+    for (int i = 0; i < num_threads_; ++i) {
+      pthread_join(threads_[i].id, NULL);
+    }
+#endif
+  }
+
+  // Does the work of IgnoreLiveObjectsLocked, using *found for the
+  // objects found by this thread.
+  void MarkLocked(const char* name2, MarkBuffer* found,
+                  int64* live_object_count, int64* live_byte_count) {
+    RAW_DCHECK(heap_checker_lock.IsHeld(), "");
+    chunks_ = reinterpret_cast<Chunk*>(
+        Allocator::Allocate(kMaxChunks * sizeof(*chunks_)));
+    for (int i = 0; i < num_threads_; ++i) {
+      threads_[i].found.Init();
+    }
+    // A multiple of the alignment, so that each chunk of an object
+    // starts at a position its predecessor would have scanned next.
+    const size_t step =
+      max(kChunkBytes / pointer_source_alignment, size_t(1)) *
+      pointer_source_alignment;
+    const char* next = NULL;  // rest of the object being split up
+    const char* last = NULL;
+    int num_chunks = 0;
+    while (true) {
+      while (num_chunks < kMaxChunks) {
+        if (next == NULL) {
+          if (live_objects->empty()) break;
+          size_t size;
+          if (!PopLiveObjectLocked(name2, &next, &size,
+                                   live_object_count, live_byte_count)) {
+            next = NULL;
+            continue;
+          }
+          last = next + size - sizeof(void*);
+        }
+        Chunk* chunk = &chunks_[num_chunks++];
+        chunk->first = next;
+        if (static_cast<size_t>(last - next) >= step) {
+          chunk->last = next + step - pointer_source_alignment;
+          next += step;
+        } else {
+          chunk->last = last;
+          next = NULL;
+        }
+      }
+      if (num_chunks == 0) break;
+
+      num_chunks_ = num_chunks;
+      base::subtle::NoBarrier_Store(&next_chunk_, 0);
+      base::subtle::NoBarrier_Store(&done_, 0);
+      StartRound();
+      ScanChunks(found);
+      int loop = 0;
+      Atomic32 done;
+      while ((done = base::subtle::Acquire_Load(&done_)) < num_threads_) {
+        base::internal::SpinLockDelay(&done_, done, ++loop);
+      }
+
+      found->FlushLocked(live_object_count, live_byte_count);
+      for (int i = 0; i < num_threads_; ++i) {
+        threads_[i].found.FlushLocked(live_object_count, live_byte_count);
+      }
+      // Keep the chunks that were not scanned to the end:
+      int kept = 0;
+      for (int i = 0; i < num_chunks; ++i) {
+        if (chunks_[i].first <= chunks_[i].last) chunks_[kept++] = chunks_[i];
+      }
+      num_chunks = kept;
+    }
+    for (int i = 0; i < num_threads_; ++i) {
+      threads_[i].found.Free();
+    }
+    Allocator::Free(chunks_);
+    chunks_ = NULL;
+  }
+
+ private:
+  static const int kMaxThreads = 64;
+  static const int kMaxChunks = 1024;
+  static const size_t kChunkBytes = 64 << 10;
+
+  // Positions in a live object at which pointers are yet to be looked for.
+  struct Chunk {
+    const char* first;
+    const char* last;
+  };
+
+  struct Thread {
+    MarkWorkers* owner;
+    MarkBuffer found;
+#ifdef HAVE_PTHREAD
+    pthread_t id;
+#endif
+  };
+
+  void StartRound() {
+    base::subtle::Release_Store(&round_, round_ + 1);
+    base::internal::SpinLockWake(&round_, true);
+  }
+
+  // Adds 1 to *counter and returns its old value.
+  static Atomic32 FetchAndIncrement(volatile Atomic32* counter) {
+    Atomic32 old = base::subtle::NoBarrier_Load(counter);
+    while (true) {
+      const Atomic32 prev =
+        base::subtle::Release_CompareAndSwap(counter, old, old + 1);
+      if (prev == old) return old;
+      old = prev;
+    }
+  }
+
+  // Claims chunks and scans them until there are no more or found is full.
+  void ScanChunks(MarkBuffer* found) {
+    while (!found->full()) {
+      const int i = FetchAndIncrement(&next_chunk_);
+      if (i >= num_chunks_) break;
+      chunks_[i].first =
+        ScanForHeapPointersLocked(chunks_[i].first, chunks_[i].last, found);
+    }
+  }
+
+  static void* Run(void* arg) {
+    Thread* const t = reinterpret_cast<Thread*>(arg);
+    MarkWorkers* const w = t->owner;
+    Atomic32 seen = 0;
+    int loop = 0;
+    while (true) {
+      const Atomic32 round = base::subtle::Acquire_Load(&w->round_);
+      if (round == seen) {
+        base::internal::SpinLockDelay(&w->round_, round, ++loop);
+        continue;
+      }
+      seen = round;
+      loop = 0;
+      if (w->stop_) return NULL;
+      w->ScanChunks(&t->found);
+      FetchAndIncrement(&w->done_);  // publishes t->found
+      base::internal::SpinLockWake(&w->done_, false);
+    }
+  }
+
+  Thread threads_[kMaxThreads];
+  int num_threads_;
+  bool active_;  // whether we set mark_workers
+  bool stop_;    // tells the threads to exit at the next round
+
+  // The chunks of the current round, claimed in order via next_chunk_.
+  Chunk* chunks_;
+  int num_chunks_;
+  volatile Atomic32 next_chunk_;
+
+  volatile Atomic32 round_;  // bumped to start a round
+  volatile Atomic32 done_;   // number of threads done with the round
+};
+
 // This function changes the live bits in the heap_profile-table's state:
 // we only record the live objects to be skipped.
 //
@@ -1394,116 +1773,88 @@ static SpinLock alignment_checker_lock(SpinLock::LINKER_INITIALIZED);
   RAW_DCHECK(heap_checker_lock.IsHeld(), "");
   int64 live_object_count = 0;
   int64 live_byte_count = 0;
-  while (!live_objects->empty()) {
-    const char* object =
-      reinterpret_cast<const char*>(live_objects->back().ptr);
-    size_t size = live_objects->back().size;
-    const ObjectPlacement place = live_objects->back().place;
-    live_objects->pop_back();
-    if (place == MUST_BE_ON_HEAP  &&  heap_profile->MarkAsLive(object)) {
-      live_object_count += 1;
-      live_byte_count += size;
-    }
-    RAW_VLOG(13, "Looking for heap pointers in %p of %" PRIuS " bytes",
-                object, size);
-    const char* const whole_object = object;
-    size_t const whole_size = size;
-    // Try interpretting any byte sequence in object,size as a heap pointer:
-    const size_t remainder = AsInt(object) % pointer_source_alignment;
-    if (remainder) {
-      object += pointer_source_alignment - remainder;
-      if (size >= pointer_source_alignment - remainder) {
-        size -= pointer_source_alignment - remainder;
-      } else {
-        size = 0;
-      }
-    }
-    if (size < sizeof(void*)) continue;
-
-#ifdef NO_FRAME_POINTER
-    // Frame pointer omission requires us to use libunwind, which uses direct
-    // mmap and munmap system calls, and that needs special handling.
-    if (name2 == kUnnamedProcSelfMapEntry) {
-      static const uintptr_t page_mask = ~(getpagesize() - 1);
-      const uintptr_t addr = reinterpret_cast<uintptr_t>(object);
-      if ((addr & page_mask) == 0 && (size & page_mask) == 0) {
-        // This is an object we slurped from /proc/self/maps.
-        // It may or may not be readable at this point.
-        //
-        // In case all the above conditions made a mistake, and the object is
-        // not related to libunwind, we also verify that it's not readable
-        // before ignoring it.
-        if (msync(const_cast<char*>(object), size, MS_ASYNC) != 0) {
-          // Skip unreadable object, so we don't crash trying to sweep it.
-          RAW_VLOG(0, "Ignoring inaccessible object [%p, %p) "
-                   "(msync error %d (%s))",
-                   object, object + size, errno, strerror(errno));
-          continue;
-        }
+  MarkBuffer found;
+  found.Init();
+  if (mark_workers != NULL) {
+    mark_workers->MarkLocked(name2, &found,
+                             &live_object_count, &live_byte_count);
+  } else {
+    while (!live_objects->empty()) {
+      const char* object;
+      size_t size;
+      if (!PopLiveObjectLocked(name2, &object, &size,
+                               &live_object_count, &live_byte_count)) {
+        continue;
       }
+      const char* const last = object + size - sizeof(void*);
+      do {
+        object = ScanForHeapPointersLocked(object, last, &found);
+        found.FlushLocked(&live_object_count, &live_byte_count);
+      } while (object <= last);
     }
-#endif
+  }
+  found.Free();
+  live_objects_total += live_object_count;
+  live_bytes_total += live_byte_count;
+  if (live_object_count) {
+    RAW_VLOG(10, "Removed %" PRId64 " live heap objects of %" PRId64 " bytes: %s%s",
+                live_object_count, live_byte_count, name, name2);
+  }
+}
 
-    const char* const max_object = object + size - sizeof(void*);
-    while (object <= max_object) {
-      // potentially unaligned load:
-      const uintptr_t addr = *reinterpret_cast<const uintptr_t*>(object);
-      // Do fast check before the more expensive HaveOnHeapLocked lookup:
-      // this code runs for all memory words that are potentially pointers:
-      const bool can_be_on_heap =
-        // Order tests by the likelyhood of the test failing in 64/32 bit modes.
-        // Yes, this matters: we either lose 5..6% speed in 32 bit mode
-        // (which is already slower) or by a factor of 1.5..1.91 in 64 bit mode.
-        // After the alignment test got dropped the above performance figures
-        // must have changed; might need to revisit this.
+// static
+const char* HeapLeakChecker::ScanForHeapPointersLocked(const char* object,
+                                                       const char* last,
+                                                       MarkBuffer* found) {
+  while (object <= last  &&  !found->full()) {
+    // potentially unaligned load:
+    const uintptr_t addr = *reinterpret_cast<const uintptr_t*>(object);
+    // Do fast check before the more expensive HaveOnHeapLocked lookup:
+    // this code runs for all memory words that are potentially pointers:
+    const bool can_be_on_heap =
+      // Order tests by the likelyhood of the test failing in 64/32 bit modes.
+      // Yes, this matters: we either lose 5..6% speed in 32 bit mode
+      // (which is already slower) or by a factor of 1.5..1.91 in 64 bit mode.
+      // After the alignment test got dropped the above performance figures
+      // must have changed; might need to revisit this.
 #if defined(__x86_64__)
-        addr <= max_heap_address  &&  // <= is for 0-sized object with max addr
-        min_heap_address <= addr;
+      addr <= max_heap_address  &&  // <= is for 0-sized object with max addr
+      min_heap_address <= addr;
 #else
-        min_heap_address <= addr  &&
-        addr <= max_heap_address;  // <= is for 0-sized object with max addr
+      min_heap_address <= addr  &&
+      addr <= max_heap_address;  // <= is for 0-sized object with max addr
 #endif
-      if (can_be_on_heap) {
-        const void* ptr = reinterpret_cast<const void*>(addr);
-        // Too expensive (inner loop): manually uncomment when debugging:
-        // RAW_VLOG(17, "Trying pointer to %p at %p", ptr, object);
-        size_t object_size;
-        if (HaveOnHeapLocked(&ptr, &object_size)  &&
-            heap_profile->MarkAsLive(ptr)) {
-          // We take the (hopefully low) risk here of encountering by accident
-          // a byte sequence in memory that matches an address of
-          // a heap object which is in fact leaked.
-          // I.e. in very rare and probably not repeatable/lasting cases
-          // we might miss some real heap memory leaks.
-          RAW_VLOG(14, "Found pointer to %p of %" PRIuS " bytes at %p "
-                      "inside %p of size %" PRIuS "",
-                      ptr, object_size, object, whole_object, whole_size);
-          if (VLOG_IS_ON(15)) {
-            // log call stacks to help debug how come something is not a leak
-            HeapProfileTable::AllocInfo alloc;
-            if (!heap_profile->FindAllocDetails(ptr, &alloc)) {
-              RAW_LOG(FATAL, "FindAllocDetails failed on ptr %p", ptr);
-            }
-            RAW_LOG(INFO, "New live %p object's alloc stack:", ptr);
-            for (int i = 0; i < alloc.stack_depth; ++i) {
-              RAW_LOG(INFO, "  @ %p", alloc.call_stack[i]);
-            }
+    if (can_be_on_heap) {
+      const void* ptr = reinterpret_cast<const void*>(addr);
+      // Too expensive (inner loop): manually uncomment when debugging:
+      // RAW_VLOG(17, "Trying pointer to %p at %p", ptr, object);
+      size_t object_size;
+      if (HaveOnHeapLocked(&ptr, &object_size)  &&
+          heap_profile->MarkAsLive(ptr)) {
+        // We take the (hopefully low) risk here of encountering by accident
+        // a byte sequence in memory that matches an address of
+        // a heap object which is in fact leaked.
+        // I.e. in very rare and probably not repeatable/lasting cases
+        // we might miss some real heap memory leaks.
+        RAW_VLOG(14, "Found pointer to %p of %" PRIuS " bytes at %p",
+                    ptr, object_size, object);
+        if (VLOG_IS_ON(15)) {
+          // log call stacks to help debug how come something is not a leak
+          HeapProfileTable::AllocInfo alloc;
+          if (!heap_profile->FindAllocDetails(ptr, &alloc)) {
+            RAW_LOG(FATAL, "FindAllocDetails failed on ptr %p", ptr);
+          }
+          RAW_LOG(INFO, "New live %p object's alloc stack:", ptr);
+          for (int i = 0; i < alloc.stack_depth; ++i) {
+            RAW_LOG(INFO, "  @ %p", alloc.call_stack[i]);
           }
-          live_object_count += 1;
-          live_byte_count += object_size;
-          live_objects->push_back(AllocObject(ptr, object_size,
-                                              IGNORED_ON_HEAP));
         }
+        found->Add(ptr, object_size);
       }
-      object += pointer_source_alignment;
     }
+    object += pointer_source_alignment;
   }
-  live_objects_total += live_object_count;
-  live_bytes_total += live_byte_count;
-  if (live_object_count) {
-    RAW_VLOG(10, "Removed %" PRId64 " live heap objects of %" PRId64 " bytes: %s%s",
-                live_object_count, live_byte_count, name, name2);
-  }
+  return object;
 }
 
 //----------------------------------------------------------------------
@@ -1714,6 +2065,8 @@ bool HeapLeakChecker::DoNoLeaks(ShouldSymbolize should_symbolize) {
   // The locking also helps us keep the messages
   // for the two checks close together.
   SpinLockHolder al(&alignment_checker_lock);
+  // Started here, since they can't be once heap_checker_lock is held.
+  MarkWorkers workers(FLAGS_heap_check_mark_threads);
 
   // thread-safe: protected by alignment_checker_lock
   static bool have_disabled_hooks_for_symbolize = false;
@@ -1768,6 +2121,20 @@ bool HeapLeakChecker::DoNoLeaks(ShouldSymbolize should_symbolize) {
     pointer_source_alignment = FLAGS_heap_check_pointer_source_alignment;
     IgnoreAllLiveObjectsLocked(&a_local_var);
     leaks = heap_profile->NonLiveSnapshot(base);
+    if (!leaks->Empty() && mark_workers != NULL) {
+      // The other threads ran while the mark threads looked for live
+      // objects, and a pointer they moved meanwhile can make a reachable
+      // object look leaked.  Only report what a pass with all threads
+      // stopped for its whole length still finds.
+      heap_profile->ReleaseSnapshot(leaks);
+      MarkWorkers* const workers = mark_workers;
+      mark_workers = NULL;
+      IgnoreAllLiveObjectsLocked(&a_local_var);
+      mark_workers = workers;
+      leaks = heap_profile->NonLiveSnapshot(base);
+      RAW_VLOG(10, "Leaks confirmed with all threads stopped: %d objects",
+               int(leaks->total().allocs - leaks->total().frees));
+    }
 
     inuse_bytes_increase_ = static_cast<ssize_t>(leaks->total().alloc_size);
     inuse_allocs_increase_ = static_cast<ssize_t>(leaks->total().allocs);
@@ -262,11 +262,7 @@ bool HeapProfileTable::FindInsideAlloc(const void* ptr,
 
 bool HeapProfileTable::MarkAsLive(const void* ptr) {
   AllocValue* alloc = address_map_->FindMutable(ptr);
-  if (alloc && !alloc->live()) {
-    alloc->set_live(true);
-    return true;
-  }
-  return false;
+  return alloc != NULL && alloc->try_set_live();
 }
 
 void HeapProfileTable::MarkAsIgnored(const void* ptr) {
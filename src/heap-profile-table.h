@@ -37,6 +37,7 @@
 #define BASE_HEAP_PROFILE_TABLE_H_
 
 #include "addressmap-inl.h"
+#include "base/atomicops.h"
 #include "base/basictypes.h"
 #include "base/logging.h"   // for RawFD
 #include "heap-profile-stats.h"
@@ -121,7 +122,9 @@ class HeapProfileTable {
 
   // If "ptr" points to a recorded allocation and it's not marked as live
   // mark it as live and return true. Else return false.
-  // All allocations start as non-live.
+  // All allocations start as non-live.  Several threads may mark at
+  // once, as long as the table is not otherwise changed meanwhile: only
+  // one of them gets true for any allocation.
   bool MarkAsLive(const void* ptr);
 
   // If "ptr" points to a recorded allocation, mark it as "ignored".
@@ -201,6 +204,20 @@ class HeapProfileTable {
     void set_live(bool l) {
       bucket_rep = (bucket_rep & ~uintptr_t(kLive)) | (l ? kLive : 0);
     }
+    // Sets the liveness flag atomically.  Returns false if it was
+    // already set.
+    bool try_set_live() {
+      volatile AtomicWord* rep =
+          reinterpret_cast<volatile AtomicWord*>(&bucket_rep);
+      AtomicWord old = base::subtle::NoBarrier_Load(rep);
+      while (!(old & kLive)) {
+        const AtomicWord prev =
+            base::subtle::NoBarrier_CompareAndSwap(rep, old, old | kLive);
+        if (prev == old) return true;
+        old = prev;
+      }
+      return false;
+    }
 
     // Should this allocation be ignored if it looks like a leak?
     bool ignore() const { return bucket_rep & kIgnore; }
@@ -71,6 +71,7 @@
 #include "base/low_level_alloc.h"
 #include "base/sysinfo.h"      // for GetUniquePathFromEnv()
 #include "heap-profile-table.h"
+#include "maybe_threads.h"
 #include "memory_region_map.h"
 
 
@@ -123,6 +124,11 @@ DEFINE_bool(only_mmap_profile,
             EnvToBool("HEAP_PROFILE_ONLY_MMAP", false),
             "If heap-profiling is on, only profile mmap, mremap, and sbrk; "
             "do not profile malloc/new/etc");
+DEFINE_bool(heap_profile_thread_buffers,
+            EnvToBool("HEAP_PROFILE_THREAD_BUFFERS", true),
+            "If true, record allocations and deallocations in per-thread "
+            "buffers that are merged into the profile in batches, instead "
+            "of taking the profiler's lock for every event.");
 
 
 //----------------------------------------------------------------------
@@ -178,6 +184,191 @@ static int64 last_dump_time = 0;      // The time of the last dump
 
 static HeapProfileTable* heap_profile = NULL;  // the heap profile table
 
+//----------------------------------------------------------------------
+// Per-thread event buffers
+//
+// Looking up the bucket for a stack and updating the address map for
+// every allocation is too much work to do while every other thread
+// waits on heap_lock.  Instead each thread appends its events to a
+// buffer of its own, under a lock that only a merge ever contends for,
+// and the buffered events are applied to heap_profile in one go when
+// a buffer fills up or someone needs an up to date profile.
+//
+// Events must be applied in the order they happened: an object freed
+// by one thread can be handed back to another by malloc before the
+// first thread's buffer is merged.  Every event therefore takes a
+// number from event_order, whose high bits count merges.  A merge
+// bumps that count and applies, sorted, exactly the events numbered
+// below the bump; since a thread numbers and appends an event under
+// its buffer's lock, all of them are in the buffers by the time the
+// merge has locked each one, and everything left behind is newer.
+//----------------------------------------------------------------------
+
+static const int kEventBufferSize = 128;
+static const int64 kMergeEpoch = static_cast<int64>(1) << 40;
+
+struct ProfileEvent {
+  int64       order;   // Position in the global event order
+  const void* ptr;
+  size_t      bytes;
+  int         depth;   // Depth of stack, or -1 for a deallocation
+  void*       stack[HeapProfileTable::kMaxStackDepth];
+};
+
+struct EventBuffer {
+  SpinLock      lock;      // Protects count and events
+  EventBuffer*  next;      // All buffers; protected by heap_lock
+  bool          in_use;    // Owned by a live thread; protected by heap_lock
+  int           count;     // Number of events buffered
+  int           drain;     // Events being applied by a merge
+  ProfileEvent  events[kEventBufferSize];
+};
+
+// Buffers are never freed, so a thread may keep using its buffer
+// across HeapProfilerStop()/HeapProfilerStart().  When a thread exits,
+// its buffer is handed to the next thread that needs one.
+static LowLevelAlloc::Arena* event_buffer_memory = NULL;
+static EventBuffer* event_buffers = NULL;
+static base::subtle::Atomic64 event_order = 0;
+
+// Set while dumping from a signal handler, which may have interrupted
+// a thread holding its buffer's lock; such dumps leave buffers alone.
+static bool in_signal_dump = false;
+
+// Set while a merge is applying events, so that dumps it triggers do
+// not start another one.
+static bool merging = false;
+
+static bool event_buffer_key_created = false;
+static pthread_key_t event_buffer_key;
+
+#ifdef HAVE_TLS
+static __thread EventBuffer* thread_event_buffer ATTR_INITIAL_EXEC;
+// Set while a thread registers its buffer, so that allocations made by
+// pthread_setspecific() are recorded without one.
+static __thread bool in_event_buffer_setup ATTR_INITIAL_EXEC;
+#endif
+
+static int64 NextEventOrder(int64 increment) {
+  return base::subtle::NoBarrier_AtomicIncrement(&event_order, increment);
+}
+
+static void MaybeDumpProfileLocked();  // defined below
+
+static bool EventBefore(const ProfileEvent* a, const ProfileEvent* b) {
+  return a->order < b->order;
+}
+
+// Apply all buffered events numbered before now to heap_profile.  The
+// dump thresholds are checked after every event, as if it had been
+// recorded directly, so dumps happen at the same points in the event
+// stream; they are only written later.
+static void MergeEventsLocked() {
+  RAW_DCHECK(heap_lock.IsHeld(), "");
+  if (event_buffers == NULL || merging) return;
+  const int64 limit = NextEventOrder(kMergeEpoch) & ~(kMergeEpoch - 1);
+
+  int total = 0;
+  for (EventBuffer* b = event_buffers; b != NULL; b = b->next) {
+    SpinLockHolder l(&b->lock);
+    int n = 0;
+    while (n < b->count && b->events[n].order < limit) n++;
+    b->drain = n;
+    total += n;
+  }
+  if (total == 0) return;
+
+  // Threads keep appending past b->drain while we work.
+  ProfileEvent** events = reinterpret_cast<ProfileEvent**>(
+      LowLevelAlloc::AllocWithArena(total * sizeof(*events),
+                                    event_buffer_memory));
+  int n = 0;
+  for (EventBuffer* b = event_buffers; b != NULL; b = b->next) {
+    for (int i = 0; i < b->drain; i++) {
+      events[n++] = &b->events[i];
+    }
+  }
+  sort(events, events + total, EventBefore);
+  if (is_on) {
+    merging = true;
+    for (int i = 0; i < total; i++) {
+      const ProfileEvent* e = events[i];
+      if (e->depth < 0) {
+        heap_profile->RecordFree(e->ptr);
+      } else {
+        heap_profile->RecordAlloc(e->ptr, e->bytes, e->depth, e->stack);
+      }
+      MaybeDumpProfileLocked();
+    }
+    merging = false;
+  }
+  LowLevelAlloc::Free(events);
+
+  for (EventBuffer* b = event_buffers; b != NULL; b = b->next) {
+    if (b->drain == 0) continue;
+    SpinLockHolder l(&b->lock);
+    b->count -= b->drain;
+    memmove(b->events, b->events + b->drain, b->count * sizeof(b->events[0]));
+    b->drain = 0;
+  }
+}
+
+// Throw away everything buffered; used when the profile goes away.
+static void DiscardEventsLocked() {
+  RAW_DCHECK(heap_lock.IsHeld(), "");
+  for (EventBuffer* b = event_buffers; b != NULL; b = b->next) {
+    SpinLockHolder l(&b->lock);
+    b->count = 0;
+  }
+}
+
+static void ReleaseEventBuffer(void* arg) {
+  EventBuffer* b = reinterpret_cast<EventBuffer*>(arg);
+#ifdef HAVE_TLS
+  thread_event_buffer = NULL;
+#endif
+  // Its events stay behind until the next merge.
+  SpinLockHolder l(&heap_lock);
+  b->in_use = false;
+}
+
+// Returns the calling thread's buffer, or NULL if events must be
+// recorded directly.
+static EventBuffer* GetEventBuffer() {
+#ifdef HAVE_TLS
+  EventBuffer* b = thread_event_buffer;
+  if (PREDICT_TRUE(b != NULL)) return b;
+  if (!FLAGS_heap_profile_thread_buffers || in_event_buffer_setup) {
+    return NULL;
+  }
+  in_event_buffer_setup = true;
+  {
+    SpinLockHolder l(&heap_lock);
+    if (is_on && event_buffer_key_created) {
+      for (b = event_buffers; b != NULL && b->in_use; b = b->next) { }
+      if (b == NULL) {
+        b = reinterpret_cast<EventBuffer*>(
+            LowLevelAlloc::AllocWithArena(sizeof(*b), event_buffer_memory));
+        new (&b->lock) SpinLock();
+        b->count = 0;
+        b->drain = 0;
+        b->next = event_buffers;
+        event_buffers = b;
+      }
+      b->in_use = true;
+    }
+  }
+  if (b != NULL) {
+    perftools_pthread_setspecific(event_buffer_key, b);
+    thread_event_buffer = b;
+  }
+  in_event_buffer_setup = false;
+  return b;
+#else
+  return NULL;
+#endif
+}
+
 //----------------------------------------------------------------------
 // Profile generation
 //----------------------------------------------------------------------
@@ -192,6 +383,7 @@ static char* DoGetHeapProfileLocked(char* buf, int buflen) {
   RAW_DCHECK(heap_lock.IsHeld(), "");
   int bytes_written = 0;
   if (is_on) {
+    if (!in_signal_dump) MergeEventsLocked();
     HeapProfileTable::Stats const stats = heap_profile->total();
     (void)stats;   // avoid an unused-variable warning in non-debug mode.
     bytes_written = heap_profile->FillOrderedProfile(buf, buflen - 1);
@@ -314,13 +506,42 @@ static void MaybeDumpProfileLocked() {
   }
 }
 
+// Add an event to the calling thread's buffer, merging all buffers
+// into the profile first if it is full.  Returns false if the event
+// has to be recorded directly.
+static bool BufferEvent(const void* ptr, size_t bytes, int depth,
+                        void* const* stack) {
+  EventBuffer* b = GetEventBuffer();
+  if (b == NULL) return false;
+  for (;;) {
+    {
+      SpinLockHolder l(&b->lock);
+      if (b->count < kEventBufferSize) {
+        ProfileEvent* e = &b->events[b->count];
+        e->order = NextEventOrder(1);
+        e->ptr = ptr;
+        e->bytes = bytes;
+        e->depth = depth;
+        if (depth > 0) memcpy(e->stack, stack, depth * sizeof(stack[0]));
+        b->count++;
+        return true;
+      }
+    }
+    SpinLockHolder l(&heap_lock);
+    if (!is_on) return true;
+    MergeEventsLocked();
+  }
+}
+
 // Record an allocation in the profile.
 static void RecordAlloc(const void* ptr, size_t bytes, int skip_count) {
   // Take the stack trace outside the critical section.
   void* stack[HeapProfileTable::kMaxStackDepth];
   int depth = HeapProfileTable::GetCallerStackTrace(skip_count + 1, stack);
+  if (BufferEvent(ptr, bytes, depth, stack)) return;
   SpinLockHolder l(&heap_lock);
   if (is_on) {
+    MergeEventsLocked();
     heap_profile->RecordAlloc(ptr, bytes, depth, stack);
     MaybeDumpProfileLocked();
   }
@@ -328,8 +549,10 @@ static void RecordAlloc(const void* ptr, size_t bytes, int skip_count) {
 
 // Record a deallocation in the profile.
 static void RecordFree(const void* ptr) {
+  if (BufferEvent(ptr, 0, -1, NULL)) return;
   SpinLockHolder l(&heap_lock);
   if (is_on) {
+    MergeEventsLocked();
     heap_profile->RecordFree(ptr);
     MaybeDumpProfileLocked();
   }
@@ -463,6 +686,14 @@ extern "C" void HeapProfilerStart(const char* prefix) {
   heap_profile = new(ProfilerMalloc(sizeof(HeapProfileTable)))
       HeapProfileTable(ProfilerMalloc, ProfilerFree, FLAGS_mmap_profile);
 
+  if (FLAGS_heap_profile_thread_buffers && event_buffer_memory == NULL) {
+    event_buffer_memory =
+      LowLevelAlloc::NewArena(0, LowLevelAlloc::DefaultArena());
+    event_buffer_key_created =
+      perftools_pthread_key_create(&event_buffer_key,
+                                   ReleaseEventBuffer) == 0;
+  }
+
   last_dump_alloc = 0;
   last_dump_free = 0;
   high_water_mark = 0;
@@ -509,6 +740,9 @@ extern "C" void HeapProfilerStop() {
     RAW_CHECK(MallocHook::RemoveMunmapHook(&MunmapHook), "");
   }
 
+  // Events buffered by now belong to the profile we are about to free.
+  DiscardEventsLocked();
+
   // free profile
   heap_profile->~HeapProfileTable();
   ProfilerFree(heap_profile);
@@ -547,7 +781,9 @@ static void HeapProfilerDumpSignal(int signal_number) {
     return;
   }
   if (is_on && !dumping) {
+    in_signal_dump = true;
     DumpProfileLocked("signal");
+    in_signal_dump = false;
   }
   heap_lock.Unlock();
 }
@@ -595,6 +831,10 @@ static void HeapProfilerInit() {
 struct HeapProfileEndWriter {
   ~HeapProfileEndWriter() {
     char buf[128];
+    {
+      SpinLockHolder l(&heap_lock);
+      if (is_on) MergeEventsLocked();
+    }
     if (heap_profile) {
       const HeapProfileTable::Stats& total = heap_profile->total();
       const int64 inuse_bytes = total.alloc_size - total.free_size;
@@ -0,0 +1,225 @@
+// -*- Mode: C++; c-basic-offset: 2; indent-tabs-mode: nil -*-
+// Copyright (c) 2026, gperftools Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <config.h>
+#include "heap_limit.h"
+#include <inttypes.h>                   // for PRIu64
+#include <string.h>                     // for strcmp
+#include "base/commandlineflags.h"      // for DECLARE_int64
+#include "base/spinlock.h"              // for SpinLock, SpinLockHolder
+#include "central_freelist.h"           // for CentralFreeListPadded
+#include "cpu_cache.h"                  // for CpuCache
+#include "internal_logging.h"           // for TCMalloc_Printer
+#include "page_heap.h"                  // for PageHeap
+#include "static_vars.h"                // for Static
+#include "thread_cache.h"               // for ThreadCache
+
+DECLARE_int64(tcmalloc_heap_limit_mb);
+DECLARE_int64(tcmalloc_soft_heap_limit_mb);
+
+namespace tcmalloc {
+
+// Past the soft limit, the caches are shrunk again each time the heap
+// grows by another 1/kSoftLimitSteps of it.
+static const int kSoftLimitSteps = 16;
+
+volatile bool HeapLimit::pending_ = false;
+volatile bool HeapLimit::shrink_pending_ = false;
+
+// Held while the work owed is done, so that only one thread does it,
+// and allocations made by the callback do not start it over.
+static SpinLock relieve_lock(SpinLock::LINKER_INITIALIZED);
+
+static HeapLimit::Callback volatile callback = NULL;
+
+// Protected by extended_lock().
+static Length next_soft_trigger;        // 0 means the soft limit itself
+static bool shrink_pending;             // Shrink() is owed
+static bool soft_pending;               // The soft limit callback is owed
+static Length soft_heap_pages;
+static Length soft_limit_pages;
+static bool hard_pending;
+static Length hard_heap_pages;
+static Length hard_limit_pages;
+static uint64_t soft_hits;
+static uint64_t hard_hits;
+
+// Written with relieve_lock held, but read without it, so that the
+// callback may look at the counters.
+static uint64_t released_pages;
+
+void HeapLimit::NoteHeapSize(Length heap_pages, Length limit_pages) {
+  if (heap_pages <= limit_pages) {
+    next_soft_trigger = 0;
+    return;
+  }
+  if (heap_pages <= next_soft_trigger) return;
+  next_soft_trigger = heap_pages + limit_pages / kSoftLimitSteps;
+  soft_hits++;
+  shrink_pending = true;
+  shrink_pending_ = true;
+  soft_pending = true;
+  soft_heap_pages = heap_pages;
+  soft_limit_pages = limit_pages;
+  pending_ = true;
+}
+
+void HeapLimit::NoteHardLimitHit(Length heap_pages, Length limit_pages) {
+  hard_hits++;
+  hard_pending = true;
+  hard_heap_pages = heap_pages;
+  hard_limit_pages = limit_pages;
+  pending_ = true;
+}
+
+void HeapLimit::Relieve(bool run_callback) {
+  if (!relieve_lock.TryLock()) return;
+  bool shrink, soft = false, hard = false;
+  Length soft_heap, soft_limit, hard_heap, hard_limit;
+  {
+    SpinLockHolder h(Static::extended_lock());
+    shrink = shrink_pending;
+    soft_heap = soft_heap_pages;
+    soft_limit = soft_limit_pages;
+    hard_heap = hard_heap_pages;
+    hard_limit = hard_limit_pages;
+    shrink_pending = false;
+    shrink_pending_ = false;
+    if (run_callback) {
+      soft = soft_pending;
+      hard = hard_pending;
+      soft_pending = hard_pending = false;
+    }
+    pending_ = soft_pending || hard_pending;
+  }
+  if (shrink) {
+    released_pages += Shrink(soft_limit);
+  }
+  Callback cb = callback;
+  if (cb != NULL) {
+    if (soft) cb(false, soft_heap << kPageShift, soft_limit << kPageShift);
+    if (hard) cb(true, hard_heap << kPageShift, hard_limit << kPageShift);
+  }
+  relieve_lock.Unlock();
+}
+
+Length HeapLimit::Shrink(Length soft_limit_pages) {
+  // Thread caches can only be trimmed by their own threads.
+  ThreadCache::RequestScavenge();
+  if (CpuCache::IsEnabled()) {
+    CpuCache::Scavenge();
+  }
+  for (int cl = 1; cl < Static::num_size_classes(); cl++) {
+    Static::central_cache()[cl].DrainTransferCache();
+  }
+  for (int i = 0; i < Static::get_pageheap_count(); i++) {
+    SpinLockHolder h(Static::pageheap_lock_by_number(i));
+    Static::pageheap(i)->ReturnFreeSpans(0);
+  }
+
+  SpinLockHolder h(Static::extended_lock());
+  const Length heap_pages = Static::pagemap()->HeapPages();
+  if (heap_pages <= soft_limit_pages) return 0;
+  return Static::extended_memory()->ReleaseAtLeastNPages(
+      heap_pages - soft_limit_pages);
+}
+
+HeapLimit::Callback HeapLimit::SetCallback(Callback cb) {
+  Callback previous = callback;
+  callback = cb;
+  return previous;
+}
+
+bool HeapLimit::GetProperty(const char* name, size_t* value) {
+  if (strcmp(name, "tcmalloc.heap_limit_mb") == 0) {
+    *value = FLAGS_tcmalloc_heap_limit_mb;
+    return true;
+  }
+  if (strcmp(name, "tcmalloc.soft_heap_limit_mb") == 0) {
+    *value = FLAGS_tcmalloc_soft_heap_limit_mb;
+    return true;
+  }
+  if (strcmp(name, "tcmalloc.heap_limit_hits") == 0) {
+    SpinLockHolder h(Static::extended_lock());
+    *value = hard_hits;
+    return true;
+  }
+  if (strcmp(name, "tcmalloc.soft_heap_limit_hits") == 0) {
+    SpinLockHolder h(Static::extended_lock());
+    *value = soft_hits;
+    return true;
+  }
+  if (strcmp(name, "tcmalloc.soft_heap_limit_released_bytes") == 0) {
+    *value = released_pages << kPageShift;
+    return true;
+  }
+  return false;
+}
+
+bool HeapLimit::SetProperty(const char* name, size_t value) {
+  if (strcmp(name, "tcmalloc.heap_limit_mb") == 0) {
+    SpinLockHolder h(Static::extended_lock());
+    FLAGS_tcmalloc_heap_limit_mb = value;
+    // Release what is needed to get under the new limit now.
+    Static::pagemap()->EnsureLimit(0, true);
+  } else if (strcmp(name, "tcmalloc.soft_heap_limit_mb") == 0) {
+    SpinLockHolder h(Static::extended_lock());
+    FLAGS_tcmalloc_soft_heap_limit_mb = value;
+    next_soft_trigger = 0;
+    // Start shrinking right away if the heap is past the new limit.
+    Static::pagemap()->EnsureLimit(0, false);
+  } else {
+    return false;
+  }
+  MaybeRelieve();
+  return true;
+}
+
+void HeapLimit::Print(TCMalloc_Printer* out) {
+  if (FLAGS_tcmalloc_heap_limit_mb == 0 &&
+      FLAGS_tcmalloc_soft_heap_limit_mb == 0) {
+    return;
+  }
+  uint64_t hard, soft;
+  {
+    SpinLockHolder h(Static::extended_lock());
+    hard = hard_hits;
+    soft = soft_hits;
+  }
+  out->printf("------------------------------------------------\n");
+  out->printf("Heap limit: %8" PRId64 " MiB; %12" PRIu64 " hits\n",
+              static_cast<int64_t>(FLAGS_tcmalloc_heap_limit_mb), hard);
+  out->printf("Soft limit: %8" PRId64 " MiB; %12" PRIu64 " hits;"
+              " %12" PRIu64 " bytes released\n",
+              static_cast<int64_t>(FLAGS_tcmalloc_soft_heap_limit_mb),
+              soft, released_pages << kPageShift);
+}
+
+}  // namespace tcmalloc
@@ -0,0 +1,120 @@
+// -*- Mode: C++; c-basic-offset: 2; indent-tabs-mode: nil -*-
+// Copyright (c) 2026, gperftools Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// ---
+//
+// Graduated back-pressure as the heap nears its limits.
+//
+// The hard limit, TCMALLOC_HEAP_LIMIT_MB, works as it always has:
+// PageMap::EnsureLimit() releases free pages to stay under it and
+// turns the allocation down if that is not enough.  The soft limit,
+// TCMALLOC_SOFT_HEAP_LIMIT_MB, never fails an allocation.  When the
+// heap grows past it, and again each time it grows another sixteenth
+// of it, the allocator gives back what it holds in its caches: the
+// per-cpu and thread caches, the central transfer caches and the page
+// heap shards' free lists go back to the shared heap, and the shared
+// heap's free pages are released until the heap is under the soft
+// limit again, or out of free pages.  This runs once no allocator lock
+// is held, on the allocating thread or the background thread.
+//
+// Both limits can be changed at runtime through the
+// "tcmalloc.heap_limit_mb" and "tcmalloc.soft_heap_limit_mb"
+// properties, and MallocExtension::SetHeapLimitCallback() installs a
+// function to be told when either limit is hit.
+
+#ifndef TCMALLOC_HEAP_LIMIT_H_
+#define TCMALLOC_HEAP_LIMIT_H_
+
+#include <config.h>
+#include <stddef.h>                     // for size_t
+#include <gperftools/malloc_extension.h>  // for MallocExtension
+#include "base/basictypes.h"
+#include "common.h"                     // for Length
+
+class TCMalloc_Printer;
+
+namespace tcmalloc {
+
+class HeapLimit {
+ public:
+  typedef MallocExtension::HeapLimitCallback Callback;
+
+  // Called by PageMap::EnsureLimit() with extended_lock() held.
+  // heap_pages is what the heap would hold after the allocation being
+  // checked.
+  static void NoteHeapSize(Length heap_pages, Length soft_limit_pages);
+  static void NoteHardLimitHit(Length heap_pages, Length limit_pages);
+
+  // Does the work owed by the calls above.  Cheap when there is none.
+  // Called from the public allocation entry points, never from
+  // do_malloc() and below, so that the callback may allocate.
+  // REQUIRES: no allocator lock is held.
+  static void MaybeRelieve() {
+    if (PREDICT_FALSE(pending_)) Relieve(true);
+  }
+
+  // Shrinks the caches if the soft limit asks for it, but leaves the
+  // callback to MaybeRelieve().  Called at the end of a front-end cache
+  // refill, off the cache hit path.  The debug allocator may hold a
+  // lock of its own there, which the callback could need.
+  // REQUIRES: no allocator lock is held.
+  static void MaybeShrink() {
+    if (PREDICT_FALSE(shrink_pending_)) Relieve(false);
+  }
+
+  // Returns the previous callback.
+  static Callback SetCallback(Callback callback);
+
+  // Handles "tcmalloc.heap_limit_mb" and "tcmalloc.soft_heap_limit_mb",
+  // which are writable, and the "tcmalloc.heap_limit_hits",
+  // "tcmalloc.soft_heap_limit_hits" and
+  // "tcmalloc.soft_heap_limit_released_bytes" counters.
+  // REQUIRES: no allocator lock is held.
+  static bool GetProperty(const char* name, size_t* value);
+  static bool SetProperty(const char* name, size_t value);
+
+  // Prints the limits and counters for MallocExtension::GetStats().
+  static void Print(TCMalloc_Printer* out);
+
+ private:
+  static void Relieve(bool run_callback);
+
+  // Gives back what the caches and free lists hold, then releases free
+  // pages until the heap is below soft_limit_pages.  Returns the number
+  // of pages released.
+  static Length Shrink(Length soft_limit_pages);
+
+  static volatile bool pending_;          // Any work is owed
+  static volatile bool shrink_pending_;   // Shrink() is owed
+};
+
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_HEAP_LIMIT_H_
@@ -0,0 +1,310 @@
+// -*- Mode: C++; c-basic-offset: 2; indent-tabs-mode: nil -*-
+// Copyright (c) 2026, gperftools Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <config.h>
+#include "lock_profile.h"
+#include <inttypes.h>                   // for PRIu64
+#include <stdlib.h>                     // for strtol
+#include <string.h>                     // for memset, memcmp, strcmp
+#include "base/spinlock.h"              // for SpinLock, SpinLockHolder
+#include "central_freelist.h"           // for CentralFreeListPadded
+#include "common.h"                     // for MetaDataAlloc, kMaxStackDepth
+#include "getenv_safe.h"                // for TCMallocGetenvSafe
+#include "internal_logging.h"           // for ASSERT, Log, TCMalloc_Printer
+#include "page_heap.h"                  // for GetStackTrace
+#include "static_vars.h"                // for Static
+
+namespace tcmalloc {
+
+// Both must be powers of two.  kMaxLocks is well above the number of
+// locks registered (at most 2 + kMaxPageHeapShards + 2 * kClassSizesMax).
+static const int kMaxLocks = 512;
+static const int kMaxLockStacks = 1024;
+static const int kMaxLockName = 32;
+
+struct LockEntry {
+  const SpinLock* lock;        // NULL if the slot is unused
+  char   name[kMaxLockName];
+  uint64 acquisitions;
+  uint64 contended;
+  uint64 wait_ns;
+};
+
+struct LockStack {
+  uintptr_t hash;              // 0 if the slot is unused
+  int       depth;
+  uint64    count;
+  uint64    wait_ns;
+  void*     stack[kMaxStackDepth];
+};
+
+bool LockProfile::enabled_ = false;
+
+static int sample_period = 0;
+
+// Open addressed by lock address, filled in before the hook is
+// installed and never changed afterwards, so lookups need no lock.
+static LockEntry* locks = NULL;
+// Registered slots in registration order, for printing.
+static int lock_order[kMaxLocks];
+static int num_locks = 0;
+
+// Open addressed by stack hash.  Guarded by stacks_lock, which is not
+// registered, so taking it from the hook does not recurse.
+static SpinLock stacks_lock(SpinLock::LINKER_INITIALIZED);
+static LockStack* stacks = NULL;
+static int num_stacks = 0;
+static uint64 dropped_stacks = 0;
+
+// Counts contended acquisitions of registered locks to pick which
+// ones to sample.  Updated without synchronization: a lost increment
+// only shifts which wait gets sampled.
+static unsigned int contended_seen = 0;
+
+static int LockSlot(const SpinLock* lock) {
+  const uintptr_t p = reinterpret_cast<uintptr_t>(lock);
+  return static_cast<int>(((p >> 3) * 2654435761u) >> 7) & (kMaxLocks - 1);
+}
+
+static LockEntry* FindLock(const SpinLock* lock) {
+  int i = LockSlot(lock);
+  for (int n = 0; n < kMaxLocks; n++, i = (i + 1) & (kMaxLocks - 1)) {
+    if (locks[i].lock == lock) return &locks[i];
+    if (locks[i].lock == NULL) return NULL;
+  }
+  return NULL;
+}
+
+// Formats "<name>" or "<name>.<index>" without going through
+// snprintf, which may allocate.
+static void FormatLockName(char* out, const char* name, int index) {
+  int len = 0;
+  while (name[len] != '\0' && len < kMaxLockName - 1) {
+    out[len] = name[len];
+    len++;
+  }
+  if (index >= 0 && len < kMaxLockName - 12) {
+    char digits[12];
+    int n = 0;
+    do {
+      digits[n++] = '0' + index % 10;
+      index /= 10;
+    } while (index > 0);
+    out[len++] = '.';
+    while (n > 0) out[len++] = digits[--n];
+  }
+  out[len] = '\0';
+}
+
+void LockProfile::Register(const SpinLock* lock, const char* name,
+                           int index) {
+  ASSERT(num_locks < kMaxLocks);
+  int i = LockSlot(lock);
+  while (locks[i].lock != NULL) {
+    if (locks[i].lock == lock) return;
+    i = (i + 1) & (kMaxLocks - 1);
+  }
+  locks[i].lock = lock;
+  FormatLockName(locks[i].name, name, index);
+  lock_order[num_locks++] = i;
+}
+
+void LockProfile::InitModule() {
+  const char* flag = TCMallocGetenvSafe("TCMALLOC_LOCK_PROFILE");
+  if (flag == NULL) return;
+  const long period = strtol(flag, NULL, 10);
+  if (period <= 0) return;
+
+  locks = reinterpret_cast<LockEntry*>(
+      MetaDataAlloc(sizeof(LockEntry) * kMaxLocks));
+  stacks = reinterpret_cast<LockStack*>(
+      MetaDataAlloc(sizeof(LockStack) * kMaxLockStacks));
+  if (locks == NULL || stacks == NULL) {
+    Log(kLog, __FILE__, __LINE__,
+        "TCMALLOC_LOCK_PROFILE ignored: out of memory for lock profile");
+    return;
+  }
+  memset(locks, 0, sizeof(LockEntry) * kMaxLocks);
+  memset(stacks, 0, sizeof(LockStack) * kMaxLockStacks);
+
+  Register(Static::extended_lock(), "extended", -1);
+  Register(Static::span_allocator_lock(), "span_allocator", -1);
+  for (int i = 0; i < Static::get_pageheap_count(); i++) {
+    Register(Static::pageheap_lock_by_number(i), "pageheap_shard", i);
+  }
+  for (int cl = 1; cl < Static::num_size_classes(); cl++) {
+    Register(Static::central_cache()[cl].span_lock(), "central", cl);
+    Register(Static::central_cache()[cl].transfer_cache_lock(),
+             "transfer", cl);
+  }
+
+  sample_period = static_cast<int>(period);
+  enabled_ = true;
+  SpinLock::SetProfileHook(Hook);
+}
+
+// Called with "lock" held, so the entry's counters are ours to update.
+void LockProfile::Hook(const SpinLock* lock, bool contended, int64 wait_ns) {
+  LockEntry* e = FindLock(lock);
+  if (e == NULL) return;
+  e->acquisitions++;
+  if (!contended) return;
+  e->contended++;
+  e->wait_ns += wait_ns;
+  if (++contended_seen % sample_period == 0) {
+    RecordStack(wait_ns);
+  }
+}
+
+void LockProfile::RecordStack(int64 wait_ns) {
+  void* stack[kMaxStackDepth];
+  // Skip this function, Hook() and SpinLock::SlowLock().
+  const int depth = GetStackTrace(stack, kMaxStackDepth, 3);
+  if (depth <= 0) return;
+  uintptr_t hash = depth;
+  for (int i = 0; i < depth; i++) {
+    hash = hash * 31 + reinterpret_cast<uintptr_t>(stack[i]);
+  }
+  if (hash == 0) hash = 1;
+
+  SpinLockHolder h(&stacks_lock);
+  int i = static_cast<int>(hash) & (kMaxLockStacks - 1);
+  for (int n = 0; n < kMaxLockStacks; n++, i = (i + 1) & (kMaxLockStacks - 1)) {
+    LockStack* s = &stacks[i];
+    if (s->hash == hash && s->depth == depth &&
+        memcmp(s->stack, stack, depth * sizeof(stack[0])) == 0) {
+      s->count++;
+      s->wait_ns += wait_ns;
+      return;
+    }
+    if (s->hash == 0) {
+      // Keep a quarter of the table free so that probes stay short.
+      if (num_stacks >= kMaxLockStacks - kMaxLockStacks / 4) break;
+      s->hash = hash;
+      s->depth = depth;
+      s->count = 1;
+      s->wait_ns = wait_ns;
+      memcpy(s->stack, stack, depth * sizeof(stack[0]));
+      num_stacks++;
+      return;
+    }
+  }
+  dropped_stacks++;
+}
+
+bool LockProfile::GetProperty(const char* name, size_t* value) {
+  static const char kPrefix[] = "tcmalloc.lock.";
+  if (!enabled_ || strncmp(name, kPrefix, sizeof(kPrefix) - 1) != 0) {
+    return false;
+  }
+  const char* lock_name = name + sizeof(kPrefix) - 1;
+  const char* stat = strrchr(lock_name, '.');
+  if (stat == NULL) return false;
+  const size_t len = stat - lock_name;
+  stat++;
+
+  for (int n = 0; n < num_locks; n++) {
+    const LockEntry& e = locks[lock_order[n]];
+    if (strlen(e.name) != len || strncmp(e.name, lock_name, len) != 0) {
+      continue;
+    }
+    if (strcmp(stat, "acquisitions") == 0) {
+      *value = e.acquisitions;
+    } else if (strcmp(stat, "contended") == 0) {
+      *value = e.contended;
+    } else if (strcmp(stat, "wait_ns") == 0) {
+      *value = e.wait_ns;
+    } else {
+      return false;
+    }
+    return true;
+  }
+  return false;
+}
+
+void LockProfile::Print(TCMalloc_Printer* out) {
+  if (!enabled_) return;
+
+  out->printf("------------------------------------------------\n");
+  out->printf("Lock contention (1 in %d contended waits sampled):\n",
+              sample_period);
+  for (int n = 0; n < num_locks; n++) {
+    const LockEntry& e = locks[lock_order[n]];
+    if (e.acquisitions == 0) continue;
+    out->printf("lock %-20s %12" PRIu64 " acquisitions %10" PRIu64
+                " contended (%5.2f%%) %14" PRIu64 " ns waited\n",
+                e.name, e.acquisitions, e.contended,
+                100.0 * e.contended / e.acquisitions, e.wait_ns);
+  }
+  if (dropped_stacks > 0) {
+    out->printf("lock profile: %" PRIu64 " sampled waits dropped,"
+                " stack table full\n", dropped_stacks);
+  }
+}
+
+void** LockProfile::ReadStackTraces(int* sample_period_out) {
+  if (!enabled_) return NULL;
+
+  // Size the result first: allocating it may take the very locks
+  // being profiled, and with them stacks_lock.
+  int needed_slots;
+  {
+    SpinLockHolder h(&stacks_lock);
+    needed_slots = 1;
+    for (int i = 0; i < kMaxLockStacks; i++) {
+      if (stacks[i].hash != 0) needed_slots += 3 + stacks[i].depth;
+    }
+    needed_slots += needed_slots / 8;  // Slop in case the table grows
+  }
+  void** result = new void*[needed_slots];
+
+  SpinLockHolder h(&stacks_lock);
+  int used_slots = 0;
+  for (int i = 0; i < kMaxLockStacks; i++) {
+    const LockStack& s = stacks[i];
+    if (s.hash == 0) continue;
+    if (used_slots + 3 + s.depth >= needed_slots) break;
+    result[used_slots+0] = reinterpret_cast<void*>(
+        static_cast<uintptr_t>(s.count));
+    result[used_slots+1] = reinterpret_cast<void*>(
+        static_cast<uintptr_t>(s.wait_ns));
+    result[used_slots+2] = reinterpret_cast<void*>(
+        static_cast<uintptr_t>(s.depth));
+    for (int d = 0; d < s.depth; d++) {
+      result[used_slots+3+d] = s.stack[d];
+    }
+    used_slots += 3 + s.depth;
+  }
+  result[used_slots] = reinterpret_cast<void*>(static_cast<uintptr_t>(0));
+  *sample_period_out = sample_period;
+  return result;
+}
+
+}  // namespace tcmalloc
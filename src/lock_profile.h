@@ -0,0 +1,89 @@
+// -*- Mode: C++; c-basic-offset: 2; indent-tabs-mode: nil -*-
+// Copyright (c) 2026, gperftools Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// ---
+//
+// Contention profiling for the allocator's own locks: the page heap
+// shard locks, extended_lock(), span_allocator_lock() and the span and
+// transfer cache locks of every central free list.
+//
+// Enabled by TCMALLOC_LOCK_PROFILE=<N>.  Every acquisition of one of
+// those locks then updates its counters (acquisitions, contended
+// acquisitions, nanoseconds spent waiting), and one in N contended
+// acquisitions records the stack trace of the waiter.  The counters
+// are only ever changed by the thread holding the lock they describe,
+// so they need no synchronization of their own.
+
+#ifndef TCMALLOC_LOCK_PROFILE_H_
+#define TCMALLOC_LOCK_PROFILE_H_
+
+#include <config.h>
+#include <stddef.h>                     // for size_t
+#include "base/basictypes.h"
+
+class SpinLock;
+class TCMalloc_Printer;
+
+namespace tcmalloc {
+
+class LockProfile {
+ public:
+  // Reads TCMALLOC_LOCK_PROFILE and, if set, registers the allocator's
+  // locks and installs the SpinLock profile hook.  Called once from
+  // ThreadCache::InitModule() after the static vars are initialized.
+  static void InitModule();
+
+  static bool IsEnabled() { return enabled_; }
+
+  // Handles the "tcmalloc.lock.<lock>.<stat>" properties, where <stat>
+  // is acquisitions, contended or wait_ns.
+  static bool GetProperty(const char* name, size_t* value);
+
+  // Prints the per-lock counters for MallocExtension::GetStats().
+  static void Print(TCMalloc_Printer* out);
+
+  // Returns the sampled waits in the format of
+  // MallocExtension::ReadStackTraces(), with the count and total wait
+  // in nanoseconds of each stack in place of object count and size.
+  // Sets *sample_period to N.  The caller must delete[] the result.
+  // Returns NULL if profiling is off.
+  static void** ReadStackTraces(int* sample_period);
+
+ private:
+  static void Register(const SpinLock* lock, const char* name, int index);
+  static void Hook(const SpinLock* lock, bool contended, int64 wait_ns);
+  static void RecordStack(int64 wait_ns);
+
+  static bool enabled_;
+};
+
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_LOCK_PROFILE_H_
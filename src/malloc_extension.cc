@@ -33,6 +33,7 @@
 
 #include <config.h>
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #if defined HAVE_STDINT_H
@@ -127,6 +128,10 @@ void MallocExtension::GetStats(char* buffer, int length) {
   buffer[0] = '\0';
 }
 
+void MallocExtension::GetStatsJSON(MallocExtensionWriter* writer) {
+  writer->append("{}\n", 3);
+}
+
 bool MallocExtension::MallocMemoryStats(int* blocks, size_t* total,
                                        int histogram[kMallocHistogramSize]) {
   *blocks = 0;
@@ -143,6 +148,10 @@ void** MallocExtension::ReadHeapGrowthStackTraces() {
   return NULL;
 }
 
+void** MallocExtension::ReadLockContentionStackTraces(int* sample_period) {
+  return NULL;
+}
+
 void MallocExtension::MarkThreadIdle() {
   // Default implementation does nothing
 }
@@ -175,10 +184,31 @@ double MallocExtension::GetMemoryReleaseRate() {
   return -1.0;
 }
 
+MallocExtension::HeapLimitCallback MallocExtension::SetHeapLimitCallback(
+    HeapLimitCallback callback) {
+  return NULL;
+}
+
 size_t MallocExtension::GetEstimatedAllocatedSize(size_t size) {
   return size;
 }
 
+size_t MallocExtension::AllocateBatch(size_t size, void** ptrs,
+                                      size_t count) {
+  size_t n = 0;
+  for (; n < count; n++) {
+    ptrs[n] = malloc(size);
+    if (ptrs[n] == NULL) break;
+  }
+  return n;
+}
+
+void MallocExtension::FreeBatch(void** ptrs, size_t count, size_t size) {
+  for (size_t i = 0; i < count; i++) {
+    free(ptrs[i]);
+  }
+}
+
 size_t MallocExtension::GetAllocatedSize(const void* p) {
   assert(GetOwnership(p) != kNotOwned);
   return 0;
@@ -345,6 +375,41 @@ void MallocExtension::GetHeapGrowthStacks(MallocExtensionWriter* writer) {
   DumpAddressMap(writer);
 }
 
+void MallocExtension::GetLockContentionProfile(MallocExtensionWriter* writer) {
+  int sample_period = 0;
+  void** entries = ReadLockContentionStackTraces(&sample_period);
+  if (entries == NULL) {
+    const char* const kErrorMsg =
+        "This malloc implementation does not support lock contention\n"
+        "profiling, or it is turned off.  With tcmalloc, set\n"
+        "TCMALLOC_LOCK_PROFILE to a sampling period such as 1 or 100.\n";
+    writer->append(kErrorMsg, strlen(kErrorMsg));
+    return;
+  }
+
+  // The times recorded are in nanoseconds; pprof expects cycles.
+  char buf[100];
+  snprintf(buf, sizeof(buf),
+           "--- contention\n"
+           "cycles/second = 1000000000\n"
+           "sampling period = %d\n", sample_period);
+  writer->append(buf, strlen(buf));
+  for (void** entry = entries; Count(entry) != 0; entry += 3 + Depth(entry)) {
+    snprintf(buf, sizeof(buf), "%" PRIu64 " %" PRIu64 " @",
+             static_cast<uint64>(Size(entry)),
+             static_cast<uint64>(Count(entry)));
+    writer->append(buf, strlen(buf));
+    for (int i = 0; i < Depth(entry); i++) {
+      snprintf(buf, sizeof(buf), " %p", PC(entry, i));
+      writer->append(buf, strlen(buf));
+    }
+    writer->append("\n", 1);
+  }
+  delete[] entries;
+
+  DumpAddressMap(writer);
+}
+
 void MallocExtension::Ranges(void* arg, RangeFunction func) {
   // No callbacks by default
 }
@@ -377,6 +442,10 @@ C_SHIM(ReleaseFreeMemory, void, (void), ());
 C_SHIM(ReleaseToSystem, void, (size_t num_bytes), (num_bytes));
 C_SHIM(GetEstimatedAllocatedSize, size_t, (size_t size), (size));
 C_SHIM(GetAllocatedSize, size_t, (const void* p), (p));
+C_SHIM(AllocateBatch, size_t,
+       (size_t size, void** ptrs, size_t count), (size, ptrs, count));
+C_SHIM(FreeBatch, void,
+       (void** ptrs, size_t count, size_t size), (ptrs, count, size));
 C_SHIM(GetThreadCacheSize, size_t, (void), ());
 C_SHIM(MarkThreadTemporarilyIdle, void, (void), ());
 
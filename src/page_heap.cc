@@ -38,16 +38,18 @@
 #include <errno.h>                      // for ENOMEM, errno
 #include <gperftools/malloc_extension.h>      // for MallocRange, etc
 #include "base/basictypes.h"
+#include "alloc_latency.h"    // for AllocLatency
+#include "background_thread.h"  // for BackgroundThread
+#include "heap_limit.h"        // for HeapLimit
 #include "base/commandlineflags.h"
 #include "internal_logging.h"  // for ASSERT, TCMalloc_Printer, etc
 #include "page_heap_allocator.h"  // for PageHeapAllocator
 #include "static_vars.h"       // for Static
 #include "system-alloc.h"      // for TCMalloc_SystemAlloc, etc
+#include <algorithm>
 #include <cmath>
 #include <fstream>
-#include <sys/syscall.h>
 #include <vector>
-#include <chrono>
 
 DEFINE_double(tcmalloc_release_rate,
 		EnvToDouble("TCMALLOC_RELEASE_RATE", 1.0),
@@ -65,9 +67,42 @@ DEFINE_int64(tcmalloc_heap_limit_mb,
 		"to the system more aggressively (more minor page faults). "
 		"Zero means to allocate as long as system allows.");
 
+DEFINE_int64(tcmalloc_soft_heap_limit_mb,
+		EnvToInt("TCMALLOC_SOFT_HEAP_LIMIT_MB", 0),
+		"Size of the process heap, in MiB, past which the allocator "
+		"starts giving back memory held in its caches and free lists, "
+		"and calls the heap limit callback if one is set.  Unlike "
+		"tcmalloc_heap_limit_mb, allocations never fail because of it. "
+		"Zero means no soft limit.");
+
 namespace tcmalloc {
 
-	PageHeap::PageHeap() {
+	// Number of our pages per huge page, or 1 if our pages are larger.
+	static const Length kPagesPerHugePage =
+		kHugePageSize > kPageSize ? kHugePageSize >> kPageShift : 1;
+
+	static Length RoundUpToHugePages(Length n) {
+		return (n + kPagesPerHugePage - 1) / kPagesPerHugePage * kPagesPerHugePage;
+	}
+
+	// True if the run is made of whole huge pages, the only memory
+	// TCMalloc_SystemRelease() gives back when huge pages are on.
+	static bool IsWholeHugePages(PageID start, Length n) {
+		return start % kPagesPerHugePage == 0 && n % kPagesPerHugePage == 0;
+	}
+
+	PageHeap::PageHeap(int shard)
+		: stats_slot_(PageMap::ShardStatsSlot(shard)),
+		normal_length_(0),
+		returned_length_(0),
+		refill_pages_(kDefaultRefillPages),
+		frees_since_refill_(0),
+		refill_count_(0),
+		scavenge_counter_(0),
+		scavenge_count_(0),
+		released_pages_(0),
+		trim_refill_count_(0),
+		trim_frees_(0) {
 		DLL_Init(&free_.normal);
 		DLL_Init(&free_.returned);
 	}
@@ -75,46 +110,23 @@ namespace tcmalloc {
 	Span* PageHeap::New(Length n) {
 		ASSERT(Check());
 		ASSERT(n > 0);
-		
-		pid_t thread_id = syscall(__NR_gettid); 
-
-//    Log(kLog, __FILE__, __LINE__,
-//        "pageheap new is called! ", thread_id
-//        );
-
-//		Span* head = &free_.normal;
-//		Span* temp = head;
-//		int length = 0;
-//		if(head != NULL){
-//						do{
-//										temp = temp->next;
-//										length++;
-//						} while( temp != head );
-//		}
-//
-//    Log(kLog, __FILE__, __LINE__,
-//        "length of free normal list is: ", length, " ", thread_id  
-//        );
 
 		if (n > 1){
+						const uint64 lock_start = AllocLatency::Now();
 						SpinLockHolder h(Static::extended_lock());
+						AllocLatency::Record(AllocLatency::kExtendedLockWait, lock_start);
 						Span* large_span = Static::extended_memory()->AllocLarge(n);
-						//Log(kLog, __FILE__, __LINE__, "lage span length: ", large_span->length, large_span->sizeclass);
-						large_span->location = Span::IN_USE;
+						if (large_span != NULL) {
+							large_span->location = Span::IN_USE;
+						}
 						return large_span;
 		}
 
-			//auto start = std::chrono::high_resolution_clock::now();
 		Span* ll = &free_.normal;
 		if (!DLL_IsEmpty(ll)) {
 			Span* span = ll->next;
 			ASSERT(span->location == Span::ON_NORMAL_FREELIST);
 			ASSERT(span->location != Span::IN_USE);
-			//auto stop = std::chrono::high_resolution_clock::now();
-			//auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(stop-start);
-		//	Log(kLog, __FILE__, __LINE__,
-		//									"inner allcation duration: ", duration.count()
-		//		 );
 			RemoveFromFreeList(span);
 			span->location = Span::IN_USE;
 			return span;
@@ -126,117 +138,90 @@ namespace tcmalloc {
 			Span* span = ll->next;
 			ASSERT(span->location != Span::IN_USE);
 			RemoveFromFreeList(span);
+			// We need to recommit this address space.
+			Static::pagemap()->CommitSpan(span, stats_slot_);
 			span->location = Span::IN_USE;
 			return span;
 		}
 
-//		int request_pages = std::pow(2, std::ceil(log2(n+1))+1); 
-//		Note on request pages value:
-//		while using 2mb hugepage size, request_pages size should be 12
-//		and for using 1gb hugepage size, request_pages size should be 
-		int request_pages = 12; 
-		Span* large_span = NULL;
-		Span* new_spans[request_pages];
+		// Refill from ExtendedMemory with a batch sized to recent demand.
+		// The Span objects for the pieces are allocated first, so that
+		// extended_lock() only covers carving the run itself.
+		const uint64 refill_start = AllocLatency::Now();
+		const Length request_pages = NextRefillPages();
+		Span* new_spans[kMaxRefillPages];
 		{
-			//			Log(kLog, __FILE__, __LINE__,
-			//											"thread ", thread_id, " wants to acquire extended lock." 
-			//				 );
-						SpinLockHolder h(Static::extended_lock());
-			//			Log(kLog, __FILE__, __LINE__,
-			//											"thread ", thread_id, " acquired extended lock." 
-			//				 );
-			//			Log(kLog, __FILE__, __LINE__,
-			//											"thread ", thread_id, " needs more memory, so requests 4 pages from extended memory unit." 
-			//				 );
-						large_span = Static::extended_memory()->AllocLarge(request_pages); 
-			//			Log(kLog, __FILE__, __LINE__,
-			//											"thread ", thread_id, " recieved 4 pages from extended memory unit." 
-			//				 );
-						for(int p=0; p<large_span->length-1; p++){
-								new_spans[p] = Static::span_allocator()->New();
-						}
-		}
-		if (large_span != NULL){
-			ASSERT(large_span->location != Span::IN_USE);
-			const int old_location = large_span->location;
-			large_span->location = Span::IN_USE;
-			Event(large_span, 'A', request_pages);
-
-			int large_span_items = large_span->length; 
-			for (int i=1; i<large_span_items; i++) {
-				Span* new_span = InitSpan(new_spans[i-1] ,large_span->start + i, 1);
-				new_span->location = old_location;
-				Event(new_span, 'S', 1);
-				Static::pagemap()->RecordSpan(new_span);
-
-#ifndef NDEBUG
-				const PageID p = new_span->start;
-				const Length len = new_span->length;
-				Span* next = Static::pagemap()->GetDescriptor(p+len);
-				ASSERT (next == NULL ||
-						next->location == Span::IN_USE ||
-						next->location != new_span->location);
-#endif
-
-				PrependToFreeList(new_span);  // Skip coalescing - no candidates possible
+			SpinLockHolder h(Static::span_allocator_lock());
+			for (Length p = 0; p < request_pages - 1; p++) {
+				new_spans[p] = Static::span_allocator()->New();
 			}
-			large_span->length = 1;
-			Static::pagemap()->SetPageMap(large_span->start, large_span);
-			large_span->location = old_location;
-			ASSERT(Check());
-			if (old_location == Span::ON_RETURNED_FREELIST) {
-				Static::pagemap()->CommitSpan(large_span);
+		}
+		Span* large_span;
+		{
+			const uint64 lock_start = AllocLatency::Now();
+			SpinLockHolder h(Static::extended_lock());
+			AllocLatency::Record(AllocLatency::kExtendedLockWait, lock_start);
+			large_span = Static::extended_memory()->AllocLarge(request_pages);
+		}
+		if (large_span == NULL) {
+			SpinLockHolder h(Static::span_allocator_lock());
+			for (Length p = 0; p < request_pages - 1; p++) {
+				Static::span_allocator()->Delete(new_spans[p]);
 			}
-			PrependToFreeList(large_span);
-//}
+			AllocLatency::Record(AllocLatency::kShardRefill, refill_start);
+			return NULL;
+		}
+
+		ASSERT(large_span->location != Span::IN_USE);
+		ASSERT(large_span->length == request_pages);
+		// CarveLarge() has already committed the whole span, so every
+		// piece goes on the normal list whatever set it came from.
+		const int old_location = Span::ON_NORMAL_FREELIST;
+		large_span->location = Span::IN_USE;
+		Event(large_span, 'A', request_pages);
+
+		for (Length i = 1; i < request_pages; i++) {
+			Span* new_span = InitSpan(new_spans[i-1], large_span->start + i, 1);
+			new_span->location = old_location;
+			Event(new_span, 'S', 1);
+			Static::pagemap()->RecordSpan(new_span);
+			PrependToFreeList(new_span);  // Skip coalescing - no candidates possible
 		}
+		large_span->length = 1;
+		Static::pagemap()->SetPageMap(large_span->start, large_span);
+		large_span->location = old_location;
+		ASSERT(Check());
+		PrependToFreeList(large_span);
+		AllocLatency::Record(AllocLatency::kShardRefill, refill_start);
 		return New(n);
 	}
 
 	void PageHeap::PrependToFreeList(Span* span) {
 		ASSERT(span->location != Span::IN_USE);
 		if (span->location == Span::ON_NORMAL_FREELIST)
-			Static::pagemap()->AddFreeBytes(span->length << kPageShift);
+			Static::pagemap()->AddFreeBytes(stats_slot_, span->length << kPageShift);
 		else
-			Static::pagemap()->AddUnmappedBytes(span->length << kPageShift);
-//		if(span->length != 1){
-//			int f = 0;
-//		}
+			Static::pagemap()->AddUnmappedBytes(stats_slot_, span->length << kPageShift);
 		SpanList* list = &free_;
 		if (span->location == Span::ON_NORMAL_FREELIST) {
 			DLL_Prepend(&list->normal, span);
+			normal_length_++;
 		} else {
 			DLL_Prepend(&list->returned, span);
+			returned_length_++;
 		}
-	/*	Span* head = &free_.normal;
-		Span* temp = head;
-		int length = 0;
-		if(head != NULL){
-				do{
-						temp = temp->next;
-						length++;
-				} while( temp != head );
-		}
-		if (length > 5)
-		{
-				int p = 9;
-		i}*/	
 	}
 
 	void PageHeap::RemoveFromFreeList(Span* span) {
 		ASSERT(span->location != Span::IN_USE);
 		if (span->location == Span::ON_NORMAL_FREELIST) {
-			Static::pagemap()->ReduceFreeBytes(span->length << kPageShift);
+			Static::pagemap()->ReduceFreeBytes(stats_slot_, span->length << kPageShift);
+			normal_length_--;
 		} else {
-			Static::pagemap()->ReduceUnmappedBytes(span->length << kPageShift);
+			Static::pagemap()->ReduceUnmappedBytes(stats_slot_, span->length << kPageShift);
+			returned_length_--;
 		}
-//		auto start = std::chrono::high_resolution_clock::now();
 		DLL_Remove(span);
-//		auto stop = std::chrono::high_resolution_clock::now();
-//		auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(stop-start);
-//		Log(kLog, __FILE__, __LINE__,
-//										"dll remove time: " ,duration.count()
-//			 );
 	}
 
 	void PageHeap::AppendSpantoPageHeap(Span* span) {
@@ -253,18 +238,153 @@ namespace tcmalloc {
 		if (span->length > 1)
 		{
 			SpinLockHolder h(Static::extended_lock());
-			Static::extended_memory()->PrependToFreeSet(span);
+			Static::extended_memory()->ReclaimSpan(span);  // Coalesces if possible
 		}
 		else
 		{
 			PrependToFreeList(span);
-			ASSERT(Static::pagemap()->GetUnmappedBytes() + Static::pagemap()->GetCommitedBytes() == Static::pagemap()->GetSystemBytes());
+			IncrementalScavenge(n);
+			frees_since_refill_ += n;
+			if (normal_length_ + returned_length_ > 2 * refill_pages_) {
+				// Demand has dropped below what we refill with: shrink the
+				// next batch and give back all but one (smaller) batch.
+				refill_pages_ = std::max<Length>(refill_pages_ / 2, kMinRefillPages);
+				ReturnFreeSpans(refill_pages_);
+			}
 			ASSERT(Check());
 		}
 	}
+
+	Length PageHeap::NextRefillPages() {
+		// If little of the previous batch came back before this shard ran
+		// dry again, allocations are outrunning frees: refill in bigger
+		// batches so that fewer trips to extended_lock() are needed.
+		if (frees_since_refill_ < refill_pages_ / 2) {
+			refill_pages_ = std::min<Length>(refill_pages_ * 2, kMaxRefillPages);
+		}
+		frees_since_refill_ = 0;
+		refill_count_++;
+		if (TCMalloc_HugePagesEnabled()) {
+			// Carve whole huge pages where we can, so that shards do not
+			// share them.
+			const Length rounded = RoundUpToHugePages(refill_pages_);
+			if (rounded <= kMaxRefillPages) return rounded;
+		}
+		return refill_pages_;
+	}
+
+	Length PageHeap::ReturnFreeSpans(Length keep) {
+		Length moved = 0;
+		if (normal_length_ + returned_length_ <= keep) return moved;
+
+		SpinLockHolder h(Static::extended_lock());
+		while (normal_length_ + returned_length_ > keep) {
+			// Decommitted spans are of no use to this shard's hot path, and
+			// among the normal ones the tail was freed longest ago.
+			Span* span = !DLL_IsEmpty(&free_.returned)
+				? free_.returned.prev : free_.normal.prev;
+			ASSERT(span->location != Span::IN_USE);
+			RemoveFromFreeList(span);
+			moved += span->length;
+			Event(span, 'B', span->length);
+			Static::extended_memory()->ReclaimSpan(span);
+		}
+		return moved;
+	}
+
+	Length PageHeap::ReleaseAtLeastNPages(Length num_pages) {
+		Length released_pages = 0;
+		if (TCMalloc_HugePagesEnabled() && kPagesPerHugePage > 1) {
+			// A shard span is one page, far less than a huge page, and
+			// releasing it alone would split the huge page it lies in.
+			// Hand the spans to ExtendedMemory instead, where they merge
+			// with their neighbours into whole huge pages it can release.
+			const Length held = normal_length_ + returned_length_;
+			const Length moved = ReturnFreeSpans(held > num_pages ? held - num_pages : 0);
+			if (moved == 0) return released_pages;
+			SpinLockHolder h(Static::extended_lock());
+			released_pages = Static::extended_memory()->ReleaseAtLeastNPages(moved);
+			released_pages_ += released_pages;
+			return released_pages;
+		}
+
+		// The tail of the normal list holds the spans that have been idle
+		// the longest, and New() never looks there while the head is busy.
+		while (released_pages < num_pages && !DLL_IsEmpty(&free_.normal)) {
+			Span* s = free_.normal.prev;
+			ASSERT(s->location == Span::ON_NORMAL_FREELIST);
+			// Some systems do not support release
+			if (!Static::pagemap()->DecommitSpan(s, stats_slot_)) break;
+			RemoveFromFreeList(s);
+			s->location = Span::ON_RETURNED_FREELIST;
+			PrependToFreeList(s);
+			released_pages += s->length;
+		}
+		released_pages_ += released_pages;
+		return released_pages;
+	}
+
+	void PageHeap::IncrementalScavenge(Length n) {
+		// Fast path; not yet time to release memory
+		scavenge_counter_ -= n;
+		if (scavenge_counter_ >= 0) return;  // Not yet time to scavenge
+		if (BackgroundThread::IsRunning()) return;  // It will get to us
+		Scavenge();
+	}
+
+	Length PageHeap::Scavenge() {
+		const double rate = FLAGS_tcmalloc_release_rate;
+		if (rate <= 1e-6) {
+			// Tiny release rate means that releasing is disabled.
+			scavenge_counter_ = kDefaultShardReleaseDelay;
+			return 0;
+		}
+
+		Static::pagemap()->AddScavengeCount(stats_slot_, 1);
+		scavenge_count_++;
+
+		Length released_pages = ReleaseAtLeastNPages(1);
+
+		if (released_pages == 0) {
+			// Nothing to scavenge, delay for a while.
+			scavenge_counter_ = kDefaultShardReleaseDelay;
+		} else {
+			// Same pacing as ExtendedMemory::Scavenge(), but
+			// bounded by what a shard can hold.
+			const double mult = 1000.0 / rate;
+			double wait = mult * static_cast<double>(released_pages);
+			if (wait > kMaxShardReleaseDelay) {
+				wait = kMaxShardReleaseDelay;
+			}
+			// Pages freed while the background thread was asleep are
+			// still owed a release, so it carries the (bounded) overshoot
+			// over to its next scavenge.
+			const int64_t owed = BackgroundThread::IsRunning()
+				? std::max<int64_t>(scavenge_counter_, -kMaxShardReleaseDelay) : 0;
+			scavenge_counter_ = owed + static_cast<int64_t>(wait);
+		}
+		return released_pages;
+	}
+
+	Length PageHeap::TrimIfIdle() {
+		const bool idle = refill_count_ == trim_refill_count_ &&
+			frees_since_refill_ == trim_frees_;
+		trim_refill_count_ = refill_count_;
+		trim_frees_ = frees_since_refill_;
+		if (!idle) return 0;
+		return ReturnFreeSpans(kMinRefillPages);
+	}
+
+	void PageHeap::GetShardStats(ShardStats* result) {
+		result->scavenge_count = scavenge_count_;
+		result->released_pages = released_pages_;
+		result->refill_count = refill_count_;
+		result->refill_pages = refill_pages_;
+	}
+
 	void PageHeap::GetSmallSpanStats(SmallSpanStats* result) {
-		result->normal_length = DLL_Length(&free_.normal);
-		result->returned_length = DLL_Length(&free_.returned);
+		result->normal_length = normal_length_;
+		result->returned_length = returned_length_;
 	}
 
 	bool PageHeap::Check() {
@@ -386,7 +506,6 @@ namespace tcmalloc {
 		   >>> for flowchart 18 goto implementation of GrowHeap method in this file.
 		 */
 		if (!GrowHeap(n)) {
-			ASSERT(Static::pagemap()->GetUnmappedBytes() + Static::pagemap()->GetCommitedBytes() == Static::pagemap()->GetSystemBytes());
 			ASSERT(Check());
 			// underlying SysAllocator likely set ENOMEM but we can get here
 			// due to EnsureLimit so we set it here too.
@@ -418,13 +537,15 @@ namespace tcmalloc {
 
 			// The previous span of |leftover| was just splitted -- no need to
 			// coalesce them. The next span of |leftover| was not previously coalesced
-			// with |span|, i.e. is NULL or has got location other than |old_location|.
+			// with |span|, i.e. is NULL, belongs to a shard, or has got location
+			// other than |old_location|.
 #ifndef NDEBUG
 			const PageID p = leftover->start;
 			const Length len = leftover->length;
 			Span* next = Static::pagemap()->GetDescriptor(p+len);
 			ASSERT (next == NULL ||
 					next->location == Span::IN_USE ||
+					!next->has_span_iter ||
 					next->location != leftover->location);
 #endif
 
@@ -436,21 +557,106 @@ namespace tcmalloc {
 		ASSERT(Check());
 		if (old_location == Span::ON_RETURNED_FREELIST) {
 			// We need to recommit this address space.
-			Static::pagemap()->CommitSpan(span);
+			Static::pagemap()->CommitSpan(span, PageMap::kExtendedStatsSlot);
 		}
 		ASSERT(span->location != Span::IN_USE);
 		ASSERT(span->length == n);
-		ASSERT(Static::pagemap()->GetUnmappedBytes() + Static::pagemap()->GetCommitedBytes() == Static::pagemap()->GetSystemBytes());
 		return span;
 	}
 
 
+	// First page at or after span->start that is a multiple of align.
+	static inline PageID AlignedStart(const Span* span, Length align) {
+		return (span->start + align - 1) & ~static_cast<PageID>(align - 1);
+	}
+
+	// Only spans shorter than n + align - 1 pages can fail to fit, so the
+	// search stops soon after reaching those that are that long.
+	Span* PageHeap::ExtendedMemory::FindAligned(SpanSet* set, Length n, Length align) {
+		Span bound;
+		bound.start = 0;
+		bound.length = n;
+		for (SpanSet::iterator it = set->upper_bound(SpanPtrWithLength(&bound));
+				it != set->end(); ++it) {
+			Span* span = it->span;
+			if (AlignedStart(span, align) + n <= span->start + span->length) {
+				return span;
+			}
+		}
+		return NULL;
+	}
+
+	Span* PageHeap::ExtendedMemory::AllocAligned(Length n, Length align) {
+		ASSERT(n > 0);
+		ASSERT((align & (align - 1)) == 0);
+		if (align <= 1) {
+			return AllocLarge(n);
+		}
+
+		// Same choice between the NORMAL and RETURNED sets as AllocLarge.
+		Span* best_normal = FindAligned(&large_normal_, n, align);
+		Span* best = best_normal;
+		Span* c = FindAligned(&large_returned_, n, align);
+		if (c != NULL) {
+			ASSERT(c->location == Span::ON_RETURNED_FREELIST);
+			if (best_normal == NULL
+					|| c->length < best->length
+					|| (c->length == best->length && c->start < best->start))
+				best = c;
+		}
+
+		if (best == best_normal && best != NULL) {
+			return CarveAligned(best, AlignedStart(best, align), n);
+		}
+
+		// best comes from RETURNED set.
+		if (Static::pagemap()->EnsureLimit(n, false) && best != NULL) {
+			return CarveAligned(best, AlignedStart(best, align), n);
+		}
+
+		if (Static::pagemap()->EnsureLimit(n, true) && best != NULL) {
+			// Releasing may have coalesced best away; retry.
+			return AllocAligned(n, align);
+		}
+
+		ASSERT(best_normal == NULL);
+		// Grow by an aligned run, which the retry is sure to find.
+		if (!GrowHeap(n, align << kPageShift)) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		return AllocAligned(n, align);
+	}
+
+	Span* PageHeap::ExtendedMemory::CarveAligned(Span* span, PageID start, Length n) {
+		ASSERT(span->location != Span::IN_USE);
+		ASSERT(span->start <= start);
+		ASSERT(start + n <= span->start + span->length);
+		const Length skip = start - span->start;
+		if (skip > 0) {
+			// Leave the leading pages free as a span of their own.  They
+			// were part of one free span, so there is nothing to coalesce
+			// them with.
+			RemoveFromFreeSet(span);
+			Span* prefix = NewSpan(span->start, skip);
+			prefix->location = span->location;
+			Event(prefix, 'S', skip);
+			Static::pagemap()->RecordSpan(prefix);
+			PrependToFreeSet(prefix);
+			span->start = start;
+			span->length -= skip;
+			Static::pagemap()->SetPageMap(span->start, span);
+			PrependToFreeSet(span);
+		}
+		return CarveLarge(span, n);
+	}
+
 	void PageHeap::ExtendedMemory::RemoveFromFreeSet(Span* span) {
 		ASSERT(span->location != Span::IN_USE);
 		if (span->location == Span::ON_NORMAL_FREELIST) {
-			Static::pagemap()->ReduceFreeBytes(span->length << kPageShift);
+			Static::pagemap()->ReduceFreeBytes(PageMap::kExtendedStatsSlot, span->length << kPageShift);
 		} else {
-			Static::pagemap()->ReduceUnmappedBytes(span->length << kPageShift);
+			Static::pagemap()->ReduceUnmappedBytes(PageMap::kExtendedStatsSlot, span->length << kPageShift);
 		}
 		SpanSet *set = &large_normal_;
 		if (span->location == Span::ON_RETURNED_FREELIST)
@@ -464,9 +670,9 @@ namespace tcmalloc {
 	void PageHeap::ExtendedMemory::PrependToFreeSet(Span* span) {
 		ASSERT(span->location != Span::IN_USE);
 		if (span->location == Span::ON_NORMAL_FREELIST)
-			Static::pagemap()->AddFreeBytes(span->length << kPageShift);
+			Static::pagemap()->AddFreeBytes(PageMap::kExtendedStatsSlot, span->length << kPageShift);
 		else
-			Static::pagemap()->AddUnmappedBytes(span->length << kPageShift);
+			Static::pagemap()->AddUnmappedBytes(PageMap::kExtendedStatsSlot, span->length << kPageShift);
 
 		SpanSet *set = &large_normal_;
 		if (span->location == Span::ON_RETURNED_FREELIST)
@@ -478,6 +684,18 @@ namespace tcmalloc {
 		return;
 	}
 
+	void PageHeap::ExtendedMemory::ReclaimSpan(Span* span) {
+		ASSERT(span->location != Span::IN_USE);
+		ASSERT(span->next == NULL && span->prev == NULL);
+		ASSERT(!span->has_span_iter);
+		const Length n = span->length;
+		const bool normal = (span->location == Span::ON_NORMAL_FREELIST);
+		MergeIntoFreeSet(span);  // Coalesces if possible
+		if (normal) {
+			IncrementalScavenge(n);
+		}
+	}
+
 	bool PageHeap::ExtendedMemory::Check() {
 		return true;
 	}
@@ -488,9 +706,15 @@ namespace tcmalloc {
 		while (released_pages < num_pages && Static::pagemap()->GetFreeBytes() > 0) {
 			Span *s;
 			if (large_normal_.empty()) {
-				return 0;
+				return released_pages;
+			}
+			// With huge pages only whole huge pages are released.
+			if (TCMalloc_HugePagesEnabled()) {
+				s = FindHugePageSpan();
+				if (s == NULL) return released_pages;
+			} else {
+				s = (large_normal_.begin())->span;
 			}
-			s = (large_normal_.begin())->span;
 
 			Length released_len = ReleaseSpan(s);
 			// Some systems do not support release
@@ -503,7 +727,14 @@ namespace tcmalloc {
 	Length PageHeap::ExtendedMemory::ReleaseSpan(Span* s) {
 		ASSERT(s->location == Span::ON_NORMAL_FREELIST);
 
-		if (Static::pagemap()->DecommitSpan(s)) {
+		const bool carve = TCMalloc_HugePagesEnabled() &&
+			!IsWholeHugePages(s->start, s->length);
+		if (carve) {
+			s = CarveHugePages(s);
+			if (s == NULL) return 0;
+		}
+
+		if (Static::pagemap()->DecommitSpan(s, PageMap::kExtendedStatsSlot)) {
 			RemoveFromFreeSet(s);
 			const Length n = s->length;
 			s->location = Span::ON_RETURNED_FREELIST;
@@ -511,9 +742,57 @@ namespace tcmalloc {
 			return n;
 		}
 
+		if (carve) {
+			// Put back together what was split off above.
+			RemoveFromFreeSet(s);
+			MergeIntoFreeSet(s);
+		}
 		return 0;
 	}
 
+	Span* PageHeap::ExtendedMemory::FindHugePageSpan() {
+		for (SpanSet::reverse_iterator it = large_normal_.rbegin();
+				it != large_normal_.rend() && it->length >= kPagesPerHugePage; ++it) {
+			const PageID start = RoundUpToHugePages(it->span->start);
+			if (start + kPagesPerHugePage <= it->span->start + it->length) {
+				return it->span;
+			}
+		}
+		return NULL;
+	}
+
+	Span* PageHeap::ExtendedMemory::CarveHugePages(Span* span) {
+		ASSERT(span->location == Span::ON_NORMAL_FREELIST);
+		const PageID end = span->start + span->length;
+		const PageID lo = RoundUpToHugePages(span->start);
+		const PageID hi = end / kPagesPerHugePage * kPagesPerHugePage;
+		if (lo >= hi) return NULL;
+
+		// The pieces were part of one free span, so there is nothing to
+		// coalesce them with.
+		RemoveFromFreeSet(span);
+		if (lo > span->start) {
+			Span* prefix = NewSpan(span->start, lo - span->start);
+			prefix->location = span->location;
+			Event(prefix, 'S', prefix->length);
+			Static::pagemap()->RecordSpan(prefix);
+			PrependToFreeSet(prefix);
+			span->start = lo;
+			Static::pagemap()->SetPageMap(span->start, span);
+		}
+		if (hi < end) {
+			Span* suffix = NewSpan(hi, end - hi);
+			suffix->location = span->location;
+			Event(suffix, 'S', suffix->length);
+			Static::pagemap()->RecordSpan(suffix);
+			PrependToFreeSet(suffix);
+			Static::pagemap()->SetPageMap(hi - 1, span);
+		}
+		span->length = hi - lo;
+		PrependToFreeSet(span);
+		return span;
+	}
+
 	void PageHeap::ExtendedMemory::MergeIntoFreeSet(Span* span) {
 		ASSERT(span->location != Span::IN_USE);
 
@@ -538,7 +817,7 @@ namespace tcmalloc {
 		const Length n = span->length;
 
 		if (aggressive_decommit_ && span->location == Span::ON_NORMAL_FREELIST) {
-			if (Static::pagemap()->DecommitSpan(span)) {
+			if (Static::pagemap()->DecommitSpan(span, PageMap::kExtendedStatsSlot)) {
 				span->location = Span::ON_RETURNED_FREELIST;
 			}
 		}
@@ -584,7 +863,7 @@ namespace tcmalloc {
 		// then we try to decommit adjacent span.
 		if (aggressive_decommit_ && other->location == Span::ON_NORMAL_FREELIST
 				&& span->location == Span::ON_RETURNED_FREELIST) {
-			bool worked = Static::pagemap()->DecommitSpan(other);
+			bool worked = Static::pagemap()->DecommitSpan(other, PageMap::kExtendedStatsSlot);
 			if (!worked) {
 				return NULL;
 			}
@@ -603,41 +882,50 @@ namespace tcmalloc {
 		Static::set_growth_stacks(t);
 	}
 
-	bool PageHeap::ExtendedMemory::GrowHeap(Length n) {
+	bool PageHeap::ExtendedMemory::GrowHeap(Length n, size_t alignment) {
 		if (n > kMaxValidPages) return false;
 		Length ask = (n>kMinSystemAlloc) ? n : static_cast<Length>(kMinSystemAlloc);
+		if (TCMalloc_HugePagesEnabled()) {
+			// Grow in whole, aligned huge pages, so that no huge page is
+			// shared with anything else and each can be released as a unit.
+			n = RoundUpToHugePages(n);
+			ask = RoundUpToHugePages(ask);
+			alignment = std::max(alignment, std::max(kPageSize, kHugePageSize));
+		}
 		size_t actual_size;
 		void* ptr = NULL;
+		const uint64 system_start = AllocLatency::Now();
 		if (Static::pagemap()->EnsureLimit(ask)) {
 			/*
 			   >>> flowchart 18. grow heap by  requesting  m size of bytes that is multiple 
 			   >>> size of n pages. for more info about allocating by system calls goto
 			   >>> implementation of TCMalloc_SystemAlloc in system_alloc.cc file.
 			 */
-			ptr = TCMalloc_SystemAlloc(ask << kPageShift, &actual_size, kPageSize);
+			ptr = TCMalloc_SystemAlloc(ask << kPageShift, &actual_size, alignment);
 		}
 		if (ptr == NULL) {
 			if (n < ask) {
 				// Try growing just "n" pages
 				ask = n;
 				if (Static::pagemap()->EnsureLimit(ask)) {
-					ptr = TCMalloc_SystemAlloc(ask << kPageShift, &actual_size, kPageSize);
+					ptr = TCMalloc_SystemAlloc(ask << kPageShift, &actual_size, alignment);
 				}
 			}
-			if (ptr == NULL) return false;
 		}
+		AllocLatency::Record(AllocLatency::kSystemAlloc, system_start);
+		if (ptr == NULL) return false;
 		ask = actual_size >> kPageShift;
 		RecordGrowth(ask << kPageShift);
 
-		Static::pagemap()->AddReserveCount(1);
-		Static::pagemap()->AddCommitCount(1);
+		Static::pagemap()->AddReserveCount(PageMap::kExtendedStatsSlot, 1);
+		Static::pagemap()->AddCommitCount(PageMap::kExtendedStatsSlot, 1);
 
 		uint64_t old_system_bytes = Static::pagemap()->GetSystemBytes();
-		Static::pagemap()->AddSystemBytes(ask << kPageShift);
-		Static::pagemap()->AddCommitedBytes(ask << kPageShift);
+		Static::pagemap()->AddSystemBytes(PageMap::kExtendedStatsSlot, ask << kPageShift);
+		Static::pagemap()->AddCommitedBytes(PageMap::kExtendedStatsSlot, ask << kPageShift);
 
-		Static::pagemap()->AddTotalCommitBytes(ask << kPageShift);
-		Static::pagemap()->AddTotalReserveBytes(ask << kPageShift);
+		Static::pagemap()->AddTotalCommitBytes(PageMap::kExtendedStatsSlot, ask << kPageShift);
+		Static::pagemap()->AddTotalReserveBytes(PageMap::kExtendedStatsSlot, ask << kPageShift);
 
 		const PageID p = reinterpret_cast<uintptr_t>(ptr) >> kPageShift;
 		ASSERT(p > 0);
@@ -666,7 +954,6 @@ namespace tcmalloc {
 			Span* span = NewSpan(p, ask);
 			Static::pagemap()->RecordSpan(span);
 			Delete(span);
-			ASSERT(Static::pagemap()->GetUnmappedBytes() + Static::pagemap()->GetCommitedBytes() == Static::pagemap()->GetSystemBytes());
 			ASSERT(Check());
 			return true;
 		} else {
@@ -689,7 +976,6 @@ namespace tcmalloc {
 		Event(span, 'D', span->length);
 		MergeIntoFreeSet(span);  // Coalesces if possible
 		IncrementalScavenge(n);
-		ASSERT(Static::pagemap()->GetUnmappedBytes() + Static::pagemap()->GetCommitedBytes() == Static::pagemap()->GetSystemBytes());
 		ASSERT(Check());
 	}
 
@@ -711,19 +997,72 @@ namespace tcmalloc {
 		return leftover;
 	}
 
+	bool PageHeap::ExtendedMemory::ResizeInPlace(Span* span, Length n) {
+		ASSERT(n > 0);
+		ASSERT(span->location == Span::IN_USE);
+		ASSERT(span->sizeclass == 0);
+		if (n == span->length) {
+			return true;
+		}
+		if (n < span->length) {
+			Delete(Split(span, n));
+			return true;
+		}
+
+		// Only spans in our free set can be taken: 1-page spans on a page
+		// heap shard's free list belong to that shard.
+		const PageID end = span->start + span->length;
+		const Length extra = n - span->length;
+		Span* next = Static::pagemap()->GetDescriptor(end);
+		if (next == NULL || !next->has_span_iter || next->length < extra) {
+			return false;
+		}
+		ASSERT(next->start == end);
+		ASSERT(next->location != Span::IN_USE);
+		const bool returned = (next->location == Span::ON_RETURNED_FREELIST);
+		if (returned && !Static::pagemap()->EnsureLimit(extra, false)) {
+			return false;
+		}
+
+		RemoveFromFreeSet(next);
+		if (next->length > extra) {
+			next->start += extra;
+			next->length -= extra;
+			Static::pagemap()->SetPageMap(next->start, next);
+			PrependToFreeSet(next);  // Its neighbours were already coalesced
+		} else {
+			DeleteSpan(next);
+		}
+		Event(span, 'G', extra);
+		span->length = n;
+		Static::pagemap()->SetPageMap(span->start + n - 1, span);
+		if (returned) {
+			// We need to recommit the pages taken.
+			Span taken;
+			taken.start = end;
+			taken.length = extra;
+			Static::pagemap()->CommitSpan(&taken, PageMap::kExtendedStatsSlot);
+		}
+		return true;
+	}
+
 	void PageHeap::ExtendedMemory::IncrementalScavenge(Length n) {
 		// Fast path; not yet time to release memory
 		scavenge_counter_ -= n;
 		if (scavenge_counter_ >= 0) return;  // Not yet time to scavenge
+		if (BackgroundThread::IsRunning()) return;  // It will get to us
+		Scavenge();
+	}
 
+	Length PageHeap::ExtendedMemory::Scavenge() {
 		const double rate = FLAGS_tcmalloc_release_rate;
 		if (rate <= 1e-6) {
 			// Tiny release rate means that releasing is disabled.
 			scavenge_counter_ = kDefaultReleaseDelay;
-			return;
+			return 0;
 		}
 
-		Static::pagemap()->AddScavengeCount(1);
+		Static::pagemap()->AddScavengeCount(PageMap::kExtendedStatsSlot, 1);
 
 		Length released_pages = ReleaseAtLeastNPages(1);
 
@@ -740,8 +1079,12 @@ namespace tcmalloc {
 				// Avoid overflow and bound to reasonable range.
 				wait = kMaxReleaseDelay;
 			}
-			scavenge_counter_ = static_cast<int64_t>(wait);
+			// As in PageHeap::Scavenge().
+			const int64_t owed = BackgroundThread::IsRunning()
+				? std::max<int64_t>(scavenge_counter_, -kMaxReleaseDelay) : 0;
+			scavenge_counter_ = owed + static_cast<int64_t>(wait);
 		}
+		return released_pages;
 	}
 
 	bool PageHeap::ExtendedMemory::CheckSet() {
@@ -778,22 +1121,40 @@ namespace tcmalloc {
 
 	PageHeap::PageMap::PageMap()
 		: pagemap_(MetaDataAlloc){
+			for (int i = 0; i < kMaxStatsSlots; i++) {
+				for (int c = 0; c < kNumStatsCounters; c++) {
+					base::subtle::NoBarrier_Store(&stats_[i].counters[c], 0);
+				}
+			}
 		}
 
-	void PageHeap::PageMap::CommitSpan(Span* span) {
-		++stats_.commit_count;
+	PageHeap::PageMap::Stats PageHeap::PageMap::stats() const {
+		Stats result;
+		result.system_bytes = Sum(kSystemBytes);
+		result.free_bytes = Sum(kFreeBytes);
+		result.unmapped_bytes = Sum(kUnmappedBytes);
+		result.committed_bytes = Sum(kCommittedBytes);
+		result.scavenge_count = Sum(kScavengeCount);
+		result.commit_count = Sum(kCommitCount);
+		result.total_commit_bytes = Sum(kTotalCommitBytes);
+		result.decommit_count = Sum(kDecommitCount);
+		result.total_decommit_bytes = Sum(kTotalDecommitBytes);
+		result.reserve_count = Sum(kReserveCount);
+		result.total_reserve_bytes = Sum(kTotalReserveBytes);
+		return result;
+	}
+
+	void PageHeap::PageMap::CommitSpan(Span* span, int slot) {
+		Add(slot, kCommitCount, 1);
 
 		TCMalloc_SystemCommit(reinterpret_cast<void*>(span->start << kPageShift),
 				static_cast<size_t>(span->length << kPageShift));
-		stats_.committed_bytes += span->length << kPageShift;
-		stats_.total_commit_bytes += (span->length << kPageShift);
+		Add(slot, kCommittedBytes, span->length << kPageShift);
+		Add(slot, kTotalCommitBytes, span->length << kPageShift);
 	}
 
-	bool PageHeap::PageMap::EnsureLimit(Length n, bool withRelease)
+	Length PageHeap::PageMap::HeapPages() const
 	{
-		Length limit = (FLAGS_tcmalloc_heap_limit_mb*1024*1024) >> kPageShift;
-		if (limit == 0) return true; //there is no limit
-
 		// We do not use stats_.system_bytes because it does not take
 		// MetaDataAllocs into account.
 		Length takenPages = TCMalloc_SystemTaken >> kPageShift;
@@ -803,25 +1164,46 @@ namespace tcmalloc {
 		//* sys_alloc may round allocation up to huge page size,
 		//  although smaller limit was ensured
 
-		ASSERT(takenPages >= stats_.unmapped_bytes >> kPageShift);
-		takenPages -= stats_.unmapped_bytes >> kPageShift;
+		const Length unmappedPages = GetUnmappedBytes() >> kPageShift;
+		ASSERT(takenPages >= unmappedPages);
+		return takenPages - unmappedPages;
+	}
+
+	bool PageHeap::PageMap::EnsureLimit(Length n, bool withRelease)
+	{
+		Length limit = (FLAGS_tcmalloc_heap_limit_mb*1024*1024) >> kPageShift;
+		const Length soft_limit = (FLAGS_tcmalloc_soft_heap_limit_mb*1024*1024) >> kPageShift;
+		if (limit == 0 && soft_limit == 0) return true; //there is no limit
+
+		Length takenPages = HeapPages();
+		if (soft_limit != 0) {
+			HeapLimit::NoteHeapSize(takenPages + n, soft_limit);
+		}
+		if (limit == 0) return true;
 
 		if (takenPages + n > limit && withRelease) {
 			takenPages -= Static::extended_memory()->ReleaseAtLeastNPages(takenPages + n - limit);
+			if (takenPages + n > limit) {
+				HeapLimit::NoteHardLimitHit(takenPages + n, limit);
+			}
 		}
 
 		return takenPages + n <= limit;
 	}
 
 
-	bool PageHeap::PageMap::DecommitSpan(Span* span) {
-		++stats_.decommit_count;
+	bool PageHeap::PageMap::DecommitSpan(Span* span, int slot) {
+		// Part of a huge page would stay backed, yet be counted as released.
+		if (TCMalloc_HugePagesEnabled() && !IsWholeHugePages(span->start, span->length)) {
+			return false;
+		}
+		Add(slot, kDecommitCount, 1);
 
 		bool rv = TCMalloc_SystemRelease(reinterpret_cast<void*>(span->start << kPageShift),
 				static_cast<size_t>(span->length << kPageShift));
 		if (rv) {
-			stats_.committed_bytes -= span->length << kPageShift;
-			stats_.total_decommit_bytes += (span->length << kPageShift);
+			Add(slot, kCommittedBytes, -(span->length << kPageShift));
+			Add(slot, kTotalDecommitBytes, span->length << kPageShift);
 		}
 
 		return rv;
@@ -855,6 +1237,52 @@ namespace tcmalloc {
 		}
 	}
 
+	void PageHeap::PageMap::GetHugePageStats(HugePageStats* result) {
+		result->full = 0;
+		result->partial = 0;
+		result->free = 0;
+
+		// Walk the spans in address order, tallying the in-use pages of
+		// the huge page we are in and flushing the tally at each boundary.
+		PageID current = 0;
+		Length used = 0;
+		Length backed = 0;
+		PageID p = 0;
+		while (Span* span = reinterpret_cast<Span*>(pagemap_.Next(p))) {
+			PageID start = span->start;
+			const PageID end = span->start + span->length;
+			while (start < end) {
+				const PageID huge = start / kPagesPerHugePage;
+				if (huge != current) {
+					CountHugePage(used, backed, result);
+					current = huge;
+					used = 0;
+					backed = 0;
+				}
+				const PageID huge_end = std::min<PageID>(end, (huge + 1) * kPagesPerHugePage);
+				backed += huge_end - start;
+				if (span->location == Span::IN_USE) {
+					used += huge_end - start;
+				}
+				start = huge_end;
+			}
+			p = end;
+		}
+		CountHugePage(used, backed, result);
+	}
+
+	void PageHeap::PageMap::CountHugePage(Length used, Length backed,
+			HugePageStats* result) {
+		if (backed == 0) return;
+		if (used == kPagesPerHugePage) {
+			result->full++;
+		} else if (used > 0) {
+			result->partial++;
+		} else {
+			result->free++;
+		}
+	}
+
 	bool PageHeap::PageMap::GetNextRange(PageID start, base::MallocRange* r) {
 		Span* span = reinterpret_cast<Span*>(pagemap_.Next(start));
 		if (span == NULL) {
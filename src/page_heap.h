@@ -40,6 +40,7 @@
 #include <stdint.h>                     // for uint64_t, int64_t, uint16_t
 #endif
 #include <gperftools/malloc_extension.h>
+#include "base/atomicops.h"
 #include "base/basictypes.h"
 #include "common.h"
 #include "packed-cache-inl.h"
@@ -112,7 +113,9 @@ namespace tcmalloc {
 
 	class PERFTOOLS_DLL_DECL PageHeap {
 		public:
-			PageHeap();
+			// "shard" is the index of this heap among Static::pageheap(),
+			// used to pick its PageMap stats slot.
+			explicit PageHeap(int shard);
 
 			// Allocate a run of "n" pages.  Returns zero if out of memory.
 			// Caller should not pass "n == 0" -- instead, n should have
@@ -124,7 +127,53 @@ namespace tcmalloc {
 				int64 returned_length;
 			};
 			void GetSmallSpanStats(SmallSpanStats* result);
+
+			struct ShardStats {
+				uint64_t scavenge_count;  // Number of incremental scavenges
+				uint64_t released_pages;  // Pages decommitted in lifetime of shard
+				uint64_t refill_count;    // Number of refills from ExtendedMemory
+				uint64_t refill_pages;    // Current refill batch size
+			};
+			void GetShardStats(ShardStats* result);
+
+			// Try to release at least num_pages of this shard's normal free
+			// list for reuse by the OS, moving them to the returned list.
+			// Returns the actual number of pages released, which is less
+			// than num_pages if the shard ran out of normal spans.  When huge
+			// pages are on, shard spans rarely cover a whole one, so up to
+			// num_pages of them are moved to ExtendedMemory instead, which
+			// releases the whole huge pages they complete.
+			// REQUIRES: this shard's lock is held, extended_lock() is not.
+			Length ReleaseAtLeastNPages(Length num_pages);
+
+			// Puts a freed 1-page span on this shard's free list, or hands a
+			// larger span to ExtendedMemory.  If the shard then holds more
+			// than two refill batches, the batch size is halved and the
+			// surplus is drained back to ExtendedMemory.
+			// REQUIRES: this shard's lock is held, extended_lock() is not.
 			void AppendSpantoPageHeap(Span* span);
+
+			// Moves free spans from this shard into ExtendedMemory until at
+			// most "keep" are left, returned (decommitted) spans first, then
+			// the least recently freed normal ones.  ExtendedMemory coalesces
+			// them with their free neighbours so that any shard can reuse
+			// them, or the scavenger can release them.  Returns the number
+			// of pages moved.
+			// REQUIRES: this shard's lock is held, extended_lock() is not.
+			Length ReturnFreeSpans(Length keep);
+
+			// Like ExtendedMemory::ScavengeDue() and Scavenge(), for this
+			// shard's free lists.
+			// REQUIRES: this shard's lock is held.
+			bool ScavengeDue() const { return scavenge_counter_ < 0; }
+			Length Scavenge();
+
+			// If nothing has been freed into or refilled this shard since the
+			// previous call, returns all but kMinRefillPages of its free
+			// pages to ExtendedMemory, where other shards can use them.
+			// Returns the number of pages moved.
+			// REQUIRES: this shard's lock is held, extended_lock() is not.
+			Length TrimIfIdle();
 			bool Check();
 			// Like Check() but does some more comprehensive checking.
 			bool CheckExpensive();
@@ -140,9 +189,21 @@ namespace tcmalloc {
 					// span of exactly the specified length.  Else, returns NULL.
 					Span* AllocLarge(Length n);
 
+					// Allocate a span of length == n whose first page is a multiple
+					// of "align" pages, a power of two.  The span is carved from the
+					// best-fitting free span that holds such a run, so no more than
+					// n pages are taken.  Returns NULL if out of memory.
+					Span* AllocAligned(Length n, Length align);
+
 					// Prepends span to appropriate free list, and adjusts stats.
 					void PrependToFreeSet(Span* span);
 
+					// Takes back a free span given up by a page heap shard and
+					// coalesces it with neighbouring free spans.
+					// REQUIRES: span is not on any list and its location is
+					//           ON_NORMAL_FREELIST or ON_RETURNED_FREELIST.
+					void ReclaimSpan(Span* span);
+
 					bool Check();
 
 					// Try to release at least num_pages for reuse by the OS.  Returns
@@ -153,6 +214,17 @@ namespace tcmalloc {
 					// smaller released and unreleased ranges.
 					Length ReleaseAtLeastNPages(Length num_pages);
 
+					// True once enough pages have been freed since the last
+					// scavenge that FLAGS_tcmalloc_release_rate calls for another.
+					bool ScavengeDue() const { return scavenge_counter_ < 0; }
+
+					// Releases idle pages at the pace set by
+					// FLAGS_tcmalloc_release_rate and schedules the next scavenge.
+					// Run by IncrementalScavenge(), or by the background thread
+					// when there is one.  Returns the number of pages released.
+					// REQUIRES: extended_lock() is held.
+					Length Scavenge();
+
 					struct LargeSpanStats {
 						int64 spans;           // Number of such spans
 						int64 normal_pages;    // Combined page length of normal large spans
@@ -174,6 +246,16 @@ namespace tcmalloc {
 					// REQUIRES: span->location == IN_USE
 					// REQUIRES: span->sizeclass == 0
 					Span* Split(Span* span, Length n);
+
+					// Resize an allocated span to length n without moving it.  A
+					// shrinking span gives its tail back to the free set; a growing
+					// one takes the pages it needs from the free span that follows
+					// it, if there is one big enough.  Returns false, leaving the
+					// span alone, if it cannot grow.
+					//
+					// REQUIRES: span->location == IN_USE
+					// REQUIRES: span->sizeclass == 0
+					bool ResizeInPlace(Span* span, Length n);
 					bool CheckSet();
 
 					bool GetAggressiveDecommit(void) {return aggressive_decommit_;}
@@ -186,17 +268,36 @@ namespace tcmalloc {
 					SpanSet large_normal_;
 					SpanSet large_returned_;
 
-					bool GrowHeap(Length n);
+					bool GrowHeap(Length n, size_t alignment = kPageSize);
 
 					// return span.
 					Span* CarveLarge(Span* span, Length n);
 
+					// Returns the first span of "set" in best-fit order that holds
+					// n pages starting at a multiple of align, or NULL.
+					static Span* FindAligned(SpanSet* set, Length n, Length align);
+
+					// Returns the largest normal span that covers at least one
+					// whole huge page, or NULL.
+					Span* FindHugePageSpan();
+
+					// Splits off the pages of the normal "span" that lie outside
+					// its whole huge pages, leaving them free as spans of their
+					// own, and returns the rest, or NULL if there is none.
+					Span* CarveHugePages(Span* span);
+
+					// Like CarveLarge, but the span returned starts at page
+					// "start" inside "span"; the pages before it stay free.
+					Span* CarveAligned(Span* span, PageID start, Length n);
+
 					// Removes span from its free list, and adjust stats.
 					void RemoveFromFreeSet(Span* span);
 
 					// Attempts to decommit 's' and move it to the returned freelist.
 					//
 					// Returns the length of the Span or zero if release failed.
+					// With huge pages only the whole huge pages in 's' are
+					// released; the pages around them stay on the normal freelist.
 					//
 					// REQUIRES: 's' must be on the NORMAL freelist.
 					Length ReleaseSpan(Span *s);
@@ -207,6 +308,8 @@ namespace tcmalloc {
 
 					Span* CheckAndHandlePreMerge(Span *span, Span *other);
 					bool aggressive_decommit_;
+					// Counts n freed pages towards the next scavenge, and does it
+					// right away unless the background thread is running.
 					void IncrementalScavenge(Length n);
 
 					// Number of pages to deallocate before doing more scavenging
@@ -266,23 +369,37 @@ namespace tcmalloc {
 						uint64_t reserve_count;         // Number of virtual memory reserves
 						uint64_t total_reserve_bytes;   // Bytes reserved in lifetime of process
 					};
-					inline Stats stats() const { return stats_; }
-
-					uint64_t GetSystemBytes(){ return stats_.system_bytes; } 
-					uint64_t GetFreeBytes(){ return stats_.free_bytes; } 
-					uint64_t GetUnmappedBytes(){ return stats_.unmapped_bytes; } 
-					uint64_t GetCommitedBytes(){ return stats_.committed_bytes; }
-					void AddFreeBytes(uint64_t val){ stats_.free_bytes += val; }
-					void AddSystemBytes(uint64_t val){ stats_.system_bytes += val; }
-					void AddUnmappedBytes(uint64_t val){ stats_.unmapped_bytes += val; }
-					void AddCommitedBytes(uint64_t val){ stats_.committed_bytes += val; }
-					void AddTotalCommitBytes(uint64_t val){ stats_.total_commit_bytes += val; }
-					void AddTotalReserveBytes(uint64_t val){ stats_.total_reserve_bytes += val; }	
-					void ReduceFreeBytes(uint64_t val){ stats_.free_bytes -= val; }	
-					void ReduceUnmappedBytes(uint64_t val){ stats_.unmapped_bytes -= val; }	
-					void AddScavengeCount(uint64_t val){ stats_.scavenge_count += val; }	
-					void AddReserveCount(uint64_t val){ stats_.reserve_count += val; }	
-					void AddCommitCount(uint64_t val){ stats_.commit_count += val; }	
+
+					// The statistics are kept in one slot per writer: slot
+					// kExtendedStatsSlot belongs to ExtendedMemory and slot i+1 to
+					// page heap shard i.  A slot is only written under its owner's
+					// lock, so updates need no atomic read-modify-write and never
+					// bounce a cache line between shards.  Readers sum all slots
+					// without taking any lock.
+					static const int kExtendedStatsSlot = 0;
+					static const int kMaxStatsSlots = 65;  // 1 + Static::kMaxPageHeapShards
+					static int ShardStatsSlot(int shard) { return shard + 1; }
+
+					// Returns the sum of all slots.  Each counter is exact, but
+					// counters may be mutually inconsistent if read while they
+					// are being updated.
+					Stats stats() const;
+
+					uint64_t GetSystemBytes() const { return Sum(kSystemBytes); }
+					uint64_t GetFreeBytes() const { return Sum(kFreeBytes); }
+					uint64_t GetUnmappedBytes() const { return Sum(kUnmappedBytes); }
+					uint64_t GetCommitedBytes() const { return Sum(kCommittedBytes); }
+					void AddFreeBytes(int slot, uint64_t val){ Add(slot, kFreeBytes, val); }
+					void AddSystemBytes(int slot, uint64_t val){ Add(slot, kSystemBytes, val); }
+					void AddUnmappedBytes(int slot, uint64_t val){ Add(slot, kUnmappedBytes, val); }
+					void AddCommitedBytes(int slot, uint64_t val){ Add(slot, kCommittedBytes, val); }
+					void AddTotalCommitBytes(int slot, uint64_t val){ Add(slot, kTotalCommitBytes, val); }
+					void AddTotalReserveBytes(int slot, uint64_t val){ Add(slot, kTotalReserveBytes, val); }
+					void ReduceFreeBytes(int slot, uint64_t val){ Add(slot, kFreeBytes, -val); }
+					void ReduceUnmappedBytes(int slot, uint64_t val){ Add(slot, kUnmappedBytes, -val); }
+					void AddScavengeCount(int slot, uint64_t val){ Add(slot, kScavengeCount, val); }
+					void AddReserveCount(int slot, uint64_t val){ Add(slot, kReserveCount, val); }
+					void AddCommitCount(int slot, uint64_t val){ Add(slot, kCommitCount, val); }
 
 					// Reads and writes to pagemap_cache_ do not require locking.
 					bool TryGetSizeClass(PageID p, uint32* out) const {
@@ -309,6 +426,18 @@ namespace tcmalloc {
 					// If this page heap is managing a range with starting page # >= start,
 					// store info about the range in *r and return true.  Else return false.
 					bool GetNextRange(PageID start, base::MallocRange* r);
+
+					// How full the huge pages backing the heap are: a huge page is
+					// full when all of its pages are in use, partial when only
+					// some are, and free when none are.
+					struct HugePageStats {
+						int64 full;
+						int64 partial;
+						int64 free;
+					};
+					// REQUIRES: extended_lock() is held, so spans are not merged
+					//           or deleted under us.
+					void GetHugePageStats(HugePageStats* result);
 					typedef uintptr_t Number;
 
 					void RecordSpan(Span* span) {
@@ -318,16 +447,22 @@ namespace tcmalloc {
 						}
 					}
 
-					// Commit the span.
-					void CommitSpan(Span* span);
+					// Commit the span, charging the given stats slot.
+					void CommitSpan(Span* span, int slot);
 
 					// Checks if we are allowed to take more memory from the system.
 					// If limit is reached and allowRelease is true, tries to release
-					// some unused spans.
+					// some unused spans.  Also tells HeapLimit when the soft limit
+					// is crossed, or the hard limit turns an allocation down.
 					bool EnsureLimit(Length n, bool allowRelease = true);
 
-					// Decommit the span.
-					bool DecommitSpan(Span* span);
+					// Pages of the heap that count against the limits: those taken
+					// from the system and not released back to it.
+					Length HeapPages() const;
+
+					// Decommit the span, charging the given stats slot.  With
+					// huge pages, fails unless the span is whole huge pages.
+					bool DecommitSpan(Span* span, int slot);
 
 					void SetPageMap(Number k, void* v);
 					void* NextPageMap(Number k);
@@ -340,8 +475,57 @@ namespace tcmalloc {
 					mutable PageMapCache pagemap_cache_;
 					PageMapType pagemap_;
 
+					enum StatsCounter {
+						kSystemBytes,
+						kFreeBytes,
+						kUnmappedBytes,
+						kCommittedBytes,
+						kScavengeCount,
+						kCommitCount,
+						kTotalCommitBytes,
+						kDecommitCount,
+						kTotalDecommitBytes,
+						kReserveCount,
+						kTotalReserveBytes,
+						kNumStatsCounters
+					};
+
+					// Counters are deltas, so a single slot may go negative (e.g.
+					// a shard decommits memory ExtendedMemory committed); only
+					// the sum over all slots is meaningful.
+					struct StatsSlot {
+						base::subtle::Atomic64 counters[kNumStatsCounters];
+					} CACHELINE_ALIGNED;
+
+					void Add(int slot, StatsCounter c, uint64_t val) {
+						ASSERT(0 <= slot && slot < kMaxStatsSlots);
+						// Charge a stray slot to ExtendedMemory rather than write
+						// out of bounds; the check also lets the compiler prove
+						// the index is in range.
+						if (static_cast<unsigned>(slot) >= kMaxStatsSlots) {
+							slot = kExtendedStatsSlot;
+						}
+						// Only the owner of the slot writes it, so a plain
+						// load and store is enough to never lose an update.
+						base::subtle::Atomic64* counter = &stats_[slot].counters[c];
+						base::subtle::NoBarrier_Store(
+								counter, base::subtle::NoBarrier_Load(counter) + val);
+					}
+					uint64_t Sum(StatsCounter c) const {
+						base::subtle::Atomic64 sum = 0;
+						for (int i = 0; i < kMaxStatsSlots; i++) {
+							sum += base::subtle::NoBarrier_Load(&stats_[i].counters[c]);
+						}
+						return static_cast<uint64_t>(sum);
+					}
+
 					// Statistics on system, free, and unmapped bytes
-					Stats stats_;
+					StatsSlot stats_[kMaxStatsSlots];
+
+					// Adds one huge page with "used" of its "backed" pages in use
+					// to *result.
+					static void CountHugePage(Length used, Length backed,
+							HugePageStats* result);
 			};
 
 		private:
@@ -356,6 +540,50 @@ namespace tcmalloc {
 			// Array mapping from span length to a doubly linked list of free spans
 			SpanList free_;
 
+			// PageMap stats slot owned by this shard.
+			const int stats_slot_;
+
+			// Number of spans on free_.normal and free_.returned.
+			int64 normal_length_;
+			int64 returned_length_;
+
+			// Number of pages carved from ExtendedMemory when the shard runs
+			// dry.  It doubles while allocations outrun frees and halves when
+			// free spans pile up, within [kMinRefillPages, kMaxRefillPages].
+			// A shard holds at most two batches' worth of free spans; the
+			// gap to the single batch kept after a drain stops spans from
+			// bouncing back and forth around one refill.
+			Length refill_pages_;
+			Length frees_since_refill_;
+			uint64_t refill_count_;
+			static const int kMinRefillPages = 4;
+			static const int kDefaultRefillPages = 12;
+			static const int kMaxRefillPages = 48;
+
+			// Picks the size of the next refill from the demand seen since
+			// the previous one.
+			Length NextRefillPages();
+
+			// Number of pages to free into this shard before doing more
+			// scavenging, and lifetime counters for GetShardStats().
+			int64_t scavenge_counter_;
+			uint64_t scavenge_count_;
+			uint64_t released_pages_;
+
+			// Activity seen by the previous TrimIfIdle().
+			uint64_t trim_refill_count_;
+			Length trim_frees_;
+
+			// A shard keeps at most 2 * kMaxRefillPages pages, so it is
+			// scavenged on a much shorter fuse than ExtendedMemory.
+			static const int kMaxShardReleaseDelay = 1 << 14;
+			static const int kDefaultShardReleaseDelay = 1 << 8;
+
+			// Releases idle spans as pages are freed into this shard, at a
+			// pace set by FLAGS_tcmalloc_release_rate, unless the background
+			// thread is running.
+			void IncrementalScavenge(Length n);
+
 			// Prepends span to appropriate free list, and adjusts stats.
 			void PrependToFreeList(Span* span);
 
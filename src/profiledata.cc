@@ -45,6 +45,7 @@
 #include <sys/time.h>
 #include <string.h>
 #include <fcntl.h>
+#include <sched.h>
 
 #include "profiledata.h"
 
@@ -56,9 +57,15 @@ const int ProfileData::kMaxStackDepth;
 const int ProfileData::kAssociativity;
 const int ProfileData::kBuckets;
 const int ProfileData::kBufferLength;
+const int ProfileStream::kMaxStackDepth;
+const int ProfileStream::kPoolSlots;
+const int ProfileStream::kIndexSize;
+const int ProfileStream::kMaxProbes;
 
 ProfileData::Options::Options()
-    : frequency_(1) {
+    : frequency_(1),
+      trailer_writer_(NULL),
+      trailer_writer_arg_(NULL) {
 }
 
 // This function is safe to call from asynchronous signals (but is not
@@ -86,7 +93,9 @@ ProfileData::ProfileData()
       evictions_(0),
       total_bytes_(0),
       fname_(0),
-      start_time_(0) {
+      start_time_(0),
+      trailer_writer_(NULL),
+      trailer_writer_arg_(NULL) {
 }
 
 bool ProfileData::Start(const char* fname,
@@ -104,6 +113,8 @@ bool ProfileData::Start(const char* fname,
 
   start_time_ = time(NULL);
   fname_ = strdup(fname);
+  trailer_writer_ = options.trailer_writer();
+  trailer_writer_arg_ = options.trailer_writer_arg();
 
   // Reset counters
   num_evicted_ = 0;
@@ -190,6 +201,9 @@ void ProfileData::Stop() {
 
   // Dump "/proc/self/maps" so we get list of mapped shared libraries
   DumpProcSelfMaps(out_);
+  if (trailer_writer_ != NULL) {
+    (*trailer_writer_)(out_, trailer_writer_arg_);
+  }
 
   Reset();
   fprintf(stderr, "PROFILE: interrupts/evictions/bytes = %d/%d/%" PRIuS "\n",
@@ -330,3 +344,331 @@ void ProfileData::FlushEvicted() {
   }
   num_evicted_ = 0;
 }
+
+// ---------------------------------------------------------------------
+// ProfileStream
+
+// How often the writer thread checks the table and the chunk's age.
+static const int kWriterPollMillis = 100;
+
+static ProfileData::Slot HashStack(int depth, const void* const* stack) {
+  ProfileData::Slot h = 0;
+  for (int i = 0; i < depth; i++) {
+    ProfileData::Slot slot = reinterpret_cast<ProfileData::Slot>(stack[i]);
+    h = (h << 8) | (h >> (8*(sizeof(h)-1)));
+    h += (slot * 31) + (slot * 7) + (slot * 3);
+  }
+  return h;
+}
+
+ProfileStream::Options::Options()
+    : frequency_(1),
+      chunk_seconds_(0),
+      trailer_writer_(NULL),
+      trailer_writer_arg_(NULL) {
+}
+
+ProfileStream::ProfileStream()
+    : active_(0),
+      in_add_(0),
+      enabled_(false),
+      period_(0),
+      chunk_seconds_(0),
+      fname_(0),
+      start_time_(0),
+      trailer_writer_(NULL),
+      trailer_writer_arg_(NULL),
+      count_(0),
+      dropped_(0),
+      out_(-1),
+      chunk_(0),
+      chunk_start_(0),
+      total_bytes_(0),
+      stop_writer_(false) {
+  memset(tables_, 0, sizeof(tables_));
+  chunk_name_[0] = '\0';
+  pthread_mutex_init(&io_lock_, NULL);
+  pthread_cond_init(&wakeup_, NULL);
+}
+
+ProfileStream::~ProfileStream() {
+  Stop();
+  pthread_cond_destroy(&wakeup_);
+  pthread_mutex_destroy(&io_lock_);
+}
+
+bool ProfileStream::Start(const char* fname,
+                          const ProfileStream::Options& options) {
+  if (enabled()) {
+    return false;
+  }
+  CHECK_NE(0, options.frequency());
+  period_ = 1000000 / options.frequency();
+  chunk_seconds_ = options.chunk_seconds();
+  trailer_writer_ = options.trailer_writer();
+  trailer_writer_arg_ = options.trailer_writer_arg();
+
+  pthread_mutex_lock(&io_lock_);
+  fname_ = strdup(fname);
+  chunk_ = 0;
+  total_bytes_ = 0;
+  OpenChunkLocked();
+  if (out_ < 0) {
+    free(fname_);
+    fname_ = 0;
+    pthread_mutex_unlock(&io_lock_);
+    return false;
+  }
+  pthread_mutex_unlock(&io_lock_);
+
+  for (int i = 0; i < 2; i++) {
+    tables_[i].pool = new Slot[kPoolSlots];
+    tables_[i].index = new int32[kIndexSize];
+    tables_[i].used = 0;
+    tables_[i].entries = 0;
+    memset(tables_[i].index, 0xff, sizeof(tables_[i].index[0]) * kIndexSize);
+  }
+  count_ = 0;
+  dropped_ = 0;
+  start_time_ = time(NULL);
+  stop_writer_ = false;
+  base::subtle::Release_Store(&active_, 0);
+  enabled_ = true;
+
+  if (pthread_create(&writer_, NULL, WriterMain, this) != 0) {
+    RAW_LOG(ERROR, "ProfileStream: cannot start writer thread: %s",
+            strerror(errno));
+    Shutdown(false);
+    return false;
+  }
+  return true;
+}
+
+void* ProfileStream::WriterMain(void* arg) {
+  reinterpret_cast<ProfileStream*>(arg)->RunWriter();
+  return NULL;
+}
+
+void ProfileStream::RunWriter() {
+  pthread_mutex_lock(&io_lock_);
+  while (!stop_writer_) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    struct timespec deadline;
+    long usec = now.tv_usec + kWriterPollMillis * 1000L;
+    deadline.tv_sec = now.tv_sec + usec / 1000000;
+    deadline.tv_nsec = (usec % 1000000) * 1000;
+    pthread_cond_timedwait(&wakeup_, &io_lock_, &deadline);
+    if (stop_writer_) break;
+
+    const StackTable* t = &tables_[base::subtle::Acquire_Load(&active_)];
+    if (chunk_seconds_ > 0 && time(NULL) - chunk_start_ >= chunk_seconds_) {
+      DrainLocked();
+      FinishChunkLocked();
+      OpenChunkLocked();
+    } else if (t->used >= kPoolSlots / 2 || t->entries >= kIndexSize / 4) {
+      // Leave room for the samples that arrive until the next check.
+      DrainLocked();
+    }
+  }
+  pthread_mutex_unlock(&io_lock_);
+}
+
+void ProfileStream::DrainLocked() {
+  const int old = base::subtle::Acquire_Load(&active_);
+  base::subtle::Release_Store(&active_, 1 - old);
+  base::subtle::MemoryBarrier();
+  // An 'Add' that started before the switch may still be writing to
+  // the old table.  It only runs for a few microseconds.
+  while (base::subtle::Acquire_Load(&in_add_) != 0) {
+    sched_yield();
+  }
+
+  StackTable* t = &tables_[old];
+  if (t->used > 0 && out_ >= 0) {
+    const size_t bytes = sizeof(t->pool[0]) * t->used;
+    FDWrite(out_, reinterpret_cast<const char*>(t->pool), bytes);
+    total_bytes_ += bytes;
+  }
+  t->used = 0;
+  t->entries = 0;
+  memset(t->index, 0xff, sizeof(t->index[0]) * kIndexSize);
+}
+
+void ProfileStream::OpenChunkLocked() {
+  chunk_++;
+  snprintf(chunk_name_, sizeof(chunk_name_), "%s.%04d", fname_, chunk_);
+  chunk_start_ = time(NULL);
+  out_ = open(chunk_name_, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+  if (out_ < 0) {
+    RAW_LOG(ERROR, "ProfileStream: cannot open %s: %s",
+            chunk_name_, strerror(errno));
+    return;
+  }
+  // Same header as ProfileData::Start.
+  const Slot header[] = { 0, 3, 0, static_cast<Slot>(period_), 0 };
+  FDWrite(out_, reinterpret_cast<const char*>(header), sizeof(header));
+  total_bytes_ += sizeof(header);
+}
+
+void ProfileStream::FinishChunkLocked() {
+  if (out_ < 0) {
+    return;
+  }
+  const Slot trailer[] = { 0, 1, 0 };   // End of data marker
+  FDWrite(out_, reinterpret_cast<const char*>(trailer), sizeof(trailer));
+  total_bytes_ += sizeof(trailer);
+  // Each chunk carries its own copy of the mappings, since libraries
+  // may come and go while the program runs.
+  DumpProcSelfMaps(out_);
+  if (trailer_writer_ != NULL) {
+    (*trailer_writer_)(out_, trailer_writer_arg_);
+  }
+  close(out_);
+  out_ = -1;
+}
+
+void ProfileStream::StopWriter() {
+  pthread_mutex_lock(&io_lock_);
+  stop_writer_ = true;
+  pthread_cond_signal(&wakeup_);
+  pthread_mutex_unlock(&io_lock_);
+  pthread_join(writer_, NULL);
+}
+
+void ProfileStream::Shutdown(bool write) {
+  pthread_mutex_lock(&io_lock_);
+  if (write) {
+    DrainLocked();
+    FinishChunkLocked();
+  } else if (out_ >= 0) {
+    close(out_);
+    out_ = -1;
+  }
+  pthread_mutex_unlock(&io_lock_);
+
+  for (int i = 0; i < 2; i++) {
+    delete[] tables_[i].pool;
+    delete[] tables_[i].index;
+    tables_[i].pool = 0;
+    tables_[i].index = 0;
+  }
+  free(fname_);
+  fname_ = 0;
+  chunk_name_[0] = '\0';
+  start_time_ = 0;
+  enabled_ = false;
+}
+
+void ProfileStream::Stop() {
+  if (!enabled()) {
+    return;
+  }
+  StopWriter();
+  Shutdown(true);
+  fprintf(stderr, "PROFILE: interrupts/dropped/chunks/bytes = "
+          "%d/%d/%d/%" PRIuS "\n", count_, dropped_, chunk_, total_bytes_);
+}
+
+void ProfileStream::Reset() {
+  if (!enabled()) {
+    return;
+  }
+  StopWriter();
+  Shutdown(false);
+}
+
+void ProfileStream::FlushTable() {
+  if (!enabled()) {
+    return;
+  }
+  pthread_mutex_lock(&io_lock_);
+  DrainLocked();
+  pthread_mutex_unlock(&io_lock_);
+}
+
+bool ProfileStream::Rotate() {
+  if (!enabled()) {
+    return false;
+  }
+  pthread_mutex_lock(&io_lock_);
+  DrainLocked();
+  FinishChunkLocked();
+  OpenChunkLocked();
+  const bool ok = out_ >= 0;
+  pthread_mutex_unlock(&io_lock_);
+  return ok;
+}
+
+void ProfileStream::GetCurrentState(ProfileData::State* state) {
+  if (enabled()) {
+    state->enabled = true;
+    state->start_time = start_time_;
+    state->samples_gathered = count_;
+    pthread_mutex_lock(&io_lock_);
+    int buf_size = sizeof(state->profile_name);
+    strncpy(state->profile_name, chunk_name_, buf_size);
+    state->profile_name[buf_size-1] = '\0';
+    pthread_mutex_unlock(&io_lock_);
+  } else {
+    state->enabled = false;
+    state->start_time = 0;
+    state->samples_gathered = 0;
+    state->profile_name[0] = '\0';
+  }
+}
+
+void ProfileStream::Add(int depth, const void* const* stack) {
+  if (!enabled()) {
+    return;
+  }
+
+  if (depth > kMaxStackDepth) depth = kMaxStackDepth;
+  RAW_CHECK(depth > 0, "ProfileStream::Add depth <= 0");
+
+  // Announce ourselves before looking at active_; DrainLocked does
+  // the opposite, so one of us sees the other.
+  base::subtle::NoBarrier_Store(&in_add_, 1);
+  base::subtle::MemoryBarrier();
+  StackTable* t = &tables_[base::subtle::Acquire_Load(&active_)];
+  count_++;
+
+  const Slot h = HashStack(depth, stack);
+  bool done = false;
+  for (int probe = 0; probe < kMaxProbes && !done; probe++) {
+    int32* slot = &t->index[(h + probe) & (kIndexSize - 1)];
+    if (*slot < 0) {
+      // New stack: append a record if it fits.
+      if (t->used + depth + 2 > kPoolSlots) break;
+      Slot* e = &t->pool[t->used];
+      e[0] = 1;
+      e[1] = depth;
+      for (int i = 0; i < depth; i++) {
+        e[2 + i] = reinterpret_cast<Slot>(stack[i]);
+      }
+      *slot = t->used;
+      t->used += depth + 2;
+      t->entries++;
+      done = true;
+    } else {
+      Slot* e = &t->pool[*slot];
+      if (e[1] != static_cast<Slot>(depth)) continue;
+      bool match = true;
+      for (int i = 0; i < depth; i++) {
+        if (e[2 + i] != reinterpret_cast<Slot>(stack[i])) {
+          match = false;
+          break;
+        }
+      }
+      if (match) {
+        e[0]++;
+        done = true;
+      }
+    }
+  }
+  if (!done) {
+    dropped_++;
+  }
+
+  base::subtle::Release_Store(&in_add_, 0);
+}
@@ -44,7 +44,9 @@
 #include <config.h>
 #include <time.h>   // for time_t
 #include <stdint.h>
+#include <pthread.h>
 #include "base/basictypes.h"
+#include "base/atomicops.h"
 
 // A class that accumulates profile samples and writes them to a file.
 //
@@ -78,6 +80,8 @@
 //    the first SpinLock in all cases where both are needed.)
 class ProfileData {
  public:
+  typedef void (*TrailerWriter)(int fd, void* arg);
+
   struct State {
     bool     enabled;             // Is profiling currently enabled?
     time_t   start_time;          // If enabled, when was profiling started?
@@ -97,12 +101,30 @@ class ProfileData {
       frequency_ = frequency;
     }
 
+    // Get and set a function that appends text to the profile after
+    // the memory map, e.g. to describe synthetic stack entries.
+    TrailerWriter trailer_writer() const {
+      return trailer_writer_;
+    }
+    void* trailer_writer_arg() const {
+      return trailer_writer_arg_;
+    }
+    void set_trailer_writer(TrailerWriter writer, void* arg) {
+      trailer_writer_ = writer;
+      trailer_writer_arg_ = arg;
+    }
+
    private:
     int      frequency_;                  // Sample frequency.
+    TrailerWriter trailer_writer_;        // Appends text, or NULL.
+    void*    trailer_writer_arg_;
   };
 
   static const int kMaxStackDepth = 64;  // Max stack depth stored in profile
 
+  // Type of slots: each slot can be either a count, or a PC value
+  typedef uintptr_t Slot;
+
   ProfileData();
   ~ProfileData();
 
@@ -147,9 +169,6 @@ class ProfileData {
   static const int kBuckets = 1 << 10;          // For hashtable
   static const int kBufferLength = 1 << 18;     // For eviction buffer
 
-  // Type of slots: each slot can be either a count, or a PC value
-  typedef uintptr_t Slot;
-
   // Hash-table/eviction-buffer entry (a.k.a. a sample)
   struct Entry {
     Slot count;                  // Number of hits
@@ -171,6 +190,8 @@ class ProfileData {
   size_t        total_bytes_;   // How much output
   char*         fname_;         // Profile file name
   time_t        start_time_;    // Start time, or 0
+  TrailerWriter trailer_writer_;
+  void*         trailer_writer_arg_;
 
   // Move 'entry' to the eviction buffer.
   void Evict(const Entry& entry);
@@ -181,4 +202,163 @@ class ProfileData {
   DISALLOW_COPY_AND_ASSIGN(ProfileData);
 };
 
+// A collector for long running processes, which writes the profile as
+// a sequence of self-contained chunks: files named <fname>.0001,
+// <fname>.0002, etc., each in the same format ProfileData writes, so
+// pprof can read any one of them or several together.
+//
+// Samples are interned into a table of distinct stacks, each stored
+// once with its count, instead of being evicted one by one.  Two such
+// tables are allocated at Start: 'Add' records into one while the
+// other is written out by a writer thread, so all file I/O happens
+// outside the signal handler and memory use is fixed regardless of
+// how many distinct stacks the program has.  Samples that arrive while
+// the active table is full are dropped and counted.
+//
+// The writer thread writes the active table when it is half full and
+// starts a new chunk every 'chunk_seconds' seconds, if that is
+// positive.  'Rotate' starts a new chunk on demand.
+//
+// Synchronization requirements are as for ProfileData, except that
+// 'Add' may also run concurrently with 'FlushTable' and 'Rotate', and
+// 'FlushTable' and 'Rotate' may be called at the same time.
+class ProfileStream {
+ public:
+  class Options {
+   public:
+    Options();
+
+    int frequency() const {
+      return frequency_;
+    }
+    void set_frequency(int frequency) {
+      frequency_ = frequency;
+    }
+
+    // Seconds between chunks, or 0 to rotate only on request.
+    int chunk_seconds() const {
+      return chunk_seconds_;
+    }
+    void set_chunk_seconds(int seconds) {
+      chunk_seconds_ = seconds;
+    }
+
+    // As for ProfileData::Options; called for every chunk.
+    ProfileData::TrailerWriter trailer_writer() const {
+      return trailer_writer_;
+    }
+    void* trailer_writer_arg() const {
+      return trailer_writer_arg_;
+    }
+    void set_trailer_writer(ProfileData::TrailerWriter writer, void* arg) {
+      trailer_writer_ = writer;
+      trailer_writer_arg_ = arg;
+    }
+
+   private:
+    int      frequency_;                  // Sample frequency.
+    int      chunk_seconds_;              // Chunk rotation interval.
+    ProfileData::TrailerWriter trailer_writer_;
+    void*    trailer_writer_arg_;
+  };
+
+  static const int kMaxStackDepth = ProfileData::kMaxStackDepth;
+
+  ProfileStream();
+  ~ProfileStream();
+
+  // Start collecting data into chunks of fname, and start the writer
+  // thread.  Returns false if collection was already enabled or the
+  // first chunk could not be opened.
+  bool Start(const char *fname, const Options& options);
+
+  // Write out the remaining samples, finish the current chunk and stop.
+  void Stop();
+
+  // Stop without writing anything else, discarding collected data.
+  void Reset();
+
+  // Record a sample.  Safe to call from asynchronous signals, but not
+  // re-entrant.
+  void Add(int depth, const void* const* stack);
+
+  // Write out all samples collected so far to the current chunk.
+  void FlushTable();
+
+  // Write out all samples collected so far, finish the current chunk
+  // and start the next one.  Returns false if not enabled or the next
+  // chunk could not be opened; in the latter case samples are dropped
+  // until a later rotation succeeds.
+  bool Rotate();
+
+  bool enabled() const { return enabled_; }
+
+  // Number of samples dropped since 'Start' for lack of room.  'Stop'
+  // reports it too.
+  int samples_dropped() const { return dropped_; }
+
+  // Get the current state of the collector; profile_name is the name
+  // of the chunk being written.
+  void GetCurrentState(ProfileData::State* state);
+
+ private:
+  static const int kPoolSlots = 1 << 17;   // Per table
+  static const int kIndexSize = 1 << 13;   // Distinct stacks per table
+  static const int kMaxProbes = 16;
+
+  typedef ProfileData::Slot Slot;
+
+  // Interned stacks.  pool holds one record per distinct stack, laid
+  // out as in the profile file: count, depth, then the pcs.  index
+  // maps a hash of the stack to the record's offset in pool, or -1.
+  struct StackTable {
+    Slot*    pool;
+    int      used;             // Slots in use in pool
+    int      entries;          // Records in pool
+    int32*   index;
+  };
+
+  StackTable    tables_[2];
+  volatile Atomic32 active_;  // Table 'Add' records into
+  volatile Atomic32 in_add_;  // Set while 'Add' runs
+
+  bool          enabled_;
+  int           period_;        // Sampling period (microseconds)
+  int           chunk_seconds_;
+  char*         fname_;         // Chunk file name prefix
+  time_t        start_time_;    // Start time, or 0
+  ProfileData::TrailerWriter trailer_writer_;
+  void*         trailer_writer_arg_;
+
+  // Touched only by 'Add'.
+  int           count_;         // How many samples recorded
+  int           dropped_;       // How many samples found no room
+
+  // Protected by io_lock_.
+  pthread_mutex_t io_lock_;
+  pthread_cond_t  wakeup_;      // Wakes the writer thread early
+  int           out_;           // fd for the current chunk, or -1
+  int           chunk_;         // Number of the current chunk
+  char          chunk_name_[1024];
+  time_t        chunk_start_;   // When the current chunk was started
+  size_t        total_bytes_;   // How much output
+  bool          stop_writer_;
+  pthread_t     writer_;
+
+  static void* WriterMain(void* arg);
+  void RunWriter();
+
+  // Make the other table active, wait for any 'Add' still using the
+  // old one, then write it out and clear it.
+  void DrainLocked();
+  void OpenChunkLocked();
+  void FinishChunkLocked();
+  void StopWriter();
+  // Release everything; with 'write', first write out the remaining
+  // samples and finish the current chunk.
+  void Shutdown(bool write);
+
+  DISALLOW_COPY_AND_ASSIGN(ProfileStream);
+};
+
 #endif  // BASE_PROFILEDATA_H_
@@ -44,6 +44,9 @@
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>  // for getpid()
 #endif
+#ifdef __linux__
+#include <sys/syscall.h>  // for SYS_gettid
+#endif
 #if defined(HAVE_SYS_UCONTEXT_H)
 #include <sys/ucontext.h>
 #elif defined(HAVE_UCONTEXT_H)
@@ -55,6 +58,7 @@ typedef ucontext ucontext_t;
 typedef int ucontext_t;   // just to quiet the compiler, mostly
 #endif
 #include <sys/time.h>
+#include <algorithm>
 #include <string>
 #include <gperftools/profiler.h>
 #include <gperftools/stacktrace.h>
@@ -63,6 +67,7 @@ typedef int ucontext_t;   // just to quiet the compiler, mostly
 #include "base/googleinit.h"
 #include "base/spinlock.h"
 #include "base/sysinfo.h"             /* for GetUniquePathFromEnv, etc */
+#include "base/atomicops.h"
 #include "profiledata.h"
 #include "profile-handler.h"
 #ifdef HAVE_CONFLICT_SIGNAL_H
@@ -76,6 +81,232 @@ DEFINE_bool(cpu_profiler_unittest,
             "Determines whether or not we are running under the \
              control of a unit test. This allows us to include or \
 			 exclude certain behaviours.");
+DEFINE_int32(cpu_profile_chunk_seconds,
+             EnvToInt("CPUPROFILE_CHUNK_SECONDS", -1),
+             "If non-negative, write the profile as a series of "
+             "self-contained chunks, <profile>.0001, <profile>.0002, ..., "
+             "from a background thread, starting a new chunk every this "
+             "many seconds (0: only when ProfilerRotate() is called).");
+DEFINE_bool(cpu_profile_thread_tags,
+            EnvToBool("CPUPROFILE_THREAD_TAGS", false),
+            "If true, end every sample's stack with an entry naming the "
+            "thread it was taken on, by thread id and the label set with "
+            "ProfilerSetThreadLabel(), so pprof can split the profile by "
+            "thread.");
+
+//----------------------------------------------------------------------
+// Thread labels, filters and tags
+//
+// A thread may give itself a label with ProfilerSetThreadLabel().
+// ProfilerIncludeThreads() and ProfilerExcludeThreads() select the
+// threads to profile by label prefix; samples from other threads are
+// dropped before their stack is unwound, which is most of the cost of
+// a sample.
+//
+// With CPUPROFILE_THREAD_TAGS, each sample's stack gets one more
+// outermost entry: a fake pc, kThreadTagBase + 16 * n + 8, for the
+// n'th (thread id, label) pair seen in this profile.  The pairs are
+// listed after the memory map as
+//    thread-tag 0x<fake pc> <thread id> <label>
+// and pprof shows each fake pc as a "thread <id> <label>" frame.
+//----------------------------------------------------------------------
+
+static const int kMaxThreadLabel = 32;
+static const int kMaxThreadFilters = 16;
+static const int kMaxThreadTags = 1024;
+// Never a user-space pc: on 64-bit systems the top 16 MB below the
+// addresses pprof drops as bogus, which are not canonical; on 32-bit
+// ones the top 16 MB of the address space.
+static const uintptr_t kThreadTagBase =
+    sizeof(uintptr_t) > 4
+    ? (~static_cast<uintptr_t>(0) >> 1) & ~static_cast<uintptr_t>(0xffffff)
+    : ~static_cast<uintptr_t>(0) << 24;
+
+struct ThreadFilter {
+  char prefix[kMaxThreadLabel];
+  bool include;
+};
+
+// Written under filter_lock.  The signal handler reads them without a
+// lock, and retries later if filter_seq was odd or changed meanwhile.
+static SpinLock filter_lock(SpinLock::LINKER_INITIALIZED);
+static ThreadFilter thread_filters[kMaxThreadFilters];
+static int num_thread_filters = 0;
+static volatile Atomic32 filter_seq = 0;
+
+struct ThreadTag {
+  volatile Atomic32 ready;   // Set once tid and label are filled in
+  int  tid;
+  char label[kMaxThreadLabel];
+};
+
+// Entries are claimed and filled in by the signal handler, and read
+// when the profile is written.  The extra entry at the end stands for
+// all threads seen after the table filled up.
+static ThreadTag thread_tags[kMaxThreadTags + 1];
+static volatile Atomic32 num_thread_tags = 0;
+static volatile Atomic32 thread_tag_epoch = 0;   // Bumped per profile
+
+#ifdef HAVE_TLS
+struct ThreadProfileState {
+  char label[kMaxThreadLabel];
+  volatile int label_version;   // Odd while the label is being changed
+
+  // Whether the filters include this thread, as of filter_seq and
+  // label_version.
+  bool filter_valid;
+  bool included;
+  int  filter_seq;
+  int  filter_label_version;
+
+  // This thread's entry in thread_tags, as of thread_tag_epoch and
+  // label_version.
+  int  tag_epoch;
+  int  tag_label_version;
+  int  tag_index;
+};
+
+static __thread ThreadProfileState thread_profile_state ATTR_INITIAL_EXEC;
+
+static bool LabelHasPrefix(const char* label, const char* prefix) {
+  for (; *prefix != '\0'; prefix++, label++) {
+    if (*label != *prefix) return false;
+  }
+  return true;
+}
+
+// Safe to call from the signal handler.
+static bool ThreadIncluded(ThreadProfileState* ts) {
+  const int version = ts->label_version;
+  const int seq = base::subtle::Acquire_Load(&filter_seq);
+  if (ts->filter_valid && ts->filter_seq == seq &&
+      ts->filter_label_version == version) {
+    return ts->included;
+  }
+  if ((seq & 1) || (version & 1)) {
+    // Interrupted a change; go by what we knew before.
+    return ts->filter_valid ? ts->included : true;
+  }
+
+  bool any_include = false;
+  bool included = false;
+  bool excluded = false;
+  for (int i = 0; i < num_thread_filters; i++) {
+    const ThreadFilter& f = thread_filters[i];
+    const bool match = LabelHasPrefix(ts->label, f.prefix);
+    if (f.include) {
+      any_include = true;
+      included |= match;
+    } else {
+      excluded |= match;
+    }
+  }
+  base::subtle::MemoryBarrier();
+  if (base::subtle::NoBarrier_Load(&filter_seq) != seq) {
+    return ts->filter_valid ? ts->included : true;
+  }
+
+  ts->included = (included || !any_include) && !excluded;
+  ts->filter_seq = seq;
+  ts->filter_label_version = version;
+  ts->filter_valid = true;
+  return ts->included;
+}
+
+// Safe to call from the signal handler.
+static void* ThreadTagPC(ThreadProfileState* ts) {
+  const int epoch = base::subtle::Acquire_Load(&thread_tag_epoch);
+  const int version = ts->label_version;
+  if (ts->tag_epoch != epoch ||
+      (ts->tag_label_version != version && !(version & 1))) {
+    int index = kMaxThreadTags;
+    Atomic32 n = base::subtle::NoBarrier_Load(&num_thread_tags);
+    while (n < kMaxThreadTags) {
+      const Atomic32 prev = base::subtle::NoBarrier_CompareAndSwap(
+          &num_thread_tags, n, n + 1);
+      if (prev == n) {
+        index = n;
+        break;
+      }
+      n = prev;
+    }
+    if (index < kMaxThreadTags) {
+      ThreadTag* tag = &thread_tags[index];
+#if defined(__linux__) && defined(SYS_gettid)
+      tag->tid = syscall(SYS_gettid);
+#else
+      tag->tid = getpid();
+#endif
+      if (version & 1) {
+        strcpy(tag->label, "?");
+      } else {
+        memcpy(tag->label, ts->label, sizeof(tag->label));
+      }
+      base::subtle::Release_Store(&tag->ready, 1);
+    }
+    ts->tag_epoch = epoch;
+    ts->tag_label_version = version;
+    ts->tag_index = index;
+  }
+  return reinterpret_cast<void*>(kThreadTagBase + 16 * ts->tag_index + 8);
+}
+#endif  // HAVE_TLS
+
+// Called when a profile starts, while the signal handler is not
+// registered.
+static void ResetThreadTags() {
+  base::subtle::NoBarrier_Store(&num_thread_tags, 0);
+  for (int i = 0; i < kMaxThreadTags; i++) {
+    base::subtle::NoBarrier_Store(&thread_tags[i].ready, 0);
+  }
+  ThreadTag* other = &thread_tags[kMaxThreadTags];
+  other->tid = 0;
+  strcpy(other->label, "(other threads)");
+  base::subtle::Release_Store(&other->ready, 1);
+  const Atomic32 epoch = base::subtle::NoBarrier_Load(&thread_tag_epoch);
+  base::subtle::Release_Store(&thread_tag_epoch, epoch + 1);
+}
+
+static void WriteThreadTag(int fd, int index) {
+  const ThreadTag& tag = thread_tags[index];
+  if (!base::subtle::Acquire_Load(&tag.ready)) {
+    return;
+  }
+  char line[128];
+  int len = snprintf(line, sizeof(line),
+                     "thread-tag 0x%" PRIxPTR " %d %.*s\n",
+                     kThreadTagBase + 16 * index + 8, tag.tid,
+                     kMaxThreadLabel, tag.label);
+  if (len > 0) {
+    RawWrite(fd, line, std::min<int>(len, sizeof(line) - 1));
+  }
+}
+
+// ProfileData::TrailerWriter listing the tags handed out so far.
+static void WriteThreadTags(int fd, void*) {
+  const int n = base::subtle::Acquire_Load(&num_thread_tags);
+  for (int i = 0; i < n; i++) {
+    WriteThreadTag(fd, i);
+  }
+  WriteThreadTag(fd, kMaxThreadTags);
+}
+
+static int AddThreadFilter(const char* prefix, bool include) {
+  SpinLockHolder l(&filter_lock);
+  if (num_thread_filters == kMaxThreadFilters) {
+    return 0;
+  }
+  const int seq = base::subtle::NoBarrier_Load(&filter_seq);
+  base::subtle::Release_Store(&filter_seq, seq + 1);
+  base::subtle::MemoryBarrier();
+  ThreadFilter* f = &thread_filters[num_thread_filters];
+  strncpy(f->prefix, prefix, sizeof(f->prefix));
+  f->prefix[sizeof(f->prefix) - 1] = '\0';
+  f->include = include;
+  num_thread_filters++;
+  base::subtle::Release_Store(&filter_seq, seq + 2);
+  return 1;
+}
 
 // Collects up all profile data. This is a singleton, which is
 // initialized by a constructor at startup. If no cpu profiler
@@ -100,6 +331,9 @@ class CpuProfiler {
   // Write the data to disk (and continue profiling).
   void FlushTable();
 
+  // Finish the current chunk of a streamed profile and start the next.
+  bool Rotate();
+
   bool Enabled();
 
   void GetCurrentState(ProfilerState* state);
@@ -119,6 +353,15 @@ class CpuProfiler {
   SpinLock      lock_;
   ProfileData   collector_;
 
+  // Used instead of collector_ when the profile is streamed in chunks.
+  // Set at start, read-only while running.
+  ProfileStream stream_;
+  bool          streaming_;
+
+  // Whether samples end with a thread tag.  Set at start, read-only
+  // while running.
+  bool          tag_threads_;
+
   // Filter function and its argument, if any.  (NULL means include all
   // samples).  Set at start, read-only while running.  Written while holding
   // lock_, read and executed in the context of SIGPROF interrupt.
@@ -178,7 +421,9 @@ CpuProfiler CpuProfiler::instance_;
 
 // Initialize profiling: activated if getenv("CPUPROFILE") exists.
 CpuProfiler::CpuProfiler()
-    : prof_handler_token_(NULL) {
+    : streaming_(false),
+      tag_threads_(false),
+      prof_handler_token_(NULL) {
   // TODO(cgd) Move this code *out* of the CpuProfile constructor into a
   // separate object responsible for initialization. With ProfileHandler there
   // is no need to limit the number of profilers.
@@ -231,17 +476,38 @@ CpuProfiler::CpuProfiler()
 bool CpuProfiler::Start(const char* fname, const ProfilerOptions* options) {
   SpinLockHolder cl(&lock_);
 
-  if (collector_.enabled()) {
+  if (collector_.enabled() || stream_.enabled()) {
     return false;
   }
 
   ProfileHandlerState prof_handler_state;
   ProfileHandlerGetState(&prof_handler_state);
 
-  ProfileData::Options collector_options;
-  collector_options.set_frequency(prof_handler_state.frequency);
-  if (!collector_.Start(fname, collector_options)) {
-    return false;
+#ifdef HAVE_TLS
+  tag_threads_ = FLAGS_cpu_profile_thread_tags;
+#endif
+  ProfileData::TrailerWriter trailer_writer = NULL;
+  if (tag_threads_) {
+    ResetThreadTags();
+    trailer_writer = WriteThreadTags;
+  }
+
+  streaming_ = FLAGS_cpu_profile_chunk_seconds >= 0;
+  if (streaming_) {
+    ProfileStream::Options stream_options;
+    stream_options.set_frequency(prof_handler_state.frequency);
+    stream_options.set_chunk_seconds(FLAGS_cpu_profile_chunk_seconds);
+    stream_options.set_trailer_writer(trailer_writer, NULL);
+    if (!stream_.Start(fname, stream_options)) {
+      return false;
+    }
+  } else {
+    ProfileData::Options collector_options;
+    collector_options.set_frequency(prof_handler_state.frequency);
+    collector_options.set_trailer_writer(trailer_writer, NULL);
+    if (!collector_.Start(fname, collector_options)) {
+      return false;
+    }
   }
 
   filter_ = NULL;
@@ -264,7 +530,7 @@ CpuProfiler::~CpuProfiler() {
 void CpuProfiler::Stop() {
   SpinLockHolder cl(&lock_);
 
-  if (!collector_.enabled()) {
+  if (!collector_.enabled() && !stream_.enabled()) {
     return;
   }
 
@@ -274,12 +540,21 @@ void CpuProfiler::Stop() {
 
   // DisableHandler waits for the currently running callback to complete and
   // guarantees no future invocations. It is safe to stop the collector.
-  collector_.Stop();
+  if (streaming_) {
+    stream_.Stop();
+  } else {
+    collector_.Stop();
+  }
 }
 
 void CpuProfiler::FlushTable() {
   SpinLockHolder cl(&lock_);
 
+  if (stream_.enabled()) {
+    // ProfileStream::Add may run concurrently with flushing.
+    stream_.FlushTable();
+    return;
+  }
   if (!collector_.enabled()) {
     return;
   }
@@ -295,16 +570,25 @@ void CpuProfiler::FlushTable() {
   EnableHandler();
 }
 
+bool CpuProfiler::Rotate() {
+  SpinLockHolder cl(&lock_);
+  return stream_.Rotate();
+}
+
 bool CpuProfiler::Enabled() {
   SpinLockHolder cl(&lock_);
-  return collector_.enabled();
+  return collector_.enabled() || stream_.enabled();
 }
 
 void CpuProfiler::GetCurrentState(ProfilerState* state) {
   ProfileData::State collector_state;
   {
     SpinLockHolder cl(&lock_);
-    collector_.GetCurrentState(&collector_state);
+    if (stream_.enabled()) {
+      stream_.GetCurrentState(&collector_state);
+    } else {
+      collector_.GetCurrentState(&collector_state);
+    }
   }
 
   state->enabled = collector_state.enabled;
@@ -337,6 +621,13 @@ void CpuProfiler::prof_handler(int sig, siginfo_t*, void* signal_ucontext,
                                void* cpu_profiler) {
   CpuProfiler* instance = static_cast<CpuProfiler*>(cpu_profiler);
 
+#ifdef HAVE_TLS
+  ThreadProfileState* ts = &thread_profile_state;
+  if (!ThreadIncluded(ts)) {
+    return;
+  }
+#endif
+
   if (instance->filter_ == NULL ||
       (*instance->filter_)(instance->filter_arg_)) {
     void* stack[ProfileData::kMaxStackDepth];
@@ -366,7 +657,20 @@ void CpuProfiler::prof_handler(int sig, siginfo_t*, void* signal_ucontext,
       depth++;  // To account for pc value in stack[0];
     }
 
-    instance->collector_.Add(depth, used_stack);
+#ifdef HAVE_TLS
+    if (instance->tag_threads_) {
+      // The tag replaces the outermost frame of a truncated stack.
+      const int room = stack + arraysize(stack) - used_stack;
+      if (depth >= room) depth = room - 1;
+      used_stack[depth++] = ThreadTagPC(ts);
+    }
+#endif
+
+    if (instance->streaming_) {
+      instance->stream_.Add(depth, used_stack);
+    } else {
+      instance->collector_.Add(depth, used_stack);
+    }
   }
 }
 
@@ -380,6 +684,43 @@ extern "C" PERFTOOLS_DLL_DECL void ProfilerFlush() {
   CpuProfiler::instance_.FlushTable();
 }
 
+extern "C" PERFTOOLS_DLL_DECL void ProfilerSetThreadLabel(const char* label) {
+#ifdef HAVE_TLS
+  ThreadProfileState* ts = &thread_profile_state;
+  ts->label_version++;
+  base::subtle::MemoryBarrier();
+  int i = 0;
+  for (; label != NULL && label[i] != '\0' && i < kMaxThreadLabel - 1; i++) {
+    ts->label[i] = (label[i] == '\n') ? ' ' : label[i];
+  }
+  ts->label[i] = '\0';
+  base::subtle::MemoryBarrier();
+  ts->label_version++;
+#endif
+}
+
+extern "C" PERFTOOLS_DLL_DECL int ProfilerIncludeThreads(
+    const char* label_prefix) {
+  return AddThreadFilter(label_prefix, true);
+}
+
+extern "C" PERFTOOLS_DLL_DECL int ProfilerExcludeThreads(
+    const char* label_prefix) {
+  return AddThreadFilter(label_prefix, false);
+}
+
+extern "C" PERFTOOLS_DLL_DECL void ProfilerClearThreadFilters() {
+  SpinLockHolder l(&filter_lock);
+  const int seq = base::subtle::NoBarrier_Load(&filter_seq);
+  base::subtle::Release_Store(&filter_seq, seq + 1);
+  num_thread_filters = 0;
+  base::subtle::Release_Store(&filter_seq, seq + 2);
+}
+
+extern "C" PERFTOOLS_DLL_DECL int ProfilerRotate() {
+  return CpuProfiler::instance_.Rotate();
+}
+
 extern "C" PERFTOOLS_DLL_DECL int ProfilingIsEnabledForAllThreads() {
   return CpuProfiler::instance_.Enabled();
 }
@@ -410,6 +751,11 @@ extern "C" PERFTOOLS_DLL_DECL void ProfilerGetCurrentState(
 // disabled under Cygwin.
 extern "C" void ProfilerRegisterThread() { }
 extern "C" void ProfilerFlush() { }
+extern "C" int ProfilerRotate() { return 0; }
+extern "C" void ProfilerSetThreadLabel(const char* label) { }
+extern "C" int ProfilerIncludeThreads(const char* label_prefix) { return 0; }
+extern "C" int ProfilerExcludeThreads(const char* label_prefix) { return 0; }
+extern "C" void ProfilerClearThreadFilters() { }
 extern "C" int ProfilingIsEnabledForAllThreads() { return 0; }
 extern "C" int ProfilerStart(const char* fname) { return 0; }
 extern "C" int ProfilerStartWithOptions(const char *fname,
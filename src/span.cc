@@ -36,6 +36,7 @@
 
 #include <string.h>                     // for NULL, memset
 
+#include "base/spinlock.h"      // for SpinLockHolder
 #include "internal_logging.h"  // for ASSERT
 #include "page_heap_allocator.h"  // for PageHeapAllocator
 #include "static_vars.h"       // for Static
@@ -52,7 +53,11 @@ void Event(Span* span, char op, int v = 0) {
 #endif
 
 Span* NewSpan(PageID p, Length len) {
-  Span* span = Static::span_allocator()->New();
+  Span* span;
+  {
+    SpinLockHolder h(Static::span_allocator_lock());
+    span = Static::span_allocator()->New();
+  }
   memset(span, 0, sizeof(*span));
   span->start = p;
   span->length = len;
@@ -77,6 +82,7 @@ void DeleteSpan(Span* span) {
   // In debug mode, trash the contents of deleted Spans
   memset(span, 0x3f, sizeof(*span));
 #endif
+  SpinLockHolder h(Static::span_allocator_lock());
   Static::span_allocator()->Delete(span);
 }
 
@@ -84,6 +84,7 @@ struct Span {
   unsigned int  sizeclass : 8;  // Size-class for small objects (or 0)
   unsigned int  location : 2;   // Is the span on a freelist, and if so, which?
   unsigned int  sample : 1;     // Sampled object?
+  unsigned int  arena : 4;      // Owning Arena's id, or 0 for the main heap
   bool          has_span_iter : 1; // Iff span_iter_space has valid
                                    // iterator. Only for debug builds.
 
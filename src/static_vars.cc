@@ -34,15 +34,24 @@
 #include <config.h>
 #include "static_vars.h"
 #include <stddef.h>                     // for NULL
+#include <stdlib.h>                     // for strtol
 #include <new>                          // for operator new
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>                // for SYS_gettid
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>                     // for syscall
+#endif
 #ifdef HAVE_PTHREAD
 #include <pthread.h>                    // for pthread_atfork
 #endif
 #include "internal_logging.h"  // for CHECK_CONDITION
 #include "common.h"
+#include "cpu_cache.h"         // for CpuCache
 #include "sampler.h"           // for Sampler
 #include "getenv_safe.h"       // TCMallocGetenvSafe
 #include "base/googleinit.h"
+#include "base/sysinfo.h"      // for GetSystemCPUsCount, GetSystemCPUNodes
 #include "maybe_threads.h"
 
 namespace tcmalloc {
@@ -54,10 +63,12 @@ namespace tcmalloc {
 
 	void CentralCacheLockAll()
 	{
+		CpuCache::LockAll();
 		for(int i=0; i<Static::get_pageheap_count(); i++){
 			Static::pageheap_lock_by_number(i)->Lock();
 		}
 		Static::extended_lock()->Lock();
+		Static::span_allocator_lock()->Lock();
 		for (int i = 0; i < Static::num_size_classes(); ++i)
 			Static::central_cache()[i].Lock();
 	}
@@ -69,20 +80,26 @@ namespace tcmalloc {
 		for(int i=0; i<Static::get_pageheap_count(); i++){
 			Static::pageheap_lock_by_number(i)->Unlock();
 		}
+		Static::span_allocator_lock()->Unlock();
 		Static::extended_lock()->Unlock();
+		CpuCache::UnlockAll();
 	}
 #endif
 
 	bool Static::inited_;
-	SpinLock Static::pageheap_lock_[Static::pageheap_count]; 
+	Static::PageHeapLockPadded Static::pageheap_lock_[Static::kMaxPageHeapShards];
 	SpinLock Static::extended_lock_(SpinLock::LINKER_INITIALIZED);
+	SpinLock Static::span_allocator_lock_(SpinLock::LINKER_INITIALIZED);
 	SizeMap Static::sizemap_;
 	CentralFreeListPadded Static::central_cache_[kClassSizesMax];
 	PageHeapAllocator<Span> Static::span_allocator_;
 	PageHeapAllocator<StackTrace> Static::stacktrace_allocator_;
 	Span Static::sampled_objects_;
 	StackTrace* Static::growth_stacks_ = NULL;
-	Static::PageHeapStorage Static::pageheap_[Static::pageheap_count];
+	Static::PageHeapStorage Static::pageheap_[Static::kMaxPageHeapShards];
+	int Static::pageheap_count_ = 0;
+	int Static::pageheap_nodes_ = 0;
+	unsigned char Static::cpu_to_shard_[Static::kMaxShardedCPUs];
 	Static::ExtendedMemoryStorage Static::extended_memory_;
 	Static::PageMapStorage Static::pagemap_;
 
@@ -98,8 +115,9 @@ namespace tcmalloc {
 			central_cache_[i].Init(i);
 		}
 
-		for(int i=0; i<pageheap_count; i++){
-			new (&pageheap_[i].memory) PageHeap;
+		InitPageHeapShards();
+		for(int i=0; i<pageheap_count_; i++){
+			new (&pageheap_[i].memory) PageHeap(i);
 		}
 		new (&extended_memory_.memory) PageHeap::ExtendedMemory;
 		new (&pagemap_.memory) PageHeap::PageMap;
@@ -123,6 +141,112 @@ namespace tcmalloc {
 		DLL_Init(&sampled_objects_);
 	}
 
+	// Number of cpus sharing one page heap shard by default.  Small
+	// enough that shard locks are rarely contended, large enough that
+	// memory parked on shard free lists stays modest.
+	static const int kCPUsPerPageHeapShard = 4;
+
+	// NUMA nodes with a larger id share shards round-robin.
+	static const int kMaxPageHeapNodes = 64;
+
+	// Every shard needs a PageMap stats slot of its own.
+	COMPILE_ASSERT(PageHeap::PageMap::kMaxStatsSlots
+			>= 1 + Static::kMaxPageHeapShards, too_few_pagemap_stats_slots);
+
+	void Static::InitPageHeapShards() {
+		// Runs once from InitStaticVars(); static to keep it off the stack.
+		static int cpu_to_node[kMaxShardedCPUs];
+		int cpus = GetSystemCPUsCount();
+		int nodes = GetSystemCPUNodes(cpu_to_node, kMaxShardedCPUs);
+		if (cpus < 1) cpus = 1;
+		if (nodes == 0) {
+			// No topology information: treat the machine as one node.
+			for (int cpu = 0; cpu < kMaxShardedCPUs; cpu++) {
+				cpu_to_node[cpu] = cpu < cpus ? 0 : -1;
+			}
+			nodes = 1;
+		}
+
+		// Count cpus per node and give each node a contiguous run of
+		// shards proportional to its size, so that a shard never mixes
+		// cpus from different nodes.
+		int node_cpus[kMaxPageHeapNodes];
+		int node_first_shard[kMaxPageHeapNodes];
+		int node_shards[kMaxPageHeapNodes];
+		int node_seen[kMaxPageHeapNodes];
+		int max_node = -1;
+		int known_cpus = 0;
+		for (int i = 0; i < kMaxPageHeapNodes; i++) {
+			node_cpus[i] = 0;
+			node_seen[i] = 0;
+		}
+		for (int cpu = 0; cpu < kMaxShardedCPUs; cpu++) {
+			const int node = cpu_to_node[cpu];
+			if (node < 0 || node >= kMaxPageHeapNodes) continue;
+			node_cpus[node]++;
+			known_cpus++;
+			if (node > max_node) max_node = node;
+		}
+		if (known_cpus > cpus) cpus = known_cpus;
+
+		int wanted = (cpus + kCPUsPerPageHeapShard - 1) / kCPUsPerPageHeapShard;
+		const char* env = TCMallocGetenvSafe("TCMALLOC_PAGEHEAP_SHARDS");
+		if (env != NULL && strtol(env, NULL, 10) > 0) {
+			wanted = strtol(env, NULL, 10);
+		}
+		if (wanted < nodes) wanted = nodes;
+		if (wanted > kMaxPageHeapShards) wanted = kMaxPageHeapShards;
+
+		int count = 0;
+		for (int node = 0; node <= max_node; node++) {
+			if (node_cpus[node] == 0) continue;
+			int n = (wanted * node_cpus[node] + known_cpus - 1) / known_cpus;
+			if (n < 1) n = 1;
+			if (count + n > kMaxPageHeapShards) n = kMaxPageHeapShards - count;
+			if (n < 1) {
+				// More nodes than shards: share shards between nodes.
+				node_first_shard[node] = node % kMaxPageHeapShards;
+				node_shards[node] = 1;
+				continue;
+			}
+			node_first_shard[node] = count;
+			node_shards[node] = n;
+			count += n;
+		}
+		if (count == 0) count = 1;
+
+		for (int cpu = 0; cpu < kMaxShardedCPUs; cpu++) {
+			const int node = cpu_to_node[cpu];
+			if (node < 0 || node >= kMaxPageHeapNodes || node_cpus[node] == 0) {
+				cpu_to_shard_[cpu] = cpu % count;
+				continue;
+			}
+			cpu_to_shard_[cpu] = node_first_shard[node] +
+				node_seen[node] % node_shards[node];
+			node_seen[node]++;
+		}
+		pageheap_count_ = count;
+		pageheap_nodes_ = nodes;
+	}
+
+	int Static::ThreadPageHeapShard() {
+#ifdef HAVE_TLS
+		// Stores shard + 1 so that zero means "not yet computed".
+		static __thread int cached_shard ATTR_INITIAL_EXEC;
+		if (PREDICT_TRUE(cached_shard != 0)) {
+			return cached_shard - 1;
+		}
+#endif
+		int shard = 0;
+		if (pageheap_count_ > 1) {
+			shard = syscall(SYS_gettid) % pageheap_count_;
+		}
+#ifdef HAVE_TLS
+		cached_shard = shard + 1;
+#endif
+		return shard;
+	}
+
 	void Static::InitLateMaybeRecursive() {
 #if defined(HAVE_FORK) && defined(HAVE_PTHREAD) \
 		&& !defined(__APPLE__) && !defined(TCMALLOC_NO_ATFORK)
@@ -37,6 +37,9 @@
 #define TCMALLOC_STATIC_VARS_H_
 
 #include <config.h>
+#ifdef HAVE_SCHED_H
+#include <sched.h>                      // for sched_getcpu
+#endif
 #include "base/basictypes.h"
 #include "base/spinlock.h"
 #include "central_freelist.h"
@@ -50,27 +53,35 @@ namespace tcmalloc {
 
 	class Static {
 		public:
+			// Upper bounds for the runtime page heap sharding.  The actual
+			// number of shards is picked in InitStaticVars() from the number
+			// of online cpus and the NUMA topology.
+			static const int kMaxPageHeapShards = 64;
+			static const int kMaxShardedCPUs = 1024;
+
 			// Linker initialized, so this lock can be accessed at any time.
+			// Picks the page heap shard of the cpu we are running on and
+			// returns its lock; the shard number is stored in pageheap_rank.
 			static SpinLock* pageheap_lock(int &pageheap_rank) {
-							pid_t thread_id = syscall(__NR_gettid); 
-//				for(int i=0; i<pageheap_count; i++){
-//					if(!pageheap_lock_[i].IsHeld()){
-//						pageheap_rank = i;
-//						Log(kLog, __FILE__, __LINE__,
-//														"------------ pageheap rank requsted: ", pageheap_rank, " ", thread_id
-//							 );
-//						return &pageheap_lock_[i];
-//					}
-//				}
-				pageheap_rank = thread_id % 5;
-//				Log(kLog, __FILE__, __LINE__,
-//												"------------ pageheap rank requsted: ", pageheap_rank
-//					 );
-				return &pageheap_lock_[pageheap_rank];
+				pageheap_rank = CurrentPageHeapShard();
+				return &pageheap_lock_[pageheap_rank].lock;
 			}
 
 			static SpinLock* pageheap_lock_by_number(int num){
-				return &pageheap_lock_[num];
+				return &pageheap_lock_[num].lock;
+			}
+
+			// Returns the page heap shard serving the current cpu.  With
+			// sched_getcpu() this is a read of the kernel maintained
+			// (rseq/vdso) cpu number, so no system call is made.
+			static inline int CurrentPageHeapShard() {
+#ifdef HAVE_SCHED_GETCPU
+				const int cpu = sched_getcpu();
+				if (PREDICT_TRUE(cpu >= 0 && cpu < kMaxShardedCPUs)) {
+					return cpu_to_shard_[cpu];
+				}
+#endif
+				return ThreadPageHeapShard();
 			}
 
 			static SpinLock* extended_lock() { 
@@ -81,6 +92,11 @@ namespace tcmalloc {
 							return &extended_lock_; 
 			}
 
+			// Protects span_allocator().  Nests inside the shard locks and
+			// extended_lock(), so that a shard can allocate the Span objects
+			// for a refill before taking extended_lock().
+			static SpinLock* span_allocator_lock() { return &span_allocator_lock_; }
+
 			// Must be called before calling any of the accessors below.
 			static void InitStaticVars();
 			static void InitLateMaybeRecursive();
@@ -117,18 +133,37 @@ namespace tcmalloc {
 
 			// Check if InitStaticVars() has been run.
 			static bool IsInited() { return inited_; }
-			static const int get_pageheap_count(){
-							return pageheap_count;		
+			static int get_pageheap_count(){
+				return pageheap_count_;
 			}
 
+			// Number of NUMA nodes the page heap shards were spread over.
+			static int get_pageheap_nodes() { return pageheap_nodes_; }
+
 		private:
 			// some unit tests depend on this and link to static vars
 			// imperfectly. Thus we keep those unhidden for now. Thankfully
 			// they're not performance-critical.
 			/* ATTRIBUTE_HIDDEN */ static bool inited_;
-			static const int pageheap_count = 5;
-			/* ATTRIBUTE_HIDDEN */ static SpinLock pageheap_lock_[pageheap_count];
+
+			// Shard locks are padded so that threads on different cpus do
+			// not bounce one cache line between them.
+			struct PageHeapLockPadded {
+				SpinLock lock;
+			} CACHELINE_ALIGNED;
+			/* ATTRIBUTE_HIDDEN */ static PageHeapLockPadded pageheap_lock_[kMaxPageHeapShards];
 			/* ATTRIBUTE_HIDDEN */ static SpinLock extended_lock_;
+			/* ATTRIBUTE_HIDDEN */ static SpinLock span_allocator_lock_;
+
+			// Computes pageheap_count_ and cpu_to_shard_.
+			static void InitPageHeapShards();
+
+			// Shard for threads whose cpu is unknown.  Cached per thread.
+			static int ThreadPageHeapShard();
+
+			/* ATTRIBUTE_HIDDEN */ static int pageheap_count_;
+			/* ATTRIBUTE_HIDDEN */ static int pageheap_nodes_;
+			/* ATTRIBUTE_HIDDEN */ static unsigned char cpu_to_shard_[kMaxShardedCPUs];
 
 			// These static variables require explicit initialization.  We cannot
 			// count on their constructors to do any initialization because other
@@ -154,7 +189,7 @@ namespace tcmalloc {
 				char memory[sizeof(PageHeap)];
 				uintptr_t extra;  // To force alignment
 			};
-			ATTRIBUTE_HIDDEN static PageHeapStorage pageheap_[pageheap_count];
+			ATTRIBUTE_HIDDEN static PageHeapStorage pageheap_[kMaxPageHeapShards];
 
 			union ExtendedMemoryStorage {
 				char memory[sizeof(PageHeap::ExtendedMemory)];
@@ -162,10 +197,11 @@ namespace tcmalloc {
 			};
 			ATTRIBUTE_HIDDEN static ExtendedMemoryStorage extended_memory_;
 
+			// PageMap keeps its stats in cache-line-aligned slots.
 			union PageMapStorage {
 				char memory[sizeof(PageHeap::PageMap)];
 				uintptr_t extra;  // To force alignment
-			};
+			} CACHELINE_ALIGNED;
 			ATTRIBUTE_HIDDEN static PageMapStorage pagemap_;
 	};
 
@@ -55,6 +55,7 @@
 #include "base/spinlock.h"              // for SpinLockHolder, SpinLock, etc
 #include "common.h"
 #include "internal_logging.h"
+#include "system-alloc.h"
 
 // On systems (like freebsd) that don't define MAP_ANONYMOUS, use the old
 // form of the name instead.
@@ -140,6 +141,12 @@ DEFINE_bool(malloc_disable_memory_release,
             EnvToBool("TCMALLOC_DISABLE_MEMORY_RELEASE", false),
             "Whether MADV_FREE/MADV_DONTNEED should be used"
             " to return unused memory to the system.");
+DEFINE_int32(malloc_hugepages,
+             EnvToInt("TCMALLOC_HUGEPAGES", 0),
+             "Whether to back the heap with 2MiB huge pages.  0 disables,"
+             " 1 grows the heap in whole, aligned huge pages and advises"
+             " MADV_HUGEPAGE (transparent huge pages), 2 also tries"
+             " MAP_HUGETLB from the reserved hugetlbfs pool first.");
 
 // static allocators
 class SbrkSysAllocator : public SysAllocator {
@@ -218,6 +225,11 @@ void* SbrkSysAllocator::Alloc(size_t size, size_t *actual_size,
   if (FLAGS_malloc_skip_sbrk) {
     return NULL;
   }
+  // sbrk comes first in release builds; in hugetlbfs mode leave the
+  // heap to MmapSysAllocator, which tries MAP_HUGETLB.
+  if (FLAGS_malloc_hugepages >= 2) {
+    return NULL;
+  }
 
   // sbrk will release memory if passed a negative number, so we do
   // a strict check here
@@ -311,6 +323,22 @@ void* MmapSysAllocator::Alloc(size_t size, size_t *actual_size,
     extra = alignment - pagesize;
   }
 
+#ifdef MAP_HUGETLB
+  // hugetlbfs mappings are always huge page aligned, and fail quickly
+  // if the reserved pool is exhausted, in which case we fall back to
+  // transparent huge pages.
+  if (FLAGS_malloc_hugepages >= 2 && alignment <= kHugePageSize &&
+      (size & (kHugePageSize - 1)) == 0) {
+    void* result = mmap(NULL, size,
+                        PROT_READ|PROT_WRITE,
+                        MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,
+                        -1, 0);
+    if (result != reinterpret_cast<void*>(MAP_FAILED)) {
+      return result;
+    }
+  }
+#endif
+
   // Note: size + extra does not overflow since:
   //            size + alignment < (1<<NBITS).
   // and        extra <= alignment
@@ -506,10 +534,24 @@ void* TCMalloc_SystemAlloc(size_t size, size_t *actual_size,
     CHECK_CONDITION(
       CheckAddressBits(reinterpret_cast<uintptr_t>(result) + *actual_size - 1));
     TCMalloc_SystemTaken += *actual_size;
+#ifdef MADV_HUGEPAGE
+    // Callers that want huge pages ask for whole, aligned ones (see
+    // ExtendedMemory::GrowHeap()).  The advice is only a hint: a kernel
+    // without transparent huge pages ignores it.
+    if (TCMalloc_HugePagesEnabled() &&
+        (reinterpret_cast<uintptr_t>(result) & (kHugePageSize - 1)) == 0 &&
+        (*actual_size & (kHugePageSize - 1)) == 0) {
+      madvise(reinterpret_cast<char*>(result), *actual_size, MADV_HUGEPAGE);
+    }
+#endif
   }
   return result;
 }
 
+bool TCMalloc_HugePagesEnabled() {
+  return FLAGS_malloc_hugepages > 0;
+}
+
 bool TCMalloc_SystemRelease(void* start, size_t length) {
 #ifdef MADV_FREE
   if (FLAGS_malloc_devmem_start) {
@@ -519,7 +561,11 @@ bool TCMalloc_SystemRelease(void* start, size_t length) {
   }
   if (FLAGS_malloc_disable_memory_release) return false;
   if (pagesize == 0) pagesize = getpagesize();
-  const size_t pagemask = pagesize - 1;
+  // Releasing part of a huge page would make the kernel split it.
+  const size_t release_size =
+      TCMalloc_HugePagesEnabled() && kHugePageSize > pagesize
+      ? kHugePageSize : pagesize;
+  const size_t pagemask = release_size - 1;
 
   size_t new_start = reinterpret_cast<size_t>(start);
   size_t end = new_start + length;
@@ -527,7 +573,7 @@ bool TCMalloc_SystemRelease(void* start, size_t length) {
 
   // Round up the starting address and round down the ending address
   // to be page aligned:
-  new_start = (new_start + pagesize - 1) & ~pagemask;
+  new_start = (new_start + release_size - 1) & ~pagemask;
   new_end = new_end & ~pagemask;
 
   ASSERT((new_start & pagemask) == 0);
@@ -548,6 +594,39 @@ bool TCMalloc_SystemRelease(void* start, size_t length) {
   return false;
 }
 
+bool TCMalloc_SystemMove(void* from, void* to, size_t length) {
+#if defined(HAVE_MMAP) && defined(MREMAP_FIXED)
+  // /dev/mem and hugetlbfs mappings cannot be replaced by ordinary
+  // anonymous memory below.
+  if (FLAGS_malloc_devmem_start || FLAGS_malloc_hugepages >= 2) {
+    return false;
+  }
+  void* result = mremap(from, length, length, MREMAP_MAYMOVE|MREMAP_FIXED, to);
+  if (result == MAP_FAILED) {
+    return false;
+  }
+  ASSERT(result == to);
+  // mremap leaves a hole where the pages were; the heap still owns
+  // that range, so map fresh pages there.
+  result = mmap(from, length, PROT_READ|PROT_WRITE,
+                MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0);
+  if (result == MAP_FAILED) {
+    tcmalloc::Log(tcmalloc::kCrash, __FILE__, __LINE__,
+                  "Cannot refill range after moving its pages", from, length);
+  }
+#ifdef MADV_HUGEPAGE
+  // The fresh mapping does not inherit the MADV_HUGEPAGE advice that
+  // TCMalloc_SystemAlloc() gave the range; give it again.
+  if (TCMalloc_HugePagesEnabled()) {
+    madvise(from, length, MADV_HUGEPAGE);
+  }
+#endif
+  return true;
+#else
+  return false;
+#endif
+}
+
 void TCMalloc_SystemCommit(void* start, size_t length) {
   // Nothing to do here.  TCMalloc_SystemRelease does not alter pages
   // such that they need to be re-committed before they can be used by the
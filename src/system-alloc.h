@@ -72,6 +72,8 @@ void* TCMalloc_SystemAlloc(size_t bytes, size_t *actual_bytes,
 // performance.  (Only pages fully covered by the memory region will
 // be released, partial pages will not.)
 //
+// With huge pages enabled only whole huge pages are released.
+//
 // Returns false if release failed or not supported.
 extern PERFTOOLS_DLL_DECL
 bool TCMalloc_SystemRelease(void* start, size_t length);
@@ -83,6 +85,25 @@ bool TCMalloc_SystemRelease(void* start, size_t length);
 extern PERFTOOLS_DLL_DECL
 void TCMalloc_SystemCommit(void* start, size_t length);
 
+// Moves the pages backing [from, from + length) to [to, to + length)
+// by remapping them, without copying their contents.  The old range is
+// left mapped, but its contents are gone.  Both ranges must be
+// page-aligned heap memory and must not overlap.
+//
+// Returns false, changing nothing, if moving is not supported.
+extern PERFTOOLS_DLL_DECL
+bool TCMalloc_SystemMove(void* from, void* to, size_t length);
+
+// Size of the huge pages used when TCMALLOC_HUGEPAGES is set.
+static const size_t kHugePageSize = 2 << 20;
+
+// Returns true if the heap should be grown in whole, aligned huge pages.
+// TCMalloc_SystemAlloc() then backs such requests with huge pages, and
+// TCMalloc_SystemRelease() only releases whole huge pages so that the
+// kernel never has to split them.
+extern PERFTOOLS_DLL_DECL
+bool TCMalloc_HugePagesEnabled();
+
 // The current system allocator.
 extern PERFTOOLS_DLL_DECL SysAllocator* tcmalloc_sys_alloc;
 
@@ -101,7 +101,9 @@
 #else
 #include <sys/types.h>
 #endif
+#include <stdarg.h>                     // for va_list, va_start
 #include <stddef.h>                     // for size_t, NULL
+#include <stdio.h>                      // for vsnprintf
 #include <stdlib.h>                     // for getenv
 #include <string.h>                     // for strcmp, memset, strlen, etc
 #ifdef HAVE_UNISTD_H
@@ -115,14 +117,20 @@
 #include <gperftools/malloc_extension.h>
 #include <gperftools/malloc_hook.h>         // for MallocHook
 #include <gperftools/nallocx.h>
+#include "alloc_latency.h"              // for AllocLatency
+#include "arena.h"                      // for Arena
+#include "background_thread.h"          // for BackgroundThread
+#include "heap_limit.h"                 // for HeapLimit
 #include "base/basictypes.h"            // for int64
 #include "base/commandlineflags.h"      // for RegisterFlagValidator, etc
 #include "base/dynamic_annotations.h"   // for RunningOnValgrind
 #include "base/spinlock.h"              // for SpinLockHolder
 #include "central_freelist.h"  // for CentralFreeListPadded
 #include "common.h"            // for StackTrace, kPageShift, etc
+#include "cpu_cache.h"         // for CpuCache
 #include "internal_logging.h"  // for ASSERT, TCMalloc_Printer, etc
 #include "linked_list.h"       // for SLL_SetNext
+#include "lock_profile.h"      // for LockProfile
 #include "malloc_hook-inl.h"       // for MallocHook::InvokeNewHook, etc
 #include "page_heap.h"         // for PageHeap, PageHeap::Stats
 #include "page_heap_allocator.h"  // for PageHeapAllocator
@@ -150,9 +158,15 @@ using STL_NAMESPACE::vector;
 #include "libc_override.h"
 
 using tcmalloc::AlignmentForSize;
+using tcmalloc::AllocLatency;
+using tcmalloc::Arena;
+using tcmalloc::BackgroundThread;
+using tcmalloc::HeapLimit;
 using tcmalloc::kLog;
 using tcmalloc::kCrash;
 using tcmalloc::kCrashWithStats;
+using tcmalloc::CpuCache;
+using tcmalloc::LockProfile;
 using tcmalloc::Log;
 using tcmalloc::PageHeap;
 using tcmalloc::PageHeapAllocator;
@@ -231,6 +245,12 @@ extern "C" {
       ATTRIBUTE_SECTION(google_malloc);
   void tc_cfree(void* ptr) PERFTOOLS_NOTHROW
       ATTRIBUTE_SECTION(google_malloc);
+  size_t tc_malloc_batch(size_t size, void** ptrs, size_t count) PERFTOOLS_NOTHROW
+      ATTRIBUTE_SECTION(google_malloc);
+  void tc_free_batch(void** ptrs, size_t count, size_t size) PERFTOOLS_NOTHROW
+      ATTRIBUTE_SECTION(google_malloc);
+  void* tc_arena_malloc(int arena, size_t size) PERFTOOLS_NOTHROW
+      ATTRIBUTE_SECTION(google_malloc);
 
   void* tc_memalign(size_t __alignment, size_t __size) PERFTOOLS_NOTHROW
       ATTRIBUTE_SECTION(google_malloc);
@@ -348,12 +368,67 @@ size_t InvalidGetAllocatedSize(const void* ptr) {
 // Extract interesting stats
 struct TCMallocStats {
   uint64_t thread_bytes;      // Bytes in thread caches
+  uint64_t cpu_bytes;         // Bytes in per-cpu caches
   uint64_t central_bytes;     // Bytes in central cache
   uint64_t transfer_bytes;    // Bytes in central transfer cache
   uint64_t metadata_bytes;    // Bytes alloced for metadata
   PageHeap::PageMap::Stats pageheap;   // Stats from page heap
 };
 
+// Sums the 1-page span free lists of all page heap shards.  Takes
+// one shard lock at a time.
+static void GetAllSmallSpanStats(PageHeap::SmallSpanStats* result) {
+  result->normal_length = 0;
+  result->returned_length = 0;
+  for (int i = 0; i < Static::get_pageheap_count(); i++) {
+    PageHeap::SmallSpanStats shard;
+    SpinLockHolder h(Static::pageheap_lock_by_number(i));
+    Static::pageheap(i)->GetSmallSpanStats(&shard);
+    result->normal_length += shard.normal_length;
+    result->returned_length += shard.returned_length;
+  }
+}
+
+// Handles the "tcmalloc.pageheap_shard.<N>.<stat>" properties.
+static bool GetPageHeapShardProperty(const char* name, size_t* value) {
+  static const char kPrefix[] = "tcmalloc.pageheap_shard.";
+  if (strncmp(name, kPrefix, sizeof(kPrefix) - 1) != 0) {
+    return false;
+  }
+  const char* number = name + sizeof(kPrefix) - 1;
+  char* end;
+  const long shard = strtol(number, &end, 10);
+  if (end == number || *end != '.' ||
+      shard < 0 || shard >= Static::get_pageheap_count()) {
+    return false;
+  }
+  const char* stat = end + 1;
+
+  PageHeap::SmallSpanStats small;
+  PageHeap::ShardStats shard_stats;
+  {
+    SpinLockHolder h(Static::pageheap_lock_by_number(shard));
+    Static::pageheap(shard)->GetSmallSpanStats(&small);
+    Static::pageheap(shard)->GetShardStats(&shard_stats);
+  }
+  if (strcmp(stat, "free_bytes") == 0) {
+    *value = small.normal_length << kPageShift;
+  } else if (strcmp(stat, "unmapped_bytes") == 0) {
+    *value = small.returned_length << kPageShift;
+  } else if (strcmp(stat, "scavenge_count") == 0) {
+    *value = shard_stats.scavenge_count;
+  } else if (strcmp(stat, "total_decommit_bytes") == 0) {
+    *value = shard_stats.released_pages << kPageShift;
+  } else if (strcmp(stat, "refill_count") == 0) {
+    *value = shard_stats.refill_count;
+  } else if (strcmp(stat, "refill_bytes") == 0) {
+    *value = shard_stats.refill_pages << kPageShift;
+  } else {
+    return false;
+  }
+  return true;
+}
+
 // Get stats into "r".  Also, if class_count != NULL, class_count[k]
 // will be set to the total number of objects of size class k in the
 // central cache, transfer cache, and per-thread caches. If small_spans
@@ -382,18 +457,23 @@ static void ExtractStats(TCMallocStats* r, uint64_t* class_count,
   // Add stats from per-thread heaps
   r->thread_bytes = 0;
   { // scope
-    SpinLockHolder h(Static::pageheap_lock_by_number(0));
     SpinLockHolder w(Static::extended_lock());
     ThreadCache::GetThreadStats(&r->thread_bytes, class_count);
     r->metadata_bytes = tcmalloc::metadata_system_bytes();
-    r->pageheap = Static::pagemap()->stats();
-    if (small_spans != NULL) {
-      Static::pageheap(0)->GetSmallSpanStats(small_spans);
-    }
     if (large_spans != NULL) {
       Static::extended_memory()->GetLargeSpanStats(large_spans);
     }
   }
+  // Add stats from per-cpu caches
+  r->cpu_bytes = 0;
+  if (CpuCache::IsEnabled()) {
+    CpuCache::GetStats(&r->cpu_bytes, class_count);
+  }
+  // The page heap stats are summed from per-shard slots and need no lock.
+  r->pageheap = Static::pagemap()->stats();
+  if (small_spans != NULL) {
+    GetAllSmallSpanStats(small_spans);
+  }
 }
 
 static double PagesToMiB(uint64_t pages) {
@@ -423,7 +503,8 @@ static void DumpStats(TCMalloc_Printer* out, int level) {
                                         - stats.pageheap.free_bytes
                                         - stats.central_bytes
                                         - stats.transfer_bytes
-                                        - stats.thread_bytes);
+                                        - stats.thread_bytes
+                                        - stats.cpu_bytes);
 
 #ifdef TCMALLOC_SMALL_BUT_SLOW
   out->printf(
@@ -436,6 +517,7 @@ static void DumpStats(TCMalloc_Printer* out, int level) {
       "MALLOC: + %12" PRIu64 " (%7.1f MiB) Bytes in central cache freelist\n"
       "MALLOC: + %12" PRIu64 " (%7.1f MiB) Bytes in transfer cache freelist\n"
       "MALLOC: + %12" PRIu64 " (%7.1f MiB) Bytes in thread cache freelists\n"
+      "MALLOC: + %12" PRIu64 " (%7.1f MiB) Bytes in per-cpu cache freelists\n"
       "MALLOC: + %12" PRIu64 " (%7.1f MiB) Bytes in malloc metadata\n"
       "MALLOC:   ------------\n"
       "MALLOC: = %12" PRIu64 " (%7.1f MiB) Actual memory used (physical + swap)\n"
@@ -456,6 +538,7 @@ static void DumpStats(TCMalloc_Printer* out, int level) {
       stats.central_bytes, stats.central_bytes / MiB,
       stats.transfer_bytes, stats.transfer_bytes / MiB,
       stats.thread_bytes, stats.thread_bytes / MiB,
+      stats.cpu_bytes, stats.cpu_bytes / MiB,
       stats.metadata_bytes, stats.metadata_bytes / MiB,
       physical_memory_used, physical_memory_used / MiB,
       stats.pageheap.unmapped_bytes, stats.pageheap.unmapped_bytes / MiB,
@@ -484,6 +567,30 @@ static void DumpStats(TCMalloc_Printer* out, int level) {
       }
     }
 
+    // Span layout per size class, and the space lost at the tail of
+    // each span because the class size does not divide it.
+    out->printf("------------------------------------------------\n");
+    out->printf("Span layout and tail waste, by size class\n");
+    out->printf("------------------------------------------------\n");
+    uint64_t total_waste = 0;
+    for (uint32 cl = 1; cl < Static::num_size_classes(); ++cl) {
+      const uint64_t spans = Static::central_cache()[cl].num_spans();
+      if (spans == 0) continue;
+      const size_t cl_size = Static::sizemap()->ByteSizeForClass(cl);
+      const size_t span_bytes = Static::sizemap()->class_to_pages(cl) << kPageShift;
+      const uint64_t waste = spans * (span_bytes % cl_size);
+      total_waste += waste;
+      out->printf("class %3d [ %8" PRIuS " bytes ] : "
+                  "%3" PRIuS " pages, %6" PRIuS " objs/span, batch %3d; "
+                  "%6" PRIu64 " spans; %5.1f MiB tail waste\n",
+                  cl, cl_size,
+                  Static::sizemap()->class_to_pages(cl),
+                  span_bytes / cl_size,
+                  Static::sizemap()->num_objects_to_move(cl),
+                  spans, waste / MiB);
+    }
+    out->printf("Total span tail waste: %.1f MiB\n", total_waste / MiB);
+
     // append page heap info
     int nonempty_sizes = 0;
     if (small.normal_length + small.returned_length > 0) {
@@ -525,6 +632,23 @@ static void DumpStats(TCMalloc_Printer* out, int level) {
                 PagesToMiB(total_normal + total_returned),
                 PagesToMiB(large.returned_pages),
                 PagesToMiB(total_returned));
+
+    PageHeap::PageMap::HugePageStats hugepages;
+    {
+      SpinLockHolder l(Static::extended_lock());
+      Static::pagemap()->GetHugePageStats(&hugepages);
+    }
+    out->printf("------------------------------------------------\n");
+    out->printf("Huge pages (%s): %6" PRId64 " full; %6" PRId64 " partial;"
+                " %6" PRId64 " free\n",
+                TCMalloc_HugePagesEnabled() ? "enabled" : "disabled",
+                hugepages.full, hugepages.partial, hugepages.free);
+
+    AllocLatency::Print(out);
+    LockProfile::Print(out);
+    Arena::Print(out);
+    HeapLimit::Print(out);
+    BackgroundThread::Print(out);
   }
 }
 
@@ -537,6 +661,142 @@ static void PrintStats(int level) {
   delete[] buffer;
 }
 
+static void Appendf(MallocExtensionWriter* writer, const char* format, ...)
+#ifdef HAVE___ATTRIBUTE__
+    __attribute__ ((__format__ (__printf__, 2, 3)))
+#endif
+;
+
+static void Appendf(MallocExtensionWriter* writer, const char* format, ...) {
+  char buf[256];
+  va_list ap;
+  va_start(ap, format);
+  const int n = vsnprintf(buf, sizeof(buf), format, ap);
+  va_end(ap);
+  if (n > 0) {
+    writer->append(buf, n < static_cast<int>(sizeof(buf)) ? n : sizeof(buf) - 1);
+  }
+}
+
+// Writes the stats DumpStats() prints, and a per size class, per thread
+// cache and per shard breakdown, to "writer" as a JSON object.  The
+// format only ever gains fields; "version" changes if one is removed
+// or changes meaning.  Locks are taken one at a time, and the thread
+// cache list is walked kThreadBatch caches per hold of its lock, so
+// the numbers are not one consistent snapshot.
+static void DumpStatsJSON(MallocExtensionWriter* writer) {
+  static const int kThreadBatch = 64;
+
+  TCMallocStats stats;
+  PageHeap::ExtendedMemory::LargeSpanStats large;
+  ExtractStats(&stats, NULL, NULL, &large);
+
+  const uint64_t physical_memory_used = stats.pageheap.system_bytes
+      + stats.metadata_bytes - stats.pageheap.unmapped_bytes;
+  const uint64_t bytes_in_use_by_app = physical_memory_used
+      - stats.metadata_bytes - stats.pageheap.free_bytes
+      - stats.central_bytes - stats.transfer_bytes
+      - stats.thread_bytes - stats.cpu_bytes;
+
+  Appendf(writer, "{\n  \"version\": 1,\n  \"page_size\": %" PRIuS ",\n",
+          kPageSize);
+  Appendf(writer, "  \"summary\": {\n");
+  Appendf(writer, "    \"bytes_in_use_by_app\": %" PRIu64 ",\n",
+          bytes_in_use_by_app);
+  Appendf(writer, "    \"pageheap_free_bytes\": %" PRIu64 ",\n",
+          stats.pageheap.free_bytes);
+  Appendf(writer, "    \"pageheap_unmapped_bytes\": %" PRIu64 ",\n",
+          stats.pageheap.unmapped_bytes);
+  Appendf(writer, "    \"central_cache_free_bytes\": %" PRIu64 ",\n",
+          stats.central_bytes);
+  Appendf(writer, "    \"transfer_cache_free_bytes\": %" PRIu64 ",\n",
+          stats.transfer_bytes);
+  Appendf(writer, "    \"thread_cache_free_bytes\": %" PRIu64 ",\n",
+          stats.thread_bytes);
+  Appendf(writer, "    \"cpu_cache_free_bytes\": %" PRIu64 ",\n",
+          stats.cpu_bytes);
+  Appendf(writer, "    \"metadata_bytes\": %" PRIu64 ",\n",
+          stats.metadata_bytes);
+  Appendf(writer, "    \"system_bytes\": %" PRIu64 ",\n",
+          stats.pageheap.system_bytes);
+  Appendf(writer, "    \"large_spans\": %" PRId64 ",\n", large.spans);
+  Appendf(writer, "    \"large_free_bytes\": %" PRIu64 ",\n",
+          static_cast<uint64_t>(large.normal_pages) << kPageShift);
+  Appendf(writer, "    \"large_unmapped_bytes\": %" PRIu64 "\n  },\n",
+          static_cast<uint64_t>(large.returned_pages) << kPageShift);
+
+  // Walk the thread caches first, keeping the per-thread numbers on the
+  // stack: nothing may be appended, which allocates, with the lock held.
+  uint64_t thread_count[kClassSizesMax];
+  memset(thread_count, 0, sizeof(thread_count));
+  Appendf(writer, "  \"thread_caches\": [");
+  ThreadCache::CacheStats caches[kThreadBatch];
+  for (int done = 0, n = kThreadBatch; n == kThreadBatch; done += n) {
+    {
+      SpinLockHolder h(Static::extended_lock());
+      n = ThreadCache::GetCacheStats(done, kThreadBatch, caches, thread_count);
+    }
+    for (int i = 0; i < n; i++) {
+      Appendf(writer, "%s\n    {\"size_bytes\": %" PRIuS
+              ", \"max_size_bytes\": %" PRIuS "}",
+              done + i == 0 ? "" : ",", caches[i].size, caches[i].max_size);
+    }
+  }
+  Appendf(writer, "\n  ],\n");
+
+  uint64_t cpu_count[kClassSizesMax];
+  memset(cpu_count, 0, sizeof(cpu_count));
+  if (CpuCache::IsEnabled()) {
+    uint64_t cpu_bytes = 0;
+    CpuCache::GetStats(&cpu_bytes, cpu_count);
+  }
+
+  Appendf(writer, "  \"size_classes\": [");
+  for (int cl = 1; cl < Static::num_size_classes(); ++cl) {
+    tcmalloc::CentralFreeListPadded* central = &Static::central_cache()[cl];
+    const size_t size = Static::sizemap()->ByteSizeForClass(cl);
+    const size_t pages = Static::sizemap()->class_to_pages(cl);
+    const uint64_t spans = central->num_spans();
+    const uint64_t central_free = central->length();
+    const uint64_t transfer_free = central->tc_length();
+    const uint64_t total = spans * ((pages << kPageShift) / size);
+    const uint64_t free = central_free + transfer_free
+        + thread_count[cl] + cpu_count[cl];
+    Appendf(writer, "%s\n    {\"class\": %d, \"size\": %" PRIuS
+            ", \"pages\": %" PRIuS ", \"spans\": %" PRIu64,
+            cl == 1 ? "" : ",", cl, size, pages, spans);
+    Appendf(writer, ", \"central_free\": %" PRIu64
+            ", \"transfer_free\": %" PRIu64
+            ", \"thread_cache_free\": %" PRIu64
+            ", \"cpu_cache_free\": %" PRIu64,
+            central_free, transfer_free, thread_count[cl], cpu_count[cl]);
+    // The counts are read at different times, so may not add up.
+    Appendf(writer, ", \"in_use\": %" PRIu64 "}",
+            total > free ? total - free : 0);
+  }
+  Appendf(writer, "\n  ],\n");
+
+  Appendf(writer, "  \"pageheap_shards\": [");
+  for (int i = 0; i < Static::get_pageheap_count(); i++) {
+    PageHeap::SmallSpanStats small;
+    PageHeap::ShardStats shard;
+    {
+      SpinLockHolder h(Static::pageheap_lock_by_number(i));
+      Static::pageheap(i)->GetSmallSpanStats(&small);
+      Static::pageheap(i)->GetShardStats(&shard);
+    }
+    Appendf(writer, "%s\n    {\"shard\": %d, \"free_spans\": %" PRId64
+            ", \"unmapped_spans\": %" PRId64,
+            i == 0 ? "" : ",", i, small.normal_length, small.returned_length);
+    Appendf(writer, ", \"scavenge_count\": %" PRIu64
+            ", \"total_decommit_bytes\": %" PRIu64
+            ", \"refill_count\": %" PRIu64 ", \"refill_bytes\": %" PRIu64 "}",
+            shard.scavenge_count, shard.released_pages << kPageShift,
+            shard.refill_count, shard.refill_pages << kPageShift);
+  }
+  Appendf(writer, "\n  ]\n}\n");
+}
+
 static void** DumpHeapGrowthStackTraces() {
   // Count how much space we need
   int needed_slots = 0;
@@ -640,6 +900,10 @@ class TCMallocImplementation : public MallocExtension {
     }
   }
 
+  virtual void GetStatsJSON(MallocExtensionWriter* writer) {
+    DumpStatsJSON(writer);
+  }
+
   // We may print an extra, tcmalloc-specific warning message here.
   virtual void GetHeapSample(MallocExtensionWriter* writer) {
     if (FLAGS_tcmalloc_sample_parameter == 0) {
@@ -673,6 +937,10 @@ class TCMallocImplementation : public MallocExtension {
     return DumpHeapGrowthStackTraces();
   }
 
+  virtual void** ReadLockContentionStackTraces(int* sample_period) {
+    return LockProfile::ReadStackTraces(sample_period);
+  }
+
   virtual size_t GetThreadCacheSize() {
     ThreadCache* tc = ThreadCache::GetCacheIfPresent();
     if (!tc)
@@ -696,6 +964,7 @@ class TCMallocImplementation : public MallocExtension {
       ExtractStats(&stats, NULL, NULL, NULL);
       *value = stats.pageheap.system_bytes
                - stats.thread_bytes
+               - stats.cpu_bytes
                - stats.central_bytes
                - stats.transfer_bytes
                - stats.pageheap.free_bytes
@@ -721,7 +990,6 @@ class TCMallocImplementation : public MallocExtension {
     if (strcmp(name, "tcmalloc.slack_bytes") == 0) {
       // Kept for backwards compatibility.  Now defined externally as:
       //    pageheap_free_bytes + pageheap_unmapped_bytes.
-      SpinLockHolder l(Static::extended_lock());
       PageHeap::PageMap::Stats stats = Static::pagemap()->stats();
       *value = stats.free_bytes + stats.unmapped_bytes;
       return true;
@@ -748,62 +1016,59 @@ class TCMallocImplementation : public MallocExtension {
       return true;
     }
 
+    if (strcmp(name, "tcmalloc.cpu_cache_free_bytes") == 0) {
+      TCMallocStats stats;
+      ExtractStats(&stats, NULL, NULL, NULL);
+      *value = stats.cpu_bytes;
+      return true;
+    }
+
     if (strcmp(name, "tcmalloc.pageheap_free_bytes") == 0) {
-      SpinLockHolder l(Static::extended_lock());
       *value = Static::pagemap()->stats().free_bytes;
       return true;
     }
 
     if (strcmp(name, "tcmalloc.pageheap_unmapped_bytes") == 0) {
-      SpinLockHolder l(Static::extended_lock());
       *value = Static::pagemap()->stats().unmapped_bytes;
       return true;
     }
 
     if (strcmp(name, "tcmalloc.pageheap_committed_bytes") == 0) {
-      SpinLockHolder l(Static::extended_lock());
       *value = Static::pagemap()->stats().committed_bytes;
       return true;
     }
 
     if (strcmp(name, "tcmalloc.pageheap_scavenge_count") == 0) {
-      SpinLockHolder l(Static::extended_lock());
       *value = Static::pagemap()->stats().scavenge_count;
       return true;
     }
 
     if (strcmp(name, "tcmalloc.pageheap_commit_count") == 0) {
-      SpinLockHolder l(Static::extended_lock());
       *value = Static::pagemap()->stats().commit_count;
       return true;
     }
 
     if (strcmp(name, "tcmalloc.pageheap_total_commit_bytes") == 0) {
-      SpinLockHolder l(Static::extended_lock());
       *value = Static::pagemap()->stats().total_commit_bytes;
       return true;
     }
 
     if (strcmp(name, "tcmalloc.pageheap_decommit_count") == 0) {
-      SpinLockHolder l(Static::extended_lock());
       *value = Static::pagemap()->stats().decommit_count;
       return true;
     }
 
     if (strcmp(name, "tcmalloc.pageheap_total_decommit_bytes") == 0) {
-      SpinLockHolder l(Static::extended_lock());
       *value = Static::pagemap()->stats().total_decommit_bytes;
       return true;
     }
 
     if (strcmp(name, "tcmalloc.pageheap_reserve_count") == 0) {
-      SpinLockHolder l(Static::extended_lock());
       *value = Static::pagemap()->stats().reserve_count;
       return true;
     }
 
     if (strcmp(name, "tcmalloc.pageheap_total_reserve_bytes") == 0) {
-        SpinLockHolder l(Static::extended_lock());
         *value = Static::pagemap()->stats().total_reserve_bytes;
         return true;
     }
@@ -830,6 +1095,53 @@ class TCMallocImplementation : public MallocExtension {
       return true;
     }
 
+    if (strcmp(name, "tcmalloc.pageheap_shards") == 0) {
+      *value = Static::get_pageheap_count();
+      return true;
+    }
+
+    if (strcmp(name, "tcmalloc.hugepages_full") == 0 ||
+        strcmp(name, "tcmalloc.hugepages_partial") == 0 ||
+        strcmp(name, "tcmalloc.hugepages_free") == 0) {
+      PageHeap::PageMap::HugePageStats hugepages;
+      {
+        SpinLockHolder l(Static::extended_lock());
+        Static::pagemap()->GetHugePageStats(&hugepages);
+      }
+      if (strcmp(name, "tcmalloc.hugepages_full") == 0) {
+        *value = hugepages.full;
+      } else if (strcmp(name, "tcmalloc.hugepages_partial") == 0) {
+        *value = hugepages.partial;
+      } else {
+        *value = hugepages.free;
+      }
+      return true;
+    }
+
+    if (GetPageHeapShardProperty(name, value)) {
+      return true;
+    }
+
+    if (AllocLatency::GetProperty(name, value)) {
+      return true;
+    }
+
+    if (LockProfile::GetProperty(name, value)) {
+      return true;
+    }
+
+    if (Arena::GetProperty(name, value)) {
+      return true;
+    }
+
+    if (HeapLimit::GetProperty(name, value)) {
+      return true;
+    }
+
+    if (BackgroundThread::GetProperty(name, value)) {
+      return true;
+    }
+
     return false;
   }
 
@@ -851,6 +1163,10 @@ class TCMallocImplementation : public MallocExtension {
       return true;
     }
 
+    if (HeapLimit::SetProperty(name, value)) {
+      return true;
+    }
+
     return false;
   }
 
@@ -871,20 +1187,35 @@ class TCMallocImplementation : public MallocExtension {
   }
 
   virtual void ReleaseToSystem(size_t num_bytes) {
-    SpinLockHolder h(Static::extended_lock());
-    if (num_bytes <= extra_bytes_released_) {
-      // We released too much on a prior call, so don't release any
-      // more this time.
-      extra_bytes_released_ = extra_bytes_released_ - num_bytes;
-      return;
+    Length num_pages;
+    Length released_pages;
+    {
+      SpinLockHolder h(Static::extended_lock());
+      if (num_bytes <= extra_bytes_released_) {
+        // We released too much on a prior call, so don't release any
+        // more this time.
+        extra_bytes_released_ = extra_bytes_released_ - num_bytes;
+        return;
+      }
+      num_bytes = num_bytes - extra_bytes_released_;
+      // num_bytes might be less than one page.  If we pass zero to
+      // ReleaseAtLeastNPages, it won't do anything, so we release a whole
+      // page now and let extra_bytes_released_ smooth it out over time.
+      num_pages = max<Length>(num_bytes >> kPageShift, 1);
+      released_pages = Static::extended_memory()->ReleaseAtLeastNPages(
+          num_pages);
     }
-    num_bytes = num_bytes - extra_bytes_released_;
-    // num_bytes might be less than one page.  If we pass zero to
-    // ReleaseAtLeastNPages, it won't do anything, so we release a whole
-    // page now and let extra_bytes_released_ smooth it out over time.
-    Length num_pages = max<Length>(num_bytes >> kPageShift, 1);
-    size_t bytes_released = Static::extended_memory()->ReleaseAtLeastNPages(
-        num_pages) << kPageShift;
+    // Make up the rest from the shards' free lists.  A shard lock may not
+    // be taken while holding extended_lock(), hence the separate pass.
+    for (int i = 0;
+         i < Static::get_pageheap_count() && released_pages < num_pages;
+         i++) {
+      SpinLockHolder h(Static::pageheap_lock_by_number(i));
+      released_pages += Static::pageheap(i)->ReleaseAtLeastNPages(
+          num_pages - released_pages);
+    }
+    SpinLockHolder h(Static::extended_lock());
+    size_t bytes_released = released_pages << kPageShift;
     if (bytes_released > num_bytes) {
       extra_bytes_released_ = bytes_released - num_bytes;
     } else {
@@ -902,8 +1233,20 @@ class TCMallocImplementation : public MallocExtension {
   virtual double GetMemoryReleaseRate() {
     return FLAGS_tcmalloc_release_rate;
   }
+
+  virtual HeapLimitCallback SetHeapLimitCallback(HeapLimitCallback callback) {
+    return HeapLimit::SetCallback(callback);
+  }
   virtual size_t GetEstimatedAllocatedSize(size_t size);
 
+  virtual size_t AllocateBatch(size_t size, void** ptrs, size_t count) {
+    return tc_malloc_batch(size, ptrs, count);
+  }
+
+  virtual void FreeBatch(void** ptrs, size_t count, size_t size) {
+    tc_free_batch(ptrs, count, size);
+  }
+
   // This just calls GetSizeWithCallback, but because that's in an
   // unnamed namespace, we need to move the definition below it in the
   // file.
@@ -988,10 +1331,9 @@ class TCMallocImplementation : public MallocExtension {
     // append page heap info
     PageHeap::SmallSpanStats small;
     PageHeap::ExtendedMemory::LargeSpanStats large;
+    GetAllSmallSpanStats(&small);
     {
-      SpinLockHolder h(Static::pageheap_lock_by_number(0));
       SpinLockHolder w(Static::extended_lock());
-      Static::pageheap(0)->GetSmallSpanStats(&small);
       Static::extended_memory()->GetLargeSpanStats(&large);
     }
 
@@ -1122,6 +1464,7 @@ TCMallocGuard::TCMallocGuard() {
     tc_free(tc_malloc(1));
     ThreadCache::InitTSD();
     tc_free(tc_malloc(1));
+    BackgroundThread::Start();
     // Either we, or debugallocation.cc, or valgrind will control memory
     // management.  We register our extension if we're the winner.
 #ifdef TCMALLOC_USING_DEBUGALLOCATION
@@ -1399,6 +1742,9 @@ ATTRIBUTE_ALWAYS_INLINE inline void* do_malloc(size_t size) {
   >>> flowchart 3. look for object in thread cache free list
   >>> for next step for implementation of Allocate method goto thread_cache.h
   */
+  if (CpuCache::IsEnabled()) {
+    return CheckedMallocResult(CpuCache::Allocate(allocated_size, cl, nop_oom_handler));
+  }
   return CheckedMallocResult(cache->Allocate(allocated_size, cl, nop_oom_handler));
 }
 
@@ -1408,6 +1754,7 @@ static void *retry_malloc(void* size) {
 
 ATTRIBUTE_ALWAYS_INLINE inline void* do_malloc_or_cpp_alloc(size_t size) {
   void *rv = do_malloc(size);
+  HeapLimit::MaybeRelieve();
   if (PREDICT_TRUE(rv != NULL)) {
     return rv;
   }
@@ -1451,55 +1798,16 @@ static ATTRIBUTE_NOINLINE void do_free_pages(Span* span, void* ptr) {
   //Static::extended_memory()->Delete(span);
 }
 
-// Helper for the object deletion (free, delete, etc.).  Inputs:
-//   ptr is object to be freed
-//   invalid_free_fn is a function that gets invoked on certain "bad frees"
-//
-// We can usually detect the case where ptr is not pointing to a page that
-// tcmalloc is using, and in those cases we invoke invalid_free_fn.
+// Frees an object of size class cl into the per-cpu cache, the thread
+// cache or, failing both, straight into the central free list.
 ATTRIBUTE_ALWAYS_INLINE inline
-void do_free_with_callback(void* ptr,
-                           void (*invalid_free_fn)(void*),
-                           bool use_hint, size_t size_hint) {
-  ThreadCache* heap = ThreadCache::GetCacheIfPresent();
-
-  const PageID p = reinterpret_cast<uintptr_t>(ptr) >> kPageShift;
-  uint32 cl;
-
-#ifndef NO_TCMALLOC_SAMPLES
-  // we only pass size hint when ptr is not page aligned. Which
-  // implies that it must be very small object.
-  ASSERT(!use_hint || size_hint < kPageSize);
-#endif
-
-  if (!use_hint || PREDICT_FALSE(!Static::sizemap()->GetSizeClass(size_hint, &cl))) {
-    // if we're in sized delete, but size is too large, no need to
-    // probe size cache
-    bool cache_hit = !use_hint && Static::pagemap()->TryGetSizeClass(p, &cl);
-    if (PREDICT_FALSE(!cache_hit)) {
-      Span* span  = Static::pagemap()->GetDescriptor(p);
-      if (PREDICT_FALSE(!span)) {
-        // span can be NULL because the pointer passed in is NULL or invalid
-        // (not something returned by malloc or friends), or because the
-        // pointer was allocated with some other allocator besides
-        // tcmalloc.  The latter can happen if tcmalloc is linked in via
-        // a dynamic library, but is not listed last on the link line.
-        // In that case, libraries after it on the link line will
-        // allocate with libc malloc, but free with tcmalloc's free.
-        free_null_or_invalid(ptr, invalid_free_fn);
-        return;
-      }
-      cl = span->sizeclass;
-      if (PREDICT_FALSE(cl == 0)) {
-        ASSERT(reinterpret_cast<uintptr_t>(ptr) % kPageSize == 0);
-        ASSERT(span != NULL && span->start == p);
-        do_free_pages(span, ptr);
-        return;
-      }
-      if (!use_hint) {
-        Static::pagemap()->SetCachedSizeClass(p, cl);
-      }
-    }
+void do_free_small(void* ptr, uint32 cl, ThreadCache* heap,
+                   void (*invalid_free_fn)(void*)) {
+  // The per-cpu cache is only enabled after Static is inited, and it
+  // takes frees from threads without a thread cache too.
+  if (CpuCache::IsEnabled()) {
+    CpuCache::Deallocate(ptr, cl);
+    return;
   }
 
   if (PREDICT_TRUE(heap != NULL)) {
@@ -1525,9 +1833,84 @@ void do_free_with_callback(void* ptr,
   Static::central_cache()[cl].InsertRange(ptr, ptr, 1);
 }
 
+// Helper for the object deletion (free, delete, etc.).  Inputs:
+//   ptr is object to be freed
+//   invalid_free_fn is a function that gets invoked on certain "bad frees"
+//
+// We can usually detect the case where ptr is not pointing to a page that
+// tcmalloc is using, and in those cases we invoke invalid_free_fn.
+ATTRIBUTE_ALWAYS_INLINE inline
+void do_free_with_callback(void* ptr,
+                           void (*invalid_free_fn)(void*)) {
+  ThreadCache* heap = ThreadCache::GetCacheIfPresent();
+
+  const PageID p = reinterpret_cast<uintptr_t>(ptr) >> kPageShift;
+  uint32 cl;
+
+  if (PREDICT_FALSE(!Static::pagemap()->TryGetSizeClass(p, &cl))) {
+    Span* span  = Static::pagemap()->GetDescriptor(p);
+    if (PREDICT_FALSE(!span)) {
+      // span can be NULL because the pointer passed in is NULL or invalid
+      // (not something returned by malloc or friends), or because the
+      // pointer was allocated with some other allocator besides
+      // tcmalloc.  The latter can happen if tcmalloc is linked in via
+      // a dynamic library, but is not listed last on the link line.
+      // In that case, libraries after it on the link line will
+      // allocate with libc malloc, but free with tcmalloc's free.
+      free_null_or_invalid(ptr, invalid_free_fn);
+      return;
+    }
+    if (PREDICT_FALSE(span->arena != 0)) {
+      // Arena pages are never in the size class cache, so arena
+      // objects always come this way.
+      Arena::ForSpan(span)->Free(span, ptr);
+      return;
+    }
+    cl = span->sizeclass;
+    if (PREDICT_FALSE(cl == 0)) {
+      ASSERT(reinterpret_cast<uintptr_t>(ptr) % kPageSize == 0);
+      ASSERT(span != NULL && span->start == p);
+      do_free_pages(span, ptr);
+      return;
+    }
+    Static::pagemap()->SetCachedSizeClass(p, cl);
+  }
+
+  do_free_small(ptr, cl, heap, invalid_free_fn);
+}
+
 // The default "do_free" that uses the default callback.
 ATTRIBUTE_ALWAYS_INLINE inline void do_free(void* ptr) {
-  return do_free_with_callback(ptr, &InvalidFree, false, 0);
+  return do_free_with_callback(ptr, &InvalidFree);
+}
+
+#ifndef NDEBUG
+// Whether the pagemap agrees that ptr is an object of size class cl.
+// Only used to check size hints in debug builds.
+static bool SizeClassMatchesPagemap(void* ptr, uint32 cl) {
+  const PageID p = reinterpret_cast<uintptr_t>(ptr) >> kPageShift;
+  const Span* span = Static::pagemap()->GetDescriptor(p);
+  return span != NULL && span->sizeclass == cl && span->arena == 0;
+}
+#endif
+
+// Sized deletion (free_sized, sized operator delete).  The size class
+// comes straight from the size the caller passed, so for small objects
+// the pagemap, and the cache miss of reading it, is skipped entirely.
+// The caller must have ruled out ptr being NULL or a sampled
+// allocation; sampled objects get a span of their own whatever their
+// size.  Arena objects must not come here either: their size class is
+// not their span's.  Objects too large
+// for a size class need their span anyway and take the unsized path.
+ATTRIBUTE_ALWAYS_INLINE inline
+void do_free_sized(void* ptr, size_t size) {
+  uint32 cl;
+  if (PREDICT_FALSE(!Static::sizemap()->GetSizeClass(size, &cl))) {
+    do_free(ptr);
+    return;
+  }
+  ASSERT(SizeClassMatchesPagemap(ptr, cl));
+  do_free_small(ptr, cl, ThreadCache::GetCacheIfPresent(), &InvalidFree);
 }
 
 // NOTE: some logic here is duplicated in GetOwnership (above), for
@@ -1559,6 +1942,47 @@ inline size_t GetSizeWithCallback(const void* ptr,
   return span->length << kPageShift;
 }
 
+// Large allocations at least this big are moved by remapping their
+// pages when they cannot grow in place.
+static const size_t kMinRemapBytes = 32 << 20;
+
+// Resizes the page-level allocation at ptr to new_size bytes without
+// copying it: in place if the pages after it are free or it shrinks,
+// else by remapping its pages to a new span if it is very large.
+// Returns the allocation's address, or NULL if the caller has to copy.
+static void* do_realloc_pages(void* ptr, size_t new_size) {
+  const PageID p = reinterpret_cast<uintptr_t>(ptr) >> kPageShift;
+  Span* span = Static::pagemap()->GetDescriptor(p);
+  if (span == NULL || span->start != p || span->sizeclass != 0 ||
+      span->sample || span->arena != 0) {
+    return NULL;
+  }
+  const Length n = tcmalloc::pages(new_size);
+  {
+    SpinLockHolder h(Static::extended_lock());
+    if (Static::extended_memory()->ResizeInPlace(span, n)) {
+      return ptr;
+    }
+  }
+
+  const size_t old_bytes = span->length << kPageShift;
+  if (old_bytes < kMinRemapBytes) return NULL;
+  Span* moved;
+  {
+    SpinLockHolder h(Static::extended_lock());
+    moved = Static::extended_memory()->AllocLarge(n);
+    if (moved == NULL) return NULL;
+    moved->location = Span::IN_USE;
+  }
+  void* result = reinterpret_cast<void*>(moved->start << kPageShift);
+  const bool ok = TCMalloc_SystemMove(ptr, result, old_bytes);
+  {
+    SpinLockHolder h(Static::extended_lock());
+    Static::extended_memory()->Delete(ok ? span : moved);
+  }
+  return ok ? SpanToMallocResult(moved) : NULL;
+}
+
 // This lets you call back to a given function pointer if ptr is invalid.
 // It is used primarily by windows code which wants a specialized callback.
 ATTRIBUTE_ALWAYS_INLINE inline void* do_realloc_with_callback(
@@ -1582,6 +2006,16 @@ ATTRIBUTE_ALWAYS_INLINE inline void* do_realloc_with_callback(
     // Need to reallocate.
     void* new_ptr = NULL;
 
+    // Page-level allocations can usually be resized without a copy.
+    if (old_size > kMaxSize && new_size > kMaxSize) {
+      new_ptr = do_realloc_pages(old_ptr, new_size);
+      if (new_ptr != NULL) {
+        MallocHook::InvokeDeleteHook(old_ptr);
+        MallocHook::InvokeNewHook(new_ptr, new_size);
+        return new_ptr;
+      }
+    }
+
     if (new_size > old_size && new_size < lower_bound_to_grow) {
       new_ptr = do_malloc_or_cpp_alloc(lower_bound_to_grow);
     }
@@ -1598,7 +2032,7 @@ ATTRIBUTE_ALWAYS_INLINE inline void* do_realloc_with_callback(
     // We could use a variant of do_free() that leverages the fact
     // that we already know the sizeclass of old_ptr.  The benefit
     // would be small, so don't bother.
-    do_free_with_callback(old_ptr, invalid_free_fn, false, 0);
+    do_free_with_callback(old_ptr, invalid_free_fn);
     return new_ptr;
   } else {
     // We still need to call hooks to report the updated size:
@@ -1624,46 +2058,18 @@ void* do_memalign_pages(size_t align, size_t size) {
   // Allocate at least one byte to avoid boundary conditions below
   if (size == 0) size = 1;
 
-  // We will allocate directly from the page heap
-	int pageheap_rank;
-  SpinLockHolder h(Static::pageheap_lock(pageheap_rank));
-  SpinLockHolder w(Static::extended_lock());
-
-  // Allocate extra pages and carve off an aligned portion
-  const Length alloc = tcmalloc::pages(size + align);
-  Span* span = Static::pageheap(pageheap_rank)->New(alloc);
-  if (PREDICT_FALSE(span == NULL)) return NULL;
-
-  // Skip starting portion so that we end up aligned
-  Length skip = 0;
-  while ((((span->start+skip) << kPageShift) & (align - 1)) != 0) {
-    skip++;
-  }
-  ASSERT(skip < alloc);
-  if (skip > 0) {
-    Span* rest = Static::extended_memory()->Split(span, skip);
-	{
-					int pageheap_rank;
-					SpinLockHolder h(Static::pageheap_lock(pageheap_rank));
-					Static::pageheap(pageheap_rank)->AppendSpantoPageHeap(span);
-	}
-    //Static::extended_memory()->Delete(span);
-    span = rest;
-  }
-
-  // Skip trailing portion that we do not need to return
-  const Length needed = tcmalloc::pages(size);
-  ASSERT(span->length >= needed);
-  if (span->length > needed) {
-    Span* trailer = Static::extended_memory()->Split(span, needed);
-
-	{
-					int pageheap_rank;
-					SpinLockHolder h(Static::pageheap_lock(pageheap_rank));
-					Static::pageheap(pageheap_rank)->AppendSpantoPageHeap(span);
-	}
-   // Static::extended_memory()->Delete(trailer);
+  // Take an aligned run of exactly the pages needed straight from
+  // ExtendedMemory, where all multi-page spans live anyway; no page
+  // heap shard is involved.
+  Span* span;
+  {
+    SpinLockHolder h(Static::extended_lock());
+    span = Static::extended_memory()->AllocAligned(tcmalloc::pages(size),
+                                                   align >> kPageShift);
+    if (PREDICT_TRUE(span != NULL)) span->location = Span::IN_USE;
   }
+  if (PREDICT_FALSE(span == NULL)) return NULL;
+  ASSERT(((span->start << kPageShift) & (align - 1)) == 0);
   return SpanToMallocResult(span);
 }
 
@@ -1690,12 +2096,14 @@ inline struct mallinfo do_mallinfo() {
   // size values will be truncated.
   info.arena     = static_cast<int>(stats.pageheap.system_bytes);
   info.fsmblks   = static_cast<int>(stats.thread_bytes
+                                    + stats.cpu_bytes
                                     + stats.central_bytes
                                     + stats.transfer_bytes);
   info.fordblks  = static_cast<int>(stats.pageheap.free_bytes +
                                     stats.pageheap.unmapped_bytes);
   info.uordblks  = static_cast<int>(stats.pageheap.system_bytes
                                     - stats.thread_bytes
+                                    - stats.cpu_bytes
                                     - stats.central_bytes
                                     - stats.transfer_bytes
                                     - stats.pageheap.free_bytes
@@ -1810,6 +2218,7 @@ template <void* OOMHandler(size_t)>
 ATTRIBUTE_ALWAYS_INLINE inline
 static void* do_allocate_full(size_t size) {
   void* p = do_malloc(size);
+  HeapLimit::MaybeRelieve();
   if (PREDICT_FALSE(p == NULL)) {
     p = OOMHandler(size);
   }
@@ -1855,6 +2264,7 @@ static ATTRIBUTE_SECTION(google_malloc)
 void* memalign_pages(size_t align, size_t size,
                      bool from_operator, bool nothrow) {
   void *rv = do_memalign_pages(align, size);
+  HeapLimit::MaybeRelieve();
   if (PREDICT_FALSE(rv == NULL)) {
     retry_memalign_data data;
     data.align = align;
@@ -1906,7 +2316,13 @@ static void * malloc_fast_path(size_t size) {
     return tcmalloc::dispatch_allocate_full<OOMHandler>(size);
   }
 
-  return CheckedMallocResult(cache->Allocate(allocated_size, cl, OOMHandler));
+  void* rv;
+  if (CpuCache::IsEnabled()) {
+    rv = CpuCache::Allocate(allocated_size, cl, OOMHandler);
+  } else {
+    rv = cache->Allocate(allocated_size, cl, OOMHandler);
+  }
+  return CheckedMallocResult(rv);
 }
 
 template <void* OOMHandler(size_t)>
@@ -1948,12 +2364,17 @@ void tc_free(void* ptr) PERFTOOLS_NOTHROW {
   free_fast_path(ptr);
 }
 
-extern "C" PERFTOOLS_DLL_DECL CACHELINE_ALIGNED_FN
-void tc_free_sized(void *ptr, size_t size) PERFTOOLS_NOTHROW {
+static ATTRIBUTE_ALWAYS_INLINE inline
+void free_sized_fast_path(void *ptr, size_t size) {
   if (PREDICT_FALSE(!base::internal::delete_hooks_.empty())) {
     tcmalloc::invoke_hooks_and_free(ptr);
     return;
   }
+  // ptr may be an arena object, which only the pagemap can tell.
+  if (PREDICT_FALSE(Arena::AnyCreated())) {
+    do_free(ptr);
+    return;
+  }
 #ifndef NO_TCMALLOC_SAMPLES
   // if ptr is kPageSize-aligned, then it could be sampled allocation,
   // thus we don't trust hint and just do plain free. It also handles
@@ -1967,7 +2388,12 @@ void tc_free_sized(void *ptr, size_t size) PERFTOOLS_NOTHROW {
     return;
   }
 #endif
-  do_free_with_callback(ptr, &InvalidFree, true, size);
+  do_free_sized(ptr, size);
+}
+
+extern "C" PERFTOOLS_DLL_DECL CACHELINE_ALIGNED_FN
+void tc_free_sized(void *ptr, size_t size) PERFTOOLS_NOTHROW {
+  free_sized_fast_path(ptr, size);
 }
 
 #ifdef TC_ALIAS
@@ -1988,6 +2414,137 @@ extern "C" PERFTOOLS_DLL_DECL void tc_deletearray_sized(void *p, size_t size) PE
 
 #endif
 
+// Largest number of objects the batch calls move with one thread cache
+// operation.  Keeps the byte count handed to the sampler small.
+static const size_t kMaxBatchChunk = 1024;
+
+// Batch allocation.  Objects come straight off the thread cache's
+// freelist, then a central cache batch at a time, so the cost per
+// object is close to one pointer store.  Sampling is decided for a
+// whole chunk at once: if no object of it is due to be sampled, none
+// is.  Whenever the batch path does not apply (new hooks, a sample
+// due, no thread cache yet, the per-cpu cache, sizes above kMaxSize)
+// objects are allocated one at a time the ordinary way.
+extern "C" PERFTOOLS_DLL_DECL
+size_t tc_malloc_batch(size_t size, void** ptrs, size_t count) PERFTOOLS_NOTHROW {
+  uint32 cl;
+  if (PREDICT_FALSE(!Static::sizemap()->GetSizeClass(size, &cl))) {
+    cl = 0;
+  }
+  size_t n = 0;
+  while (n < count) {
+    ThreadCache* cache = ThreadCache::GetFastPathCache();
+    if (PREDICT_TRUE(cl != 0 && cache != NULL &&
+                     base::internal::new_hooks_.empty() &&
+                     !CpuCache::IsEnabled())) {
+      const size_t allocated_size = Static::sizemap()->ByteSizeForClass(cl);
+      const size_t chunk = std::min(count - n, kMaxBatchChunk);
+      if (cache->TryRecordAllocationFast(allocated_size * chunk)) {
+        const size_t got = cache->AllocateBatch(allocated_size, cl,
+                                                ptrs + n, chunk);
+        n += got;
+        if (got == chunk) {
+          continue;
+        }
+        // Out of memory: let the single object path below run the
+        // usual OOM handling.
+      }
+    }
+    void* p = malloc_fast_path<tcmalloc::malloc_oom>(size);
+    if (PREDICT_FALSE(p == NULL)) {
+      break;
+    }
+    ptrs[n++] = p;
+  }
+  return n;
+}
+
+// Batch free.  Objects are chained together as they are read from ptrs
+// and the chain is pushed onto the thread cache's freelist in one go.
+// NULL and page-aligned pointers are freed one at a time, since the
+// latter may be sampled allocations with a span of their own.  So is
+// everything once an arena exists, since any of them may be an arena
+// object.
+extern "C" PERFTOOLS_DLL_DECL
+void tc_free_batch(void** ptrs, size_t count, size_t size) PERFTOOLS_NOTHROW {
+  ThreadCache* heap = ThreadCache::GetCacheIfPresent();
+  uint32 cl;
+  if (PREDICT_FALSE(heap == NULL ||
+                    !base::internal::delete_hooks_.empty() ||
+                    CpuCache::IsEnabled() ||
+                    Arena::AnyCreated() ||
+                    !Static::sizemap()->GetSizeClass(size, &cl))) {
+    for (size_t i = 0; i < count; i++) {
+      free_sized_fast_path(ptrs[i], size);
+    }
+    return;
+  }
+
+  void* head = NULL;
+  void* tail = NULL;
+  int n = 0;
+  for (size_t i = 0; i < count; i++) {
+    void* ptr = ptrs[i];
+    if (PREDICT_FALSE((reinterpret_cast<uintptr_t>(ptr) & (kPageSize-1)) == 0)) {
+      free_sized_fast_path(ptr, size);
+      continue;
+    }
+    ASSERT(SizeClassMatchesPagemap(ptr, cl));
+    if (head == NULL) {
+      head = ptr;
+    } else {
+      tcmalloc::SLL_SetNext(tail, ptr);
+    }
+    tail = ptr;
+    if (++n == kMaxBatchChunk) {
+      heap->DeallocateRange(cl, head, tail, n);
+      head = NULL;
+      n = 0;
+    }
+  }
+  if (n > 0) {
+    heap->DeallocateRange(cl, head, tail, n);
+  }
+}
+
+extern "C" PERFTOOLS_DLL_DECL int tc_arena_create(const char* name) PERFTOOLS_NOTHROW {
+  if (PREDICT_FALSE(!Static::IsInited())) ThreadCache::InitModule();
+  return Arena::Create(name);
+}
+
+extern "C" PERFTOOLS_DLL_DECL void tc_arena_destroy(int arena) PERFTOOLS_NOTHROW {
+  Arena::Destroy(arena);
+}
+
+// Arena objects skip the thread cache in both directions: they are
+// carved by the arena under its own lock, and free() hands them back
+// to it from the slow path of do_free_with_callback().  Ids that do not
+// name a live arena, 0 in particular, allocate from the main heap.
+extern "C" PERFTOOLS_DLL_DECL
+void* tc_arena_malloc(int arena, size_t size) PERFTOOLS_NOTHROW {
+  Arena* a = Arena::Get(arena);
+  if (a == NULL) {
+    return malloc_fast_path<tcmalloc::malloc_oom>(size);
+  }
+  void* result = a->Allocate(size);
+  if (PREDICT_FALSE(result == NULL)) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  MallocHook::InvokeNewHook(result, size);
+  return result;
+}
+
+extern "C" PERFTOOLS_DLL_DECL void tc_arena_reset(int arena) PERFTOOLS_NOTHROW {
+  Arena* a = Arena::Get(arena);
+  if (a != NULL) a->Reset();
+}
+
+extern "C" PERFTOOLS_DLL_DECL void tc_arena_release(int arena) PERFTOOLS_NOTHROW {
+  Arena* a = Arena::Get(arena);
+  if (a != NULL) a->Release();
+}
+
 extern "C" PERFTOOLS_DLL_DECL void* tc_calloc(size_t n,
                                               size_t elem_size) PERFTOOLS_NOTHROW {
   if (ThreadCache::IsUseEmergencyMalloc()) {
@@ -2130,11 +2687,16 @@ extern "C" PERFTOOLS_DLL_DECL void tc_delete_aligned(void* p, std::align_val_t)
   free_fast_path(p);
 }
 
-// There is no easy way to obtain the actual size used by do_memalign to allocate aligned storage, so for now
-// just ignore the size. It might get useful in the future.
+// memalign_fast_path() serves alignments up to kPageSize with a plain
+// allocation of the size rounded up to the alignment, so that is the
+// size to free.  Larger alignments get a span of their own.
 extern "C" PERFTOOLS_DLL_DECL void tc_delete_sized_aligned(void* p, size_t size, std::align_val_t align) PERFTOOLS_NOTHROW
 {
-  free_fast_path(p);
+  if (static_cast<size_t>(align) <= kPageSize) {
+    free_sized_fast_path(p, align_size_up(size, static_cast<size_t>(align)));
+  } else {
+    free_fast_path(p);
+  }
 }
 
 extern "C" PERFTOOLS_DLL_DECL void tc_delete_aligned_nothrow(void* p, std::align_val_t, const std::nothrow_t&) PERFTOOLS_NOTHROW
@@ -2169,14 +2731,12 @@ TC_ALIAS(tc_delete_aligned);
 }
 #endif
 
-// There is no easy way to obtain the actual size used by do_memalign to allocate aligned storage, so for now
-// just ignore the size. It might get useful in the future.
 extern "C" PERFTOOLS_DLL_DECL void tc_deletearray_sized_aligned(void* p, size_t size, std::align_val_t align) PERFTOOLS_NOTHROW
 #ifdef TC_ALIAS
 TC_ALIAS(tc_delete_sized_aligned);
 #else
 {
-  free_fast_path(p);
+  tc_delete_sized_aligned(p, size, align);
 }
 #endif
 
@@ -2229,6 +2789,7 @@ extern "C" PERFTOOLS_DLL_DECL size_t tc_malloc_size(void* ptr) PERFTOOLS_NOTHROW
 
 extern "C" PERFTOOLS_DLL_DECL void* tc_malloc_skip_new_handler(size_t size)  PERFTOOLS_NOTHROW {
   void* result = do_malloc(size);
+  HeapLimit::MaybeRelieve();
   MallocHook::InvokeNewHook(result, size);
   return result;
 }
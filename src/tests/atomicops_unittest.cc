@@ -90,6 +90,26 @@ static void TestAtomicExchange(AtomicType (*atomic_exchange_func)
 }
 
 
+template <class AtomicType>
+static void TestAtomicIncrement() {
+  AtomicType value = 0;
+  ASSERT_EQ(1, base::subtle::NoBarrier_AtomicIncrement(&value, 1));
+  ASSERT_EQ(1, value);
+  ASSERT_EQ(3, base::subtle::NoBarrier_AtomicIncrement(&value, 2));
+  ASSERT_EQ(3, value);
+  ASSERT_EQ(0, base::subtle::NoBarrier_AtomicIncrement(&value, -3));
+  ASSERT_EQ(0, value);
+
+  // Carry out of the low half, for the 64-bit implementation on 32-bit
+  // platforms.
+  const AtomicType k_test_val = (GG_ULONGLONG(1) <<
+                                 (NUM_BITS(AtomicType) / 2)) - 1;
+  value = k_test_val;
+  ASSERT_EQ(k_test_val + 1,
+            base::subtle::NoBarrier_AtomicIncrement(&value, 1));
+  ASSERT_EQ(k_test_val + 1, value);
+}
+
 // This is a simple sanity check that values are correct. Not testing
 // atomicity
 template <class AtomicType>
@@ -150,6 +170,8 @@ static void TestAtomicOps() {
   TestAtomicExchange<AtomicType>(base::subtle::Acquire_AtomicExchange);
   TestAtomicExchange<AtomicType>(base::subtle::Release_AtomicExchange);
 
+  TestAtomicIncrement<AtomicType>();
+
   TestStore<AtomicType>();
   TestLoad<AtomicType>();
 }
@@ -84,6 +84,11 @@ run_check "local"
 run_check "normal"
 run_check "strict"
 
+# Also look for live objects with extra threads, as HEAP_CHECK_MARK_THREADS
+# lets a large program do.  This must not report anything more.
+HEAP_CHECK_MARK_THREADS=4 run_check "normal"
+HEAP_CHECK_MARK_THREADS=4 run_check "strict"
+
 rm -rf $TMPDIR      # clean up
 
 echo "PASS"
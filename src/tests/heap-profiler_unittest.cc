@@ -32,11 +32,13 @@
 // Author: Craig Silverstein
 //
 // A small program that just exercises our heap profiler by allocating
-// memory and letting the heap-profiler emit a profile.  We don't test
-// threads (TODO).  By itself, this unittest tests that the heap-profiler
-// doesn't crash on simple programs, but its output can be analyzed by
-// another testing script to actually verify correctness.  See, eg,
-// heap-profiler_unittest.sh.
+// memory and letting the heap-profiler emit a profile.  By itself, this
+// unittest tests that the heap-profiler doesn't crash on simple programs,
+// but its output can be analyzed by another testing script to actually
+// verify correctness.  See, eg, heap-profiler_unittest.sh.  Run with the
+// argument "threads" it instead checks the profile of several threads
+// that free each other's allocations, and with "arena" that resetting
+// an arena takes its objects out of the profile.
 
 #include "config_for_unittests.h"
 #include <stdlib.h>
@@ -47,10 +49,14 @@
 #include <unistd.h>                 // for fork()
 #endif
 #include <sys/wait.h>               // for wait()
+#include <string.h>                 // for strcmp()
+#include <pthread.h>
 #include <string>
+#include "base/atomicops.h"
 #include "base/basictypes.h"
 #include "base/logging.h"
 #include <gperftools/heap-profiler.h>
+#include <gperftools/tcmalloc.h>
 
 using std::string;
 
@@ -121,12 +127,166 @@ static void TestDumpHeapProfiler() {
   }
 }
 
+// Slots that the threads below swap allocations through, so that most
+// objects are freed by a different thread than the one that allocated
+// them.  If buffered events were merged out of order, a free would be
+// applied before its allocation and the object would stay in-use in the
+// profile forever.
+static const int kThreads = 4;
+static const int kSlots = 64;
+static const int kSwapsPerThread = 50000;
+static const int kObjectSize = 1000;
+static AtomicWord g_slots[kSlots];
+
+static void* SwapAllocations(void* arg) {
+  const int id = static_cast<int>(reinterpret_cast<intptr_t>(arg));
+  for (int i = 0; i < kSwapsPerThread; i++) {
+    char* p = new char[kObjectSize];
+    AtomicWord* slot = &g_slots[(i + id * (kSlots / kThreads)) % kSlots];
+    char* old = reinterpret_cast<char*>(
+        base::subtle::Acquire_AtomicExchange(slot,
+                                             reinterpret_cast<AtomicWord>(p)));
+    delete[] old;
+  }
+  return NULL;
+}
+
+// Reads the in-use totals from the header line of a heap profile.
+static void GetInUse(int* objects, int64* bytes) {
+  char* profile = GetHeapProfile();
+  long long b = 0;
+  CHECK_EQ(2, sscanf(profile, "heap profile: %d: %lld", objects, &b));
+  *bytes = b;
+  free(profile);
+}
+
+static void TestThreadedHeapProfile() {
+  CHECK(!IsHeapProfilerRunning());
+  const char* tmpdir = getenv("TMPDIR");
+  if (tmpdir == NULL)
+    tmpdir = "/tmp";
+  mkdir(tmpdir, 0755);     // if necessary
+  HeapProfilerStart((string(tmpdir) + "/threads").c_str());
+
+  int objects_before;
+  int64 bytes_before;
+  GetInUse(&objects_before, &bytes_before);
+
+  pthread_t threads[kThreads];
+  for (int i = 0; i < kThreads; i++) {
+    CHECK_EQ(0, pthread_create(&threads[i], NULL, SwapAllocations,
+                               reinterpret_cast<void*>(i)));
+  }
+  for (int i = 0; i < kThreads; i++) {
+    CHECK_EQ(0, pthread_join(threads[i], NULL));
+  }
+
+  // Every slot now holds exactly one live object.  Allow some slack for
+  // what the thread library allocates on its own.
+  int objects_after;
+  int64 bytes_after;
+  GetInUse(&objects_after, &bytes_after);
+  CHECK_GE(objects_after - objects_before, kSlots);
+  CHECK_LE(objects_after - objects_before, kSlots + 64);
+  CHECK_GE(bytes_after - bytes_before, kSlots * kObjectSize);
+  CHECK_LE(bytes_after - bytes_before, kSlots * kObjectSize + (64 << 10));
+
+  for (int i = 0; i < kSlots; i++) {
+    delete[] reinterpret_cast<char*>(g_slots[i]);
+    g_slots[i] = 0;
+  }
+  GetInUse(&objects_after, &bytes_after);
+  CHECK_LE(bytes_after - bytes_before, 64 << 10);
+
+  HeapProfilerStop();
+}
+
+// What the arena test below allocates: the small objects share spans,
+// the large ones get a span each.
+static const int kArenaSmall = 1000;
+static const int kArenaSmallSize = 100;
+static const int kArenaLarge = 4;
+static const int kArenaLargeSize = 1 << 20;
+
+// Fills an arena with small objects, some of them freed again, and a
+// few large ones.
+static void FillArena(int arena) {
+  void* small[kArenaSmall];
+  for (int i = 0; i < kArenaSmall; i++) {
+    small[i] = tc_arena_malloc(arena, kArenaSmallSize);
+    CHECK(small[i] != NULL);
+  }
+  for (int i = 0; i < kArenaSmall; i += 3) {
+    tc_free(small[i]);
+  }
+  for (int i = 0; i < kArenaLarge; i++) {
+    CHECK(tc_arena_malloc(arena, kArenaLargeSize) != NULL);
+  }
+}
+
+static void TestArenaHeapProfile() {
+  CHECK(!IsHeapProfilerRunning());
+  const char* tmpdir = getenv("TMPDIR");
+  if (tmpdir == NULL)
+    tmpdir = "/tmp";
+  mkdir(tmpdir, 0755);     // if necessary
+  HeapProfilerStart((string(tmpdir) + "/arena").c_str());
+
+  int objects_before;
+  int64 bytes_before;
+  GetInUse(&objects_before, &bytes_before);
+
+  int arena = tc_arena_create("heap-profiler_unittest");
+  if (arena == 0) {
+    // The debug allocator has no arenas.
+    HeapProfilerStop();
+    return;
+  }
+  const int64 kLive = (kArenaSmall - (kArenaSmall + 2) / 3) * kArenaSmallSize
+      + kArenaLarge * kArenaLargeSize;
+
+  int objects_after;
+  int64 bytes_after;
+  FillArena(arena);
+  GetInUse(&objects_after, &bytes_after);
+  CHECK_GE(bytes_after - bytes_before, kLive);
+
+  // Resetting frees every live object, so none may stay in the profile.
+  tc_arena_reset(arena);
+  GetInUse(&objects_after, &bytes_after);
+  CHECK_LE(bytes_after - bytes_before, 64 << 10);
+
+  // The same goes for releasing, and for destroying an arena that
+  // still holds objects.
+  FillArena(arena);
+  tc_arena_release(arena);
+  GetInUse(&objects_after, &bytes_after);
+  CHECK_LE(bytes_after - bytes_before, 64 << 10);
+
+  FillArena(arena);
+  tc_arena_destroy(arena);
+  GetInUse(&objects_after, &bytes_after);
+  CHECK_LE(bytes_after - bytes_before, 64 << 10);
+
+  HeapProfilerStop();
+}
 
 int main(int argc, char** argv) {
   if (argc > 2 || (argc == 2 && argv[1][0] == '-')) {
-    printf("USAGE: %s [number of children to fork]\n", argv[0]);
+    printf("USAGE: %s [number of children to fork | threads | arena]\n",
+           argv[0]);
     exit(0);
   }
+  if (argc == 2 && strcmp(argv[1], "threads") == 0) {
+    TestThreadedHeapProfile();
+    printf("DONE.\n");
+    return 0;
+  }
+  if (argc == 2 && strcmp(argv[1], "arena") == 0) {
+    TestArenaHeapProfile();
+    printf("DONE.\n");
+    return 0;
+  }
   int num_forks = 0;
   if (argc == 2) {
     num_forks = atoi(argv[1]);
@@ -137,6 +137,33 @@ VerifyOutputContains "62 MB freed"
 # testing of the HeapProfileStart/Stop functionality.
 $HEAP_PROFILER >"$TEST_TMPDIR/output2" 2>&1
 
+# Check that events recorded by several threads at once are merged into
+# a consistent profile.  The dump intervals go back to their defaults,
+# so that the run isn't spent writing profiles.
+(unset HEAPPROFILE HEAP_PROFILE_INUSE_INTERVAL \
+       HEAP_PROFILE_ALLOCATION_INTERVAL HEAP_PROFILE_DEALLOCATION_INTERVAL;
+ TMPDIR="$TEST_TMPDIR" $HEAP_PROFILER threads >"$TEST_TMPDIR/output3" 2>&1)
+if [ $? != 0 ]; then
+  echo "--- Test failed for threaded heap profile"
+  echo "--- Program output:"
+  cat "$TEST_TMPDIR/output3"
+  echo "---"
+  num_failures=`expr $num_failures + 1`
+fi
+
+# Check that objects freed by resetting or releasing an arena leave the
+# profile.
+(unset HEAPPROFILE HEAP_PROFILE_INUSE_INTERVAL \
+       HEAP_PROFILE_ALLOCATION_INTERVAL HEAP_PROFILE_DEALLOCATION_INTERVAL;
+ TMPDIR="$TEST_TMPDIR" $HEAP_PROFILER arena >"$TEST_TMPDIR/output4" 2>&1)
+if [ $? != 0 ]; then
+  echo "--- Test failed for arena heap profile"
+  echo "--- Program output:"
+  cat "$TEST_TMPDIR/output4"
+  echo "---"
+  num_failures=`expr $num_failures + 1`
+fi
+
 rm -rf $TEST_TMPDIR      # clean up
 
 if [ $num_failures = 0 ]; then
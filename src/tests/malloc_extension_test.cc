@@ -35,11 +35,695 @@
 
 #include "config_for_unittests.h"
 #include <stdio.h>
+#include <stdlib.h>                     // for getenv
+#include <string.h>                     // for strncmp
 #include <sys/types.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <sched.h>                      // for sched_yield
+#include <time.h>                       // for nanosleep
+#endif
+#include <algorithm>                    // for std::swap
+#include <string>
 #include "base/logging.h"
+#include "base/spinlock.h"
+#include "static_vars.h"                // for Static::extended_lock
 #include <gperftools/malloc_extension.h>
 #include <gperftools/malloc_extension_c.h>
 
+using std::string;
+
+// Checks that GetStatsJSON() writes one balanced JSON object with the
+// fields monitoring tools rely on.
+static void TestStatsJSON() {
+  string json;
+  MallocExtension::instance()->GetStatsJSON(&json);
+  ASSERT_FALSE(json.empty());
+  ASSERT_EQ('{', json[0]);
+
+  // No field name or value contains brackets or quotes, so counting
+  // them is enough to see the object is well formed.
+  int depth = 0;
+  int quotes = 0;
+  for (size_t i = 0; i < json.size(); ++i) {
+    const char c = json[i];
+    if (c == '{' || c == '[') {
+      depth++;
+    } else if (c == '}' || c == ']') {
+      depth--;
+      ASSERT_GE(depth, 0);
+      if (depth == 0) {
+        ASSERT_EQ(string::npos, json.find_first_not_of(" \n", i + 1));
+      }
+    } else if (c == '"') {
+      quotes++;
+    }
+  }
+  ASSERT_EQ(0, depth);
+  ASSERT_EQ(0, quotes % 2);
+
+  const char* const kFields[] = {
+    "\"version\": 1",
+    "\"summary\"",
+    "\"bytes_in_use_by_app\"",
+    "\"size_classes\"",
+    "\"class\": 1,",
+    "\"central_free\"",
+    "\"transfer_free\"",
+    "\"thread_cache_free\"",
+    "\"in_use\"",
+    "\"thread_caches\"",
+    "\"pageheap_shards\"",
+    "\"shard\": 0,",
+    "\"free_spans\"",
+  };
+  for (int i = 0; i < sizeof(kFields) / sizeof(*kFields); ++i) {
+    if (json.find(kFields[i]) == string::npos) {
+      fprintf(stderr, "%s missing from:\n%s", kFields[i], json.c_str());
+      ASSERT_TRUE(false);
+    }
+  }
+}
+
+static size_t GetProperty(const char* name) {
+  size_t value = 0;
+  ASSERT_TRUE(MallocExtension::instance()->GetNumericProperty(name, &value));
+  return value;
+}
+
+// Sums a "tcmalloc.pageheap_shard.<N>.<stat>" property over all shards.
+static size_t GetShardProperty(const char* stat) {
+  const size_t shards = GetProperty("tcmalloc.pageheap_shards");
+  size_t sum = 0;
+  for (size_t i = 0; i < shards; i++) {
+    char name[64];
+    snprintf(name, sizeof(name), "tcmalloc.pageheap_shard.%zu.%s", i, stat);
+    sum += GetProperty(name);
+  }
+  return sum;
+}
+
+// Just over kMaxSize, so that each block is a span of its own, one
+// page long even with the debug allocator's header, and is freed into
+// a page heap shard.
+static const size_t kShardBlockSize = kPageSize / 2 + 1;
+
+// Frees blocks[0..count).  The debug allocator queues up to 10MiB of
+// freed blocks before really freeing them; freeing one block bigger
+// than that flushes the queue.
+static void FreeBlocks(void** blocks, int count) {
+  for (int i = 0; i < count; i++) {
+    free(blocks[i]);
+  }
+  free(malloc(16 << 20));
+}
+
+// ReleaseFreeMemory() moves the shards' free spans to their returned
+// lists, and freeing pages into a shard scavenges it now and then.
+static void TestShardRelease() {
+  MallocExtension* ext = MallocExtension::instance();
+  const double rate = ext->GetMemoryReleaseRate();
+  ext->SetMemoryReleaseRate(0);
+
+  static const int kBlocks = 8;
+  void* blocks[kBlocks];
+  for (int i = 0; i < kBlocks; i++) {
+    blocks[i] = malloc(kShardBlockSize);
+    ASSERT_TRUE(blocks[i] != NULL);
+  }
+  ext->ReleaseFreeMemory();
+  const size_t decommitted = GetShardProperty("total_decommit_bytes");
+  FreeBlocks(blocks, kBlocks);
+  const size_t free_bytes = GetShardProperty("free_bytes");
+  ASSERT_GT(free_bytes, 0);
+
+  ext->ReleaseFreeMemory();
+  ASSERT_EQ(0, GetShardProperty("free_bytes"));
+  // The shards may have drained returned spans in between, so only
+  // the spans just released are sure to be there.
+  ASSERT_GE(GetShardProperty("unmapped_bytes"), free_bytes);
+  ASSERT_GE(GetShardProperty("total_decommit_bytes"),
+            decommitted + free_bytes);
+
+  // At this rate a shard scavenges every few pages freed into it, once
+  // the delay set by its previous scavenge, at most 16384 pages, has
+  // run out.
+  ext->SetMemoryReleaseRate(1000);
+  const size_t scavenges = GetShardProperty("scavenge_count");
+  for (int i = 0;
+       i < (1 << 15) && GetShardProperty("scavenge_count") == scavenges;
+       i++) {
+    free(malloc(kShardBlockSize));
+  }
+  ASSERT_GT(GetShardProperty("scavenge_count"), scavenges);
+  ext->SetMemoryReleaseRate(rate);
+}
+
+struct DrainState {
+  void** blocks;
+  int count;
+  int merged;   // blocks that lie in a free range of several pages
+};
+
+static void CountMergedBlocks(void* arg, const base::MallocRange* r) {
+  DrainState* state = static_cast<DrainState*>(arg);
+  if ((r->type != base::MallocRange::FREE &&
+       r->type != base::MallocRange::UNMAPPED) ||
+      r->length <= kPageSize) {
+    return;
+  }
+  for (int i = 0; i < state->count; i++) {
+    const uintptr_t p = reinterpret_cast<uintptr_t>(state->blocks[i]);
+    if (r->address <= p && p < r->address + r->length) {
+      state->merged++;
+    }
+  }
+}
+
+// A burst of 1-page spans freed on one thread is more than a shard
+// keeps: it holds on to at most two refill batches and drains the rest
+// to ExtendedMemory, where the spans merge with their free neighbours.
+static void TestShardDrain() {
+  MallocExtension* ext = MallocExtension::instance();
+  const double rate = ext->GetMemoryReleaseRate();
+  ext->SetMemoryReleaseRate(0);
+
+  // Well over two of the largest refill batches.
+  static const int kBlocks = 256;
+  void* blocks[kBlocks];
+  for (int i = 0; i < kBlocks; i++) {
+    blocks[i] = malloc(kShardBlockSize);
+    ASSERT_TRUE(blocks[i] != NULL);
+  }
+  FreeBlocks(blocks, kBlocks);
+
+  const size_t shards = GetProperty("tcmalloc.pageheap_shards");
+  for (size_t i = 0; i < shards; i++) {
+    char name[64];
+    snprintf(name, sizeof(name), "tcmalloc.pageheap_shard.%zu.", i);
+    const string prefix = name;
+    const size_t held =
+        GetProperty((prefix + "free_bytes").c_str()) +
+        GetProperty((prefix + "unmapped_bytes").c_str());
+    ASSERT_LE(held, 2 * GetProperty((prefix + "refill_bytes").c_str()));
+  }
+
+  DrainState state = { blocks, kBlocks, 0 };
+  ext->Ranges(&state, CountMergedBlocks);
+  ASSERT_GE(state.merged, kBlocks / 2);
+  ext->SetMemoryReleaseRate(rate);
+}
+
+// A shard refills in bigger batches while allocations outrun frees,
+// and in smaller ones once freed spans pile up on it.
+static void TestShardRefill() {
+  static const int kBlocks = 256;
+  void* blocks[kBlocks];
+
+  // Start from the smallest batch: a burst of frees shrinks it.
+  for (int i = 0; i < kBlocks; i++) {
+    blocks[i] = malloc(kShardBlockSize);
+    ASSERT_TRUE(blocks[i] != NULL);
+  }
+  FreeBlocks(blocks, kBlocks);
+  const size_t idle_bytes = GetShardProperty("refill_bytes");
+  const size_t refills = GetShardProperty("refill_count");
+
+  for (int i = 0; i < kBlocks; i++) {
+    blocks[i] = malloc(kShardBlockSize);
+    ASSERT_TRUE(blocks[i] != NULL);
+  }
+  const size_t burst_bytes = GetShardProperty("refill_bytes");
+  ASSERT_GT(GetShardProperty("refill_count"), refills);
+  ASSERT_GT(burst_bytes, idle_bytes);
+
+  FreeBlocks(blocks, kBlocks);
+  ASSERT_LT(GetShardProperty("refill_bytes"), burst_bytes);
+}
+
+static int soft_callbacks;
+static int hard_callbacks;
+static int callback_depth;
+static int callback_reentries;
+
+// Allocates from inside the callback, as a real one logging or
+// dumping stats would.  The allocator must not call it again for that.
+static void HeapLimitCallback(bool hard, size_t heap_bytes,
+                              size_t limit_bytes) {
+  if (callback_depth++ > 0) callback_reentries++;
+  ASSERT_GT(heap_bytes, limit_bytes);
+  if (hard) {
+    hard_callbacks++;
+  } else {
+    soft_callbacks++;
+  }
+  for (int i = 0; i < 16; ++i) {
+    free(malloc(1 << 20));
+  }
+  callback_depth--;
+}
+
+// Shrinking the soft limit below the heap size gives back free memory
+// and calls the callback; the hard limit turns allocations down.
+static void TestHeapLimit() {
+  MallocExtension* ext = MallocExtension::instance();
+  ASSERT_TRUE(ext->SetHeapLimitCallback(HeapLimitCallback) == NULL);
+
+  // Leave plenty of free memory behind for the soft limit to release.
+  static const int kBlocks = 64;
+  void* blocks[kBlocks];
+  for (int i = 0; i < kBlocks; ++i) {
+    blocks[i] = malloc(1 << 20);
+    ASSERT_TRUE(blocks[i] != NULL);
+  }
+  for (int i = 0; i < kBlocks; i += 2) {
+    free(blocks[i]);
+  }
+
+  const size_t soft_hits = GetProperty("tcmalloc.soft_heap_limit_hits");
+  const size_t released =
+      GetProperty("tcmalloc.soft_heap_limit_released_bytes");
+  ASSERT_TRUE(ext->SetNumericProperty("tcmalloc.soft_heap_limit_mb", 1));
+  ASSERT_EQ(1, GetProperty("tcmalloc.soft_heap_limit_mb"));
+  ASSERT_GT(GetProperty("tcmalloc.soft_heap_limit_hits"), soft_hits);
+  ASSERT_GT(GetProperty("tcmalloc.soft_heap_limit_released_bytes"),
+            released);
+  ASSERT_GE(soft_callbacks, 1);
+
+  // Growing the heap past its old peak calls the callback again, but
+  // allocations never fail because of the soft limit.  Twice the
+  // bytes freed above get the heap there whatever was released.
+  const int soft_callbacks_before = soft_callbacks;
+  for (int i = 0; i < kBlocks; i += 2) {
+    blocks[i] = malloc(2 << 20);
+    ASSERT_TRUE(blocks[i] != NULL);
+  }
+  ASSERT_GT(soft_callbacks, soft_callbacks_before);
+  ASSERT_TRUE(ext->SetNumericProperty("tcmalloc.soft_heap_limit_mb", 0));
+
+  const size_t hard_hits = GetProperty("tcmalloc.heap_limit_hits");
+  const size_t heap_mb = (GetProperty("generic.heap_size") >> 20) + 1;
+  ASSERT_TRUE(ext->SetNumericProperty("tcmalloc.heap_limit_mb",
+                                      heap_mb + 16));
+  void* big = malloc(heap_mb << 20);
+  ASSERT_TRUE(big == NULL);
+  ASSERT_GT(GetProperty("tcmalloc.heap_limit_hits"), hard_hits);
+  // The callback runs on the next allocation that finds work owed.
+  free(malloc(1 << 20));
+  ASSERT_GE(hard_callbacks, 1);
+  ASSERT_TRUE(ext->SetNumericProperty("tcmalloc.heap_limit_mb", 0));
+
+  ASSERT_EQ(0, callback_reentries);
+  ASSERT_EQ(0, callback_depth);
+  ASSERT_TRUE(ext->SetHeapLimitCallback(NULL) == HeapLimitCallback);
+  for (int i = 0; i < kBlocks; ++i) {
+    free(blocks[i]);
+  }
+}
+
+// The slow path latency histograms are only there when tcmalloc is
+// configured with --enable-alloc-latency-stats.
+static void TestAllocLatency() {
+  static const char* const kTiers[] = {
+    "fast_path_miss", "central_refill", "shard_refill",
+    "extended_lock_wait", "system_alloc",
+  };
+  static const int kNumTiers = sizeof(kTiers) / sizeof(*kTiers);
+  MallocExtension* ext = MallocExtension::instance();
+  size_t value;
+
+#ifdef ENABLE_ALLOC_LATENCY_STATS
+  // Enough objects to take every thread cache miss down to the system.
+  static const int kObjects = 20000;
+  void** objects = new void*[kObjects];
+  for (int i = 0; i < kObjects; ++i) {
+    objects[i] = malloc(3000);
+  }
+  for (int i = 0; i < kObjects; ++i) {
+    free(objects[i]);
+  }
+  delete[] objects;
+
+  for (int t = 0; t < kNumTiers; ++t) {
+    const string prefix = string("tcmalloc.latency.") + kTiers[t] + ".";
+    const size_t count = GetProperty((prefix + "count").c_str());
+    const size_t total_ns = GetProperty((prefix + "total_ns").c_str());
+    const size_t max_ns = GetProperty((prefix + "max_ns").c_str());
+    ASSERT_LE(max_ns, total_ns);
+    if (count == 0) {
+      ASSERT_EQ(0, total_ns);
+    }
+    size_t buckets = 0;
+    for (int b = 0; b < 32; ++b) {
+      char name[64];
+      snprintf(name, sizeof(name), "bucket.%d", b);
+      buckets += GetProperty((prefix + name).c_str());
+    }
+    // Read after the buckets, so events recorded meanwhile can only
+    // make it larger.
+    ASSERT_GE(GetProperty((prefix + "count").c_str()), buckets);
+    ASSERT_LE(count, buckets);
+    ASSERT_FALSE(ext->GetNumericProperty((prefix + "bucket.32").c_str(),
+                                         &value));
+    ASSERT_FALSE(ext->SetNumericProperty((prefix + "count").c_str(), 0));
+  }
+  ASSERT_GT(GetProperty("tcmalloc.latency.fast_path_miss.count"), 0);
+  ASSERT_GT(GetProperty("tcmalloc.latency.central_refill.count"), 0);
+  ASSERT_FALSE(ext->GetNumericProperty("tcmalloc.latency.no_such_tier.count",
+                                       &value));
+#else
+  for (int t = 0; t < kNumTiers; ++t) {
+    const string name = string("tcmalloc.latency.") + kTiers[t] + ".count";
+    ASSERT_FALSE(ext->GetNumericProperty(name.c_str(), &value));
+  }
+#endif
+}
+
+#ifdef HAVE_PTHREAD
+static volatile int lock_held;
+
+// Blocks of several pages come from the shared heap under
+// extended_lock(), so this waits until the main thread lets go of it.
+static void* AllocateWhileLocked(void*) {
+  while (!lock_held) sched_yield();
+  void* p = malloc(3 << 20);
+  ASSERT_TRUE(p != NULL);
+  free(p);
+  return NULL;
+}
+
+// Lock profiling is only on when the test runs with
+// TCMALLOC_LOCK_PROFILE set, as malloc_extension_test.sh does.
+static void TestLockProfile() {
+  MallocExtension* ext = MallocExtension::instance();
+  string profile;
+  size_t value;
+  if (getenv("TCMALLOC_LOCK_PROFILE") == NULL) {
+    ASSERT_FALSE(ext->GetNumericProperty(
+        "tcmalloc.lock.extended.acquisitions", &value));
+    ext->GetLockContentionProfile(&profile);
+    ASSERT_EQ(string::npos, profile.find("--- contention"));
+    return;
+  }
+
+  // The thread is started first, so that nothing it allocates on its
+  // way up needs the lock.  A loaded machine may not run it while we
+  // hold the lock, so try a few times.
+  for (int i = 0; i < 10; ++i) {
+    if (GetProperty("tcmalloc.lock.extended.contended") > 0) break;
+    pthread_t thread;
+    lock_held = 0;
+    ASSERT_EQ(0, pthread_create(&thread, NULL, AllocateWhileLocked, NULL));
+    {
+      SpinLockHolder h(tcmalloc::Static::extended_lock());
+      lock_held = 1;
+      struct timespec ts = { 0, 50 * 1000 * 1000 };
+      nanosleep(&ts, NULL);
+    }
+    ASSERT_EQ(0, pthread_join(thread, NULL));
+  }
+
+  const size_t contended = GetProperty("tcmalloc.lock.extended.contended");
+  ASSERT_GT(contended, 0);
+  ASSERT_GT(GetProperty("tcmalloc.lock.extended.wait_ns"), 0);
+  ASSERT_GE(GetProperty("tcmalloc.lock.extended.acquisitions"), contended);
+  ASSERT_FALSE(ext->GetNumericProperty("tcmalloc.lock.extended.no_such_stat",
+                                       &value));
+
+  // A header, one "<wait> <count> @ <pcs>" line per sampled stack, then
+  // the address map.  tcmalloc_minimal takes no stack traces, so it
+  // writes no stack lines.
+  ext->GetLockContentionProfile(&profile);
+  const string kHeader = "--- contention\n"
+                         "cycles/second = 1000000000\n"
+                         "sampling period = 1\n";
+  ASSERT_EQ(0, profile.compare(0, kHeader.size(), kHeader));
+  const size_t maps = profile.find("\nMAPPED_LIBRARIES:\n");
+  ASSERT_NE(string::npos, maps);
+  for (size_t line = kHeader.size(); line < maps;) {
+    const size_t end = profile.find('\n', line);
+    unsigned long long wait_ns, count;
+    char pc[32];
+    ASSERT_EQ(3, sscanf(profile.c_str() + line, "%llu %llu @ %31s",
+                        &wait_ns, &count, pc));
+    ASSERT_GT(count, 0);
+    ASSERT_EQ(0, strncmp(pc, "0x", 2));
+    line = end + 1;
+  }
+}
+
+// Returns the number following "\"key\": " in json.
+static uint64_t GetJSONNumber(const string& json, const char* key) {
+  const string quoted = string("\"") + key + "\": ";
+  const size_t pos = json.find(quoted);
+  ASSERT_NE(string::npos, pos);
+  return strtoull(json.c_str() + pos + quoted.size(), NULL, 10);
+}
+
+// Checks that the free and unmapped byte counts the shards and
+// ExtendedMemory add to their PageMap stats slots sum to the spans they
+// actually hold.  Only exact while no other thread allocates.
+static void CheckPageHeapStats() {
+  // Growing the string while the JSON is written could refill a shard
+  // after the totals were read, so make room for it up front.
+  string json;
+  MallocExtension::instance()->GetStatsJSON(&json);
+  json.reserve(2 * json.size());
+  json.clear();
+  MallocExtension::instance()->GetStatsJSON(&json);
+  const uint64_t free_bytes = GetJSONNumber(json, "large_free_bytes") +
+      GetShardProperty("free_bytes");
+  const uint64_t unmapped_bytes = GetJSONNumber(json, "large_unmapped_bytes") +
+      GetShardProperty("unmapped_bytes");
+  ASSERT_EQ(free_bytes, GetJSONNumber(json, "pageheap_free_bytes"));
+  ASSERT_EQ(unmapped_bytes, GetJSONNumber(json, "pageheap_unmapped_bytes"));
+  ASSERT_EQ(free_bytes, GetProperty("tcmalloc.pageheap_free_bytes"));
+  ASSERT_EQ(unmapped_bytes, GetProperty("tcmalloc.pageheap_unmapped_bytes"));
+}
+
+// Mixes small objects, single pages and multi-page blocks, freeing
+// each one a while after allocating it.
+static void* AllocFreeWorker(void* arg) {
+  static const size_t kSizes[] = {
+    16, 1000, 40000, kShardBlockSize, 3 * kPageSize,
+  };
+  static const int kNumSizes = sizeof(kSizes) / sizeof(*kSizes);
+  static const int kSlots = 64;
+  void* slots[kSlots] = { NULL };
+  unsigned int seed = static_cast<unsigned int>(
+      reinterpret_cast<uintptr_t>(arg));
+  for (int i = 0; i < 20000; i++) {
+    seed = seed * 1103515245 + 12345;
+    const int slot = (seed >> 8) % kSlots;
+    free(slots[slot]);
+    slots[slot] = malloc(kSizes[(seed >> 16) % kNumSizes]);
+    ASSERT_TRUE(slots[slot] != NULL);
+    if (i % 4096 == 0) {
+      MallocExtension::instance()->ReleaseToSystem(kPageSize);
+    }
+  }
+  for (int i = 0; i < kSlots; i++) {
+    free(slots[i]);
+  }
+  return NULL;
+}
+
+// The PageMap stats are kept in one slot per shard, each written under
+// that shard's lock only.  Once several threads have allocated, freed
+// and released across all shards, the slots must still add up.
+static void TestPageHeapStats() {
+  CheckPageHeapStats();
+  static const int kThreads = 4;
+  pthread_t threads[kThreads];
+  for (int i = 0; i < kThreads; i++) {
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, AllocFreeWorker,
+                                reinterpret_cast<void*>(i + 1)));
+  }
+  for (int i = 0; i < kThreads; i++) {
+    ASSERT_EQ(0, pthread_join(threads[i], NULL));
+  }
+  CheckPageHeapStats();
+  MallocExtension::instance()->ReleaseFreeMemory();
+  CheckPageHeapStats();
+}
+
+// Returns the number following "\"key\": " after entry.  Unlike
+// GetJSONNumber() it allocates nothing, so that it leaves the size
+// class counts alone.
+static uint64_t GetEntryNumber(const char* entry, const char* key) {
+  char quoted[32];
+  snprintf(quoted, sizeof(quoted), "\"%s\": ", key);
+  const char* value = strstr(entry, quoted);
+  ASSERT_TRUE(value != NULL);
+  return strtoull(value + strlen(quoted), NULL, 10);
+}
+
+// Fills in_use[cl] with the objects of each size class that are in no
+// free list, worked out from the "size_classes" counts of the JSON
+// stats.  Returns the number of classes.  Objects listed free twice
+// would make the count go negative rather than clamp at zero.
+static int GetClassesInUse(int64_t* in_use) {
+  string json;
+  json.reserve(1 << 20);  // Bigger than any size class.
+  MallocExtension::instance()->GetStatsJSON(&json);
+  static const char kClass[] = "{\"class\": ";
+  int classes = 0;
+  for (const char* entry = strstr(json.c_str(), kClass); entry != NULL;
+       entry = strstr(entry + 1, kClass)) {
+    const int cl = static_cast<int>(GetEntryNumber(entry, "class"));
+    ASSERT_EQ(classes + 1, cl);
+    const uint64_t size = GetEntryNumber(entry, "size");
+    const uint64_t total = GetEntryNumber(entry, "spans") *
+        ((GetEntryNumber(entry, "pages") << kPageShift) / size);
+    const uint64_t free = GetEntryNumber(entry, "central_free") +
+        GetEntryNumber(entry, "transfer_free") +
+        GetEntryNumber(entry, "thread_cache_free") +
+        GetEntryNumber(entry, "cpu_cache_free");
+    in_use[cl] = static_cast<int64_t>(total) - static_cast<int64_t>(free);
+    ASSERT_GE(in_use[cl], 0);
+    classes = cl;
+  }
+  ASSERT_GT(classes, 0);
+  return classes;
+}
+
+static const int kTransferThreads = 4;
+static const int kTransferBatch = 64;
+static const int kTransferRound = 32;
+static const int kTransferSlots = 16 * kTransferThreads;
+
+// A batch of objects of one size, each holding the batch's tag in its
+// first word.
+struct TransferBatch {
+  size_t size;
+  uintptr_t tag;
+  void* ptrs[kTransferBatch];
+};
+
+static SpinLock transfer_lock(SpinLock::LINKER_INITIALIZED);
+static TransferBatch* transfer_slots[kTransferSlots];
+static volatile int transfer_workers_done;
+
+static void FreeTransferBatch(TransferBatch* batch) {
+  for (int i = 0; i < kTransferBatch; i++) {
+    ASSERT_EQ(batch->tag, *static_cast<uintptr_t*>(batch->ptrs[i]));
+  }
+  MallocExtension::instance()->FreeBatch(batch->ptrs, kTransferBatch,
+                                         batch->size);
+  delete batch;
+}
+
+// Each round allocates batches of one size and swaps each for one left
+// by another thread, then frees all those in one go.  So every thread
+// keeps taking batches from the central caches, and handing back
+// bursts of others' that overflow its thread cache into the transfer
+// caches.
+static void* TransferWorker(void* arg) {
+  static const size_t kSizes[] = { 8, 48, 128, 512, 2048 };
+  static const int kNumSizes = sizeof(kSizes) / sizeof(*kSizes);
+  const uintptr_t id = reinterpret_cast<uintptr_t>(arg);
+  unsigned int seed = static_cast<unsigned int>(id);
+  uintptr_t tag = id << 20;
+  for (int round = 0; round < 128; round++) {
+    seed = seed * 1103515245 + 12345;
+    const size_t size = kSizes[(seed >> 16) % kNumSizes];
+    TransferBatch* taken[kTransferRound];
+    int num_taken = 0;
+    for (int i = 0; i < kTransferRound; i++) {
+      TransferBatch* batch = new TransferBatch;
+      batch->size = size;
+      batch->tag = ++tag;
+      ASSERT_EQ(kTransferBatch, MallocExtension::instance()->AllocateBatch(
+          size, batch->ptrs, kTransferBatch));
+      for (int j = 0; j < kTransferBatch; j++) {
+        *static_cast<uintptr_t*>(batch->ptrs[j]) = batch->tag;
+      }
+      seed = seed * 1103515245 + 12345;
+      {
+        SpinLockHolder h(&transfer_lock);
+        std::swap(batch, transfer_slots[(seed >> 8) % kTransferSlots]);
+      }
+      if (batch != NULL) {
+        taken[num_taken++] = batch;
+      }
+    }
+    for (int i = 0; i < num_taken; i++) {
+      FreeTransferBatch(taken[i]);
+    }
+    if (round % 16 == 0) {
+      MallocExtension::instance()->MarkThreadIdle();
+    }
+  }
+  return NULL;
+}
+
+// Drains the transfer caches, through the soft heap limit, while the
+// workers fill them.
+static void* TransferDrainer(void*) {
+  MallocExtension* ext = MallocExtension::instance();
+  while (!transfer_workers_done) {
+    ASSERT_TRUE(ext->SetNumericProperty("tcmalloc.soft_heap_limit_mb", 1));
+    ASSERT_TRUE(ext->SetNumericProperty("tcmalloc.soft_heap_limit_mb", 0));
+    sched_yield();
+  }
+  return NULL;
+}
+
+// The transfer caches grow by taking slots from other size classes,
+// which MakeCacheSpace() does with the cache's own lock dropped, and
+// are drained and shrunk from other threads.  With thread caches kept
+// small, so that batches keep going through the transfer caches, no
+// object may be lost or handed out twice.
+static void TestTransferCacheStress() {
+  MallocExtension* ext = MallocExtension::instance();
+  int64_t in_use_before[kClassSizesMax];
+  int64_t in_use_after[kClassSizesMax];
+  const size_t cache_bytes =
+      GetProperty("tcmalloc.max_total_thread_cache_bytes");
+  ASSERT_TRUE(ext->SetNumericProperty("tcmalloc.max_total_thread_cache_bytes",
+                                      256 << 10));
+  // The debug allocator records every block in a map of its own, kept
+  // in size class objects that grow as blocks turn up at new addresses,
+  // so the counts only hold still without it.  It reports the size
+  // asked for, where tcmalloc reports the size class's.
+  void* probe = malloc(1);
+  const bool debug_allocator = ext->GetAllocatedSize(probe) == 1;
+  free(probe);
+  // The debug allocator holds on to freed blocks for a while.
+  free(malloc(16 << 20));
+  const int classes = GetClassesInUse(in_use_before);
+
+  pthread_t drainer;
+  pthread_t threads[kTransferThreads];
+  transfer_workers_done = 0;
+  ASSERT_EQ(0, pthread_create(&drainer, NULL, TransferDrainer, NULL));
+  for (int i = 0; i < kTransferThreads; i++) {
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, TransferWorker,
+                                reinterpret_cast<void*>(i + 1)));
+  }
+  for (int i = 0; i < kTransferThreads; i++) {
+    ASSERT_EQ(0, pthread_join(threads[i], NULL));
+  }
+  transfer_workers_done = 1;
+  ASSERT_EQ(0, pthread_join(drainer, NULL));
+  for (int i = 0; i < kTransferSlots; i++) {
+    if (transfer_slots[i] != NULL) {
+      FreeTransferBatch(transfer_slots[i]);
+      transfer_slots[i] = NULL;
+    }
+  }
+  ext->MarkThreadIdle();
+  free(malloc(16 << 20));
+
+  ASSERT_EQ(classes, GetClassesInUse(in_use_after));
+  for (int cl = 1; cl <= classes && !debug_allocator; cl++) {
+    ASSERT_EQ(in_use_before[cl], in_use_after[cl]);
+  }
+  ASSERT_TRUE(ext->SetNumericProperty("tcmalloc.max_total_thread_cache_bytes",
+                                      cache_bytes));
+}
+#endif  // HAVE_PTHREAD
+
 int main(int argc, char** argv) {
   void* a = malloc(1000);
 
@@ -93,6 +777,18 @@ int main(int argc, char** argv) {
   ASSERT_EQ(static_cast<int>(MallocExtension::kNotOwned),
             static_cast<int>(MallocExtension_kNotOwned));
 
+  TestStatsJSON();
+  TestHeapLimit();
+  TestShardRelease();
+  TestShardDrain();
+  TestShardRefill();
+  TestAllocLatency();
+#ifdef HAVE_PTHREAD
+  TestLockProfile();
+  TestPageHeapStats();
+  TestTransferCacheStress();
+#endif
+
   printf("DONE\n");
   return 0;
 }
@@ -41,7 +41,9 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include <string>
 
 #include "profiledata.h"
@@ -126,6 +128,22 @@ class ProfileDataChecker {
 
   string filename() const { return filename_; }
 
+  // Returns a checker for chunk number 'chunk' of a ProfileStream
+  // profile written to filename().
+  ProfileDataChecker Chunk(int chunk) const {
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), ".%04d", chunk);
+    return ProfileDataChecker(filename_ + suffix);
+  }
+
+  // Removes the chunks a ProfileStream profile may have left behind.
+  void RemoveChunks() const {
+    int chunk = 1;
+    while (unlink(Chunk(chunk).filename().c_str()) == 0) {
+      chunk++;
+    }
+  }
+
   // Checks the first 'num_slots' profile data slots in the file
   // against the data pointed to by 'slots'.  Returns kNoError if the
   // data matched, otherwise returns an indication of the cause of the
@@ -156,7 +174,13 @@ class ProfileDataChecker {
   // an indication of the problem with the profile.
   string ValidateProfile();
 
+  // Adds up the counts of all samples in a valid profile.  Returns -1
+  // if the profile could not be read.
+  int CountSamples();
+
  private:
+  explicit ProfileDataChecker(const string& filename) : filename_(filename) {}
+
   string filename_;
 };
 
@@ -314,6 +338,29 @@ string ProfileDataChecker::ValidateProfile() {
   return kNoError;
 }
 
+int ProfileDataChecker::CountSamples() {
+  FileDescriptor fd(open(filename_.c_str(), O_RDONLY));
+  if (fd.get() < 0)
+    return -1;
+
+  ProfileDataSlot header[5];
+  if (ReadPersistent(fd.get(), header, sizeof(header)) != sizeof(header))
+    return -1;
+  int total = 0;
+  for (;;) {
+    ProfileDataSlot sample[2 + ProfileData::kMaxStackDepth];
+    if (ReadPersistent(fd.get(), sample, 2 * sizeof(sample[0])) !=
+        2 * sizeof(sample[0]) || sample[1] > ProfileData::kMaxStackDepth)
+      return -1;
+    if (sample[0] == 0 && sample[1] == 1)   // Trailer
+      return total;
+    const size_t pc_bytes = sample[1] * sizeof(sample[0]);
+    if (ReadPersistent(fd.get(), sample + 2, pc_bytes) != pc_bytes)
+      return -1;
+    total += sample[0];
+  }
+}
+
 class ProfileDataTest {
  protected:
   void ExpectStopped() {
@@ -335,7 +382,15 @@ class ProfileDataTest {
     EXPECT_STREQ(before.profile_name, after.profile_name);
   }
 
+  void ExpectStreamSamples(int samples) {
+    ProfileData::State state;
+    stream_.GetCurrentState(&state);
+    EXPECT_TRUE(state.enabled);
+    EXPECT_EQ(samples, state.samples_gathered);
+  }
+
   ProfileData        collector_;
+  ProfileStream      stream_;
   ProfileDataChecker checker_;
 
  private:
@@ -349,6 +404,11 @@ class ProfileDataTest {
   void CollectTwoMatching();
   void CollectTwoFlush();
   void StartResetRestart();
+  void StreamStartStopEmpty();
+  void StreamCollect();
+  void StreamRotate();
+  void StreamChunkSeconds();
+  void StreamDropped();
 
  public:
 #define RUN(test)  do {                         \
@@ -367,6 +427,11 @@ class ProfileDataTest {
     RUN(CollectTwoFlush);
     RUN(StartResetRestart);
     RUN(StartStopNoOptionsEmpty);
+    RUN(StreamStartStopEmpty);
+    RUN(StreamCollect);
+    RUN(StreamRotate);
+    RUN(StreamChunkSeconds);
+    RUN(StreamDropped);
     return 0;
   }
 };
@@ -603,6 +668,163 @@ TEST_F(ProfileDataTest, StartResetRestart) {
   EXPECT_EQ(kNoError, checker_.Check(slots, arraysize(slots)));
 }
 
+// Each ProfileStream chunk is a complete profile, with the same header
+// and trailer ProfileData writes.
+TEST_F(ProfileDataTest, StreamStartStopEmpty) {
+  const int frequency = 2;
+  ProfileDataSlot slots[] = {
+    0, 3, 0, 1000000 / frequency, 0,    // binary header
+    0, 1, 0                             // binary trailer
+  };
+
+  checker_.RemoveChunks();
+  ProfileStream::Options options;
+  options.set_frequency(frequency);
+  EXPECT_TRUE(stream_.Start(checker_.filename().c_str(), options));
+  ExpectStreamSamples(0);
+  EXPECT_FALSE(stream_.Start("foobar", options));
+
+  ProfileData::State state;
+  stream_.GetCurrentState(&state);
+  EXPECT_STREQ(checker_.Chunk(1).filename().c_str(), state.profile_name);
+
+  stream_.Stop();
+  EXPECT_FALSE(stream_.enabled());
+  EXPECT_EQ(kNoError, checker_.Chunk(1).ValidateProfile());
+  EXPECT_EQ(kNoError, checker_.Chunk(1).Check(slots, arraysize(slots)));
+  EXPECT_NE(0, access(checker_.Chunk(2).filename().c_str(), F_OK));
+}
+
+// Identical stacks are stored once, with their count, in the order
+// they were first seen.
+TEST_F(ProfileDataTest, StreamCollect) {
+  const int frequency = 2;
+  ProfileDataSlot slots[] = {
+    0, 3, 0, 1000000 / frequency, 0,    // binary header
+    2, 5, 100, 201, 302, 403, 504,      // two matching samples
+    1, 3, 100, 201, 305,                // and another
+    0, 1, 0                             // binary trailer
+  };
+
+  checker_.RemoveChunks();
+  ProfileStream::Options options;
+  options.set_frequency(frequency);
+  EXPECT_TRUE(stream_.Start(checker_.filename().c_str(), options));
+
+  const void *trace1[] = { V(100), V(201), V(302), V(403), V(504) };
+  const void *trace2[] = { V(100), V(201), V(305) };
+  stream_.Add(arraysize(trace1), trace1);
+  stream_.Add(arraysize(trace2), trace2);
+  stream_.Add(arraysize(trace1), trace1);
+  ExpectStreamSamples(3);
+
+  stream_.Stop();
+  EXPECT_EQ(0, stream_.samples_dropped());
+  EXPECT_EQ(kNoError, checker_.Chunk(1).ValidateProfile());
+  EXPECT_EQ(kNoError, checker_.Chunk(1).Check(slots, arraysize(slots)));
+}
+
+// Rotate, as ProfilerRotate does, finishes the current chunk and
+// carries on in the next one.
+TEST_F(ProfileDataTest, StreamRotate) {
+  const int frequency = 2;
+  ProfileDataSlot slots1[] = {
+    0, 3, 0, 1000000 / frequency, 0,    // binary header
+    1, 5, 100, 201, 302, 403, 504,      // sample before rotating
+    0, 1, 0                             // binary trailer
+  };
+  ProfileDataSlot slots2[] = {
+    0, 3, 0, 1000000 / frequency, 0,    // binary header
+    1, 3, 100, 201, 305,                // sample after rotating
+    0, 1, 0                             // binary trailer
+  };
+
+  checker_.RemoveChunks();
+  ProfileStream::Options options;
+  options.set_frequency(frequency);
+  EXPECT_TRUE(stream_.Start(checker_.filename().c_str(), options));
+
+  const void *trace1[] = { V(100), V(201), V(302), V(403), V(504) };
+  const void *trace2[] = { V(100), V(201), V(305) };
+  stream_.Add(arraysize(trace1), trace1);
+  EXPECT_TRUE(stream_.Rotate());
+  stream_.Add(arraysize(trace2), trace2);
+
+  ProfileData::State state;
+  stream_.GetCurrentState(&state);
+  EXPECT_STREQ(checker_.Chunk(2).filename().c_str(), state.profile_name);
+  ExpectStreamSamples(2);
+
+  stream_.Stop();
+  EXPECT_FALSE(stream_.Rotate());
+  EXPECT_EQ(kNoError, checker_.Chunk(1).ValidateProfile());
+  EXPECT_EQ(kNoError, checker_.Chunk(1).Check(slots1, arraysize(slots1)));
+  EXPECT_EQ(kNoError, checker_.Chunk(2).ValidateProfile());
+  EXPECT_EQ(kNoError, checker_.Chunk(2).Check(slots2, arraysize(slots2)));
+  EXPECT_NE(0, access(checker_.Chunk(3).filename().c_str(), F_OK));
+}
+
+// With chunk_seconds set, as CPUPROFILE_CHUNK_SECONDS does, the writer
+// thread starts new chunks by itself.
+TEST_F(ProfileDataTest, StreamChunkSeconds) {
+  checker_.RemoveChunks();
+  ProfileStream::Options options;
+  options.set_frequency(2);
+  options.set_chunk_seconds(1);
+  EXPECT_TRUE(stream_.Start(checker_.filename().c_str(), options));
+
+  const void *trace[] = { V(100), V(201), V(302), V(403), V(504) };
+  const int kSamples = 30;
+  for (int i = 0; i < kSamples; i++) {
+    stream_.Add(arraysize(trace), trace);
+    usleep(100 * 1000);
+  }
+  stream_.Stop();
+
+  int chunks = 0;
+  int samples = 0;
+  for (int chunk = 1; ; chunk++) {
+    ProfileDataChecker chunk_checker = checker_.Chunk(chunk);
+    if (access(chunk_checker.filename().c_str(), F_OK) != 0) break;
+    EXPECT_EQ(kNoError, chunk_checker.ValidateProfile());
+    samples += chunk_checker.CountSamples();
+    chunks++;
+  }
+  // 3 seconds at one chunk a second, allowing for a slow machine.
+  EXPECT_GE(chunks, 2);
+  EXPECT_LE(chunks, 5);
+  EXPECT_EQ(kSamples, samples);
+}
+
+// Samples that find the table full are dropped and counted, and every
+// sample is either written out or counted as dropped.
+TEST_F(ProfileDataTest, StreamDropped) {
+  checker_.RemoveChunks();
+  ProfileStream::Options options;
+  options.set_frequency(2);
+  EXPECT_TRUE(stream_.Start(checker_.filename().c_str(), options));
+
+  // Many more distinct stacks than a table holds, added faster than
+  // the writer thread drains them.
+  const int kSamples = 100000;
+  for (int i = 0; i < kSamples; i++) {
+    const void *trace[] = { V(i + 1) };
+    stream_.Add(arraysize(trace), trace);
+  }
+  ExpectStreamSamples(kSamples);
+
+  stream_.Stop();
+  EXPECT_GT(stream_.samples_dropped(), 0);
+  EXPECT_EQ(kNoError, checker_.Chunk(1).ValidateProfile());
+  EXPECT_EQ(kSamples - stream_.samples_dropped(),
+            checker_.Chunk(1).CountSamples());
+
+  // Start clears the count.
+  EXPECT_TRUE(stream_.Start(checker_.filename().c_str(), options));
+  EXPECT_EQ(0, stream_.samples_dropped());
+  stream_.Reset();
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
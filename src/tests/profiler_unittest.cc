@@ -54,6 +54,7 @@ Mutex mutex(Mutex::LINKER_INITIALIZED);
 static void test_other_thread() {
 #ifndef NO_THREADS
   ProfilerRegisterThread();
+  ProfilerSetThreadLabel("other");
 
   int i, m;
   char b[128];
@@ -81,7 +82,8 @@ static void test_main_thread() {
 
 int main(int argc, char** argv) {
   if ( argc <= 1 ) {
-    fprintf(stderr, "USAGE: %s <iters> [num_threads] [filename]\n", argv[0]);
+    fprintf(stderr, "USAGE: %s <iters> [num_threads] [filename] [exclude]\n",
+            argv[0]);
     fprintf(stderr, "   iters: How many million times to run the XOR test.\n");
     fprintf(stderr, "   num_threads: how many concurrent threads.\n");
     fprintf(stderr, "                0 or 1 for single-threaded mode,\n");
@@ -89,6 +91,9 @@ int main(int argc, char** argv) {
     fprintf(stderr, "   filename: The name of the output profile.\n");
     fprintf(stderr, ("             If you don't specify, set CPUPROFILE "
                      "in the environment instead!\n"));
+    fprintf(stderr, "   exclude: Don't profile threads with this label.\n");
+    fprintf(stderr, "            The main thread is 'main', the others are\n");
+    fprintf(stderr, "            'other'.\n");
     return 1;
   }
 
@@ -101,6 +106,10 @@ int main(int argc, char** argv) {
   if (argc > 3) {
     filename = argv[3];
   }
+  ProfilerSetThreadLabel("main");
+  if (argc > 4) {
+    ProfilerExcludeThreads(argv[4]);
+  }
 
   if (filename) {
     ProfilerStart(filename);
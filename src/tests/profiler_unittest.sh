@@ -192,6 +192,48 @@ VerifyAcrossThreads() {
   fi
 }
 
+# Takes a filename representing a profile, with its executable, taken
+# with CPUPROFILE_THREAD_TAGS set, and verifies that every sample hangs
+# off a "thread <id> <label>" frame.  If a third argument is given, it
+# is the label of threads that were filtered out, and those must
+# contribute no samples at all; otherwise the 'other' threads must show
+# up too.
+VerifyThreadTags() {
+  prof1="$TMPDIR/$1"
+  exec1="$2"
+  excluded="$3"
+
+  "$PPROF" $PPROF_FLAGS --text $exec1 "$prof1" > "$TMPDIR/out1"
+  total=`grep '^Total:' "$TMPDIR/out1" | awk '{print $2}'`
+  tagged=`grep ' thread [0-9]* [a-z]*$' "$TMPDIR/out1" | awk '{s += $4} END {print s + 0}'`
+  mthread=`grep ' thread [0-9]* main$' "$TMPDIR/out1" | awk '{print $4}'`
+  othread=`grep -c ' thread [0-9]* other$' "$TMPDIR/out1"`
+  if [ -z "$total" ] || [ "$total" -le 0 ] || [ "$tagged" != "$total" ] || \
+     [ -z "$mthread" ] || [ "$mthread" -le 0 ]
+  then
+    echo
+    echo ">>> thread tags in profile on $exec1 failed:"
+    echo "Total samples '$total', tagged with a thread '$tagged', main '$mthread'"
+    echo
+    RegisterFailure
+  fi
+  if [ -n "$excluded" ]; then
+    excluded_fn=`grep -c "test_${excluded}_thread" "$TMPDIR/out1"`
+    if [ "$othread" != 0 ] || [ "$excluded_fn" != 0 ]; then
+      echo
+      echo ">>> profile on $exec1 has samples from excluded threads:"
+      cat "$TMPDIR/out1"
+      echo
+      RegisterFailure
+    fi
+  elif [ "$othread" -le 0 ]; then
+    echo
+    echo ">>> profile on $exec1 has no 'thread <id> other' frames"
+    echo
+    RegisterFailure
+  fi
+}
+
 echo
 echo ">>> WARNING <<<"
 echo "This test looks at timing information to determine correctness."
@@ -253,6 +295,13 @@ env CPUPROFILE_REALTIME=1 "$PROFILER3" 30 2 "$TMPDIR/p16" || RegisterFailure
 env CPUPROFILE_REALTIME=1 "$PROFILER3" 60 2 "$TMPDIR/p17" || RegisterFailure
 VerifySimilar p16 "$PROFILER3_REALNAME" p17 "$PROFILER3_REALNAME" 2
 
+# Test thread tags, and that filtered-out threads leave no samples.
+env CPUPROFILE_THREAD_TAGS=1 "$PROFILER3" 30 2 "$TMPDIR/p18" || RegisterFailure
+VerifyThreadTags p18 "$PROFILER3_REALNAME"
+env CPUPROFILE_THREAD_TAGS=1 "$PROFILER3" 30 2 "$TMPDIR/p19" other \
+    || RegisterFailure
+VerifyThreadTags p19 "$PROFILER3_REALNAME" other
+
 
 # Make sure that when we have a process with a fork, the profiles don't
 # clobber each other
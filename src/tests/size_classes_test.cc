@@ -0,0 +1,139 @@
+// -*- Mode: C++; c-basic-offset: 2; indent-tabs-mode: nil -*-
+// Copyright (c) 2026, gperftools Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Tests the size class tables TCMALLOC_SIZE_CLASSES sets up.
+
+#include "config_for_unittests.h"
+
+#include <stdio.h>
+
+#include "base/logging.h"
+#include "common.h"
+
+using tcmalloc::SizeMap;
+
+namespace {
+
+// Re-initialized by every test, like the one in Static, and the
+// computed table to compare it with.
+static SizeMap sizemap;
+static SizeMap computed;
+
+// The batch the computed table uses for 'size', one of its classes.
+static int ComputedBatch(size_t size) {
+  const int cl = computed.SizeClass(size);
+  CHECK_EQ(size, computed.ByteSizeForClass(cl));
+  return computed.num_objects_to_move(cl);
+}
+
+// A table with every form of entry: size only, size:pages and
+// size:pages:batch.
+static void TestCustomTable() {
+  sizemap.Init("16:1:8, 32,48:1 128:2:64,1024:1:4 4096");
+
+  // kMaxSize is appended as the last class.
+  CHECK_EQ(8, sizemap.num_size_classes);
+  const int kSizes[] = { 0, 16, 32, 48, 128, 1024, 4096, kMaxSize };
+  for (int cl = 1; cl < 8; cl++) {
+    CHECK_EQ(kSizes[cl], sizemap.ByteSizeForClass(cl));
+  }
+
+  // Pages and batches given are used as is; the others are computed.
+  CHECK_EQ(1, sizemap.class_to_pages(1));
+  CHECK_EQ(8, sizemap.num_objects_to_move(1));
+  CHECK_GE(sizemap.class_to_pages(2), 1);
+  CHECK_EQ(ComputedBatch(32), sizemap.num_objects_to_move(2));
+  CHECK_EQ(1, sizemap.class_to_pages(3));
+  CHECK_EQ(ComputedBatch(48), sizemap.num_objects_to_move(3));
+  CHECK_EQ(2, sizemap.class_to_pages(4));
+  CHECK_EQ(64, sizemap.num_objects_to_move(4));
+  CHECK_EQ(1, sizemap.class_to_pages(5));
+  CHECK_EQ(4, sizemap.num_objects_to_move(5));
+
+  // Requests go to the smallest class that fits them.
+  CHECK_EQ(1, sizemap.SizeClass(1));
+  CHECK_EQ(1, sizemap.SizeClass(16));
+  CHECK_EQ(2, sizemap.SizeClass(17));
+  CHECK_EQ(3, sizemap.SizeClass(33));
+  CHECK_EQ(4, sizemap.SizeClass(100));
+  CHECK_EQ(5, sizemap.SizeClass(1024));
+  CHECK_EQ(6, sizemap.SizeClass(1025));
+  CHECK_EQ(7, sizemap.SizeClass(kMaxSize));
+}
+
+// Returns whether sizemap holds the computed table.
+static bool HasDefaultTable() {
+  if (sizemap.num_size_classes != computed.num_size_classes) {
+    return false;
+  }
+  for (int cl = 1; cl < computed.num_size_classes; cl++) {
+    if (sizemap.ByteSizeForClass(cl) != computed.ByteSizeForClass(cl) ||
+        sizemap.class_to_pages(cl) != computed.class_to_pages(cl) ||
+        sizemap.num_objects_to_move(cl) !=
+        computed.num_objects_to_move(cl)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Invalid tables are ignored in favor of the computed one.
+static void TestInvalidTables() {
+  const char* const kInvalid[] = {
+    "abc",              // Not a number
+    "16,x",             // Bad entry
+    "16:1:8:2",         // Too many fields
+    "16:",              // Missing field
+    "32,16",            // Sizes must increase
+    "12",               // Not a multiple of 8
+    "1032",             // Not a multiple of 128 above 1024
+    "24,48",            // 24 covers 16 but is not a multiple of it
+    "16:100",           // Span too long
+    "16:1:100000",      // Batch too large
+    "1048576",          // Larger than kMaxSize
+  };
+  for (int i = 0; i < sizeof(kInvalid) / sizeof(*kInvalid); i++) {
+    sizemap.Init("16:1:8");   // Start from something else
+    CHECK(!HasDefaultTable());
+    printf("Expecting '%s' to be ignored\n", kInvalid[i]);
+    sizemap.Init(kInvalid[i]);
+    CHECK(HasDefaultTable());
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  computed.Init(NULL);
+  TestCustomTable();
+  TestInvalidTables();
+  printf("PASS\n");
+  return 0;
+}
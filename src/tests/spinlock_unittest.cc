@@ -0,0 +1,128 @@
+// -*- Mode: C++; c-basic-offset: 2; indent-tabs-mode: nil -*-
+// Copyright (c) 2026, gperftools Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// ---
+//
+// Stress tests for SpinLock: mutual exclusion with many more threads
+// than CPUs, with short holds that are won by spinning and with long
+// holds that send waiters to sleep and through the handoff path.
+
+#include "config_for_unittests.h"
+#include <stdio.h>
+#include <time.h>                       // for nanosleep, clock_gettime
+#include "base/logging.h"
+#include "base/spinlock.h"
+#include "tests/testutil.h"
+
+static SpinLock lock(base::LINKER_INITIALIZED);
+
+// Protected by lock.  Plain variables on purpose: a broken lock shows
+// up as lost increments or as two threads inside at once.
+static long counter;
+static int inside;
+
+static int iterations;
+static int hold_ns;
+
+static long long max_wait_ns[256];
+
+static long long NowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<long long>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static void Hold() {
+  if (hold_ns <= 0) return;
+  struct timespec ts = { 0, hold_ns };
+  nanosleep(&ts, NULL);
+}
+
+static void Worker(int id) {
+  long long worst = 0;
+  for (int i = 0; i < iterations; i++) {
+    const long long start = NowNanos();
+    SpinLockHolder h(&lock);
+    const long long waited = NowNanos() - start;
+    if (waited > worst) worst = waited;
+    CHECK_EQ(inside, 0);
+    inside = 1;
+    counter++;
+    Hold();
+    inside = 0;
+  }
+  max_wait_ns[id] = worst;
+}
+
+static void RunStress(const char* name, int nthreads, int iters, int hold) {
+  CHECK_LE(nthreads, 256);
+  counter = 0;
+  iterations = iters;
+  hold_ns = hold;
+  RunManyThreadsWithId(Worker, nthreads, 64 << 10);
+  CHECK_EQ(counter, static_cast<long>(nthreads) * iters);
+  CHECK(!lock.IsHeld());
+
+  long long worst = 0;
+  for (int i = 0; i < nthreads; i++) {
+    if (max_wait_ns[i] > worst) worst = max_wait_ns[i];
+  }
+  printf("%-12s %3d threads: %ld acquisitions, worst wait %lld us\n",
+         name, nthreads, counter, worst / 1000);
+}
+
+static void TestTryLock() {
+  SpinLock l;
+  CHECK(!l.IsHeld());
+  CHECK(l.TryLock());
+  CHECK(l.IsHeld());
+  CHECK(!l.TryLock());
+  l.Unlock();
+  CHECK(!l.IsHeld());
+  l.Lock();
+  CHECK(!l.TryLock());
+  l.Unlock();
+  CHECK(l.TryLock());
+  l.Unlock();
+}
+
+int main(int argc, char** argv) {
+  TestTryLock();
+  // Holds short enough to be waited out by spinning.
+  RunStress("short holds", 4, 200000, 0);
+  // Far more threads than CPUs, as when every thread of a large
+  // server runs into the same page heap refill.
+  RunStress("oversub", 200, 500, 0);
+  // Holds long enough that waiters sleep, mark the lock starving and
+  // get it handed over.
+  RunStress("long holds", 32, 100, 20000);
+  printf("PASS\n");
+  return 0;
+}
@@ -679,6 +679,59 @@ static void TestRealloc() {
 #endif
 }
 
+#ifndef DEBUGALLOCATION  // only used by TestLargeRealloc
+static bool IsFilled(const char* p, size_t n, char c) {
+  for (size_t i = 0; i < n; ++i) {
+    if (p[i] != c) return false;
+  }
+  return true;
+}
+#endif
+
+// Page-level allocations are resized without moving them when they
+// shrink or when the pages after them are free.
+static void TestLargeRealloc() {
+#ifndef DEBUGALLOCATION  // debug alloc always moves the data
+  const int64 old_sample_parameter = FLAGS_tcmalloc_sample_parameter;
+  FLAGS_tcmalloc_sample_parameter = 0;   // turn off sampling
+
+  const size_t kSize = 1 << 20;
+  char* p = static_cast<char*>(malloc(kSize));
+  CHECK(p);
+  memset(p, 'a', kSize);
+  char* q = static_cast<char*>(realloc(p, kSize / 3));
+  CHECK(q == p);
+  CHECK(IsFilled(q, kSize / 3, 'a'));
+
+  // Free the neighbour, when there is one, and grow into it.
+  char* next = static_cast<char*>(malloc(kSize));
+  CHECK(next);
+  const size_t shrunk = (kSize / 3 + kPageSize - 1) & ~(kPageSize - 1);
+  if (next == q + shrunk) {
+    free(next);
+    next = NULL;
+    char* r = static_cast<char*>(realloc(q, kSize));
+    CHECK(r == q);
+    q = r;
+  }
+  free(next);
+
+  // Whatever happens, growing and shrinking keep the contents.
+  size_t size = kSize / 3;
+  for (int i = 0; i < 20; ++i) {
+    const size_t new_size = (i % 5 == 4) ? size / 3 : size + i * kSize;
+    char* r = static_cast<char*>(realloc(q, new_size));
+    CHECK(r);
+    CHECK(IsFilled(r, std::min(size, new_size), 'a'));
+    memset(r, 'a', new_size);
+    q = r;
+    size = new_size;
+  }
+  free(q);
+  FLAGS_tcmalloc_sample_parameter = old_sample_parameter;
+#endif
+}
+
 static void TestNewHandler() {
   ++news_handled;
   throw std::bad_alloc();
@@ -835,6 +888,64 @@ static void TestMallocAlignment() {
   }
 }
 
+#ifndef DEBUGALLOCATION  // debug alloc pads aligned allocations itself
+static size_t GetSystemBytes() {
+  size_t bytes;
+  CHECK(MallocExtension::instance()->GetNumericProperty(
+      "generic.heap_size", &bytes));
+  return bytes;
+}
+#endif
+
+// Alignments above the page size take an aligned run of pages straight
+// from the page heap, splitting off the pages in front of it when the
+// free span found is not aligned.  Freed runs must be found again.
+// Which free pages end up held by page heap shards, out of reach of
+// aligned allocations, varies from run to run, so the heap may keep
+// growing for a while; but it levels off, while a leak would grow it
+// by a whole round's allocations every round.
+static void TestLargeAlignment() {
+#ifndef DEBUGALLOCATION
+  if (!kOSSupportsMemalign) return;
+  fprintf(LOGSTREAM, "Testing alignments above the page size\n");
+  static const size_t kAligns[] = { 1 << 20, 4 << 20 };
+  static const int kWarmupRounds = 4;
+  size_t round_bytes = 0;
+  size_t system_bytes = 0;
+  for (int round = 0; round < 3 * kWarmupRounds; round++) {
+    for (int i = 0; i < sizeof(kAligns) / sizeof(*kAligns); i++) {
+      const size_t align = kAligns[i];
+      const size_t kSizes[] = { 1, kPageSize, align + 1, 3 * align };
+      for (int j = 0; j < sizeof(kSizes) / sizeof(*kSizes); j++) {
+        const size_t size = kSizes[j];
+        // A single page in front makes the next free span unaligned.
+        void* filler = malloc(kPageSize + 1);
+        CHECK(filler);
+        char* p = static_cast<char*>(Memalign(align, size));
+        CHECK(p);
+        CHECK_EQ(0, reinterpret_cast<uintptr_t>(p) & (align - 1));
+        memset(p, 'a', size);
+        void* q = NULL;
+        CHECK_EQ(0, PosixMemalign(&q, align, size));
+        CHECK_EQ(0, reinterpret_cast<uintptr_t>(q) & (align - 1));
+        CHECK(q != p);
+        memset(q, 'b', size);
+        if (round == 0) round_bytes += 2 * size;
+        CHECK(IsFilled(p, size, 'a'));
+        free(filler);
+        free(p);
+        free(q);
+      }
+    }
+    if (round == kWarmupRounds) {
+      system_bytes = GetSystemBytes();
+    } else if (round > kWarmupRounds) {
+      CHECK_LE(GetSystemBytes(), system_bytes + 3 * round_bytes);
+    }
+  }
+#endif
+}
+
 static void TestHugeThreadCache() {
   fprintf(LOGSTREAM, "==== Testing huge thread cache\n");
   // More than 2^16 to cause integer overflow of 16 bit counters.
@@ -1049,6 +1160,169 @@ static void TestAggressiveDecommit() {
 #endif   // #ifndef DEBUGALLOCATION
 }
 
+#ifndef DEBUGALLOCATION
+// Sums a "tcmalloc.pageheap_shard.<N>.<stat>" property over all shards.
+static size_t SumShardProperty(const char* stat) {
+  MallocExtension* const ext = MallocExtension::instance();
+  size_t shards = 0;
+  CHECK(ext->GetNumericProperty("tcmalloc.pageheap_shards", &shards));
+  size_t sum = 0;
+  for (size_t i = 0; i < shards; i++) {
+    char name[64];
+    snprintf(name, sizeof(name), "tcmalloc.pageheap_shard.%zu.%s", i, stat);
+    size_t value = 0;
+    CHECK(ext->GetNumericProperty(name, &value));
+    sum += value;
+  }
+  return sum;
+}
+#endif
+
+// ReleaseFreeMemory() must empty the shards' normal free lists whether
+// or not huge pages are on.  With them on, the shards hand their spans
+// to the shared heap, which releases the whole huge pages among them.
+static void TestReleaseShards() {
+#ifndef DEBUGALLOCATION
+  // With huge pages on, HaveSystemRelease is false: a single page is
+  // less than the huge page a release has to cover.
+  static const bool have_release = TCMalloc_SystemRelease(
+      TCMalloc_SystemAlloc(kHugePageSize, NULL, kHugePageSize),
+      kHugePageSize);
+  if (!have_release) return;
+
+  const double old_tcmalloc_release_rate = FLAGS_tcmalloc_release_rate;
+  FLAGS_tcmalloc_release_rate = 0;
+  AggressiveDecommitChanger disabler(0);
+
+  // Each block is a 1-page span, which is freed into a shard.
+  static const int kBlocks = 8;
+  void* blocks[kBlocks];
+  for (int i = 0; i < kBlocks; i++) {
+    blocks[i] = malloc(kPageSize);
+    CHECK(blocks[i] != NULL);
+  }
+  MallocExtension::instance()->ReleaseFreeMemory();
+  const size_t unmapped = GetUnmappedBytes();
+  for (int i = 0; i < kBlocks; i++) {
+    free(blocks[i]);
+  }
+  CHECK_GT(SumShardProperty("free_bytes"), 0);
+
+  MallocExtension::instance()->ReleaseFreeMemory();
+  EXPECT_EQ(0, SumShardProperty("free_bytes"));
+  CHECK_GT(GetUnmappedBytes(), unmapped);
+
+  FLAGS_tcmalloc_release_rate = old_tcmalloc_release_rate;
+#endif   // #ifndef DEBUGALLOCATION
+}
+
+#if defined(__linux__) && !defined(DEBUGALLOCATION)
+// Returns the value of a "Name: value kB" line of the given /proc
+// file in the mapping containing addr, or of the whole file if addr
+// is NULL.  Returns -1 if there is no such line.
+static long ReadProcField(const char* path, const char* name,
+                          const void* addr) {
+  FILE* f = fopen(path, "r");
+  if (f == NULL) return -1;
+  const uintptr_t p = reinterpret_cast<uintptr_t>(addr);
+  bool in_mapping = (addr == NULL);
+  long value = -1;
+  char line[512];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    unsigned long start, end;
+    if (addr != NULL && sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+      in_mapping = (start <= p && p < end);
+    } else if (in_mapping && strncmp(line, name, strlen(name)) == 0) {
+      value = strtol(line + strlen(name), NULL, 10);
+      if (addr != NULL) break;
+    }
+  }
+  fclose(f);
+  return value;
+}
+#endif
+
+// With TCMALLOC_HUGEPAGES=2 the heap grows from the hugetlbfs pool
+// while it has pages, and from ordinary memory once it has none.
+// Run while the heap is still small, so that a large block has to
+// come from new growth.
+static void TestHugeTlbBacking() {
+#if defined(__linux__) && !defined(DEBUGALLOCATION)
+  const char* mode = getenv("TCMALLOC_HUGEPAGES");
+  if (mode == NULL || strtol(mode, NULL, 10) < 2) return;
+  fprintf(LOGSTREAM, "Testing hugetlbfs backing\n");
+
+  // Big enough that the heap has to grow for it.
+  static const size_t kSize = 64 << 20;
+  const long pool_free = ReadProcField("/proc/meminfo", "HugePages_Free:",
+                                       NULL);
+  char* p = static_cast<char*>(malloc(kSize));
+  CHECK(p != NULL);
+  memset(p, 1, kSize);
+  const long page_kb = ReadProcField("/proc/self/smaps", "KernelPageSize:",
+                                     p + kSize / 2);
+  CHECK_GT(page_kb, 0);
+  if (pool_free >= 0 &&
+      static_cast<size_t>(pool_free) * kHugePageSize >= 2 * kSize) {
+    CHECK_EQ(page_kb * 1024, kHugePageSize);
+  } else {
+    fprintf(LOGSTREAM, "  hugetlbfs pool too small, got %ld kB pages\n",
+            page_kb);
+  }
+  free(p);
+#endif
+}
+
+// With TCMALLOC_PAGEHEAP_SHARDS set, tcmalloc.pageheap_shards must
+// report that many shards, clamped to kMaxPageHeapShards.  Values that
+// are not a positive number leave the default of one per 4 cpus.
+static void TestPageHeapShards() {
+  const char* env = getenv("TCMALLOC_PAGEHEAP_SHARDS");
+  if (env == NULL) return;
+  fprintf(LOGSTREAM, "Testing TCMALLOC_PAGEHEAP_SHARDS=%s\n", env);
+
+  size_t shards = 0;
+  CHECK(MallocExtension::instance()->GetNumericProperty(
+      "tcmalloc.pageheap_shards", &shards));
+  long expected = strtol(env, NULL, 10);
+  if (expected <= 0) {
+    expected = (sysconf(_SC_NPROCESSORS_ONLN) + 3) / 4;
+  }
+  expected = std::max<long>(expected, 1);
+  expected = std::min<long>(expected, tcmalloc::Static::kMaxPageHeapShards);
+  CHECK_LE(shards, tcmalloc::Static::kMaxPageHeapShards);
+  // Every NUMA node rounds its share of the shards up, so a machine
+  // with several nodes may get a few more.
+  if (access("/sys/devices/system/node/node1", F_OK) != 0) {
+    CHECK_EQ(expected, shards);
+  } else {
+    CHECK_GE(shards, expected);
+  }
+}
+
+// With TCMALLOC_BACKGROUND_INTERVAL_MS set, the background thread
+// must keep making passes while the program runs.
+static void TestBackgroundThread() {
+  const char* interval = getenv("TCMALLOC_BACKGROUND_INTERVAL_MS");
+  if (interval == NULL || strtol(interval, NULL, 10) <= 0) return;
+  fprintf(LOGSTREAM, "Testing the background thread\n");
+
+  MallocExtension* const ext = MallocExtension::instance();
+  size_t value = 0;
+  CHECK(ext->GetNumericProperty("tcmalloc.background.interval_ms", &value));
+  CHECK_EQ(strtol(interval, NULL, 10), value);
+
+  size_t passes = 0;
+  CHECK(ext->GetNumericProperty("tcmalloc.background.passes", &passes));
+  // Allow up to 10 seconds for a pass, in case the machine is loaded.
+  value = passes;
+  for (int i = 0; i < 1000 && value == passes; i++) {
+    usleep(10 * 1000);
+    CHECK(ext->GetNumericProperty("tcmalloc.background.passes", &value));
+  }
+  CHECK_GT(value, passes);
+}
+
 // On MSVC10, in release mode, the optimizer convinces itself
 // g_no_memory is never changed (I guess it doesn't realize OnNoMemory
 // might be called).  Work around this by setting the var volatile.
@@ -1122,6 +1396,194 @@ static void TestErrno(void) {
   EXPECT_EQ(ENOMEM, errno);
 }
 
+static void TestBatchAllocation() {
+  static const size_t kSizes[] = { 0, 8, 100, 4000, 40000, 1 << 20 };
+  static const size_t kCounts[] = { 1, 100, 5000 };
+  for (int i = 0; i < sizeof(kSizes) / sizeof(*kSizes); i++) {
+    const size_t size = kSizes[i];
+    for (int j = 0; j < sizeof(kCounts) / sizeof(*kCounts); j++) {
+      const size_t count = size >= (1 << 20) ? 8 : kCounts[j];
+      vector<void*> ptrs(count + 1);
+      ASSERT_EQ(count, tc_malloc_batch(size, &ptrs[0], count));
+      for (size_t k = 0; k < count; k++) {
+        ASSERT_NE(ptrs[k], NULL);
+        ASSERT_GE(MallocExtension::instance()->GetAllocatedSize(ptrs[k]),
+                  size);
+        memset(ptrs[k], k & 0xff, size);
+      }
+      vector<void*> sorted(ptrs.begin(), ptrs.begin() + count);
+      std::sort(sorted.begin(), sorted.end());
+      ASSERT_TRUE(std::unique(sorted.begin(), sorted.end()) == sorted.end());
+
+      // Free the first object on its own and the rest, plus a NULL, as
+      // a batch.
+      tc_free(ptrs[0]);
+      ptrs[count] = NULL;
+      tc_free_batch(&ptrs[1], count, size);
+
+      ASSERT_EQ(count, MallocExtension::instance()->AllocateBatch(
+                           size, &ptrs[0], count));
+      MallocExtension::instance()->FreeBatch(&ptrs[0], count, size);
+    }
+  }
+}
+
+static size_t GetCpuCacheFreeBytes() {
+  size_t value = 0;
+  CHECK(MallocExtension::instance()->GetNumericProperty(
+      "tcmalloc.cpu_cache_free_bytes", &value));
+  return value;
+}
+
+static size_t cpu_cache_bound;
+
+// Allocates and frees objects of every small size class, so that the
+// per-cpu caches refill and spill every list, and checks the bound
+// after each half: refills leave objects behind in many lists at once.
+static void CpuCacheWorker() {
+  vector<void*> ptrs;
+  for (int round = 0; round < 4; round++) {
+    for (size_t size = 8; size <= (256 << 10); size += size / 8) {
+      const int count = size < 4096 ? 200 : 8;
+      for (int k = 0; k < count; k++) {
+        void* p = malloc(size);
+        CHECK(p);
+        ptrs.push_back(p);
+      }
+    }
+    ASSERT_LE(GetCpuCacheFreeBytes(), cpu_cache_bound);
+    for (size_t k = 0; k < ptrs.size(); k++) {
+      free(ptrs[k]);
+    }
+    ptrs.clear();
+    ASSERT_LE(GetCpuCacheFreeBytes(), cpu_cache_bound);
+  }
+}
+
+// The per-cpu caches hold at most TCMALLOC_PERCPU_CACHE_BYTES each,
+// however many threads use them.  Few enough threads run that, with
+// sampled objects taking a page each, they stay well under the 1GiB
+// SetTestResourceLimit() sets.
+static void TestCpuCacheBound() {
+  const char* enabled = getenv("TCMALLOC_PERCPU_CACHE");
+  if (enabled == NULL || strtol(enabled, NULL, 10) == 0) {
+    ASSERT_EQ(0, GetCpuCacheFreeBytes());
+    return;
+  }
+  fprintf(LOGSTREAM, "Testing the per-cpu cache bound\n");
+  size_t per_cpu = 1 << 20;   // cpu_cache.cc's default
+  const char* bytes = getenv("TCMALLOC_PERCPU_CACHE_BYTES");
+  if (bytes != NULL) {
+    // Smaller settings are raised to twice the largest small object.
+    per_cpu = std::max<size_t>(strtoull(bytes, NULL, 10), 2 * (256 << 10));
+  }
+  const long cpus = sysconf(_SC_NPROCESSORS_CONF);
+  ASSERT_GT(cpus, 0);
+  cpu_cache_bound = cpus * per_cpu;
+
+  for (int i = 0; i < 3; i++) {
+    RunManyThreads(CpuCacheWorker, 8);
+    ASSERT_GT(GetCpuCacheFreeBytes(), 0);
+  }
+}
+
+#ifndef DEBUGALLOCATION  // the debug allocator has no arenas
+static size_t GetArenaProperty(const char* stat) {
+  string name = string("tcmalloc.arena.unittest.") + stat;
+  size_t value = 0;
+  CHECK(MallocExtension::instance()->GetNumericProperty(name.c_str(),
+                                                        &value));
+  return value;
+}
+#endif
+
+static void TestArenas() {
+  // Whatever the allocator, id 0 is the main heap.
+  void* p = tc_arena_malloc(0, 100);
+  ASSERT_NE(p, NULL);
+  tc_free(p);
+
+  const int arena = tc_arena_create("unittest");
+#ifdef DEBUGALLOCATION
+  // The debug allocator has no arenas.
+  ASSERT_EQ(0, arena);
+#else
+  ASSERT_NE(0, arena);
+  ASSERT_EQ(0, tc_arena_create("unittest"));
+
+  static const size_t kSizes[] = { 0, 8, 100, 4000, 40000, 1 << 20 };
+  for (int round = 0; round < 3; round++) {
+    vector<void*> ptrs;
+    for (int i = 0; i < sizeof(kSizes) / sizeof(*kSizes); i++) {
+      const size_t size = kSizes[i];
+      const int count = size >= (1 << 20) ? 4 : 1000;
+      for (int k = 0; k < count; k++) {
+        void* ptr = tc_arena_malloc(arena, size);
+        ASSERT_NE(ptr, NULL);
+        ASSERT_GE(MallocExtension::instance()->GetAllocatedSize(ptr), size);
+        memset(ptr, k & 0xff, size);
+        ptrs.push_back(ptr);
+      }
+    }
+    vector<void*> sorted(ptrs);
+    std::sort(sorted.begin(), sorted.end());
+    ASSERT_TRUE(std::unique(sorted.begin(), sorted.end()) == sorted.end());
+
+    const size_t allocated = GetArenaProperty("allocated_bytes");
+    ASSERT_GE(allocated, 4 << 20);
+    ASSERT_GE(GetArenaProperty("held_bytes"), allocated);
+
+    // Free every other object on its own, and the rest in bulk.
+    for (size_t k = 0; k < ptrs.size(); k += 2) {
+      free(ptrs[k]);
+    }
+    ASSERT_LT(GetArenaProperty("allocated_bytes"), allocated);
+    if (round < 2) {
+      // The small object spans stay with the arena.
+      tc_arena_reset(arena);
+      ASSERT_EQ(0, GetArenaProperty("allocated_bytes"));
+      ASSERT_GT(GetArenaProperty("held_bytes"), 0);
+    } else {
+      tc_arena_release(arena);
+      ASSERT_EQ(0, GetArenaProperty("allocated_bytes"));
+      ASSERT_EQ(0, GetArenaProperty("held_bytes"));
+    }
+  }
+
+  // Sized frees, one by one and in batches, hand arena objects back to
+  // the arena too, rather than to the thread cache where the next reset
+  // would let them be allocated twice.
+  for (int batch = 0; batch < 2; batch++) {
+    vector<void*> ptrs;
+    for (int k = 0; k < 1000; k++) {
+      void* ptr = tc_arena_malloc(arena, 100);
+      ASSERT_NE(ptr, NULL);
+      ptrs.push_back(ptr);
+    }
+    ASSERT_GE(GetArenaProperty("allocated_bytes"), 1000 * 100);
+    if (batch) {
+      tc_free_batch(&ptrs[0], ptrs.size(), 100);
+    } else {
+      for (size_t k = 0; k < ptrs.size(); k++) {
+        tc_free_sized(ptrs[k], 100);
+      }
+    }
+    ASSERT_EQ(0, GetArenaProperty("allocated_bytes"));
+  }
+
+  p = tc_arena_malloc(arena, 100);
+  ASSERT_NE(p, NULL);
+  tc_arena_destroy(arena);
+  size_t value;
+  ASSERT_FALSE(MallocExtension::instance()->GetNumericProperty(
+      "tcmalloc.arena.unittest.held_bytes", &value));
+
+  // The name and the id can be used again.
+  const int again = tc_arena_create("unittest");
+  ASSERT_NE(0, again);
+  tc_arena_destroy(again);
+#endif
+}
 
 #ifndef DEBUGALLOCATION
 // Ensure that nallocx works before main.
@@ -1180,7 +1642,11 @@ static ATTRIBUTE_NOINLINE void TestNewOOMHandling() {
 
   ASSERT_EQ(saw_new_handler_runs, 0);
 
-  for (int i = 0; i < 10240; i++) {
+  // The page heap starts out with several MiB of free pages from its
+  // first refills; they have to be used up before the system
+  // allocator is asked for more.
+  const size_t max_allocs = 10240 + GetSystemBytes() / 512;
+  for (size_t i = 0; i < max_allocs; i++) {
     oom_test_last_ptr = new char [512];
     ASSERT_NE(oom_test_last_ptr, NULL);
     if (saw_new_handler_runs) {
@@ -1193,6 +1659,37 @@ static ATTRIBUTE_NOINLINE void TestNewOOMHandling() {
   get_test_sys_alloc()->simulate_oom = false;
   std::set_new_handler(old);
 }
+
+// Once the system allocator fails, single pages (served by a page heap
+// shard refilling from the shared heap) and multi-page allocations run
+// out too.  malloc() must return NULL then, not crash.
+static ATTRIBUTE_NOINLINE void TestPageOOM() {
+  const size_t max_allocs = 64 + GetSystemBytes() / kPageSize;
+  vector<void*> pages;
+  pages.reserve(max_allocs);
+
+  get_test_sys_alloc()->simulate_oom = true;
+  void* big = malloc(GetSystemBytes() + (64 << 20));
+  const int big_errno = errno;
+  bool saw_null = false;
+  for (size_t i = 0; i < max_allocs && !saw_null; i++) {
+    void* p = malloc(kPageSize);
+    if (p == NULL) {
+      saw_null = true;
+      ASSERT_EQ(ENOMEM, errno);
+    } else {
+      pages.push_back(p);
+    }
+  }
+  get_test_sys_alloc()->simulate_oom = false;
+
+  ASSERT_EQ(NULL, big);
+  ASSERT_EQ(ENOMEM, big_errno);
+  ASSERT_TRUE(saw_null);
+  for (size_t i = 0; i < pages.size(); i++) {
+    free(pages[i]);
+  }
+}
 #endif  // !DEBUGALLOCATION
 
 static int RunAllTests(int argc, char** argv) {
@@ -1201,8 +1698,12 @@ static int RunAllTests(int argc, char** argv) {
 
   SetTestResourceLimit();
 
+  // Before anything else grows the heap past the hugetlbfs pool.
+  TestHugeTlbBacking();
+
 #ifndef DEBUGALLOCATION
   TestNewOOMHandling();
+  TestPageOOM();
 #endif
 
   // TODO(odo):  This test has been disabled because it is only by luck that it
@@ -1563,6 +2064,8 @@ static int RunAllTests(int argc, char** argv) {
   // Test that realloc doesn't always reallocate and copy memory.
   fprintf(LOGSTREAM, "Testing realloc\n");
   TestRealloc();
+  TestLargeRealloc();
+  TestLargeAlignment();
 
   fprintf(LOGSTREAM, "Testing operator new(nothrow).\n");
   TestNothrowNew(&::operator new);
@@ -1585,6 +2088,9 @@ static int RunAllTests(int argc, char** argv) {
   RunManyThreadsWithId(RunThread, FLAGS_numthreads, 1<<20);
 
   for (int i = 0; i < FLAGS_numthreads; ++i) delete threads[i];    // Cleanup
+  TestCpuCacheBound();
+  TestPageHeapShards();
+  TestBackgroundThread();
 
   // Do the memory intensive tests after threads are done, since exhausting
   // the available address space can make pthread_create to fail.
@@ -1607,8 +2113,11 @@ static int RunAllTests(int argc, char** argv) {
   TestRanges();
   TestReleaseToSystem();
   TestAggressiveDecommit();
+  TestReleaseShards();
   TestSetNewMode();
   TestErrno();
+  TestBatchAllocation();
+  TestArenas();
 
 // GetAllocatedSize under DEBUGALLOCATION returns the size that we asked for.
 #ifndef DEBUGALLOCATION
@@ -81,4 +81,37 @@ echo -n "Testing $TCMALLOC_UNITTEST with TCMALLOC_ENABLE_SIZED_DELETE=t ..."
 
 TCMALLOC_ENABLE_SIZED_DELETE=t run_unittest
 
+echo -n "Testing $TCMALLOC_UNITTEST with TCMALLOC_PERCPU_CACHE=1 ... "
+
+TCMALLOC_PERCPU_CACHE=1 run_unittest
+
+echo -n "Testing $TCMALLOC_UNITTEST with TCMALLOC_PERCPU_CACHE=1 and TCMALLOC_PERCPU_CACHE_BYTES=524288 ... "
+
+TCMALLOC_PERCPU_CACHE=1 TCMALLOC_PERCPU_CACHE_BYTES=524288 run_unittest
+
+echo -n "Testing $TCMALLOC_UNITTEST with TCMALLOC_HUGEPAGES=1 ... "
+
+TCMALLOC_HUGEPAGES=1 run_unittest
+
+echo -n "Testing $TCMALLOC_UNITTEST with TCMALLOC_HUGEPAGES=2 ... "
+
+TCMALLOC_HUGEPAGES=2 run_unittest
+
+echo -n "Testing $TCMALLOC_UNITTEST with TCMALLOC_PAGEHEAP_SHARDS=3 ... "
+
+TCMALLOC_PAGEHEAP_SHARDS=3 run_unittest
+
+# Out of range values are clamped, or ignored if not positive.
+echo -n "Testing $TCMALLOC_UNITTEST with TCMALLOC_PAGEHEAP_SHARDS=1000 ... "
+
+TCMALLOC_PAGEHEAP_SHARDS=1000 run_unittest
+
+echo -n "Testing $TCMALLOC_UNITTEST with TCMALLOC_PAGEHEAP_SHARDS=0 ... "
+
+TCMALLOC_PAGEHEAP_SHARDS=0 run_unittest
+
+echo -n "Testing $TCMALLOC_UNITTEST with TCMALLOC_BACKGROUND_INTERVAL_MS=1 ... "
+
+TCMALLOC_BACKGROUND_INTERVAL_MS=1 run_unittest
+
 echo "PASS"
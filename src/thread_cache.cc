@@ -36,10 +36,14 @@
 #include <errno.h>
 #include <string.h>                     // for memcpy
 #include <algorithm>                    // for max, min
+#include "alloc_latency.h"              // for AllocLatency
 #include "base/commandlineflags.h"      // for SpinLockHolder
 #include "base/spinlock.h"              // for SpinLockHolder
 #include "getenv_safe.h"                // for TCMallocGetenvSafe
+#include "heap_limit.h"                 // for HeapLimit
 #include "central_freelist.h"           // for CentralFreeListPadded
+#include "cpu_cache.h"                  // for CpuCache
+#include "lock_profile.h"               // for LockProfile
 #include "maybe_threads.h"
 
 using std::min;
@@ -68,6 +72,7 @@ PageHeapAllocator<ThreadCache> threadcache_allocator;
 ThreadCache* ThreadCache::thread_heaps_ = NULL;
 int ThreadCache::thread_heap_count_ = 0;
 ThreadCache* ThreadCache::next_memory_steal_ = NULL;
+volatile uint32 ThreadCache::scavenge_epoch_ = 0;
 #ifdef HAVE_TLS
 __thread ThreadCache::ThreadLocalData ThreadCache::threadlocal_data_
     ATTR_INITIAL_EXEC CACHELINE_ALIGNED;
@@ -94,6 +99,7 @@ void ThreadCache::Init(pthread_t tid) {
   prev_ = NULL;
   tid_  = tid;
   in_setspecific_ = false;
+  scavenge_epoch_seen_ = scavenge_epoch_;
   for (uint32 cl = 0; cl < Static::num_size_classes(); ++cl) {
     list_[cl].Init(Static::sizemap()->class_to_size(cl));
   }
@@ -127,8 +133,10 @@ void* ThreadCache::FetchFromCentralCache(uint32 cl, int32_t byte_size,
   >>> for flowchart 7 goto implementation of RemoveRange
   >>> method in central_freelist.cc file.
   */
+  const uint64 fetch_start = AllocLatency::Now();
   int fetch_count = Static::central_cache()[cl].RemoveRange(
       &start, &end, num_to_move);
+  AllocLatency::Record(AllocLatency::kFastPathMiss, fetch_start);
 
   if (fetch_count == 0) {
     ASSERT(start == NULL);
@@ -163,9 +171,68 @@ void* ThreadCache::FetchFromCentralCache(uint32 cl, int32_t byte_size,
     ASSERT(new_length % batch_size == 0);
     list->set_max_length(new_length);
   }
+  // A thread that only allocates never overflows a list, so answer
+  // RequestScavenge() here too.
+  if (PREDICT_FALSE(scavenge_epoch_seen_ != scavenge_epoch_)) {
+    ReleaseIdleObjects();
+  }
+  // The refill may have grown the heap past the soft limit.
+  HeapLimit::MaybeShrink();
   return start;
 }
 
+int ThreadCache::AllocateBatch(size_t size, uint32 cl, void** batch, int N) {
+  FreeList* list = &list_[cl];
+  ASSERT(size == list->object_size());
+  int n = min<int>(list->length(), N);
+  list->PopBatch(n, batch);
+  size_ -= n * size;
+
+  // Fetch whole batches, which the central cache can hand over from
+  // its transfer cache, and keep any surplus in the freelist as
+  // FetchFromCentralCache() does.
+  const int batch_size = Static::sizemap()->num_objects_to_move(cl);
+  while (n < N) {
+    void *start, *end;
+    const uint64 fetch_start = AllocLatency::Now();
+    const int fetch_count = Static::central_cache()[cl].RemoveRange(
+        &start, &end, batch_size);
+    AllocLatency::Record(AllocLatency::kFastPathMiss, fetch_start);
+    if (fetch_count == 0) {
+      break;
+    }
+    const int take = min(fetch_count, N - n);
+    for (int i = 0; i < take; i++) {
+      batch[n++] = start;
+      if (i + 1 < fetch_count) {
+        start = SLL_Next(start);
+      }
+    }
+    if (take < fetch_count) {
+      list->PushRange(fetch_count - take, start, end);
+      size_ += (fetch_count - take) * size;
+    }
+  }
+  return n;
+}
+
+void ThreadCache::DeallocateRange(uint32 cl, void* start, void* end, int N) {
+  FreeList* list = &list_[cl];
+  list->PushRange(N, start, end);
+  size_ += N * list->object_size();
+
+  if (PREDICT_FALSE(list->length() > list->max_length())) {
+    // Release the excess rounded up to whole batches.
+    const int batch_size = Static::sizemap()->num_objects_to_move(cl);
+    int excess = list->length() - list->max_length();
+    excess = ((excess + batch_size - 1) / batch_size) * batch_size;
+    ReleaseToCentralCache(list, cl, excess);
+  }
+  if (PREDICT_FALSE(size_ > max_size_)) {
+    Scavenge();
+  }
+}
+
 void ThreadCache::ListTooLong(FreeList* list, uint32 cl) {
   size_ += list->object_size();
 
@@ -193,6 +260,8 @@ void ThreadCache::ListTooLong(FreeList* list, uint32 cl) {
 
   if (PREDICT_FALSE(size_ > max_size_)) {
     Scavenge();
+  } else if (PREDICT_FALSE(scavenge_epoch_seen_ != scavenge_epoch_)) {
+    ReleaseIdleObjects();
   }
 }
 
@@ -219,6 +288,11 @@ void ThreadCache::ReleaseToCentralCache(FreeList* src, uint32 cl, int N) {
 
 // Release idle memory to the central cache
 void ThreadCache::Scavenge() {
+  ReleaseIdleObjects();
+  IncreaseCacheLimit();
+}
+
+void ThreadCache::ReleaseIdleObjects() {
   // If the low-water mark for the free list is L, it means we would
   // not have had to allocate anything from the central cache even if
   // we had reduced the free list size by L.  We aim to get closer to
@@ -247,8 +321,7 @@ void ThreadCache::Scavenge() {
     }
     list->clear_lowwatermark();
   }
-
-  IncreaseCacheLimit();
+  scavenge_epoch_seen_ = scavenge_epoch_;
 }
 
 void ThreadCache::IncreaseCacheLimit() {
@@ -308,6 +381,8 @@ void ThreadCache::InitModule() {
     }
     Static::InitStaticVars();
     threadcache_allocator.Init();
+    CpuCache::InitModule();
+    LockProfile::InitModule();
     phinited = 1;
   }
 
@@ -541,6 +616,25 @@ void ThreadCache::GetThreadStats(uint64_t* total_bytes, uint64_t* class_count) {
   }
 }
 
+int ThreadCache::GetCacheStats(int skip, int max_count, CacheStats* out,
+                               uint64_t* class_count) {
+  ThreadCache* h = thread_heaps_;
+  for (; h != NULL && skip > 0; h = h->next_) {
+    skip--;
+  }
+  int n = 0;
+  for (; h != NULL && n < max_count; h = h->next_, n++) {
+    out[n].size = h->Size();
+    out[n].max_size = h->max_size_;
+    if (class_count) {
+      for (int cl = 0; cl < Static::num_size_classes(); ++cl) {
+        class_count[cl] += h->freelist_length(cl);
+      }
+    }
+  }
+  return n;
+}
+
 void ThreadCache::set_overall_thread_cache_size(size_t new_size) {
   // Clip the value to a reasonable range
   if (new_size < kMinThreadCacheSize) new_size = kMinThreadCacheSize;
@@ -88,8 +88,22 @@ class ThreadCache {
   void* Allocate(size_t size, uint32 cl, void *(*oom_handler)(size_t size));
   void Deallocate(void* ptr, uint32 size_class);
 
+  // Fills batch[0..N) with objects of the given size and class, first
+  // from this cache's freelist and then a central cache batch at a
+  // time.  Returns fewer than N only if memory ran out.
+  int AllocateBatch(size_t size, uint32 cl, void** batch, int N);
+
+  // Returns the N objects of class cl linked from start to end to this
+  // cache, releasing whole batches to the central cache if the freelist
+  // grows past its maximum length.
+  void DeallocateRange(uint32 cl, void* start, void* end, int N);
+
   void Scavenge();
 
+  // The part of Scavenge() that gives idle objects back to the central
+  // cache, without growing this cache's limit afterwards.
+  void ReleaseIdleObjects();
+
   int GetSamplePeriod();
 
   // Record allocation of "k" bytes.  Return true iff allocation
@@ -112,6 +126,13 @@ class ThreadCache {
   static void         ResetUseEmergencyMalloc();
   static bool         IsUseEmergencyMalloc();
 
+  // Asks every thread cache to ReleaseIdleObjects() the next time its
+  // owner frees past a list's max_length or refills a list from the
+  // central cache.  A thread cache may only be touched by its own
+  // thread, so this is all the background thread or a thread over the
+  // soft heap limit can do.
+  static void RequestScavenge() { scavenge_epoch_++; }
+
   // Return the number of thread heaps in use.
   static inline int HeapsInUse();
 
@@ -122,6 +143,19 @@ class ThreadCache {
   // REQUIRES: Static::pageheap_lock is held.
   static void GetThreadStats(uint64_t* total_bytes, uint64_t* class_count);
 
+  struct CacheStats {
+    size_t size;                // Bytes held
+    size_t max_size;            // Bytes it may hold before Scavenge()
+  };
+
+  // Like GetThreadStats(), but for up to max_count thread heaps starting
+  // with the skip'th, so that callers can walk a long list a piece at a
+  // time.  Copies each heap's stats to out and returns the number of
+  // heaps visited, less than max_count at the end of the list.
+  // REQUIRES: Static::pageheap_lock is held.
+  static int GetCacheStats(int skip, int max_count, CacheStats* out,
+                           uint64_t* class_count);
+
   // Sets the total thread cache size to new_size, recomputing the
   // individual thread cache sizes as necessary.
   // REQUIRES: Static::pageheap lock is held.
@@ -240,6 +274,19 @@ class ThreadCache {
       length_ -= N;
       if (length_ < lowater_) lowater_ = length_;
     }
+
+    // Like PopRange(), but stores the N objects in batch[0..N).
+    void PopBatch(int N, void **batch) {
+      ASSERT(length_ >= N);
+      void *p = list_;
+      for (int i = 0; i < N; i++) {
+        batch[i] = p;
+        p = SLL_Next(p);
+      }
+      list_ = p;
+      length_ -= N;
+      if (length_ < lowater_) lowater_ = length_;
+    }
   };
 
   // Gets and returns an object from the central cache, and, if possible,
@@ -319,6 +366,12 @@ class ThreadCache {
   // across all ThreadCaches.  Protected by Static::pageheap_lock.
   static ssize_t unclaimed_cache_space_;
 
+  // Bumped by RequestScavenge(), from the background thread and from
+  // any thread whose allocation takes the heap past its soft limit
+  // (HeapLimit::Shrink()).  Bumps that race may add up to one, which is
+  // fine: a thread cache only checks whether it changed.
+  static volatile uint32 scavenge_epoch_;
+
   // This class is laid out with the most frequently used fields
   // first so that hot elements are placed on the same cache line.
 
@@ -332,6 +385,7 @@ class ThreadCache {
 
   pthread_t     tid_;                   // Which thread owns it
   bool          in_setspecific_;        // In call to pthread_setspecific?
+  uint32        scavenge_epoch_seen_;   // scavenge_epoch_ at last release
 
   // Allocate a new heap. REQUIRES: Static::pageheap_lock is held.
   static ThreadCache* NewHeap(pthread_t tid);
@@ -109,6 +109,40 @@ extern "C" {
    */
   PERFTOOLS_DLL_DECL size_t tc_malloc_size(void* ptr) PERFTOOLS_NOTHROW;
 
+  /*
+   * Allocates "count" objects of "size" bytes each and stores them in
+   * ptrs[0..count).  Returns the number allocated, which is less than
+   * count only if memory ran out.  Same as calling tc_malloc(size)
+   * count times, but small objects are handed out a whole batch at a
+   * time.  The objects may be freed individually or with tc_free_batch.
+   */
+  PERFTOOLS_DLL_DECL size_t tc_malloc_batch(size_t size, void** ptrs,
+                                            size_t count) PERFTOOLS_NOTHROW;
+
+  /*
+   * Frees ptrs[0..count), which must all have been allocated with the
+   * given size.  NULL entries are ignored.
+   */
+  PERFTOOLS_DLL_DECL void tc_free_batch(void** ptrs, size_t count,
+                                        size_t size) PERFTOOLS_NOTHROW;
+
+  /*
+   * Arenas keep a subsystem's memory apart from the rest of the heap.
+   * tc_arena_create returns the id of a new arena with the given name,
+   * or 0 if the name is taken or no more arenas can be created.  An
+   * arena object is freed with tc_free or free, but never with a
+   * sized free.  tc_arena_reset frees all objects in an arena at once
+   * and keeps its memory for reuse; tc_arena_release and
+   * tc_arena_destroy also give the memory back to the main heap.
+   * tc_arena_malloc with an id of 0 allocates from the main heap.
+   */
+  PERFTOOLS_DLL_DECL int tc_arena_create(const char* name) PERFTOOLS_NOTHROW;
+  PERFTOOLS_DLL_DECL void tc_arena_destroy(int arena) PERFTOOLS_NOTHROW;
+  PERFTOOLS_DLL_DECL void* tc_arena_malloc(int arena,
+                                           size_t size) PERFTOOLS_NOTHROW;
+  PERFTOOLS_DLL_DECL void tc_arena_reset(int arena) PERFTOOLS_NOTHROW;
+  PERFTOOLS_DLL_DECL void tc_arena_release(int arena) PERFTOOLS_NOTHROW;
+
 #ifdef __cplusplus
   PERFTOOLS_DLL_DECL int tc_set_new_mode(int flag) PERFTOOLS_NOTHROW;
   PERFTOOLS_DLL_DECL void* tc_new(size_t size);
@@ -195,6 +195,16 @@ void TCMalloc_SystemCommit(void* start, size_t length) {
   }
 }
 
+extern PERFTOOLS_DLL_DECL
+bool TCMalloc_HugePagesEnabled() {
+  return false;   // large pages need SeLockMemoryPrivilege; not supported
+}
+
+extern PERFTOOLS_DLL_DECL
+bool TCMalloc_SystemMove(void* from, void* to, size_t length) {
+  return false;   // no mremap; callers fall back to copying
+}
+
 bool RegisterSystemAllocator(SysAllocator *allocator, int priority) {
   return false;   // we don't allow registration on windows, right now
 }